@@ -0,0 +1,685 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <math.h>
+#include "bmp.h"
+
+// large image benchmark for the bmp interface
+// usage: ./benchBmp [xRes yRes [destination]]
+//        ./benchBmp blur [threadCount] (gaussian blur of a channel at 1080p, 4K and 8K)
+//        ./benchBmp convolve [threadCount] (3x3, 7x7 and 15x15 kernels on a 4K channel)
+//        ./benchBmp resize [threadCount] (4K to thumbnail and 1080p to 4K with every resampling filter)
+//        ./benchBmp pyramid (2x downsample and full pyramid of an 8K image)
+//        ./benchBmp orient (every rotation, flip and transpose of an 8K image and channel)
+//        ./benchBmp composite [threadCount] (every blend mode, 4K over 4K, opaque, translucent and premultiplied overlays)
+//        ./benchBmp colorModels [threadCount] (4K to and from luma, YCbCr 4:4:4, YCbCr 4:2:0 and HSV channels)
+//        ./benchBmp lut [threadCount] (tone curves on a 4K image and channel, 3 chained curves composed into one table)
+//        ./benchBmp histogram [threadCount] (histograms of a 4K image and channel, textured and flat)
+//        ./benchBmp equalize [threadCount] (global and adaptive (CLAHE) equalization of a 4K channel and image)
+//        ./benchBmp stats [threadCount] (min, max, sum, sum of squares and clipped counts of a 4K image and channel)
+//        ./benchBmp compare [threadCount] (identical check, MSE/PSNR/max difference and SSIM of a 4K image and channel against a blurred copy)
+// defaults to a 30000x30000 ARGB_32 image (~3.6 GB on disk, crosses every 2^31 byte boundary)
+// needs roughly two pixelArrays (2 * 16 bytes/4 pixels) plus one channel worth of memory
+
+#define DEFAULT_BENCH_XRES 30000
+#define DEFAULT_BENCH_YRES 30000
+
+static int benchBlur (int threadCount);
+static int benchConvolve (int threadCount);
+static int benchResize (int threadCount);
+static int benchPyramid ();
+static int benchOrient ();
+static int benchComposite (int threadCount);
+static int benchColorModels (int threadCount);
+static int benchLUT (int threadCount);
+static int benchHistogram (int threadCount);
+static int benchEqualize (int threadCount);
+static int benchStats (int threadCount);
+static int benchCompare (int threadCount);
+static channelPtr createBenchChannel (LONG xRes, LONG yRes);
+static bmpPtr createBenchBmp (LONG xRes, LONG yRes);
+static double secondsSince (struct timespec start);
+static byte expectedValue (LONG row, LONG column);
+
+int main (int argc, char *argv[]) {
+    if (argc >= 2 && strcmp (argv[1], "blur") == 0) {
+        int threadCount = 1;
+        if (argc >= 3) {
+            threadCount = atoi (argv[2]);
+        }
+        return benchBlur (threadCount);
+    }
+    if (argc >= 2 && strcmp (argv[1], "convolve") == 0) {
+        int threadCount = 1;
+        if (argc >= 3) {
+            threadCount = atoi (argv[2]);
+        }
+        return benchConvolve (threadCount);
+    }
+    if (argc >= 2 && strcmp (argv[1], "resize") == 0) {
+        int threadCount = 1;
+        if (argc >= 3) {
+            threadCount = atoi (argv[2]);
+        }
+        return benchResize (threadCount);
+    }
+    if (argc >= 2 && strcmp (argv[1], "pyramid") == 0) {
+        return benchPyramid ();
+    }
+    if (argc >= 2 && strcmp (argv[1], "orient") == 0) {
+        return benchOrient ();
+    }
+    if (argc >= 2 && strcmp (argv[1], "composite") == 0) {
+        int threadCount = 1;
+        if (argc >= 3) {
+            threadCount = atoi (argv[2]);
+        }
+        return benchComposite (threadCount);
+    }
+    if (argc >= 2 && strcmp (argv[1], "colorModels") == 0) {
+        int threadCount = 1;
+        if (argc >= 3) {
+            threadCount = atoi (argv[2]);
+        }
+        return benchColorModels (threadCount);
+    }
+    if (argc >= 2 && strcmp (argv[1], "lut") == 0) {
+        int threadCount = 1;
+        if (argc >= 3) {
+            threadCount = atoi (argv[2]);
+        }
+        return benchLUT (threadCount);
+    }
+    if (argc >= 2 && strcmp (argv[1], "histogram") == 0) {
+        int threadCount = 1;
+        if (argc >= 3) {
+            threadCount = atoi (argv[2]);
+        }
+        return benchHistogram (threadCount);
+    }
+    if (argc >= 2 && strcmp (argv[1], "equalize") == 0) {
+        int threadCount = 1;
+        if (argc >= 3) {
+            threadCount = atoi (argv[2]);
+        }
+        return benchEqualize (threadCount);
+    }
+    if (argc >= 2 && strcmp (argv[1], "stats") == 0) {
+        int threadCount = 1;
+        if (argc >= 3) {
+            threadCount = atoi (argv[2]);
+        }
+        return benchStats (threadCount);
+    }
+    if (argc >= 2 && strcmp (argv[1], "compare") == 0) {
+        int threadCount = 1;
+        if (argc >= 3) {
+            threadCount = atoi (argv[2]);
+        }
+        return benchCompare (threadCount);
+    }
+    LONG xRes = DEFAULT_BENCH_XRES;
+    LONG yRes = DEFAULT_BENCH_YRES;
+    char *destination = ".";
+    if (argc >= 3) {
+        xRes = atol (argv[1]);
+        yRes = atol (argv[2]);
+    }
+    if (argc >= 4) {
+        destination = argv[3];
+    }
+    assert (xRes > 0 && yRes > 0);
+    printf (">benchmarking %dx%d ARGB_32\n", xRes, yRes);
+
+    struct timespec start;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    bmpPtr image = createBmp (BITMAPV4HEADER);
+    setPixelFormat (image, ARGB_32);
+    setColorSpace (image, DEFAULT_V4IH_COLOR_SPACE);
+    setPrintResX (image, DEFAULT_V4IH_PRINT_RES_X);
+    setPrintResY (image, DEFAULT_V4IH_PRINT_RES_Y);
+    setPaletteColorCount (image, DEFAULT_V4IH_PALETTE_CLR_COUNT);
+    setImpColorCount (image, DEFAULT_V4IH_IMP_COLOR_COUNT);
+    setColorPlaneCount (image, 1);
+    setXRes (image, xRes);
+    setYRes (image, yRes);
+    setUpPixelArray (image);
+    setImageSize (image, evaluateRawImageSizeInBytes (image));
+    printf ("\t>file size %u bytes\n", determineFileSizeInBytes (image));
+    printf ("\t>setUpPixelArray: %.3f s\n", secondsSince (start));
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    channelPtr plane = createChannel (xRes, yRes);
+    LONG row = 0;
+    while (row < yRes) {
+        LONG column = 0;
+        while (column < xRes) {
+            setPixel (row, column, plane, expectedValue (row, column));
+            column ++;
+        }
+        row ++;
+    }
+    printf ("\t>setPixel fill: %.3f s\n", secondsSince (start));
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    setChannel (RED, image, plane);
+    setChannel (GREEN, image, plane);
+    setChannel (BLUE, image, plane);
+    setChannel (ALPHA, image, plane);
+    printf ("\t>setChannel x4: %.3f s\n", secondsSince (start));
+    destroyChannel (plane);
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    saveBitMap (image, "bench.bmp", destination);
+    printf ("\t>saveBitMap: %.3f s\n", secondsSince (start));
+    destroyBmp (image);
+
+    relativePath path;
+    snprintf (path, MAX_RELATIVE_PATH_LENGTH, "%s/bench.bmp", destination);
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    image = parseBitMap (path);
+    printf ("\t>parseBitMap: %.3f s\n", secondsSince (start));
+    assert (getXRes (image) == xRes && getYRes (image) == yRes);
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    channelPtr alpha = getAlphaChannel (image);
+    printf ("\t>getAlphaChannel: %.3f s\n", secondsSince (start));
+
+    // spot check the corners and the middle, including the pixels past 2^31 bytes
+    LONG rows[3] = {0, yRes / 2, yRes - 1};
+    LONG columns[3] = {0, xRes / 2, xRes - 1};
+    int i = 0;
+    while (i < 3) {
+        int j = 0;
+        while (j < 3) {
+            assert (getPixel (rows[i], columns[j], alpha) == expectedValue (rows[i], columns[j]));
+            j ++;
+        }
+        i ++;
+    }
+    destroyChannel (alpha);
+    destroyBmp (image);
+    int retCode = remove (path);
+    assert (retCode == 0);
+    printf (">done\n");
+    return EXIT_SUCCESS;
+}
+
+static int benchBlur (int threadCount) {
+    assert (threadCount > 0);
+    LONG resolutions[3][2] = {{1920, 1080}, {3840, 2160}, {7680, 4320}};
+    // fixed point gaussian passes and the box approximation
+    double sigmas[3] = {1.5, 4.0, 16.0};
+    printf (">benchmarking gaussianBlurChannel on %d thread(s)\n", threadCount);
+    int i = 0;
+    while (i < 3) {
+        LONG xRes = resolutions[i][0];
+        LONG yRes = resolutions[i][1];
+        channelPtr plane = createBenchChannel (xRes, yRes);
+        int j = 0;
+        while (j < 3) {
+            struct timespec start;
+            clock_gettime (CLOCK_MONOTONIC, &start);
+            channelPtr blurred = gaussianBlurChannel (plane, sigmas[j], threadCount);
+            double seconds = secondsSince (start);
+            printf ("\t>%dx%d sigma %.1f: %.3f s (%.0f Mpixel/s)\n", xRes, yRes, sigmas[j], seconds, xRes * (double) yRes / seconds / 1e6);
+            destroyChannel (blurred);
+            j ++;
+        }
+        destroyChannel (plane);
+        i ++;
+    }
+    printf (">done\n");
+    return EXIT_SUCCESS;
+}
+
+static int benchConvolve (int threadCount) {
+    assert (threadCount > 0);
+    LONG xRes = 3840;
+    LONG yRes = 2160;
+    printf (">benchmarking convolveChannel on a %dx%d channel, %d thread(s)\n", xRes, yRes, threadCount);
+    channelPtr plane = createBenchChannel (xRes, yRes);
+    LONG sizes[3] = {3, 7, 15};
+    double weights[MAX_KERNEL_SIZE * MAX_KERNEL_SIZE];
+    int i = 0;
+    while (i < 3) {
+        LONG tapCount = sizes[i] * sizes[i];
+        LONG tap = 0;
+        while (tap < tapCount) {
+            weights[tap] = 1.0 / tapCount;
+            tap ++;
+        }
+        kernelPtr kernel = createKernel (sizes[i], weights, 0);
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        channelPtr convolved = convolveChannel (plane, kernel, BORDER_REFLECT, threadCount);
+        double seconds = secondsSince (start);
+        printf ("\t>%dx%d kernel: %.3f s (%.0f Mpixel/s)\n", sizes[i], sizes[i], seconds, xRes * (double) yRes / seconds / 1e6);
+        destroyChannel (convolved);
+        destroyKernel (kernel);
+        i ++;
+    }
+    destroyChannel (plane);
+    printf (">done\n");
+    return EXIT_SUCCESS;
+}
+
+static int benchResize (int threadCount) {
+    assert (threadCount > 0);
+    // source and target resolutions: a thumbnail of a 4K frame and an upscale of a 1080p one
+    LONG cases[2][4] = {{3840, 2160, 256, 144}, {1920, 1080, 3840, 2160}};
+    resampleFilter filters[3] = {RESAMPLE_BILINEAR, RESAMPLE_BICUBIC, RESAMPLE_LANCZOS};
+    char *filterNames[3] = {"bilinear", "bicubic", "lanczos"};
+    printf (">benchmarking resizeBmp (ARGB_32) on %d thread(s)\n", threadCount);
+    int i = 0;
+    while (i < 2) {
+        bmpPtr image = createBenchBmp (cases[i][0], cases[i][1]);
+        int j = 0;
+        while (j < 3) {
+            struct timespec start;
+            clock_gettime (CLOCK_MONOTONIC, &start);
+            bmpPtr resized = resizeBmp (image, cases[i][2], cases[i][3], filters[j], threadCount);
+            double seconds = secondsSince (start);
+            printf ("\t>%dx%d to %dx%d %s: %.3f s (%.0f source Mpixel/s)\n", cases[i][0], cases[i][1], cases[i][2], cases[i][3],
+                    filterNames[j], seconds, cases[i][0] * (double) cases[i][1] / seconds / 1e6);
+            destroyBmp (resized);
+            j ++;
+        }
+        destroyBmp (image);
+        i ++;
+    }
+    printf (">done\n");
+    return EXIT_SUCCESS;
+}
+
+static int benchPyramid () {
+    LONG xRes = 7680;
+    LONG yRes = 4320;
+    printf (">benchmarking downsampleBmp and buildPyramid on a %dx%d ARGB_32 image\n", xRes, yRes);
+    bmpPtr image = createBenchBmp (xRes, yRes);
+    struct timespec start;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    bmpPtr half = downsampleBmp (image);
+    double seconds = secondsSince (start);
+    printf ("\t>downsampleBmp: %.3f s (%.0f source Mpixel/s)\n", seconds, xRes * (double) yRes / seconds / 1e6);
+    destroyBmp (half);
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    int levelCount = 0;
+    bmpPtr *levels = buildPyramid (image, &levelCount);
+    seconds = secondsSince (start);
+    printf ("\t>buildPyramid (%d levels): %.3f s (%.0f source Mpixel/s)\n", levelCount, seconds, xRes * (double) yRes / seconds / 1e6);
+    destroyPyramid (levels, levelCount);
+    destroyBmp (image);
+    printf (">done\n");
+    return EXIT_SUCCESS;
+}
+
+static int benchOrient () {
+    LONG xRes = 7680;
+    LONG yRes = 4320;
+    char *names[6] = {"rotate 90", "rotate 180", "rotate 270", "flip horizontal", "flip vertical", "transpose"};
+    printf (">benchmarking orientBmp and orientChannel on %dx%d\n", xRes, yRes);
+    bmpPtr image = createBenchBmp (xRes, yRes);
+    channelPtr plane = createBenchChannel (xRes, yRes);
+    orientation orientation = ROTATE_90;
+    while (orientation <= TRANSPOSE) {
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        bmpPtr oriented = orientBmp (image, orientation);
+        double seconds = secondsSince (start);
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        channelPtr orientedPlane = orientChannel (plane, orientation);
+        double planeSeconds = secondsSince (start);
+        printf ("\t>%s: bmp %.3f s (%.0f Mpixel/s), channel %.3f s (%.0f Mpixel/s)\n", names[orientation], seconds,
+                xRes * (double) yRes / seconds / 1e6, planeSeconds, xRes * (double) yRes / planeSeconds / 1e6);
+        destroyChannel (orientedPlane);
+        destroyBmp (oriented);
+        orientation ++;
+    }
+    destroyChannel (plane);
+    destroyBmp (image);
+    printf (">done\n");
+    return EXIT_SUCCESS;
+}
+
+static int benchComposite (int threadCount) {
+    assert (threadCount > 0);
+    LONG xRes = 3840;
+    LONG yRes = 2160;
+    char *names[5] = {"source over", "multiply", "screen", "overlay", "add"};
+    printf (">benchmarking compositeBmp on %dx%d, %d thread(s)\n", xRes, yRes, threadCount);
+    bmpPtr target = createBenchBmp (xRes, yRes);
+    bmpPtr opaque = createBenchBmp (xRes, yRes);
+    // translucent overlay: alpha ramps across every row
+    bmpPtr translucent = createBenchBmp (xRes, yRes);
+    channelPtr alpha = createChannel (xRes, yRes);
+    LONG row = 0;
+    while (row < yRes) {
+        LONG column = 0;
+        while (column < xRes) {
+            setPixel (row, column, alpha, column & 255);
+            column ++;
+        }
+        row ++;
+    }
+    setChannel (ALPHA, translucent, alpha);
+    destroyChannel (alpha);
+    // the same translucent composite with both sides premultiplied
+    bmpPtr premultipliedTarget = createBenchBmp (xRes, yRes);
+    premultiplyBmp (premultipliedTarget);
+    bmpPtr premultipliedOverlay = materializeBmp (translucent);
+    premultiplyBmp (premultipliedOverlay);
+    blendMode mode = BLEND_SOURCE_OVER;
+    while (mode <= BLEND_ADD) {
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        compositeBmp (target, opaque, 0, 0, mode, threadCount);
+        double seconds = secondsSince (start);
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        compositeBmp (target, translucent, 0, 0, mode, threadCount);
+        double translucentSeconds = secondsSince (start);
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        compositeBmp (premultipliedTarget, premultipliedOverlay, 0, 0, mode, threadCount);
+        double premultipliedSeconds = secondsSince (start);
+        printf ("\t>%s: opaque %.3f s (%.0f Mpixel/s), translucent %.3f s (%.0f Mpixel/s), premultiplied %.3f s (%.0f Mpixel/s)\n",
+                names[mode], seconds, xRes * (double) yRes / seconds / 1e6, translucentSeconds,
+                xRes * (double) yRes / translucentSeconds / 1e6, premultipliedSeconds, xRes * (double) yRes / premultipliedSeconds / 1e6);
+        mode ++;
+    }
+    destroyBmp (premultipliedOverlay);
+    destroyBmp (premultipliedTarget);
+    destroyBmp (translucent);
+    destroyBmp (opaque);
+    destroyBmp (target);
+    printf (">done\n");
+    return EXIT_SUCCESS;
+}
+
+static int benchColorModels (int threadCount) {
+    assert (threadCount > 0);
+    LONG xRes = 3840;
+    LONG yRes = 2160;
+    char *names[4] = {"luma", "YCbCr 4:4:4", "YCbCr 4:2:0", "HSV"};
+    printf (">benchmarking color model conversions on %dx%d, %d thread(s)\n", xRes, yRes, threadCount);
+    bmpPtr image = createBenchBmp (xRes, yRes);
+    colorModel model = COLOR_MODEL_LUMA;
+    while (model <= COLOR_MODEL_HSV) {
+        channelPtr planes[3];
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        getColorModelChannels (image, model, planes, threadCount);
+        double seconds = secondsSince (start);
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        setColorModelChannels (image, model, planes, threadCount);
+        double backSeconds = secondsSince (start);
+        printf ("\t>%s: to channels %.3f s (%.0f Mpixel/s), back %.3f s (%.0f Mpixel/s)\n", names[model], seconds,
+                xRes * (double) yRes / seconds / 1e6, backSeconds, xRes * (double) yRes / backSeconds / 1e6);
+        int p = 0;
+        while (p < getColorModelChannelCount (model)) {
+            destroyChannel (planes[p]);
+            p ++;
+        }
+        model ++;
+    }
+    destroyBmp (image);
+    printf (">done\n");
+    return EXIT_SUCCESS;
+}
+
+static int benchLUT (int threadCount) {
+    assert (threadCount > 0);
+    LONG xRes = 3840;
+    LONG yRes = 2160;
+    printf (">benchmarking tone curves on %dx%d, %d thread(s)\n", xRes, yRes, threadCount);
+    byte invert[256];
+    byte gamma[256];
+    byte levels[256];
+    int v = 0;
+    while (v < 256) {
+        invert[v] = MAX_RGB_VALUE - v;
+        gamma[v] = (byte) (255 * pow (v / 255.0, 1 / 2.2) + 0.5);
+        levels[v] = (v < 16) ? 0 : ((v > 235) ? 255 : (v - 16) * 255 / 219);
+        v ++;
+    }
+    bmpPtr image = createBenchBmp (xRes, yRes);
+    struct timespec start;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    applyLUT (image, gamma, gamma, gamma, NULL, threadCount);
+    double seconds = secondsSince (start);
+    printf ("\t>applyLUT, colors: %.4f s (%.0f Mpixel/s)\n", seconds, xRes * (double) yRes / seconds / 1e6);
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    applyLUT (image, invert, gamma, levels, invert, threadCount);
+    seconds = secondsSince (start);
+    printf ("\t>applyLUT, every channel: %.4f s (%.0f Mpixel/s)\n", seconds, xRes * (double) yRes / seconds / 1e6);
+    destroyBmp (image);
+
+    channelPtr plane = createBenchChannel (xRes, yRes);
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    applyChannelLUT (plane, levels, threadCount);
+    applyChannelLUT (plane, gamma, threadCount);
+    applyChannelLUT (plane, invert, threadCount);
+    seconds = secondsSince (start);
+    printf ("\t>applyChannelLUT, 3 curves in turn: %.4f s (%.0f Mpixel/s)\n", seconds, xRes * (double) yRes / seconds / 1e6);
+    byte composed[256];
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    composeLUT (composed, levels, gamma);
+    composeLUT (composed, composed, invert);
+    applyChannelLUT (plane, composed, threadCount);
+    seconds = secondsSince (start);
+    printf ("\t>applyChannelLUT, 3 curves composed: %.4f s (%.0f Mpixel/s)\n", seconds, xRes * (double) yRes / seconds / 1e6);
+    destroyChannel (plane);
+    printf (">done\n");
+    return EXIT_SUCCESS;
+}
+
+// a flat image is the worst case of a histogram: every pixel increments the same counters
+static int benchHistogram (int threadCount) {
+    assert (threadCount > 0);
+    LONG xRes = 3840;
+    LONG yRes = 2160;
+    printf (">benchmarking histograms on %dx%d, %d thread(s)\n", xRes, yRes, threadCount);
+    bmpHistogram *histogram = (bmpHistogram *) malloc (sizeof (bmpHistogram));
+    assert (histogram != NULL);
+    bmpPtr image = createBenchBmp (xRes, yRes);
+    char *names[2] = {"textured", "flat"};
+    int flat = 0;
+    while (flat < 2) {
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        computeHistogram (image, histogram, threadCount);
+        double seconds = secondsSince (start);
+        printf ("\t>computeHistogram, %s: %.4f s (%.0f Mpixel/s)\n", names[flat], seconds, xRes * (double) yRes / seconds / 1e6);
+        byte zero[256] = {0};
+        applyLUT (image, zero, zero, zero, NULL, 1);
+        flat ++;
+    }
+    destroyBmp (image);
+    unsigned long long counts[256];
+    channelPtr plane = createBenchChannel (xRes, yRes);
+    flat = 0;
+    while (flat < 2) {
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        computeChannelHistogram (plane, counts, threadCount);
+        double seconds = secondsSince (start);
+        printf ("\t>computeChannelHistogram, %s: %.4f s (%.0f Mpixel/s)\n", names[flat], seconds, xRes * (double) yRes / seconds / 1e6);
+        byte zero[256] = {0};
+        applyChannelLUT (plane, zero, 1);
+        flat ++;
+    }
+    destroyChannel (plane);
+    free (histogram);
+    printf (">done\n");
+    return EXIT_SUCCESS;
+}
+
+static int benchEqualize (int threadCount) {
+    assert (threadCount > 0);
+    LONG xRes = 3840;
+    LONG yRes = 2160;
+    printf (">benchmarking equalization on %dx%d, %d thread(s), CLAHE with 8x8 tiles clipped at 40\n", xRes, yRes, threadCount);
+    channelPtr plane = createBenchChannel (xRes, yRes);
+    struct timespec start;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    equalizeChannel (plane, threadCount);
+    double seconds = secondsSince (start);
+    printf ("\t>equalizeChannel: %.4f s (%.0f Mpixel/s)\n", seconds, xRes * (double) yRes / seconds / 1e6);
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    equalizeChannelAdaptive (plane, 8, 8, 40, threadCount);
+    seconds = secondsSince (start);
+    printf ("\t>equalizeChannelAdaptive: %.4f s (%.0f Mpixel/s)\n", seconds, xRes * (double) yRes / seconds / 1e6);
+    destroyChannel (plane);
+
+    char *names[2] = {"luma", "channels"};
+    equalizeMode mode = EQUALIZE_LUMA;
+    while (mode <= EQUALIZE_CHANNELS) {
+        bmpPtr image = createBenchBmp (xRes, yRes);
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        equalizeBmp (image, mode, threadCount);
+        seconds = secondsSince (start);
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        equalizeBmpAdaptive (image, mode, 8, 8, 40, threadCount);
+        double adaptiveSeconds = secondsSince (start);
+        printf ("\t>%s: equalizeBmp %.4f s (%.0f Mpixel/s), equalizeBmpAdaptive %.4f s (%.0f Mpixel/s)\n", names[mode], seconds,
+                xRes * (double) yRes / seconds / 1e6, adaptiveSeconds, xRes * (double) yRes / adaptiveSeconds / 1e6);
+        destroyBmp (image);
+        mode ++;
+    }
+    printf (">done\n");
+    return EXIT_SUCCESS;
+}
+
+static int benchStats (int threadCount) {
+    assert (threadCount > 0);
+    LONG xRes = 3840;
+    LONG yRes = 2160;
+    printf (">benchmarking statistics on %dx%d, %d thread(s)\n", xRes, yRes, threadCount);
+    bmpPtr image = createBenchBmp (xRes, yRes);
+    bmpStats stats;
+    struct timespec start;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    computeBmpStats (image, &stats, threadCount);
+    double seconds = secondsSince (start);
+    printf ("\t>computeBmpStats: %.4f s (%.0f Mpixel/s), red mean %.2f\n", seconds, xRes * (double) yRes / seconds / 1e6,
+            stats.red.sum / (double) stats.red.count);
+    destroyBmp (image);
+    channelPtr plane = createBenchChannel (xRes, yRes);
+    channelStats planeStats;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    computeChannelStats (plane, &planeStats, threadCount);
+    seconds = secondsSince (start);
+    printf ("\t>computeChannelStats: %.4f s (%.0f Mpixel/s)\n", seconds, xRes * (double) yRes / seconds / 1e6);
+    destroyChannel (plane);
+    printf (">done\n");
+    return EXIT_SUCCESS;
+}
+
+static int benchCompare (int threadCount) {
+    assert (threadCount > 0);
+    LONG xRes = 3840;
+    LONG yRes = 2160;
+    printf (">benchmarking comparisons on %dx%d, %d thread(s)\n", xRes, yRes, threadCount);
+    bmpPtr image = createBenchBmp (xRes, yRes);
+    bmpPtr same = createBenchBmp (xRes, yRes);
+    bmpPtr blurred = gaussianBlurBmp (image, 1, threadCount);
+    struct timespec start;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    int identical = bmpsIdentical (image, same, threadCount);
+    double seconds = secondsSince (start);
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    int blurredIdentical = bmpsIdentical (image, blurred, threadCount);
+    double earlySeconds = secondsSince (start);
+    assert (identical && !blurredIdentical);
+    printf ("\t>bmpsIdentical: same %.4f s (%.0f Mpixel/s), different %.6f s\n", seconds, xRes * (double) yRes / seconds / 1e6, earlySeconds);
+    bmpDifference difference;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    measureBmpDifference (image, blurred, &difference, threadCount);
+    seconds = secondsSince (start);
+    printf ("\t>measureBmpDifference: %.4f s (%.0f Mpixel/s), red psnr %.2f dB\n", seconds, xRes * (double) yRes / seconds / 1e6,
+            difference.red.psnr);
+    bmpSSIM ssim;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    computeBmpSSIM (image, blurred, 8, &ssim, threadCount);
+    seconds = secondsSince (start);
+    printf ("\t>computeBmpSSIM (8x8): %.4f s (%.0f Mpixel/s), red %.4f\n", seconds, xRes * (double) yRes / seconds / 1e6, ssim.red);
+    destroyBmp (blurred);
+    destroyBmp (same);
+    destroyBmp (image);
+    channelPtr plane = createBenchChannel (xRes, yRes);
+    channelPtr blurredPlane = gaussianBlurChannel (plane, 1, threadCount);
+    channelDifference planeDifference;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    measureChannelDifference (plane, blurredPlane, &planeDifference, threadCount);
+    seconds = secondsSince (start);
+    printf ("\t>measureChannelDifference: %.4f s (%.0f Mpixel/s)\n", seconds, xRes * (double) yRes / seconds / 1e6);
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    double planeSSIM = computeChannelSSIM (plane, blurredPlane, 8, threadCount);
+    seconds = secondsSince (start);
+    printf ("\t>computeChannelSSIM (8x8): %.4f s (%.0f Mpixel/s), %.4f\n", seconds, xRes * (double) yRes / seconds / 1e6, planeSSIM);
+    destroyChannel (blurredPlane);
+    destroyChannel (plane);
+    printf (">done\n");
+    return EXIT_SUCCESS;
+}
+
+static channelPtr createBenchChannel (LONG xRes, LONG yRes) {
+    channelPtr plane = createChannel (xRes, yRes);
+    LONG row = 0;
+    while (row < yRes) {
+        LONG column = 0;
+        while (column < xRes) {
+            setPixel (row, column, plane, expectedValue (row, column));
+            column ++;
+        }
+        row ++;
+    }
+    return plane;
+}
+
+// opaque ARGB_32 bitmap with the bench pattern in every color channel
+static bmpPtr createBenchBmp (LONG xRes, LONG yRes) {
+    bmpPtr image = createBmp (BITMAPV4HEADER);
+    setPixelFormat (image, ARGB_32);
+    setColorSpace (image, DEFAULT_V4IH_COLOR_SPACE);
+    setPrintResX (image, DEFAULT_V4IH_PRINT_RES_X);
+    setPrintResY (image, DEFAULT_V4IH_PRINT_RES_Y);
+    setPaletteColorCount (image, DEFAULT_V4IH_PALETTE_CLR_COUNT);
+    setImpColorCount (image, DEFAULT_V4IH_IMP_COLOR_COUNT);
+    setColorPlaneCount (image, 1);
+    setXRes (image, xRes);
+    setYRes (image, yRes);
+    setUpPixelArray (image);
+    setImageSize (image, evaluateRawImageSizeInBytes (image));
+    channelPtr plane = createBenchChannel (xRes, yRes);
+    setChannel (RED, image, plane);
+    setChannel (GREEN, image, plane);
+    setChannel (BLUE, image, plane);
+    destroyChannel (plane);
+    plane = createChannel (xRes, yRes);
+    LONG row = 0;
+    while (row < yRes) {
+        LONG column = 0;
+        while (column < xRes) {
+            setPixel (row, column, plane, MAX_RGB_VALUE);
+            column ++;
+        }
+        row ++;
+    }
+    setChannel (ALPHA, image, plane);
+    destroyChannel (plane);
+    return image;
+}
+
+static double secondsSince (struct timespec start) {
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    double seconds = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+    return seconds;
+}
+
+static byte expectedValue (LONG row, LONG column) {
+    byte value = (row * 7 + column * 13) & 255;
+    return value;
+}
@@ -1,8 +1,17 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 #include "bmp.h"
 
@@ -16,6 +25,90 @@
 #define CHANNEL_UNINITIALIZED -1
 #define ALL_COLORS_IMPORTANT 0
 
+// pixel rows are read/written in blocks of (roughly) this many bytes
+#define PIXEL_IO_BLOCK_SIZE (1 << 20)
+// lazily parsed bitmaps decode rows in blocks of (roughly) this many bytes of pixelArray
+#define LAZY_BLOCK_SIZE (1 << 18)
+
+// pixel hashing: 64 bit primes of xxHash, tags telling bitmaps of different formats and channels apart
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME_3 0x165667B19E3779F9ULL
+#define HASH_PRIME_4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME_5 0x27D4EB2F165667C5ULL
+#define CHANNEL_HASH_TAG 0x43484E4CULL
+// RGB_24 pixels do not store alpha, it is masked out of every 8 bytes (2 pixels) of the pixelArray
+#define RGB_24_HASH_MASK 0x00FFFFFF00FFFFFFULL
+#define ALL_BYTES_HASH_MASK 0xFFFFFFFFFFFFFFFFULL
+
+// gaussian blur: kernel weights in Q14, intermediate rows in Q8 (value * 256)
+#define BLUR_WEIGHT_BITS 14
+#define BLUR_FRACTION_BITS 8
+// from this sigma on the kernel is approximated by 3 successive box blurs (O(1) per pixel)
+#define BOX_BLUR_MIN_SIGMA 6.0
+#define BOX_BLUR_PASS_COUNT 3
+// bytes of the rows a vertical pass keeps hot for one strip of columns (about half of a typical L2)
+#define BLUR_STRIP_BYTES (1 << 17)
+
+// convolution: output tile size, the input tile plus halo (at most 78x270 bytes) stays in L1/L2
+#define CONVOLUTION_TILE_ROWS 64
+#define CONVOLUTION_TILE_COLUMNS 256
+// largest weight in the 16 bit fixed point kernel and the most fraction bits used
+#define MAX_FIXED_WEIGHT 16383
+#define MAX_KERNEL_FRACTION_BITS 14
+
+// side of the square tiles of rotations and transposes (pixels)
+#define ORIENT_TILE_SIZE 64
+
+// resampling weights in Q14, sums in 32 bits
+#define RESAMPLE_WEIGHT_BITS 14
+// most taps of a resampling pass, past it the source is first box reduced by an integer factor
+// (the weights would otherwise round down to a few units each)
+#define RESAMPLE_MAX_TAPS ((1 << RESAMPLE_WEIGHT_BITS) / 16)
+
+// BT.601 full range (JFIF) YCbCr in Q14, the weights of every row sum to 1 << COLOR_WEIGHT_BITS (luma) or to 0 (chroma)
+#define COLOR_WEIGHT_BITS 14
+#define LUMA_RED_WEIGHT 4899
+#define LUMA_GREEN_WEIGHT 9617
+#define LUMA_BLUE_WEIGHT 1868
+#define BLUE_CHROMA_RED_WEIGHT -2765
+#define BLUE_CHROMA_GREEN_WEIGHT -5427
+#define BLUE_CHROMA_BLUE_WEIGHT 8192
+#define RED_CHROMA_RED_WEIGHT 8192
+#define RED_CHROMA_GREEN_WEIGHT -6860
+#define RED_CHROMA_BLUE_WEIGHT -1332
+// and back: 1.402, 0.344136, 0.714136 and 1.772 in Q14
+#define RED_FROM_RED_CHROMA 22970
+#define GREEN_FROM_BLUE_CHROMA 5638
+#define GREEN_FROM_RED_CHROMA 11700
+#define BLUE_FROM_BLUE_CHROMA 29032
+#define CHROMA_OFFSET 128
+
+// histograms: every thread counts into interleaved sets of 32 bit counters (pixel i into set i % HISTOGRAM_SET_COUNT)
+// that are added to the 64 bit totals before any counter can overflow
+#define HISTOGRAM_SET_COUNT 4
+#define HISTOGRAM_FOLD_PIXELS (1ULL << 32)
+// red, green, blue, alpha and luma
+#define HISTOGRAM_PIXEL_BINS (5 * 256)
+
+// statistics: 16 lanes of 32 bit accumulators (lane l takes byte l of every 16, so the channel l % 4 of pixels),
+// added to the 64 bit totals after at most STATS_CHUNK_BYTES bytes (255 * 255 * STATS_CHUNK_BYTES / 16 < 2^32)
+#define STATS_LANE_COUNT 16
+#define STATS_CHUNK_BYTES (1 << 18)
+// the sums and clipped counts of at most this many steps of 16 bytes are held in 16 and 8 bit lanes
+#define STATS_BLOCK_STEPS 255
+
+// CLAHE: weights of the tile tables in Q8
+#define CLAHE_WEIGHT_BITS 8
+
+// comparison: bmpsIdentical threads look for a difference found by another thread before every block of this many bytes
+#define IDENTICAL_BLOCK_BYTES (1 << 16)
+// SSIM: stabilizing constants (0.01 * 255)^2 and (0.03 * 255)^2, the window sums of squares fit a signed int up to
+// 128 x 128 (so that they are turned into doubles with SSE2)
+#define SSIM_C1 6.5025
+#define SSIM_C2 58.5225
+#define SSIM_MAX_WINDOW 128
+
 typedef struct pixel {
     byte red;
     byte green;
@@ -42,12 +135,245 @@ typedef struct bmp {
     DWORD impColorCOunt;
     pixelArray pixelArray;
     colorSpace colorSpace;
+    rowOrder rowOrder;
+    // rows are written in the opposite order of rowOrder (setFlipOnSave)
+    int flipOnSave;
+    // ARGB_32 colors are held multiplied by alpha (premultiplyBmp), they are divided back when written
+    int premultiplied;
+    // rows changed since the bitmap was parsed or saved (one flag per row, NULL while no row is dirty)
+    byte *dirtyRows;
+    LONG dirtyRowCount;
+    // header fields changed since the bitmap was parsed or saved
+    int headerDirty;
+    // the pixelArray is not known to match any file (new or reallocated pixelArray)
+    int pixelsUnsynced;
+    // file the dirty state refers to (parsed from or last saved to), NULL when there is none
+    char *syncedPath;
+    // set by markBmpReadOnly, every later change of the pixels or headers asserts
+    int readOnly;
+    // lazy loading (parseBitMapLazy): read only mapping of the source file and the blocks of rows decoded so far
+    // lazyMap is NULL once every row is resident, lazyLock serializes the decoding between readers of a lazy bitmap
+    // (NULL for a bitmap that was not parsed lazily) and lives until the bitmap is destroyed
+    byte *lazyMap;
+    pthread_mutex_t *lazyLock;
+    unsigned long long lazyMapSize;
+    LONG lazyBlockRows;
+    LONG lazyBlockCount;
+    LONG residentBlockCount;
+    byte *residentBlocks;
+    // sub-image views (createBmpView): the pixels belong to viewOwner (NULL for a bitmap owning its pixels),
+    // rows are rowStride pixels apart and start at row viewFirstRow of the owner
+    struct bmp *viewOwner;
+    LONG rowStride;
+    LONG viewFirstRow;
+    // rows written through the view, marked dirty in the owner when the view is destroyed
+    byte *viewChangedRows;
+    // views of this bitmap not yet destroyed
+    LONG viewCount;
 } bmp;
 
+// incremental pixel hash, the sum of the hashes of the rows fed so far
+typedef struct pixelHash {
+    LONG xRes;
+    LONG yRes;
+    pixelFormat pixelFormat;
+    LONG hashedRowCount;
+    unsigned long long rowHashSum;
+} pixelHash;
+
+// share of a blur done by one thread: a band of rows for horizontal passes, a range of columns for vertical ones
+typedef struct blurJob {
+    channelPtr source;
+    channelPtr target;
+    // Q8 intermediate image(s), the box approximation ping-pongs between both
+    unsigned short *buffers[2];
+    int *weights;
+    int radius;
+    int boxRadii[BOX_BLUR_PASS_COUNT];
+    int boxMode;
+    LONG firstRow;
+    LONG rowCount;
+    LONG firstColumn;
+    LONG columnCount;
+    pthread_barrier_t *barrier;
+} blurJob;
+
+typedef struct kernel {
+    LONG size;
+    double *weights;
+    double bias;
+    // weights * 2^fractionBits, rounded so that their sum matches the rounded sum of the weights
+    short *fixedWeights;
+    int fractionBits;
+} kernel;
+
+// taps of a resampling pass: output i reads counts[i] inputs from starts[i] with weights[i * maxCount ...]
+typedef struct resampleWeights {
+    LONG *starts;
+    LONG *counts;
+    int *weights;
+    LONG maxCount;
+} resampleWeights;
+
+// share of a resize done by one thread: a band of source rows (first pass) and of target rows (second pass)
+typedef struct resizeJob {
+    pixelArray source;
+    LONG sourceXRes;
+    pixelArray intermediate;
+    pixelArray target;
+    LONG xRes;
+    resampleWeights *horizontal;
+    resampleWeights *vertical;
+    LONG firstSourceRow;
+    LONG sourceRowCount;
+    LONG firstRow;
+    LONG rowCount;
+    pthread_barrier_t *barrier;
+} resizeJob;
+
+// tiles convolved by one thread (interleaved between threads)
+typedef struct convolutionJob {
+    channelPtr source;
+    channelPtr target;
+    kernelPtr kernel;
+    borderMode border;
+    int threadIndex;
+    int threadCount;
+} convolutionJob;
+
+// rows of a band run by runRowBands, first member of the job of every band
+typedef struct rowBand {
+    LONG firstRow;
+    LONG rowCount;
+} rowBand;
+
+// band of rows composited by one thread
+typedef struct compositeJob {
+    rowBand rows;
+    bmpPtr target;
+    bmpPtr source;
+    // top left corner of the overlap in target and in source
+    LONG targetX;
+    LONG targetY;
+    LONG sourceX;
+    LONG sourceY;
+    LONG width;
+    blendMode mode;
+} compositeJob;
+
+// band of rows converted by one thread (an even number of rows for COLOR_MODEL_YCBCR_420)
+typedef struct colorModelJob {
+    rowBand rows;
+    bmpPtr sample;
+    colorModel model;
+    channelPtr *planes;
+    // 1 for pixels to planes, 0 for planes to pixels
+    int toPlanes;
+    // HSV divisions by delta and by max through 16 bit reciprocals
+    unsigned int *hueReciprocals;
+    unsigned int *saturationReciprocals;
+} colorModelJob;
+
+// band of rows mapped through tables by one thread (of channel when sample is NULL)
+typedef struct lutJob {
+    rowBand rows;
+    bmpPtr sample;
+    channelPtr channel;
+    // red, green, blue and alpha tables one after the other (a single table for a channel)
+    byte *tables;
+    // premultiplied bitmaps are mapped straight
+    unsigned int *reciprocals;
+} lutJob;
+
+// band of rows counted by one thread (of channel when sample is NULL)
+typedef struct histogramJob {
+    rowBand rows;
+    bmpPtr sample;
+    channelPtr channel;
+    // red, green, blue, alpha and luma counts of the band (only the first 256 for a channel)
+    unsigned long long counts[HISTOGRAM_PIXEL_BINS];
+} histogramJob;
+
+// band of rows whose statistics are taken by one thread (of channel when sample is NULL)
+typedef struct statsJob {
+    rowBand rows;
+    bmpPtr sample;
+    channelPtr channel;
+    // red, green, blue and alpha (only the first one for a channel)
+    channelStats stats[4];
+} statsJob;
+
+// accumulators of statsBytes
+typedef struct statsLanes {
+    unsigned int sums[STATS_LANE_COUNT];
+    unsigned int squares[STATS_LANE_COUNT];
+    unsigned int blacks[STATS_LANE_COUNT];
+    unsigned int whites[STATS_LANE_COUNT];
+    byte mins[STATS_LANE_COUNT];
+    byte maxs[STATS_LANE_COUNT];
+} statsLanes;
+
+// share of a CLAHE done by one thread: the tiles threadIndex, threadIndex + threadCount ... then a band of rows
+typedef struct claheJob {
+    channelPtr channel;
+    LONG tileRows;
+    LONG tileColumns;
+    double clipLimit;
+    // 256 entries per tile, row major
+    byte *tables;
+    // for every row (column): the tile whose center is at or before it and the weight of the next tile
+    LONG *rowTiles;
+    int *rowWeights;
+    LONG *columnTiles;
+    int *columnWeights;
+    int threadIndex;
+    int threadCount;
+    LONG firstRow;
+    LONG rowCount;
+    pthread_barrier_t *barrier;
+} claheJob;
+
+// band of rows compared by one thread (of channels when firstSample is NULL), for SSIM a band of window rows
+typedef struct comparisonJob {
+    rowBand rows;
+    bmpPtr firstSample;
+    bmpPtr secondSample;
+    channelPtr firstChannel;
+    channelPtr secondChannel;
+    // bytes per row and values per pixel (4 for bitmaps, 1 for channels)
+    LONG rowBytes;
+    int channelCount;
+    // bmpsIdentical: differs is set under lock by the first thread finding a difference
+    int ignoreAlpha;
+    pthread_mutex_t *lock;
+    int *differs;
+    // measureBmpDifference: red, green, blue and alpha (only the first one for channels)
+    channelDifference differences[4];
+    // computeBmpSSIM: the SSIM of the windows of every window row summed per channel
+    LONG windowSize;
+    double *rowTotals;
+} comparisonJob;
+
+// band of rows hashed by one thread of hashBmpPixelsParallel
+typedef struct hashJob {
+    bmpPtr sample;
+    LONG firstRow;
+    LONG rowCount;
+    unsigned long long rowHashSum;
+} hashJob;
+
 
 typedef LONG row;
 typedef LONG column;
 
+typedef struct mappedBmp {
+    bmpPtr header;
+    byte *map;
+    unsigned long long mapSize;
+    unsigned long long pixelArrayOffset;
+    unsigned long long stride;
+} mappedBmp;
+
 typedef struct channel {
     LONG xRes;
     LONG yRes;
@@ -80,20 +406,207 @@ static void testToDWORD ();
 static void testToLittleEndianBytes ();
 static void testColorSpaceToLittleEndianBytes ();
 
+// writes/parses a complete '.bmp' byte stream at the current position of an open stream
+static void writeBitMapStream (FILE *targetImage, bmpPtr sample);
+static bmpPtr parseBitMapStream (FILE *sourceImage);
+// writes/parses the bitmap file header and the DIB header only, returns with the stream at the pixelArray
+static unsigned long long writeHeaderStream (FILE *targetImage, bmpPtr sample);
+static bmpPtr parseHeaderStream (FILE *sourceImage, DWORD *fileByteSize);
+// renders the headers of the specified bitmap into memory, returns the number of bytes written (the pixelArray offset)
+static DWORD renderHeaders (bmpPtr sample, byte *target);
+static void verifySamePixelLayout (bmpPtr a, bmpPtr b);
+static int hasSamePixelLayout (bmpPtr a, bmpPtr b);
+// dirty row tracking for saveBitMapInPlace
+static void writeDirtyRows (bmpPtr sample, relativePath filePath);
+static int isBitMapFile (relativePath filePath);
+static void markRowDirty (bmpPtr sample, row cRow);
+static void markAllPixelsDirty (bmpPtr sample);
+static void markHeaderDirty (bmpPtr sample);
+static pixelArray rowPixels (bmpPtr sample, row cRow);
+static int hasPackedRows (bmpPtr sample);
+static int hasAlphaChannel (bmpPtr sample);
+static int runRowBands (void *(*worker) (void *), void *jobs, size_t jobSize, LONG firstRow, LONG rowCount, LONG unitRows, int threadCount);
+static pixelArray packPixels (bmpPtr sample);
+static void destroyBmpView (bmpPtr view);
+static void clearDirtyState (bmpPtr sample);
+static void recordSyncedPath (bmpPtr sample, char *filePath);
+static int mergeChannelRow (pixelArray target, channelArray source, LONG pixelCount, channelType channelType);
+static void copyFileRange (int sourceFile, int targetFile, unsigned long long offset, unsigned long long byteCount);
+
 // returns current fileOffset
-static LONG writeBmpFileHeader (FILE *targetImage, bmpPtr sample, LONG fileOffset);
+static unsigned long long writeBmpFileHeader (FILE *targetImage, bmpPtr sample, unsigned long long fileOffset);
 static DWORD evaluatePixelArrayFileOffset (DIBHeaderVersion dibVersion);
-static LONG writeDIBHeader (FILE *targetImage, bmpPtr sample, LONG fileOffset);
-static LONG writePixelArray (FILE *targetImage, bmpPtr sample, LONG fileOffset);
+static unsigned long long writeDIBHeader (FILE *targetImage, bmpPtr sample, unsigned long long fileOffset);
+static unsigned long long writePixelArray (FILE *targetImage, bmpPtr sample, unsigned long long fileOffset);
+static unsigned long long readPixelArray (FILE *sourceImage, bmpPtr sample, unsigned long long fileOffset);
+// converts pixels between the in memory layout and the on disk (B G R [A]) layout
+static void decodePixels (pixelArray target, byte *source, unsigned long long pixelCount, WORD colorDepth);
+static void encodePixels (byte *target, pixelArray source, unsigned long long pixelCount, WORD colorDepth);
+static void verifyRowOrder (rowOrder order);
+static void encodeFileRows (byte *target, bmpPtr sample, LONG firstFileRow, LONG rowCount);
+// size in bytes of one padded row of pixels in the file
+static unsigned long long evaluateRowStride (LONG xRes, WORD colorDepth);
 static void writeBytes (FILE *targetImage, byte *bytes, LONG byteCOunt);
 static void readBytes (FILE *targetImage, byte *bytes, LONG byteCount);
 
 // proceeds reading/writing additional fields post 'impColorCount'
-static LONG readAdditionalFields (FILE *targetImage, bmpPtr sample, LONG fileOffset);
-static LONG writeAdditionalFields (bmpPtr sample, FILE * image, LONG fileOffset);
+static unsigned long long readAdditionalFields (FILE *targetImage, bmpPtr sample, unsigned long long fileOffset);
+static unsigned long long writeAdditionalFields (bmpPtr sample, FILE * image, unsigned long long fileOffset);
 
 static pixelFormat determinePixelFormat (WORD colorDepth);
 
+// pixel format conversion helpers
+static void verifyFormatForDIBVersion (DIBHeaderVersion version, pixelFormat pixelFormat);
+static void setConversionDefaults (bmpPtr sample, DIBHeaderVersion version, pixelFormat pixelFormat);
+static void convertPixels (pixelArray target, pixelArray source, unsigned long long pixelCount, pixelFormat targetFormat, byte alphaFill);
+
+// lazy loading, every function that reads the pixelArray makes the rows it reads resident first
+static void ensureRowsResident (bmpPtr sample, LONG firstRow, LONG rowCount);
+static void ensureAllRowsResident (bmpPtr sample);
+static void decodeLazyBlock (bmpPtr sample, LONG block);
+static void releaseLazyMapping (bmpPtr sample);
+static LONG countResidentRows (bmpPtr sample);
+
+// pixel hashing
+static unsigned long long hashBytes (byte *bytes, unsigned long long byteCount, unsigned long long mask, unsigned long long seed);
+static unsigned long long hashRound (unsigned long long accumulator, unsigned long long lane);
+static unsigned long long avalanche (unsigned long long hash);
+static unsigned long long hashPixelRows (bmpPtr sample, LONG firstRow, LONG rowCount);
+static unsigned long long finishHash (unsigned long long rowHashSum, LONG xRes, LONG yRes, unsigned long long formatTag);
+static void *hashWorker (void *job);
+
+// separable blur
+static int *createGaussianKernel (double sigma, int *radius);
+static void evaluateBoxRadii (double sigma, int *boxRadii);
+static LONG evaluateStripWidth (int radius);
+static void *blurWorker (void *job);
+static void gaussianRows (blurJob *work);
+static void gaussianColumns (blurJob *work);
+static void boxRows (unsigned short *target, unsigned short *source, LONG xRes, LONG firstRow, LONG rowCount, int radius);
+static void boxColumns (unsigned short *target, unsigned short *source, LONG xRes, LONG yRes, LONG firstColumn, LONG columnCount, int radius);
+static LONG clampIndex (LONG index, LONG count);
+
+// convolution
+static void verifyBorderMode (borderMode border);
+static LONG borderIndex (LONG index, LONG count, borderMode border);
+static void *convolutionWorker (void *job);
+static void convolveTile (convolutionJob *work, byte *padded, int *sums, LONG firstRow, LONG firstColumn);
+static void fillPaddedTile (byte *padded, channelPtr source, LONG firstRow, LONG firstColumn, LONG rowCount, LONG columnCount, int radius, borderMode border);
+static void accumulateKernel (int *sums, byte *window, LONG paddedWidth, short *weights, LONG size, LONG width);
+
+// resampling
+static bmpPtr createBmpLike (bmpPtr sample, DIBHeaderVersion version, pixelFormat pixelFormat, LONG xRes, LONG yRes);
+static void verifyResampleFilter (resampleFilter filter);
+static double evaluateResampleFilter (resampleFilter filter, double x);
+static double resampleFilterSupport (resampleFilter filter);
+static resampleWeights *createResampleWeights (resampleFilter filter, LONG sourceSize, LONG targetSize);
+static void destroyResampleWeights (resampleWeights *weights);
+static LONG evaluateReduceFactor (resampleFilter filter, LONG sourceSize, LONG targetSize);
+static pixelArray boxReducePixels (pixelArray source, LONG xRes, LONG yRes, LONG xFactor, LONG yFactor);
+static void *resizeWorker (void *job);
+static void resampleRows (resizeJob *work);
+static void resampleColumns (resizeJob *work);
+static void premultiplyPixels (pixelArray target, pixelArray source, unsigned long long pixelCount);
+static void unpremultiplyPixels (pixelArray pixels, unsigned long long pixelCount, unsigned int *reciprocals);
+static void fillUnpremultiplyReciprocals (unsigned int *reciprocals);
+static void clampColorsToAlpha (pixelArray pixels, unsigned long long pixelCount);
+static byte clampToByte (int value);
+
+// pyramids
+static bmpPtr createHalfBmp (bmpPtr sample);
+static void downsampleRow (bmpPtr target, bmpPtr source, row targetRow);
+static void cascadePyramidRow (bmpPtr *levels, int levelCount, int level, row cRow);
+
+// orientation
+static void verifyOrientation (orientation orientation);
+static int swapsAxes (orientation orientation);
+static void evaluateOrientationSteps (orientation orientation, LONG xRes, LONG yRes, long long *base, long long *rowStep, long long *columnStep);
+static void orientPixels (pixelArray target, pixelArray source, LONG xRes, LONG yRes, orientation orientation);
+static void orientBytes (channelArray target, channelArray source, LONG xRes, LONG yRes, orientation orientation);
+static rowOrder evaluateEncodeOrder (bmpPtr sample);
+
+// compositing
+static void verifyBlendMode (blendMode mode);
+static void *compositeWorker (void *job);
+static void compositeRow (pixelArray target, pixelArray source, LONG width, blendMode mode, int sourceOpaque, int targetOpaque, int premultiplied);
+static void blendOpaqueRun (pixelArray target, pixelArray source, LONG width, blendMode mode);
+static void blendRun (pixelArray target, pixelArray source, LONG width, blendMode mode, int sourceOpaque, int targetOpaque);
+static unsigned int blendTerm (unsigned int sourceColor, unsigned int targetColor, blendMode mode);
+static void blendPremultipliedRun (pixelArray target, pixelArray source, LONG width, blendMode mode);
+static inline __attribute__ ((always_inline)) void blendPremultipliedPixels (pixelArray target, pixelArray source, LONG width, blendMode mode);
+static inline byte blendPremultiplied (int sourceColor, int targetColor, int sourceAlpha, int targetAlpha, blendMode mode);
+static unsigned int divide255 (unsigned int value);
+static void markRowsWritten (bmpPtr sample, row firstRow, LONG rowCount);
+
+// color models
+static void verifyColorModel (colorModel model);
+static void verifyColorModelChannels (bmpPtr sample, colorModel model, channelPtr *planes);
+static void runColorModelJobs (bmpPtr sample, colorModel model, channelPtr *planes, int toPlanes, int threadCount);
+static void *colorModelWorker (void *job);
+static void lumaRow (byte *luma, pixelArray pixels, LONG pixelCount);
+static void yCbCrRow (byte *luma, byte *blueChroma, byte *redChroma, pixelArray pixels, LONG pixelCount);
+static void chroma420Row (byte *blueChroma, byte *redChroma, pixelArray upper, pixelArray lower, LONG xRes);
+static inline void blockChroma (byte *blueChroma, byte *redChroma, int red, int green, int blue);
+static void hsvRow (byte *hue, byte *saturation, byte *value, pixelArray pixels, LONG pixelCount, unsigned int *hueReciprocals, unsigned int *saturationReciprocals);
+static void grayRow (pixelArray pixels, byte *luma, LONG pixelCount);
+static void rgbFromYCbCrRow (pixelArray pixels, byte *luma, byte *blueChroma, byte *redChroma, LONG pixelCount);
+static void upsampleChromaRow (byte *target, byte *source, LONG xRes);
+static void rgbFromHsvRow (pixelArray pixels, byte *hue, byte *saturation, byte *value, LONG pixelCount);
+static inline byte hsvComponent (int position, int sectorOffset, int max, int chroma);
+
+// tone curves
+static void runLUTJobs (lutJob work, LONG rowCount, int threadCount);
+static void *lutWorker (void *job);
+static void mapPixels (pixelArray pixels, LONG pixelCount, byte *tables);
+static void mapBytes (byte *bytes, unsigned long long byteCount, byte *table);
+
+// histograms
+static void addHistogramRows (bmpHistogram *histogram, bmpPtr sample, LONG firstRow, LONG rowCount, int threadCount);
+static void runHistogramJobs (histogramJob *work, LONG firstRow, LONG rowCount, int threadCount, unsigned long long *totals, int binCount);
+static void *histogramWorker (void *job);
+static void countPixels (unsigned int *sets, pixelArray pixels, LONG pixelCount);
+static inline void countPixel (unsigned int *set, pixel value);
+static void countBytes (unsigned int *sets, byte *bytes, unsigned long long byteCount);
+static void foldHistogramSets (unsigned long long *counts, unsigned int *sets, int binCount);
+
+// statistics
+static void addStatsRows (bmpStats *stats, bmpPtr sample, LONG firstRow, LONG rowCount, int threadCount);
+static void runStatsJobs (statsJob *work, LONG firstRow, LONG rowCount, int threadCount, channelStats *totals, int channelCount);
+static void *statsWorker (void *job);
+static void statsBytes (channelStats *stats, int channelCount, byte *bytes, unsigned long long byteCount);
+static void clearStatsLanes (statsLanes *lanes);
+static void mergeChannelStats (channelStats *target, channelStats *source);
+
+// equalization
+static void verifyEqualizeMode (equalizeMode mode);
+static void fillEqualizationTable (byte *table, unsigned long long *counts, unsigned long long total);
+static void fillClippedTable (byte *table, unsigned long long *counts, unsigned long long total, double clipLimit);
+static void evaluateTileWeights (LONG *tiles, int *weights, LONG count, LONG tileCount);
+static void *claheWorker (void *job);
+static void claheTile (claheJob *work, unsigned int *sets, LONG tile);
+static void claheRow (claheJob *work, unsigned short *blended, row cRow);
+
+// comparison
+static void prepareBmpComparison (comparisonJob *work, bmpPtr first, bmpPtr second);
+static void prepareChannelComparison (comparisonJob *work, channelPtr first, channelPtr second);
+static void verifyComparableBmps (bmpPtr first, bmpPtr second);
+static void runComparisonJobs (comparisonJob *work, LONG rowCount, int threadCount, void *(*worker) (void *));
+static byte *comparedRow (bmpPtr sample, channelPtr channel, row cRow);
+static int findDifference (comparisonJob *work, LONG rowCount, int threadCount);
+static void *identicalWorker (void *job);
+static int identicalBytes (comparisonJob *band, byte *first, byte *second, unsigned long long byteCount);
+static int sameBytes (byte *first, byte *second, unsigned long long byteCount, int ignoreAlpha);
+static void *differenceWorker (void *job);
+static void differenceBytes (channelDifference *differences, byte *maxs, int channelCount, byte *first, byte *second, unsigned long long byteCount);
+static void mergeDifference (channelDifference *target, channelDifference *source);
+static void finishDifference (channelDifference *difference);
+static void windowSSIM (comparisonJob *work, LONG xRes, LONG yRes, LONG windowSize, int threadCount, double *means);
+static void *ssimWorker (void *job);
+static void addColumnSums (unsigned int *sums, LONG rowBytes, byte *first, byte *second);
+static void slideColumnSums (unsigned int *sums, LONG rowBytes, byte *first, byte *second, byte *oldFirst, byte *oldSecond);
+static void sumRowSSIM (unsigned int *sums, unsigned int *windows, double *values, LONG rowBytes, int channelCount, LONG windowSize, double *totals);
+static inline double ssimOfSums (double n, int firstSum, int secondSum, int firstSquares, int secondSquares, int products);
+
 static void testWriteHelperFunctions ();
 static void testEvaluatePixelArrayFileOffset ();
 static void testWriteBmpFileHeader ();
@@ -107,6 +620,8 @@ void saveBitMap (bmpPtr sample, fileName imageName, relativePath destination) {
     int imageNameLength = strlen (imageName);
     int destinationLength = strlen (destination);
     assert ( imageNameLength + destinationLength < MAX_RELATIVE_PATH_LENGTH);
+    // the target may be the file a lazy bitmap is mapped from, decode everything before truncating it
+    ensureAllRowsResident (sample);
     // create targetFile
     relativePath ePath;
     strcpy (ePath, destination);
@@ -114,7 +629,265 @@ void saveBitMap (bmpPtr sample, fileName imageName, relativePath destination) {
     imageOrigins = strcat (ePath, imageName);
     FILE *targetImage = fopen (imageOrigins, "wb");
     assert (targetImage != NULL);
-    LONG fileOffset = 0;
+    writeBitMapStream (targetImage, sample);
+    fclose (targetImage);
+    clearDirtyState (sample);
+    recordSyncedPath (sample, imageOrigins);
+    return;
+}
+
+void saveBitMapInPlace (bmpPtr sample, relativePath filePath) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    // the dirty rows only tell what differs from the file the bitmap was parsed from or last saved to
+    int sameFile = sample->syncedPath != NULL && strcmp (sample->syncedPath, filePath) == 0;
+    int inPlace = sameFile && !sample->pixelsUnsynced && isBitMapFile (filePath);
+    if (inPlace) {
+        bmpPtr current = parseBitMapHeader (filePath);
+        inPlace = hasSamePixelLayout (sample, current);
+        destroyBmp (current);
+    }
+
+    if (!inPlace) {
+        ensureAllRowsResident (sample);
+        FILE *targetImage = fopen (filePath, "wb");
+        assert (targetImage != NULL);
+        writeBitMapStream (targetImage, sample);
+        int retCode = fclose (targetImage);
+        assert (retCode == 0);
+    } else {
+        if (sample->headerDirty) {
+            patchBitMapHeader (sample, filePath);
+        }
+        if (sample->dirtyRowCount > 0) {
+            writeDirtyRows (sample, filePath);
+        }
+    }
+    clearDirtyState (sample);
+    recordSyncedPath (sample, filePath);
+    return;
+}
+
+// 1 when filePath can be opened and starts with the '.bmp' signature
+static int isBitMapFile (relativePath filePath) {
+    FILE *source = fopen (filePath, "rb");
+    if (source == NULL) {
+        return 0;
+    }
+    byte signature[2];
+    size_t readCount = fread (signature, 1, 2, source);
+    fclose (source);
+    return readCount == 2 && signature[0] == 'B' && signature[1] == 'M';
+}
+
+void markBmpReadOnly (bmpPtr sample) {
+    assert (sample != NULL);
+    sample->readOnly = 1;
+    return;
+}
+
+LONG getDirtyRowCount (bmpPtr sample) {
+    assert (sample != NULL);
+    LONG dirtyRowCount = sample->dirtyRowCount;
+    if (sample->pixelsUnsynced) {
+        dirtyRowCount = sample->yRes;
+    }
+    return dirtyRowCount;
+}
+
+// pwrites every run of dirty rows at its offset in the file
+static void writeDirtyRows (bmpPtr sample, relativePath filePath) {
+    assert (sample->dirtyRows != NULL);
+    unsigned long long stride = evaluateRowStride (sample->xRes, sample->colorDepth);
+    unsigned long long pixelArrayOffset = evaluatePixelArrayFileOffset (sample->DIBVersion);
+    LONG rowsPerBlock = (LONG) (PIXEL_IO_BLOCK_SIZE / stride);
+    if (rowsPerBlock < 1) {
+        rowsPerBlock = 1;
+    }
+    if (rowsPerBlock > sample->dirtyRowCount) {
+        rowsPerBlock = sample->dirtyRowCount;
+    }
+    byte *block = (byte *) malloc ((unsigned long long) rowsPerBlock * stride);
+    assert (block != NULL);
+    int file = open (filePath, O_WRONLY);
+    assert (file >= 0);
+
+    row cRow = 0;
+    while (cRow < sample->yRes) {
+        if (!sample->dirtyRows[cRow]) {
+            cRow ++;
+        } else {
+            // run of dirty rows in memory, which is also a run of rows in the file
+            LONG rowCount = 0;
+            while (cRow + rowCount < sample->yRes && sample->dirtyRows[cRow + rowCount] && rowCount < rowsPerBlock) {
+                rowCount ++;
+            }
+            row firstFileRow = cRow;
+            if (evaluateEncodeOrder (sample) == BOTTOM_UP) {
+                firstFileRow = sample->yRes - cRow - rowCount;
+            }
+            encodeFileRows (block, sample, firstFileRow, rowCount);
+            unsigned long long byteCount = (unsigned long long) rowCount * stride;
+            ssize_t written = pwrite (file, block, byteCount, pixelArrayOffset + firstFileRow * stride);
+            assert (written >= 0 && (unsigned long long) written == byteCount);
+            cRow += rowCount;
+        }
+    }
+    int retCode = close (file);
+    assert (retCode == 0);
+    free (block);
+    return;
+}
+
+static void markRowDirty (bmpPtr sample, row cRow) {
+    assert (cRow >= 0 && cRow < sample->yRes);
+    assert (!sample->readOnly);
+    if (sample->dirtyRows == NULL) {
+        sample->dirtyRows = (byte *) calloc (sample->yRes, sizeof (byte));
+        assert (sample->dirtyRows != NULL);
+    }
+    if (!sample->dirtyRows[cRow]) {
+        sample->dirtyRows[cRow] = 1;
+        sample->dirtyRowCount ++;
+    }
+    return;
+}
+
+static void markAllPixelsDirty (bmpPtr sample) {
+    assert (!sample->readOnly);
+    free (sample->dirtyRows);
+    sample->dirtyRows = NULL;
+    sample->dirtyRowCount = 0;
+    sample->pixelsUnsynced = 1;
+    if (sample->viewOwner != NULL) {
+        memset (sample->viewChangedRows, 1, sample->yRes);
+    }
+    return;
+}
+
+static void markHeaderDirty (bmpPtr sample) {
+    assert (!sample->readOnly);
+    sample->headerDirty = 1;
+    return;
+}
+
+// first pixel of a row in memory (rows of a view are rowStride pixels apart)
+static pixelArray rowPixels (bmpPtr sample, row cRow) {
+    LONG stride = sample->xRes;
+    if (sample->viewOwner != NULL) {
+        stride = sample->rowStride;
+    }
+    return sample->pixelArray + (unsigned long long) cRow * stride;
+}
+
+// whether the pixels are one contiguous array (always true unless the bitmap is a view narrower than its owner)
+static int hasPackedRows (bmpPtr sample) {
+    return sample->viewOwner == NULL || sample->rowStride == sample->xRes;
+}
+
+// 0 for RGB_24, the alpha byte of its pixels is not part of the image (kernels report it as opaque)
+static int hasAlphaChannel (bmpPtr sample) {
+    return sample->pixelFormat == ARGB_32;
+}
+
+// splits rowCount rows from firstRow in bands of whole units of unitRows rows between at most threadCount threads,
+// the calling thread takes the first band. jobs holds threadCount jobs of jobSize bytes, each starting with its
+// rowBand: the first one is copied to the others before their band is set. Returns the number of bands run
+static int runRowBands (void *(*worker) (void *), void *jobs, size_t jobSize, LONG firstRow, LONG rowCount, LONG unitRows, int threadCount) {
+    assert (rowCount > 0 && unitRows > 0 && threadCount > 0);
+    LONG unitCount = (rowCount + unitRows - 1) / unitRows;
+    int bandCount = threadCount;
+    if (bandCount > unitCount) {
+        bandCount = (int) unitCount;
+    }
+    pthread_t *threads = (pthread_t *) malloc (bandCount * sizeof (pthread_t));
+    assert (threads != NULL);
+    int t = 0;
+    while (t < bandCount) {
+        byte *job = (byte *) jobs + (unsigned long long) t * jobSize;
+        if (t > 0) {
+            memcpy (job, jobs, jobSize);
+        }
+        LONG bandStart = (LONG) ((unsigned long long) unitCount * t / bandCount) * unitRows;
+        LONG bandEnd = (LONG) ((unsigned long long) unitCount * (t + 1) / bandCount) * unitRows;
+        if (bandEnd > rowCount) {
+            bandEnd = rowCount;
+        }
+        rowBand *band = (rowBand *) job;
+        band->firstRow = firstRow + bandStart;
+        band->rowCount = bandEnd - bandStart;
+        if (t > 0) {
+            int retCode = pthread_create (threads + t, NULL, worker, job);
+            assert (retCode == 0);
+        }
+        t ++;
+    }
+    worker (jobs);
+    t = 1;
+    while (t < bandCount) {
+        pthread_join (threads[t], NULL);
+        t ++;
+    }
+    free (threads);
+    return bandCount;
+}
+
+// contiguous copy of the pixels, freed by the caller
+static pixelArray packPixels (bmpPtr sample) {
+    unsigned long long rowBytes = (unsigned long long) sample->xRes * sizeof (pixel);
+    pixelArray packed = (pixelArray) malloc (rowBytes * sample->yRes);
+    assert (packed != NULL);
+    row cRow = 0;
+    while (cRow < sample->yRes) {
+        memcpy (packed + (unsigned long long) cRow * sample->xRes, rowPixels (sample, cRow), rowBytes);
+        cRow ++;
+    }
+    return packed;
+}
+
+static void clearDirtyState (bmpPtr sample) {
+    free (sample->dirtyRows);
+    sample->dirtyRows = NULL;
+    sample->dirtyRowCount = 0;
+    sample->headerDirty = 0;
+    sample->pixelsUnsynced = 0;
+    return;
+}
+
+static void recordSyncedPath (bmpPtr sample, char *filePath) {
+    char *syncedPath = strdup (filePath);
+    assert (syncedPath != NULL);
+    free (sample->syncedPath);
+    sample->syncedPath = syncedPath;
+    return;
+}
+
+void writeBitMapToMemory (bmpPtr sample, byte *target) {
+    assert (sample != NULL);
+    assert (target != NULL);
+    DWORD fileSize = determineFileSizeInBytes (sample);
+    // "r+" so that the stream never truncates or null terminates the caller's buffer
+    FILE *targetImage = fmemopen (target, fileSize, "r+");
+    assert (targetImage != NULL);
+    setvbuf (targetImage, NULL, _IONBF, 0);
+    writeBitMapStream (targetImage, sample);
+    fclose (targetImage);
+    return;
+}
+
+static void writeBitMapStream (FILE *targetImage, bmpPtr sample) {
+    ensureAllRowsResident (sample);
+    unsigned long long fileOffset = writeHeaderStream (targetImage, sample);
+    fileOffset = writePixelArray (targetImage, sample, fileOffset);
+    DWORD cOffset = determineFileSizeInBytes (sample);
+    assert (fileOffset == cOffset);
+    return;
+}
+
+static unsigned long long writeHeaderStream (FILE *targetImage, bmpPtr sample) {
+    assert (targetImage != NULL);
+    assert (sample != NULL);
+    unsigned long long fileOffset = 0;
     fileOffset = writeBmpFileHeader (targetImage, sample, fileOffset);
     assert (fileOffset == 14);
     
@@ -136,19 +909,323 @@ void saveBitMap (bmpPtr sample, fileName imageName, relativePath destination) {
             assert (COMPRESSION_OFFSET_ARTIFACTS_NOT_SPECIFIED);
         }
     }
-    
-    fileOffset = writePixelArray (targetImage, sample, fileOffset);
-    DWORD cOffset = determineFileSizeInBytes (sample);
-    assert (fileOffset == cOffset);
-    fclose (targetImage);
-    return;
+    return fileOffset;
 }
 
 bmpPtr parseBitMap (relativePath srcFilePath) {
     FILE *source = fopen (srcFilePath, "rb");
     assert (source != NULL);
+    bmpPtr sample = parseBitMapStream (source);
+    fclose (source);
+    recordSyncedPath (sample, srcFilePath);
+    return sample;
+}
+
+bmpPtr parseBitMapFromMemory (byte *source, unsigned long long byteCount) {
+    assert (source != NULL);
+    assert (byteCount > 0);
+    FILE *sourceImage = fmemopen (source, byteCount, "rb");
+    assert (sourceImage != NULL);
+    setvbuf (sourceImage, NULL, _IONBF, 0);
+    bmpPtr sample = parseBitMapStream (sourceImage);
+    fclose (sourceImage);
+    return sample;
+}
+
+bmpPtr parseBitMapHeader (relativePath srcFilePath) {
+    FILE *source = fopen (srcFilePath, "rb");
+    assert (source != NULL);
+    DWORD fileByteSize;
+    bmpPtr sample = parseHeaderStream (source, &fileByteSize);
+    fclose (source);
+    return sample;
+}
+
+bmpPtr parseBitMapLazy (relativePath srcFilePath) {
+    bmpPtr sample = parseBitMapHeader (srcFilePath);
+    unsigned long long netRes = (unsigned long long) sample->xRes * sample->yRes;
+    // pages of the pixelArray are only backed by memory once a block of rows is decoded into them
+    sample->pixelArray = (pixelArray) malloc (netRes * sizeof (pixel));
+    assert (sample->pixelArray != NULL);
+
+    int file = open (srcFilePath, O_RDONLY);
+    assert (file >= 0);
+    struct stat fileStatus;
+    int retCode = fstat (file, &fileStatus);
+    assert (retCode == 0);
+    unsigned long long stride = evaluateRowStride (sample->xRes, sample->colorDepth);
+    unsigned long long pixelArrayEnd = evaluatePixelArrayFileOffset (sample->DIBVersion) + stride * sample->yRes;
+    assert ((unsigned long long) fileStatus.st_size >= pixelArrayEnd);
+    sample->lazyMapSize = pixelArrayEnd;
+    sample->lazyMap = (byte *) mmap (NULL, sample->lazyMapSize, PROT_READ, MAP_PRIVATE, file, 0);
+    assert (sample->lazyMap != MAP_FAILED);
+    close (file);
+
+    unsigned long long rowBytes = (unsigned long long) sample->xRes * sizeof (pixel);
+    sample->lazyBlockRows = (LONG) (LAZY_BLOCK_SIZE / rowBytes);
+    if (sample->lazyBlockRows < 1) {
+        sample->lazyBlockRows = 1;
+    }
+    sample->lazyBlockCount = (sample->yRes + sample->lazyBlockRows - 1) / sample->lazyBlockRows;
+    sample->residentBlockCount = 0;
+    sample->residentBlocks = (byte *) calloc (sample->lazyBlockCount, sizeof (byte));
+    assert (sample->residentBlocks != NULL);
+    sample->lazyLock = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+    assert (sample->lazyLock != NULL);
+    retCode = pthread_mutex_init (sample->lazyLock, NULL);
+    assert (retCode == 0);
+    clearDirtyState (sample);
+    recordSyncedPath (sample, srcFilePath);
+    return sample;
+}
+
+LONG getResidentRowCount (bmpPtr sample) {
+    assert (sample != NULL);
+    if (sample->lazyLock == NULL) {
+        return sample->yRes;
+    }
+    pthread_mutex_lock (sample->lazyLock);
+    LONG rowCount = sample->yRes;
+    if (sample->lazyMap != NULL) {
+        rowCount = countResidentRows (sample);
+    }
+    pthread_mutex_unlock (sample->lazyLock);
+    return rowCount;
+}
+
+static LONG countResidentRows (bmpPtr sample) {
+    LONG rowCount = 0;
+    LONG block = 0;
+    while (block < sample->lazyBlockCount) {
+        if (sample->residentBlocks[block]) {
+            LONG blockRows = sample->yRes - block * sample->lazyBlockRows;
+            if (blockRows > sample->lazyBlockRows) {
+                blockRows = sample->lazyBlockRows;
+            }
+            rowCount += blockRows;
+        }
+        block ++;
+    }
+    return rowCount;
+}
+
+void patchBitMapHeader (bmpPtr header, relativePath filePath) {
+    assert (header != NULL);
+    bmpPtr current = parseBitMapHeader (filePath);
+    verifySamePixelLayout (header, current);
+
+    byte before[BITMAPV4HEADER_SIZE + 14];
+    byte after[BITMAPV4HEADER_SIZE + 14];
+    DWORD headerSize = renderHeaders (current, before);
+    DWORD cHeaderSize = renderHeaders (header, after);
+    assert (headerSize == cHeaderSize);
+    destroyBmp (current);
+
+    int file = open (filePath, O_WRONLY);
+    assert (file >= 0);
+    // write back only the runs of bytes that changed
+    DWORD i = 0;
+    while (i < headerSize) {
+        if (before[i] == after[i]) {
+            i ++;
+        } else {
+            DWORD runEnd = i;
+            while (runEnd < headerSize && before[runEnd] != after[runEnd]) {
+                runEnd ++;
+            }
+            ssize_t written = pwrite (file, after + i, runEnd - i, i);
+            assert (written == runEnd - i);
+            i = runEnd;
+        }
+    }
+    int retCode = close (file);
+    assert (retCode == 0);
+    return;
+}
+
+void copyBitMapWithHeader (bmpPtr header, relativePath srcFilePath, relativePath dstFilePath) {
+    assert (header != NULL);
+    bmpPtr current = parseBitMapHeader (srcFilePath);
+    verifySamePixelLayout (header, current);
+    destroyBmp (current);
+
+    byte headerBytes[BITMAPV4HEADER_SIZE + 14];
+    DWORD headerSize = renderHeaders (header, headerBytes);
+    DWORD fileSize = determineFileSizeInBytes (header);
+
+    int sourceFile = open (srcFilePath, O_RDONLY);
+    assert (sourceFile >= 0);
+    int targetFile = open (dstFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert (targetFile >= 0);
+    ssize_t written = pwrite (targetFile, headerBytes, headerSize, 0);
+    assert (written == headerSize);
+    copyFileRange (sourceFile, targetFile, headerSize, fileSize - headerSize);
+    close (sourceFile);
+    int retCode = close (targetFile);
+    assert (retCode == 0);
+    return;
+}
+
+static DWORD renderHeaders (bmpPtr sample, byte *target) {
+    assert (sample != NULL);
+    assert (target != NULL);
+    DWORD headerSize = evaluatePixelArrayFileOffset (sample->DIBVersion);
+    FILE *targetImage = fmemopen (target, headerSize, "r+");
+    assert (targetImage != NULL);
+    setvbuf (targetImage, NULL, _IONBF, 0);
+    unsigned long long fileOffset = writeHeaderStream (targetImage, sample);
+    assert (fileOffset == headerSize);
+    fclose (targetImage);
+    return headerSize;
+}
+
+// fields that decide where and how pixels are stored can not be patched
+static void verifySamePixelLayout (bmpPtr a, bmpPtr b) {
+    assert (hasSamePixelLayout (a, b));
+    return;
+}
+
+static int hasSamePixelLayout (bmpPtr a, bmpPtr b) {
+    assert (a != NULL && b != NULL);
+    int same = a->DIBVersion == b->DIBVersion;
+    same = same && a->xRes == b->xRes && a->yRes == b->yRes;
+    same = same && a->colorDepth == b->colorDepth;
+    same = same && a->compression == b->compression;
+    same = same && a->rowOrder == b->rowOrder;
+    return same;
+}
+
+// copies byteCount bytes at offset from sourceFile to the same offset in targetFile without going through user space
+static void copyFileRange (int sourceFile, int targetFile, unsigned long long offset, unsigned long long byteCount) {
+    loff_t sourceOffset = offset;
+    loff_t targetOffset = offset;
+    unsigned long long remaining = byteCount;
+    while (remaining > 0) {
+        ssize_t copied = copy_file_range (sourceFile, &sourceOffset, targetFile, &targetOffset, remaining, 0);
+        if (copied < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+            break;
+        }
+        assert (copied > 0);
+        remaining -= copied;
+    }
+    // fallback for file systems without copy_file_range support
+    if (remaining > 0) {
+        off_t seekOffset = lseek (targetFile, targetOffset, SEEK_SET);
+        assert (seekOffset == targetOffset);
+        off_t sendOffset = sourceOffset;
+        while (remaining > 0) {
+            ssize_t copied = sendfile (targetFile, sourceFile, &sendOffset, remaining);
+            assert (copied > 0);
+            remaining -= copied;
+        }
+    }
+    return;
+}
+
+mappedBmpPtr openBitMapForEdit (relativePath filePath) {
+    mappedBmpPtr target = (mappedBmpPtr) malloc (sizeof (mappedBmp));
+    assert (target != NULL);
+    target->header = parseBitMapHeader (filePath);
+    target->mapSize = determineFileSizeInBytes (target->header);
+    target->pixelArrayOffset = evaluatePixelArrayFileOffset (target->header->DIBVersion);
+    target->stride = evaluateRowStride (target->header->xRes, target->header->colorDepth);
+
+    int file = open (filePath, O_RDWR);
+    assert (file >= 0);
+    struct stat info;
+    int retCode = fstat (file, &info);
+    assert (retCode == 0);
+    assert ((unsigned long long) info.st_size >= target->mapSize);
+    target->map = (byte *) mmap (NULL, target->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    assert (target->map != MAP_FAILED);
+    // the mapping keeps the file open
+    close (file);
+    return target;
+}
+
+bmpPtr getMappedHeader (mappedBmpPtr image) {
+    assert (image != NULL);
+    bmpPtr header = image->header;
+    return header;
+}
+
+unsigned long long getMappedRowStride (mappedBmpPtr image) {
+    assert (image != NULL);
+    unsigned long long stride = image->stride;
+    return stride;
+}
+
+byte *getMappedRow (mappedBmpPtr image, LONG cRow) {
+    assert (image != NULL);
+    assert (cRow >= 0 && cRow < image->header->yRes);
+    row fileRow = cRow;
+    if (image->header->rowOrder == BOTTOM_UP) {
+        fileRow = image->header->yRes - 1 - cRow;
+    }
+    byte *mappedRow = image->map + image->pixelArrayOffset + (unsigned long long) fileRow * image->stride;
+    return mappedRow;
+}
+
+void flushMappedRows (mappedBmpPtr image, LONG firstRow, LONG rowCount) {
+    assert (image != NULL);
+    assert (firstRow >= 0 && rowCount > 0);
+    assert (firstRow + rowCount <= image->header->yRes);
+    // the rows are contiguous in the file whichever the row order is
+    byte *start = getMappedRow (image, firstRow);
+    byte *end = getMappedRow (image, firstRow + rowCount - 1);
+    if (end < start) {
+        byte *temp = start;
+        start = end;
+        end = temp;
+    }
+    end += image->stride;
+    // msync wants a page aligned start address
+    long pageSize = sysconf (_SC_PAGESIZE);
+    unsigned long long startOffset = start - image->map;
+    unsigned long long alignedOffset = startOffset - (startOffset % pageSize);
+    int retCode = msync (image->map + alignedOffset, end - (image->map + alignedOffset), MS_SYNC);
+    assert (retCode == 0);
+    return;
+}
+
+void flushMappedBitMap (mappedBmpPtr image) {
+    assert (image != NULL);
+    int retCode = msync (image->map, image->mapSize, MS_SYNC);
+    assert (retCode == 0);
+    return;
+}
+
+void closeMappedBitMap (mappedBmpPtr image) {
+    assert (image != NULL);
+    // unflushed edits still reach the file through the page cache, just not synchronously
+    munmap (image->map, image->mapSize);
+    destroyBmp (image->header);
+    free (image);
+    return;
+}
+
+static bmpPtr parseBitMapStream (FILE *source) {
+    assert (source != NULL);
+    DWORD fileByteSize;
+    bmpPtr sample = parseHeaderStream (source, &fileByteSize);
+    unsigned long long fileOffset = evaluatePixelArrayFileOffset (sample->DIBVersion);
+
+    // pixel array setup
+    unsigned long long netRes = (unsigned long long) sample->xRes * sample->yRes;
+    sample->pixelArray = (pixelArray) malloc (netRes * sizeof(pixel));
+    assert (sample->pixelArray != NULL);
+
+    fileOffset = readPixelArray (source, sample, fileOffset);
+    assert (fileOffset == fileByteSize);
+    clearDirtyState (sample);
+    return sample;
+}
+
+static bmpPtr parseHeaderStream (FILE *source, DWORD *fileByteSize) {
+    assert (source != NULL);
+    assert (fileByteSize != NULL);
 
-    LONG fileOffset = 0;
+    unsigned long long fileOffset = 0;
     // assert file type
     byte value[2];
     readBytes (source, value, 2);
@@ -158,7 +1235,7 @@ bmpPtr parseBitMap (relativePath srcFilePath) {
     // fileByteSize
     byte bytes[4];
     readBytes (source, bytes, 4);
-    DWORD fileByteSize = toDWORD (bytes, 4);
+    *fileByteSize = toDWORD (bytes, 4);
     fileOffset += 4;
 
     // 4 reserved bytes
@@ -187,19 +1264,24 @@ bmpPtr parseBitMap (relativePath srcFilePath) {
     // xRes
     readBytes (source, bytes, 4);
     LONG xRes = (LONG) toDWORD (bytes, 4);
+    assert (xRes > 0);
     sample->xRes = xRes;
     fileOffset += 4;
 
-    // yRes
+    // yRes (negative for top-down bitmaps)
     readBytes (source, bytes, 4);
     LONG yRes = (LONG) toDWORD (bytes, 4);
+    // -INT_MIN does not fit a LONG
+    assert (yRes != INT_MIN);
+    if (yRes < 0) {
+        sample->rowOrder = TOP_DOWN;
+        yRes = -yRes;
+    } else {
+        sample->rowOrder = BOTTOM_UP;
+    }
     sample->yRes = yRes;
     fileOffset += 4;
 
-    // pixel array setup
-    unsigned long long netRes = sample->xRes * sample->yRes;
-    sample->pixelArray = (pixelArray) malloc (netRes * sizeof(pixel));
-
     assert (fileOffset == 26);
 
     // colorPlaneCount
@@ -263,66 +1345,12 @@ bmpPtr parseBitMap (relativePath srcFilePath) {
     DWORD pixelArrayFileOffsetCalculated = evaluatePixelArrayFileOffset (sample->DIBVersion);
     assert (pixelArrayFileOffsetRead == pixelArrayFileOffsetCalculated);
     assert (fileOffset == pixelArrayFileOffsetCalculated);
-
-    assert (sample->colorDepth == 24 || sample->colorDepth == 32);
-
-    DWORD bytesPerRow = sample->xRes * (sample->colorDepth/8);
-    DWORD paddingByteCount = (ceiling (bytesPerRow, 4) * 4) - bytesPerRow;
-    byte *trash = (byte *) malloc (paddingByteCount * sizeof (byte));
-
-    if (sample->DIBVersion == BITMAPINFOHEADER) {
-        row cRow = sample->yRes - 1;
-        while (cRow >= 0) {
-            column cCol = 0;
-            while (cCol < sample->xRes) {
-                unsigned long long pixIndex = (cRow * sample->xRes) + cCol;
-                byte blue = fgetc (source);
-                byte green = fgetc (source);
-                byte red = fgetc (source);
-                (sample->pixelArray + pixIndex)->blue = blue;
-                (sample->pixelArray + pixIndex)->green = green;
-                (sample->pixelArray + pixIndex)->red = red;
-                
-                fileOffset += 3;
-                cCol ++;
-            }
-            //skipPaddingBytes
-            readBytes (source, trash, paddingByteCount);
-            fileOffset += paddingByteCount;
-            cRow --;
-        }
-    } else if (sample->DIBVersion ==  BITMAPV4HEADER) {
-        row cRow = 0;
-        while (cRow < sample->yRes) {
-            column cCol = 0;
-            while (cCol < sample->xRes) {
-                unsigned long long pixIndex = (cRow * sample->xRes) + cCol;
-                byte blue = fgetc (source);
-                byte green = fgetc (source);
-                byte red = fgetc (source);
-                byte alpha = fgetc (source);
-                (sample->pixelArray + pixIndex)->blue = blue;
-                (sample->pixelArray + pixIndex)->green = green;
-                (sample->pixelArray + pixIndex)->red = red;
-                (sample->pixelArray + pixIndex)->alpha = alpha;
-                fileOffset += 4;
-                cCol ++;
-            }
-            //skipPaddingBytes
-            readBytes (source, trash, paddingByteCount);
-            fileOffset += paddingByteCount;
-            cRow ++;
-        }
-    } else {
-        assert (DIB_DEFAULTS_NOT_SPECIFIED);
-    }
-    assert (fileOffset == fileByteSize);
-    free (trash);
-    fclose (source);
+    assert (*fileByteSize == determineFileSizeInBytes (sample));
+    sample->headerDirty = 0;
     return sample;
 }
 
-static LONG readAdditionalFields (FILE *targetImage, bmpPtr sample, LONG fileOffset) {
+static unsigned long long readAdditionalFields (FILE *targetImage, bmpPtr sample, unsigned long long fileOffset) {
     assert (targetImage != NULL);
     assert (sample != NULL);
     assert (fileOffset  == 54);
@@ -388,7 +1416,7 @@ static LONG readAdditionalFields (FILE *targetImage, bmpPtr sample, LONG fileOff
     return fileOffset;
 }
 
-static LONG writeBmpFileHeader (FILE *targetImage, bmpPtr sample, LONG fileOffset) {
+static unsigned long long writeBmpFileHeader (FILE *targetImage, bmpPtr sample, unsigned long long fileOffset) {
     assert (fileOffset == 0);
     assert (targetImage != NULL);
     assert (sample != NULL);
@@ -419,7 +1447,7 @@ static LONG writeBmpFileHeader (FILE *targetImage, bmpPtr sample, LONG fileOffse
     return fileOffset;
 }
 
-static LONG writeDIBHeader (FILE *targetImage, bmpPtr sample, LONG fileOffset) {
+static unsigned long long writeDIBHeader (FILE *targetImage, bmpPtr sample, unsigned long long fileOffset) {
     assert (targetImage != NULL);
     assert (sample != NULL);
     verifyDIBVersion (sample->DIBVersion);
@@ -436,8 +1464,13 @@ static LONG writeDIBHeader (FILE *targetImage, bmpPtr sample, LONG fileOffset) {
     writeBytes (targetImage, bytes, 4);
     fileOffset += 4;
 
-    // yRes
-    toLittleEndianBytes (sample->yRes, bytes, 4);
+    // yRes (negative for top-down bitmaps)
+    verifyRowOrder (sample->rowOrder);
+    if (sample->rowOrder == TOP_DOWN) {
+        toLittleEndianBytes ((DWORD) -sample->yRes, bytes, 4);
+    } else {
+        toLittleEndianBytes (sample->yRes, bytes, 4);
+    }
     writeBytes (targetImage, bytes, 4);
     fileOffset += 4;
 
@@ -487,7 +1520,7 @@ static LONG writeDIBHeader (FILE *targetImage, bmpPtr sample, LONG fileOffset) {
     return fileOffset;    
 }
 
-static LONG writeAdditionalFields (bmpPtr sample, FILE * targetImage, LONG fileOffset) {
+static unsigned long long writeAdditionalFields (bmpPtr sample, FILE * targetImage, unsigned long long fileOffset) {
     assert (sample != NULL);
     assert (targetImage != NULL);
     assert (fileOffset == 54);
@@ -542,84 +1575,203 @@ static LONG writeAdditionalFields (bmpPtr sample, FILE * targetImage, LONG fileO
     return fileOffset;
 }
 
-static LONG writePixelArray (FILE *targetImage, bmpPtr sample, LONG fileOffset) {
+static unsigned long long writePixelArray (FILE *targetImage, bmpPtr sample, unsigned long long fileOffset) {
     assert (fileOffset == evaluatePixelArrayFileOffset (sample->DIBVersion));
     assert (targetImage != NULL);
     assert (sample != NULL);
     assert (sample->xRes > 0 && sample->yRes > 0);
     verifyDIBVersion (sample->DIBVersion);
+    verifyRowOrder (sample->rowOrder);
     DWORD cOffset = evaluatePixelArrayFileOffset (sample->DIBVersion);
     assert (fileOffset == cOffset);
 
     assert (sample->colorDepth == 24 || sample->colorDepth ==32);
-    DWORD bytesPerRow = sample->xRes * (sample->colorDepth/8);
-    DWORD paddingByteCount = (ceiling (bytesPerRow, 4) * 4) - bytesPerRow;
+    unsigned long long stride = evaluateRowStride (sample->xRes, sample->colorDepth);
 
-    byte *trash = (byte *) malloc (paddingByteCount * sizeof (byte));
-    DWORD i = 0;
-    while (i < paddingByteCount) {
-        trash[i] = 0;
-        i ++;
+    // rows are encoded into a block buffer and written with a single fwrite per block
+    LONG rowsPerBlock = (LONG) (PIXEL_IO_BLOCK_SIZE / stride);
+    if (rowsPerBlock < 1) {
+        rowsPerBlock = 1;
     }
-
-    if (sample->DIBVersion == BITMAPINFOHEADER) {
-        row cRow = sample->yRes -1;
-        while (cRow >= 0) {
-            column cCol = 0;
-            while (cCol < sample->xRes) {
-                unsigned long long pixelIndex = cRow * sample->xRes + cCol;
-                byte blue = (sample->pixelArray + pixelIndex)->blue;
-                putc (blue, targetImage);
-                byte green = (sample->pixelArray + pixelIndex)->green;
-                putc (green, targetImage);
-                byte red = (sample->pixelArray + pixelIndex)->red;
-                putc (red, targetImage);
-                fileOffset += 3;
-                cCol ++;
-            }
-            writeBytes (targetImage, trash, paddingByteCount);
-            fileOffset += paddingByteCount;
-            cRow --;
-        }
-    } else if (sample->DIBVersion == BITMAPV4HEADER) {
-        row cRow = 0;
-        while (cRow < sample->yRes) {
-            column cCol = 0;
-            while (cCol < sample->xRes) {
-                unsigned long long pixelIndex = cRow * sample->xRes + cCol;
-                byte blue = (sample->pixelArray + pixelIndex)->blue;
-                putc (blue, targetImage);
-                byte green = (sample->pixelArray + pixelIndex)->green;
-                putc (green, targetImage);
-                byte red = (sample->pixelArray + pixelIndex)->red;
-                putc (red, targetImage);
-                byte alpha = (sample->pixelArray + pixelIndex)->alpha;
-                putc (alpha, targetImage);
-                fileOffset += 4;
-                cCol ++;
-            }
-            writeBytes (targetImage, trash, paddingByteCount);
-            fileOffset += paddingByteCount;
-            cRow ++;
+    if (rowsPerBlock > sample->yRes) {
+        rowsPerBlock = sample->yRes;
+    }
+    byte *block = (byte *) malloc ((unsigned long long) rowsPerBlock * stride);
+    assert (block != NULL);
+
+    LONG rowsWritten = 0;
+    while (rowsWritten < sample->yRes) {
+        LONG rowCount = sample->yRes - rowsWritten;
+        if (rowCount > rowsPerBlock) {
+            rowCount = rowsPerBlock;
         }
-    } else {
-        assert (DIB_DEFAULTS_NOT_SPECIFIED);
+        encodeFileRows (block, sample, rowsWritten, rowCount);
+        unsigned long long blockSize = (unsigned long long) rowCount * stride;
+        size_t written = fwrite (block, 1, blockSize, targetImage);
+        assert (written == blockSize);
+        fileOffset += blockSize;
+        rowsWritten += rowCount;
     }
     DWORD fileSIzeInBytes = determineFileSizeInBytes (sample);
     assert (fileOffset == fileSIzeInBytes);
-    free (trash);
+    free (block);
     return fileOffset;
 }
 
-static void writeBytes (FILE *targetImage, byte *bytes, LONG byteCount) {
-    assert (targetImage != NULL);
-    assert (bytes != NULL);
-    assert (byteCount >= 0);
-    int i = 0;
-    while (i < byteCount) {
-        putc (bytes[i], targetImage);
-        i ++;
-    }
+// encodes rowCount rows starting at file row firstFileRow (file order, padding included) into target
+static void encodeFileRows (byte *target, bmpPtr sample, LONG firstFileRow, LONG rowCount) {
+    assert (target != NULL);
+    assert (sample != NULL);
+    assert (firstFileRow >= 0 && rowCount >= 0 && firstFileRow + rowCount <= sample->yRes);
+    unsigned long long bytesPerRow = (unsigned long long) sample->xRes * (sample->colorDepth/8);
+    unsigned long long stride = evaluateRowStride (sample->xRes, sample->colorDepth);
+    unsigned long long paddingByteCount = stride - bytesPerRow;
+    rowOrder encodeOrder = evaluateEncodeOrder (sample);
+    if (encodeOrder == TOP_DOWN && paddingByteCount == 0 && hasPackedRows (sample) && !sample->premultiplied) {
+        // file order matches memory order and rows are not padded, encode the block in one go
+        encodePixels (target, rowPixels (sample, firstFileRow), (unsigned long long) rowCount * sample->xRes, sample->colorDepth);
+    } else {
+        // files hold straight alpha, premultiplied rows are divided back in a scratch row first
+        pixelArray straightRow = NULL;
+        unsigned int reciprocals[256];
+        if (sample->premultiplied) {
+            straightRow = (pixelArray) malloc ((unsigned long long) sample->xRes * sizeof (pixel));
+            assert (straightRow != NULL);
+            fillUnpremultiplyReciprocals (reciprocals);
+        }
+        LONG i = 0;
+        while (i < rowCount) {
+            row cRow = firstFileRow + i;
+            if (encodeOrder == BOTTOM_UP) {
+                cRow = sample->yRes - 1 - cRow;
+            }
+            byte *targetRow = target + (unsigned long long) i * stride;
+            pixelArray sourceRow = rowPixels (sample, cRow);
+            if (straightRow != NULL) {
+                memcpy (straightRow, sourceRow, (unsigned long long) sample->xRes * sizeof (pixel));
+                unpremultiplyPixels (straightRow, sample->xRes, reciprocals);
+                sourceRow = straightRow;
+            }
+            encodePixels (targetRow, sourceRow, sample->xRes, sample->colorDepth);
+            memset (targetRow + bytesPerRow, 0, paddingByteCount);
+            i ++;
+        }
+        free (straightRow);
+    }
+    return;
+}
+
+static unsigned long long readPixelArray (FILE *sourceImage, bmpPtr sample, unsigned long long fileOffset) {
+    assert (sourceImage != NULL);
+    assert (sample != NULL);
+    assert (sample->xRes > 0 && sample->yRes > 0);
+    assert (sample->pixelArray != NULL);
+    verifyRowOrder (sample->rowOrder);
+    assert (fileOffset == evaluatePixelArrayFileOffset (sample->DIBVersion));
+
+    assert (sample->colorDepth == 24 || sample->colorDepth == 32);
+    unsigned long long bytesPerRow = (unsigned long long) sample->xRes * (sample->colorDepth/8);
+    unsigned long long stride = evaluateRowStride (sample->xRes, sample->colorDepth);
+    unsigned long long paddingByteCount = stride - bytesPerRow;
+
+    LONG rowsPerBlock = (LONG) (PIXEL_IO_BLOCK_SIZE / stride);
+    if (rowsPerBlock < 1) {
+        rowsPerBlock = 1;
+    }
+    if (rowsPerBlock > sample->yRes) {
+        rowsPerBlock = sample->yRes;
+    }
+    byte *block = (byte *) malloc ((unsigned long long) rowsPerBlock * stride);
+    assert (block != NULL);
+
+    LONG rowsRead = 0;
+    while (rowsRead < sample->yRes) {
+        LONG rowCount = sample->yRes - rowsRead;
+        if (rowCount > rowsPerBlock) {
+            rowCount = rowsPerBlock;
+        }
+        unsigned long long blockSize = (unsigned long long) rowCount * stride;
+        size_t read = fread (block, 1, blockSize, sourceImage);
+        assert (read == blockSize);
+        if (sample->rowOrder == TOP_DOWN && paddingByteCount == 0) {
+            // file order matches memory order and rows are not padded, decode the block in one go
+            unsigned long long pixIndex = (unsigned long long) rowsRead * sample->xRes;
+            decodePixels (sample->pixelArray + pixIndex, block, (unsigned long long) rowCount * sample->xRes, sample->colorDepth);
+        } else {
+            LONG i = 0;
+            while (i < rowCount) {
+                row cRow = rowsRead + i;
+                if (sample->rowOrder == BOTTOM_UP) {
+                    cRow = sample->yRes - 1 - cRow;
+                }
+                unsigned long long pixIndex = (unsigned long long) cRow * sample->xRes;
+                decodePixels (sample->pixelArray + pixIndex, block + (unsigned long long) i * stride, sample->xRes, sample->colorDepth);
+                i ++;
+            }
+        }
+        fileOffset += blockSize;
+        rowsRead += rowCount;
+    }
+    free (block);
+    return fileOffset;
+}
+
+static void decodePixels (pixelArray target, byte *source, unsigned long long pixelCount, WORD colorDepth) {
+    assert (target != NULL && source != NULL);
+    verifyColorDepth (colorDepth);
+    unsigned long long i = 0;
+    if (colorDepth == BPP_32) {
+        while (i < pixelCount) {
+            target[i].blue = source[4*i];
+            target[i].green = source[4*i + 1];
+            target[i].red = source[4*i + 2];
+            target[i].alpha = source[4*i + 3];
+            i ++;
+        }
+    } else if (colorDepth == BPP_24) {
+        while (i < pixelCount) {
+            target[i].blue = source[3*i];
+            target[i].green = source[3*i + 1];
+            target[i].red = source[3*i + 2];
+            target[i].alpha = 0;
+            i ++;
+        }
+    }
+    return;
+}
+
+static void encodePixels (byte *target, pixelArray source, unsigned long long pixelCount, WORD colorDepth) {
+    assert (target != NULL && source != NULL);
+    verifyColorDepth (colorDepth);
+    unsigned long long i = 0;
+    if (colorDepth == BPP_32) {
+        while (i < pixelCount) {
+            target[4*i] = source[i].blue;
+            target[4*i + 1] = source[i].green;
+            target[4*i + 2] = source[i].red;
+            target[4*i + 3] = source[i].alpha;
+            i ++;
+        }
+    } else if (colorDepth == BPP_24) {
+        while (i < pixelCount) {
+            target[3*i] = source[i].blue;
+            target[3*i + 1] = source[i].green;
+            target[3*i + 2] = source[i].red;
+            i ++;
+        }
+    }
+    return;
+}
+
+static void writeBytes (FILE *targetImage, byte *bytes, LONG byteCount) {
+    assert (targetImage != NULL);
+    assert (bytes != NULL);
+    assert (byteCount >= 0);
+    int i = 0;
+    while (i < byteCount) {
+        putc (bytes[i], targetImage);
+        i ++;
+    }
     return;
 }
 
@@ -668,7 +1820,7 @@ static void testWriteBmpFileHeader () {
     printf ("\t\t\t\t>Testing writeBmpFileHeader()\n");
     bmpPtr sample = createBmp (BITMAPINFOHEADER);
     initializeBmpDFLT (sample, RGB_24);
-    LONG fileOffset = 0;
+    unsigned long long fileOffset = 0;
     FILE *temp = fopen ("./temp0.bmp","wb");
     fileOffset = writeBmpFileHeader (temp, sample, fileOffset);
     assert (fileOffset == 14);
@@ -707,7 +1859,7 @@ static void testWriteDIBHeader () {
     printf ("\t\t\t\t>Testing writeDIBHeader () for BITMAPINFOHEADER\n");
     bmpPtr sample = createBmp (BITMAPINFOHEADER);
     initializeBmpDFLT (sample, RGB_24);
-    LONG fileOffset = 14;
+    unsigned long long fileOffset = 14;
     FILE *temp = fopen ("./temp1.bmp", "wb");
     fileOffset = writeDIBHeader (temp, sample, fileOffset);
     fclose (temp);
@@ -895,7 +2047,7 @@ static void testWritePixelArray () {
 
     bmpPtr sample = createBmp (BITMAPINFOHEADER);
     initializeBmpDFLT (sample, RGB_24);
-    LONG fileOffset = 54;
+    unsigned long long fileOffset = 54;
     FILE *temp = fopen ("./temp2.bmp", "wb");
     fileOffset = writePixelArray (temp, sample, fileOffset);
     assert (fileOffset == determineFileSizeInBytes (sample));
@@ -953,7 +2105,7 @@ static void testWritePixelArray () {
     sample = createBmp (BITMAPV4HEADER);
     initializeBmpDFLT (sample, ARGB_32);
     
-    LONG fileIndex = 122;
+    unsigned long long fileIndex = 122;
     FILE *iFile = fopen ("./iFile.bmp", "wb");
     initializeBmpDFLT (sample, ARGB_32);
     fileIndex = writePixelArray (iFile, sample, fileIndex);
@@ -961,6 +2113,7 @@ static void testWritePixelArray () {
     fclose (iFile);
 
     iFile = fopen ("./iFile.bmp", "rb");
+    // rows are stored bottom-up, so memory row 1 comes first
     byte value = fgetc (iFile);
     assert (value == 255);
     value = fgetc (iFile);
@@ -968,7 +2121,7 @@ static void testWritePixelArray () {
     value = fgetc (iFile);
     assert (value == 0);
     value = fgetc (iFile);
-    assert (value == 127);
+    assert (value == 255);
 
     value = fgetc (iFile);
     assert (value == 0);
@@ -977,7 +2130,7 @@ static void testWritePixelArray () {
     value = fgetc (iFile);
     assert (value == 0);
     value = fgetc (iFile);
-    assert (value == 127);
+    assert (value == 255);
 
     value = fgetc (iFile);
     assert (value == 0);
@@ -986,7 +2139,7 @@ static void testWritePixelArray () {
     value = fgetc (iFile);
     assert (value == 255);
     value = fgetc (iFile);
-    assert (value == 127);
+    assert (value == 255);
 
     value = fgetc (iFile);
     assert (value == 255);
@@ -995,9 +2148,9 @@ static void testWritePixelArray () {
     value = fgetc (iFile);
     assert (value == 255);
     value = fgetc (iFile);
-    assert (value == 127);
+    assert (value == 255);
 
-    // row 2
+    // row 0
     value = fgetc (iFile);
     assert (value == 255);
     value = fgetc (iFile);
@@ -1005,7 +2158,7 @@ static void testWritePixelArray () {
     value = fgetc (iFile);
     assert (value == 0);
     value = fgetc (iFile);
-    assert (value == 255);
+    assert (value == 127);
 
     value = fgetc (iFile);
     assert (value == 0);
@@ -1014,7 +2167,7 @@ static void testWritePixelArray () {
     value = fgetc (iFile);
     assert (value == 0);
     value = fgetc (iFile);
-    assert (value == 255);
+    assert (value == 127);
 
     value = fgetc (iFile);
     assert (value == 0);
@@ -1023,7 +2176,7 @@ static void testWritePixelArray () {
     value = fgetc (iFile);
     assert (value == 255);
     value = fgetc (iFile);
-    assert (value == 255);
+    assert (value == 127);
 
     value = fgetc (iFile);
     assert (value == 255);
@@ -1032,7 +2185,7 @@ static void testWritePixelArray () {
     value = fgetc (iFile);
     assert (value == 255);
     value = fgetc (iFile);
-    assert (value == 255);
+    assert (value == 127);
     
     fclose (iFile);
     retCode = remove ("./iFile.bmp");
@@ -1071,25 +2224,53 @@ bmpPtr createBmp (DIBHeaderVersion version) {
     sample->printResY = UNINTIALIZED;
     sample->xRes = UNINTIALIZED;
     sample->yRes = UNINTIALIZED;
+    sample->rowOrder = BOTTOM_UP;
+    sample->flipOnSave = 0;
+    sample->premultiplied = 0;
+    sample->dirtyRows = NULL;
+    sample->dirtyRowCount = 0;
+    sample->headerDirty = 1;
+    sample->pixelsUnsynced = 1;
+    sample->syncedPath = NULL;
+    sample->readOnly = 0;
+    sample->lazyMap = NULL;
+    sample->lazyLock = NULL;
+    sample->lazyMapSize = 0;
+    sample->lazyBlockRows = 0;
+    sample->lazyBlockCount = 0;
+    sample->residentBlockCount = 0;
+    sample->residentBlocks = NULL;
+    sample->viewOwner = NULL;
+    sample->rowStride = 0;
+    sample->viewFirstRow = 0;
+    sample->viewChangedRows = NULL;
+    sample->viewCount = 0;
     return sample;
 }
 
 void setUpPixelArray (bmpPtr sample) {
     assert (sample != NULL);
     assert (sample->xRes > 0 && sample->yRes >0);
+    // the pixels of a view belong to its owner, views of this bitmap would be left dangling
+    assert (sample->viewOwner == NULL && sample->viewCount == 0);
+    releaseLazyMapping (sample);
     free (sample->pixelArray);
-    unsigned long long netRes = sample->xRes * sample->yRes;
+    unsigned long long netRes = (unsigned long long) sample->xRes * sample->yRes;
     sample->pixelArray = (pixelArray) malloc (netRes * sizeof (pixel));
+    assert (sample->pixelArray != NULL);
+    markAllPixelsDirty (sample);
     return;
 }
 
 channelPtr createChannel (LONG xRes, LONG yRes) {
+    assert (xRes > 0 && yRes > 0);
     channelPtr targetChannel;
     targetChannel = (channelPtr) malloc (sizeof (channel));
     targetChannel->xRes = xRes;
     targetChannel->yRes = yRes;
-    targetChannel->resolution = xRes * yRes;
+    targetChannel->resolution = (unsigned long long) xRes * yRes;
     targetChannel->channelArray = (channelArray) malloc (targetChannel->resolution * sizeof (byte));
+    assert (targetChannel->channelArray != NULL);
     return targetChannel;
 }
 
@@ -1149,7 +2330,20 @@ void initializeBmpDFLT (bmpPtr bitmap, pixelFormat pixelFormat) {
 }
 
 void destroyBmp (bmpPtr sample) {
+    if (sample->viewOwner != NULL) {
+        destroyBmpView (sample);
+        return;
+    }
+    // every view must be destroyed before its owner
+    assert (sample->viewCount == 0);
+    releaseLazyMapping (sample);
+    if (sample->lazyLock != NULL) {
+        pthread_mutex_destroy (sample->lazyLock);
+        free (sample->lazyLock);
+    }
     free (sample->pixelArray);
+    free (sample->dirtyRows);
+    free (sample->syncedPath);
     free (sample);
     return;
 }
@@ -1178,15 +2372,18 @@ DWORD getDIBHeaderSize (bmpPtr sample) {
 
 void setDIBHeaderVersion (bmpPtr sample, DIBHeaderVersion version) {
     assert (sample != NULL);
+    ensureAllRowsResident (sample);
     verifyDIBVersion (version);
     DWORD dibSize = determineDIBSize (version);
     sample->DIBVersion = version;
     sample->DIBHeaderSize = dibSize;
+    markHeaderDirty (sample);
     return;
 }
 
 void setPixelFormat (bmpPtr sample, pixelFormat pixelFormat) {
     assert (sample != NULL);
+    ensureAllRowsResident (sample);
     verifyPixelFormat (pixelFormat);
     sample->pixelFormat = pixelFormat;
     if (pixelFormat == ARGB_32) {
@@ -1196,6 +2393,7 @@ void setPixelFormat (bmpPtr sample, pixelFormat pixelFormat) {
     } else {
         assert (PIXEL_FORMAT_DEFAULTS_NOT_SPECIFIED);
     }
+    markHeaderDirty (sample);
     return;
 }
 
@@ -1215,8 +2413,11 @@ LONG getXRes (bmpPtr sample) {
 
 void setXRes (bmpPtr sample, LONG xRes) {
     assert (sample != NULL);
+    assert (sample->viewOwner == NULL);
+    ensureAllRowsResident (sample);
     assert (xRes > 0);
     sample->xRes = xRes;
+    markHeaderDirty (sample);
     return;
 }
 
@@ -1229,8 +2430,44 @@ LONG getYRes (bmpPtr sample) {
 
 void setYRes (bmpPtr sample, LONG yRes) {
     assert (sample != NULL);
+    assert (sample->viewOwner == NULL);
+    ensureAllRowsResident (sample);
     assert (yRes > 0);
     sample->yRes = yRes;
+    markHeaderDirty (sample);
+    return;
+}
+
+rowOrder getRowOrder (bmpPtr sample) {
+    assert (sample != NULL);
+    verifyRowOrder (sample->rowOrder);
+    rowOrder order = sample->rowOrder;
+    return order;
+}
+
+void setRowOrder (bmpPtr sample, rowOrder order) {
+    assert (sample != NULL);
+    ensureAllRowsResident (sample);
+    verifyRowOrder (order);
+    sample->rowOrder = order;
+    markHeaderDirty (sample);
+    return;
+}
+
+int getFlipOnSave (bmpPtr sample) {
+    assert (sample != NULL);
+    return sample->flipOnSave;
+}
+
+void setFlipOnSave (bmpPtr sample, int flip) {
+    assert (sample != NULL);
+    assert (flip == 0 || flip == 1);
+    if (flip != sample->flipOnSave) {
+        ensureAllRowsResident (sample);
+        sample->flipOnSave = flip;
+        // every row moves in the file
+        markAllPixelsDirty (sample);
+    }
     return;
 }
 
@@ -1246,6 +2483,7 @@ void setColorPlaneCount (bmpPtr sample, WORD colorPlanceCount) {
     assert (sample != NULL);
     assert (colorPlanceCount == 1);
     sample->colorPlaneCount = colorPlanceCount;
+    markHeaderDirty (sample);
     return;
 }
 
@@ -1257,6 +2495,7 @@ WORD getColorDepth (bmpPtr sample) {
 }
 void setColorDepth (bmpPtr sample, WORD colorDepth) {
     assert (sample != NULL);
+    ensureAllRowsResident (sample);
     verifyColorDepth (colorDepth);
     sample->colorDepth = colorDepth;
     if (colorDepth == BPP_24) {
@@ -1267,6 +2506,7 @@ void setColorDepth (bmpPtr sample, WORD colorDepth) {
         // its a trap
         assert (PIXEL_FORMAT_DEFAULTS_NOT_SPECIFIED);
     }
+    markHeaderDirty (sample);
     return;
 }
 
@@ -1280,6 +2520,7 @@ void setCompression (bmpPtr sample, DWORD compression) {
     assert (sample != NULL);
     verifyCompression (compression, sample->DIBVersion);
     sample->compression = compression;
+    markHeaderDirty (sample);
     return;
 }
 
@@ -1295,6 +2536,7 @@ void setImageSize (bmpPtr sample, DWORD imageSize) {
     assert (sample != NULL);
     assert (imageSize > 0);
     sample->imageSizeBytes = imageSize;
+    markHeaderDirty (sample);
     return;
 }
 
@@ -1308,6 +2550,7 @@ void  setPrintResX (bmpPtr sample, LONG xPrintRes) {
     assert (sample != NULL);
     assert (xPrintRes > 0);
     sample->printResX = xPrintRes;
+    markHeaderDirty (sample);
     return;
 }
 
@@ -1321,6 +2564,7 @@ void  setPrintResY (bmpPtr sample, LONG yPrintRes) {
     assert (sample != NULL);
     assert (yPrintRes > 0);
     sample->printResY = yPrintRes;
+    markHeaderDirty (sample);
     return;
 }
 
@@ -1335,6 +2579,7 @@ void setPaletteColorCount (bmpPtr sample, DWORD paletteColorCount) {
     assert (sample != NULL);
     assert (paletteColorCount >= 0);
     sample->paletteColorCOunt = paletteColorCount;
+    markHeaderDirty (sample);
     return;
 }
 
@@ -1348,6 +2593,7 @@ void setImpColorCount (bmpPtr sample, DWORD impColorCount) {
     assert (sample != NULL);
     assert (impColorCount >= 0);
     sample->impColorCOunt = impColorCount;
+    markHeaderDirty (sample);
     return;
 }
 
@@ -1362,6 +2608,7 @@ void setColorSpace (bmpPtr sample, colorSpace colorSpace) {
     assert (sample->DIBVersion == BITMAPV4HEADER);
     verifyColorSpace (colorSpace);
     sample->colorSpace = colorSpace;
+    markHeaderDirty (sample);
     return;
 }
 
@@ -1372,16 +2619,25 @@ channelPtr getRedChannel (bmpPtr sample) {
     assert (sample != NULL);
     assert (sample->xRes > 0 && sample-> yRes > 0);
     assert (sample->pixelArray != NULL);
+    ensureAllRowsResident (sample);
     channelPtr red;
     red = (channelPtr) malloc (sizeof (channel));
     red->xRes = sample->xRes;
     red->yRes = sample->yRes;
-    red->resolution = sample->xRes * sample->yRes;
+    red->resolution = (unsigned long long) sample->xRes * sample->yRes;
     red->channelArray = (channelArray) malloc (red->resolution * sizeof (byte));
-    int i = 0;
-    while (i < red->resolution) {
-        red->channelArray[i] = (sample->pixelArray+i)->red;
-        i ++;
+    assert (red->channelArray != NULL);
+    unsigned long long i = 0;
+    row cRow = 0;
+    while (cRow < sample->yRes) {
+        pixelArray source = rowPixels (sample, cRow);
+        column cColumn = 0;
+        while (cColumn < sample->xRes) {
+            red->channelArray[i] = source[cColumn].red;
+            i ++;
+            cColumn ++;
+        }
+        cRow ++;
     }
     return red;
 }
@@ -1390,16 +2646,25 @@ channelPtr getGreenChannel (bmpPtr sample) {
     assert (sample != NULL);
     assert (sample->xRes > 0 && sample-> yRes > 0);
     assert (sample->pixelArray != NULL);
+    ensureAllRowsResident (sample);
     channelPtr green;
     green = (channelPtr) malloc (sizeof (channel));
     green->xRes = sample->xRes;
     green->yRes = sample->yRes;
-    green->resolution = sample->xRes * sample->yRes;
+    green->resolution = (unsigned long long) sample->xRes * sample->yRes;
     green->channelArray = (channelArray) malloc (green->resolution * sizeof (byte));
-    int i = 0;
-    while (i < green->resolution) {
-        green->channelArray[i] = (sample->pixelArray+i)->green;
-        i ++;
+    assert (green->channelArray != NULL);
+    unsigned long long i = 0;
+    row cRow = 0;
+    while (cRow < sample->yRes) {
+        pixelArray source = rowPixels (sample, cRow);
+        column cColumn = 0;
+        while (cColumn < sample->xRes) {
+            green->channelArray[i] = source[cColumn].green;
+            i ++;
+            cColumn ++;
+        }
+        cRow ++;
     }
     return green;
 }
@@ -1408,16 +2673,25 @@ channelPtr getBlueChannel (bmpPtr sample) {
     assert (sample != NULL);
     assert (sample->xRes > 0 && sample-> yRes > 0);
     assert (sample->pixelArray != NULL);
+    ensureAllRowsResident (sample);
     channelPtr blue;
     blue = (channelPtr) malloc (sizeof (channel));
     blue->xRes = sample->xRes;
     blue->yRes = sample->yRes;
-    blue->resolution = sample->xRes * sample->yRes;
+    blue->resolution = (unsigned long long) sample->xRes * sample->yRes;
     blue->channelArray = (channelArray) malloc (blue->resolution * sizeof (byte));
-    int i = 0;
-    while (i < blue->resolution) {
-        blue->channelArray[i] = (sample->pixelArray+i)->blue;
-        i ++;
+    assert (blue->channelArray != NULL);
+    unsigned long long i = 0;
+    row cRow = 0;
+    while (cRow < sample->yRes) {
+        pixelArray source = rowPixels (sample, cRow);
+        column cColumn = 0;
+        while (cColumn < sample->xRes) {
+            blue->channelArray[i] = source[cColumn].blue;
+            i ++;
+            cColumn ++;
+        }
+        cRow ++;
     }
     return blue;
 }
@@ -1429,20 +2703,123 @@ channelPtr getAlphaChannel (bmpPtr sample) {
     assert (sample->xRes > 0 && sample-> yRes > 0);
     assert (sample->pixelArray != NULL);
     assert (sample->pixelFormat == ARGB_32);
+    ensureAllRowsResident (sample);
     channelPtr alpha;
     alpha = (channelPtr) malloc (sizeof (channel));
     alpha->xRes = sample->xRes;
     alpha->yRes = sample->yRes;
-    alpha->resolution = sample->xRes * sample->yRes;
+    alpha->resolution = (unsigned long long) sample->xRes * sample->yRes;
     alpha->channelArray = (channelArray) malloc (alpha->resolution * sizeof (byte));
-    int i = 0;
-    while (i < alpha->resolution) {
-        alpha->channelArray[i] = (sample->pixelArray+i)->alpha;
-        i ++;
+    assert (alpha->channelArray != NULL);
+    unsigned long long i = 0;
+    row cRow = 0;
+    while (cRow < sample->yRes) {
+        pixelArray source = rowPixels (sample, cRow);
+        column cColumn = 0;
+        while (cColumn < sample->xRes) {
+            alpha->channelArray[i] = source[cColumn].alpha;
+            i ++;
+            cColumn ++;
+        }
+        cRow ++;
     }
     return alpha;
 }
 
+channelPtr getChannelRows (bmpPtr sample, channelType channelType, LONG firstRow, LONG rowCount) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (channelType == RED || channelType == GREEN || channelType == BLUE || channelType == ALPHA);
+    if (channelType == ALPHA) {
+        assert (sample->pixelFormat == ARGB_32);
+    }
+    assert (firstRow >= 0 && rowCount > 0 && firstRow + rowCount <= sample->yRes);
+    ensureRowsResident (sample, firstRow, rowCount);
+    channelPtr target = createChannel (sample->xRes, rowCount);
+    LONG i = 0;
+    while (i < rowCount) {
+        pixelArray source = rowPixels (sample, firstRow + i);
+        channelArray targetRow = target->channelArray + (unsigned long long) i * sample->xRes;
+        column cColumn = 0;
+        while (cColumn < sample->xRes) {
+            if (channelType == RED) {
+                targetRow[cColumn] = source[cColumn].red;
+            } else if (channelType == GREEN) {
+                targetRow[cColumn] = source[cColumn].green;
+            } else if (channelType == BLUE) {
+                targetRow[cColumn] = source[cColumn].blue;
+            } else {
+                targetRow[cColumn] = source[cColumn].alpha;
+            }
+            cColumn ++;
+        }
+        i ++;
+    }
+    return target;
+}
+
+channelPtr getLumaThumbnail (bmpPtr sample, LONG xRes, LONG yRes) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (xRes > 0 && yRes > 0);
+    channelPtr target = createChannel (xRes, yRes);
+    // box of source columns averaged into every target column, at least one column wide
+    LONG *firstColumns = (LONG *) malloc ((xRes + 1) * sizeof (LONG));
+    unsigned long long *sums = (unsigned long long *) malloc (xRes * sizeof (unsigned long long));
+    assert (firstColumns != NULL && sums != NULL);
+    LONG tColumn = 0;
+    while (tColumn <= xRes) {
+        firstColumns[tColumn] = (LONG) ((unsigned long long) tColumn * sample->xRes / xRes);
+        tColumn ++;
+    }
+    row tRow = 0;
+    while (tRow < yRes) {
+        row firstRow = (row) ((unsigned long long) tRow * sample->yRes / yRes);
+        row lastRow = (row) ((unsigned long long) (tRow + 1) * sample->yRes / yRes);
+        if (lastRow <= firstRow) {
+            lastRow = firstRow + 1;
+        }
+        memset (sums, 0, xRes * sizeof (unsigned long long));
+        // a lazy bitmap is decoded band by band as the thumbnail reaches it
+        ensureRowsResident (sample, firstRow, lastRow - firstRow);
+        row cRow = firstRow;
+        while (cRow < lastRow) {
+            pixelArray source = rowPixels (sample, cRow);
+            tColumn = 0;
+            while (tColumn < xRes) {
+                column lastColumn = firstColumns[tColumn + 1];
+                if (lastColumn <= firstColumns[tColumn]) {
+                    lastColumn = firstColumns[tColumn] + 1;
+                }
+                unsigned long long sum = 0;
+                column cColumn = firstColumns[tColumn];
+                while (cColumn < lastColumn) {
+                    // BT.601 luma in 8 bit fixed point
+                    sum += 77 * source[cColumn].red + 150 * source[cColumn].green + 29 * source[cColumn].blue;
+                    cColumn ++;
+                }
+                sums[tColumn] += sum;
+                tColumn ++;
+            }
+            cRow ++;
+        }
+        tColumn = 0;
+        while (tColumn < xRes) {
+            LONG columnCount = firstColumns[tColumn + 1] - firstColumns[tColumn];
+            if (columnCount < 1) {
+                columnCount = 1;
+            }
+            unsigned long long count = (unsigned long long) columnCount * (lastRow - firstRow) * 256;
+            target->channelArray[(unsigned long long) tRow * xRes + tColumn] = (byte) ((sums[tColumn] + count / 2) / count);
+            tColumn ++;
+        }
+        tRow ++;
+    }
+    free (firstColumns);
+    free (sums);
+    return target;
+}
+
 // to access dimensions of channel
 LONG getChXRes (channelPtr channel) {
     assert (channel != NULL);
@@ -1463,7 +2840,7 @@ byte getPixel (LONG row, LONG column, channelPtr channel) {
     assert (channel != NULL);
     assert (row >= 0 && column >= 0);
     assert (row < channel->yRes && column < channel->xRes);
-    unsigned long long i = channel->xRes * row + column;
+    unsigned long long i = (unsigned long long) channel->xRes * row + column;
     byte pixVal = channel->channelArray[i];
     return pixVal;
 }
@@ -1473,7 +2850,7 @@ void setPixel (LONG row, LONG column, channelPtr channel, byte pixVal) {
     assert (row >= 0 && column >= 0);
     assert (row < channel->yRes && column < channel->xRes);
     assert (pixVal >= 0 && pixVal < 256);
-    int i = channel->xRes * row + column;
+    unsigned long long i = (unsigned long long) channel->xRes * row + column;
     channel->channelArray[i] = pixVal;
     return;
 }
@@ -1485,162 +2862,4132 @@ void setChannel (channelType channelType, bmpPtr sample, channelPtr srcChannel)
         assert (sample->pixelFormat == ARGB_32 && sample->colorDepth == 32);
     }
     assert (srcChannel->xRes == sample->xRes && sample->yRes == srcChannel->yRes);
+    // the other channels of every pixel are kept, so every row has to be decoded first
+    ensureAllRowsResident (sample);
+    // merged row by row so that only the rows that actually change are marked dirty
+    row cRow = 0;
+    while (cRow < sample->yRes) {
+        unsigned long long pixIndex = (unsigned long long) cRow * sample->xRes;
+        int changed = mergeChannelRow (rowPixels (sample, cRow), srcChannel->channelArray + pixIndex, sample->xRes, channelType);
+        if (changed && !sample->pixelsUnsynced) {
+            markRowDirty (sample, cRow);
+        }
+        if (changed && sample->viewOwner != NULL) {
+            sample->viewChangedRows[cRow] = 1;
+        }
+        cRow ++;
+    }
+    return;
+}
+
+// copies one row of a channel into the pixels, returns whether any pixel changed
+static int mergeChannelRow (pixelArray target, channelArray source, LONG pixelCount, channelType channelType) {
+    int changed = 0;
+    LONG i = 0;
     if (channelType == RED) {
-        int i = 0;
-        while (i < srcChannel->resolution) {
-            ((sample->pixelArray)+i)->red = srcChannel->channelArray[i];
+        while (i < pixelCount) {
+            changed |= target[i].red ^ source[i];
+            target[i].red = source[i];
             i ++;
         }
-    } else if (channelType == BLUE) {
-        int i = 0;
-        while (i < srcChannel->resolution) {
-            ((sample->pixelArray)+i)->blue = srcChannel->channelArray[i];
+    } else if (channelType == GREEN) {
+        while (i < pixelCount) {
+            changed |= target[i].green ^ source[i];
+            target[i].green = source[i];
             i ++;
         }
-    } else if (channelType == GREEN) {
-        int i = 0;
-        while (i < srcChannel->resolution) {
-            ((sample->pixelArray)+i)->green = srcChannel->channelArray[i];
+    } else if (channelType == BLUE) {
+        while (i < pixelCount) {
+            changed |= target[i].blue ^ source[i];
+            target[i].blue = source[i];
             i ++;
         }
     } else if (channelType == ALPHA) {
-        int i = 0;
-        while (i < srcChannel->resolution) {
-            ((sample->pixelArray)+i)->alpha = srcChannel->channelArray[i];
+        while (i < pixelCount) {
+            changed |= target[i].alpha ^ source[i];
+            target[i].alpha = source[i];
             i ++;
         }
     }
-    return;
+    return changed != 0;
 }
 
-static DWORD ceiling (DWORD a, DWORD b) {
-    assert (b != 0);
-    DWORD answer;
-    if (a % b != 0) {
-        answer = (DWORD) (a/b) + 1;
+bmpPtr convertBmp (bmpPtr src, DIBHeaderVersion targetVersion, pixelFormat targetFormat, byte alphaFill) {
+    assert (src != NULL);
+    assert (src->xRes > 0 && src->yRes > 0);
+    assert (src->pixelArray != NULL);
+    verifyFormatForDIBVersion (targetVersion, targetFormat);
+    ensureAllRowsResident (src);
+
+    bmpPtr target = createBmpLike (src, targetVersion, targetFormat, src->xRes, src->yRes);
+    target->premultiplied = 0;
+    if (src->premultiplied) {
+        // the copy is straight alpha, colors are divided back before alpha is replaced
+        unsigned int reciprocals[256];
+        fillUnpremultiplyReciprocals (reciprocals);
+        row cRow = 0;
+        while (cRow < src->yRes) {
+            pixelArray targetRow = rowPixels (target, cRow);
+            memcpy (targetRow, rowPixels (src, cRow), (unsigned long long) src->xRes * sizeof (pixel));
+            unpremultiplyPixels (targetRow, src->xRes, reciprocals);
+            convertPixels (targetRow, targetRow, src->xRes, targetFormat, alphaFill);
+            cRow ++;
+        }
+    } else if (hasPackedRows (src)) {
+        unsigned long long netRes = (unsigned long long) src->xRes * src->yRes;
+        convertPixels (target->pixelArray, src->pixelArray, netRes, targetFormat, alphaFill);
     } else {
-        answer = a/b;
+        row cRow = 0;
+        while (cRow < src->yRes) {
+            convertPixels (rowPixels (target, cRow), rowPixels (src, cRow), src->xRes, targetFormat, alphaFill);
+            cRow ++;
+        }
     }
-    return answer;
+    return target;
 }
 
-static void toLittleEndianBytes (DWORD number, byte *bytes, LONG byteCount) {
-    assert (bytes != NULL);
-    assert (byteCount > 0);
-    int i = 0;
-    while (i < byteCount) {
-        bytes[i] = (number >> (8*i)) & 255;
-        i ++;
+void convertBmpInPlace (bmpPtr sample, DIBHeaderVersion targetVersion, pixelFormat targetFormat, byte alphaFill) {
+    assert (sample != NULL);
+    // a view has the layout of its owner
+    assert (sample->viewOwner == NULL);
+    assert (sample->xRes > 0 && sample->yRes > 0);
+    assert (sample->pixelArray != NULL);
+    verifyFormatForDIBVersion (targetVersion, targetFormat);
+    ensureAllRowsResident (sample);
+
+    // every pixel format is held as a 4 byte pixel in memory, so only alpha has to be touched
+    setDIBHeaderVersion (sample, targetVersion);
+    setConversionDefaults (sample, targetVersion, targetFormat);
+    unsigned long long netRes = (unsigned long long) sample->xRes * sample->yRes;
+    if (sample->premultiplied) {
+        unsigned int reciprocals[256];
+        fillUnpremultiplyReciprocals (reciprocals);
+        unpremultiplyPixels (sample->pixelArray, netRes, reciprocals);
+        sample->premultiplied = 0;
     }
+    convertPixels (sample->pixelArray, sample->pixelArray, netRes, targetFormat, alphaFill);
+    markAllPixelsDirty (sample);
     return;
 }
 
-static void colorSpaceToLittleEndianBytes (colorSpace colorSpace, byte *bytes) {
-    verifyColorSpace (colorSpace);
-    if (colorSpace == LCS_WINDOWS_COLOR_SPACE) {
-        bytes [0] = ' ';
-        bytes [1] = 'n';
-        bytes [2] = 'i';
-        bytes [3] = 'W';
-    } else {
-        assert (COLOR_SPACE_DEFAULTS_NOT_SPECIFIED);
+void premultiplyBmp (bmpPtr sample) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (sample->pixelFormat == ARGB_32);
+    // views share the pixels and the alpha storage of their owner
+    assert (sample->viewOwner == NULL && sample->viewCount == 0);
+    if (sample->premultiplied) {
+        return;
     }
+    // lazily decoded rows would come in straight
+    ensureAllRowsResident (sample);
+    unsigned long long netRes = (unsigned long long) sample->xRes * sample->yRes;
+    premultiplyPixels (sample->pixelArray, sample->pixelArray, netRes);
+    // the file keeps straight alpha, so no row becomes dirty
+    sample->premultiplied = 1;
     return;
 }
 
-static DWORD toDWORD (byte *bytes, LONG byteCount) {
-    assert (bytes != NULL);
-    assert (byteCount > 0);
-
-    DWORD number = 0;
-    int i = 0;
-    while (i < byteCount) {
-        number += bytes[i] << (8 * i);
-        i ++;
+void unpremultiplyBmp (bmpPtr sample) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (sample->viewOwner == NULL && sample->viewCount == 0);
+    if (!sample->premultiplied) {
+        return;
     }
-    return number;
+    unsigned int reciprocals[256];
+    fillUnpremultiplyReciprocals (reciprocals);
+    unpremultiplyPixels (sample->pixelArray, (unsigned long long) sample->xRes * sample->yRes, reciprocals);
+    sample->premultiplied = 0;
+    return;
 }
 
-static void verifyDIBVersion (DIBHeaderVersion version) {
-    assert (version == BITMAPINFOHEADER || version == BITMAPV4HEADER);
-    return;
+int isPremultiplied (bmpPtr sample) {
+    assert (sample != NULL);
+    return sample->premultiplied;
 }
 
-static void verifyColorSpace (colorSpace colorSpace) {
-    assert (colorSpace == LCS_WINDOWS_COLOR_SPACE);
-    return;
+bmpPtr createBmpView (bmpPtr parent, LONG firstRow, LONG firstColumn, LONG xRes, LONG yRes) {
+    assert (parent != NULL);
+    assert (parent->pixelArray != NULL);
+    assert (xRes > 0 && yRes > 0);
+    assert (firstRow >= 0 && firstColumn >= 0);
+    assert (firstRow + yRes <= parent->yRes && firstColumn + xRes <= parent->xRes);
+    // only the rows covered by the view are decoded
+    ensureRowsResident (parent, firstRow, yRes);
+    bmpPtr view = (bmpPtr) malloc (sizeof (bmp));
+    assert (view != NULL);
+    *view = *parent;
+    view->xRes = xRes;
+    view->yRes = yRes;
+    view->imageSizeBytes = evaluateRawImageSizeInBytes (view);
+    view->pixelArray = rowPixels (parent, firstRow) + firstColumn;
+    // a view of a view refers directly to the bitmap owning the pixels
+    if (parent->viewOwner != NULL) {
+        view->viewOwner = parent->viewOwner;
+        view->rowStride = parent->rowStride;
+        view->viewFirstRow = parent->viewFirstRow + firstRow;
+    } else {
+        view->viewOwner = parent;
+        view->rowStride = parent->xRes;
+        view->viewFirstRow = firstRow;
+    }
+    view->viewChangedRows = (byte *) calloc (yRes, sizeof (byte));
+    assert (view->viewChangedRows != NULL);
+    view->viewCount = 0;
+    view->viewOwner->viewCount ++;
+    view->flipOnSave = 0;
+    view->dirtyRows = NULL;
+    view->dirtyRowCount = 0;
+    view->headerDirty = 1;
+    view->pixelsUnsynced = 1;
+    view->syncedPath = NULL;
+    // writes through a view land in the pixels of its owner
+    view->readOnly = view->viewOwner->readOnly;
+    view->lazyMap = NULL;
+    view->lazyLock = NULL;
+    view->lazyMapSize = 0;
+    view->lazyBlockRows = 0;
+    view->lazyBlockCount = 0;
+    view->residentBlockCount = 0;
+    view->residentBlocks = NULL;
+    return view;
 }
 
-static void verifyPixelFormat (pixelFormat pixelFormat) {
-    assert (pixelFormat == RGB_24 || pixelFormat == ARGB_32);
-    return;
+int isBmpView (bmpPtr sample) {
+    assert (sample != NULL);
+    return sample->viewOwner != NULL;
 }
 
-static void verifyColorDepth (WORD colorDepth) {
-    assert (colorDepth == BPP_24 || colorDepth == BPP_32);
-    return;
+bmpPtr materializeBmp (bmpPtr sample) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    ensureAllRowsResident (sample);
+    bmpPtr target = createBmpLike (sample, sample->DIBVersion, sample->pixelFormat, sample->xRes, sample->yRes);
+    target->colorSpace = sample->colorSpace;
+    target->paletteColorCOunt = sample->paletteColorCOunt;
+    target->impColorCOunt = sample->impColorCOunt;
+    unsigned long long rowBytes = (unsigned long long) sample->xRes * sizeof (pixel);
+    row cRow = 0;
+    while (cRow < sample->yRes) {
+        memcpy (rowPixels (target, cRow), rowPixels (sample, cRow), rowBytes);
+        cRow ++;
+    }
+    return target;
 }
 
-static void verifyCompression (DWORD compression, DIBHeaderVersion version) {
-    verifyDIBVersion (version);
-    assert (compression == BI_RGB || compression == BI_BITFIELDS);
-    if (version == BITMAPINFOHEADER) {
-        assert (compression == BI_RGB);
-    } else if (version == BITMAPV4HEADER) {
-        assert (compression == BI_BITFIELDS);
-    } else {
-        assert (DIB_DEFAULTS_NOT_SPECIFIED);
+// hands the rows written through the view over to the dirty rows of its owner
+static void destroyBmpView (bmpPtr view) {
+    bmpPtr owner = view->viewOwner;
+    if (!owner->pixelsUnsynced) {
+        row cRow = 0;
+        while (cRow < view->yRes) {
+            if (view->viewChangedRows[cRow]) {
+                markRowDirty (owner, view->viewFirstRow + cRow);
+            }
+            cRow ++;
+        }
     }
+    owner->viewCount --;
+    free (view->viewChangedRows);
+    free (view->dirtyRows);
+    free (view->syncedPath);
+    free (view);
     return;
 }
 
-static DWORD determineDIBSize (DIBHeaderVersion version) {
-    verifyDIBVersion (version);
-    DWORD dibSize;
-    if (version == BITMAPINFOHEADER) {
-        dibSize = DEFAULT_IH_SIZE;
-    } else if (version == BITMAPV4HEADER) {
-        dibSize = DEFAULT_V4IH_SIZE;
-    } else {
-        assert (DIB_DEFAULTS_NOT_SPECIFIED);        
+unsigned long long hashBmpPixels (bmpPtr sample) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    ensureAllRowsResident (sample);
+    unsigned long long rowHashSum = hashPixelRows (sample, 0, sample->yRes);
+    return finishHash (rowHashSum, sample->xRes, sample->yRes, sample->pixelFormat);
+}
+
+unsigned long long hashBmpPixelsParallel (bmpPtr sample, int threadCount) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (threadCount > 0);
+    ensureAllRowsResident (sample);
+    if (threadCount > sample->yRes) {
+        threadCount = sample->yRes;
     }
-    return dibSize;
+    pthread_t *threads = (pthread_t *) malloc (threadCount * sizeof (pthread_t));
+    hashJob *jobs = (hashJob *) malloc (threadCount * sizeof (hashJob));
+    assert (threads != NULL && jobs != NULL);
+    LONG bandRows = sample->yRes / threadCount;
+    int i = 0;
+    while (i < threadCount) {
+        jobs[i].sample = sample;
+        jobs[i].firstRow = i * bandRows;
+        jobs[i].rowCount = bandRows;
+        if (i == threadCount - 1) {
+            jobs[i].rowCount = sample->yRes - jobs[i].firstRow;
+        }
+        int retCode = pthread_create (&threads[i], NULL, hashWorker, &jobs[i]);
+        assert (retCode == 0);
+        i ++;
+    }
+    // row hashes are summed, so the result does not depend on how the rows were split
+    unsigned long long rowHashSum = 0;
+    i = 0;
+    while (i < threadCount) {
+        pthread_join (threads[i], NULL);
+        rowHashSum += jobs[i].rowHashSum;
+        i ++;
+    }
+    free (threads);
+    free (jobs);
+    return finishHash (rowHashSum, sample->xRes, sample->yRes, sample->pixelFormat);
 }
 
-static DIBHeaderVersion determineDIBVersion (DWORD dibSize) {
-    assert (dibSize > 0);
-    assert (dibSize == DEFAULT_IH_SIZE || dibSize == DEFAULT_V4IH_SIZE);
-    DIBHeaderVersion version;
-    if (dibSize == DEFAULT_IH_SIZE) {
-        version = BITMAPINFOHEADER;
-    } else if (dibSize == DEFAULT_V4IH_SIZE) {
-        version = BITMAPV4HEADER;
+unsigned long long hashChannel (channelPtr channel) {
+    assert (channel != NULL);
+    assert (channel->channelArray != NULL);
+    unsigned long long rowHashSum = 0;
+    row cRow = 0;
+    while (cRow < channel->yRes) {
+        byte *rowBytes = channel->channelArray + (unsigned long long) cRow * channel->xRes;
+        rowHashSum += avalanche (hashBytes (rowBytes, channel->xRes, ALL_BYTES_HASH_MASK, cRow));
+        cRow ++;
     }
-    return version; 
+    return finishHash (rowHashSum, channel->xRes, channel->yRes, CHANNEL_HASH_TAG);
 }
 
-DWORD evaluateRawImageSizeInBytes (bmpPtr sample) {
+pixelHashPtr createPixelHash (LONG xRes, LONG yRes, pixelFormat pixelFormat) {
+    assert (xRes > 0 && yRes > 0);
+    verifyPixelFormat (pixelFormat);
+    pixelHashPtr hash = (pixelHashPtr) malloc (sizeof (pixelHash));
+    assert (hash != NULL);
+    hash->xRes = xRes;
+    hash->yRes = yRes;
+    hash->pixelFormat = pixelFormat;
+    hash->hashedRowCount = 0;
+    hash->rowHashSum = 0;
+    return hash;
+}
+
+void updatePixelHash (pixelHashPtr hash, bmpPtr sample, LONG firstRow, LONG rowCount) {
+    assert (hash != NULL && sample != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (sample->xRes == hash->xRes && sample->yRes == hash->yRes);
+    assert (sample->pixelFormat == hash->pixelFormat);
+    assert (firstRow >= 0 && rowCount > 0 && firstRow + rowCount <= sample->yRes);
+    ensureRowsResident (sample, firstRow, rowCount);
+    hash->rowHashSum += hashPixelRows (sample, firstRow, rowCount);
+    hash->hashedRowCount += rowCount;
+    assert (hash->hashedRowCount <= hash->yRes);
+    return;
+}
+
+unsigned long long finishPixelHash (pixelHashPtr hash) {
+    assert (hash != NULL);
+    // every row has to be fed exactly once
+    assert (hash->hashedRowCount == hash->yRes);
+    unsigned long long digest = finishHash (hash->rowHashSum, hash->xRes, hash->yRes, hash->pixelFormat);
+    free (hash);
+    return digest;
+}
+
+// xxHash64 style: 4 independent lanes over 32 byte stripes, then 8 byte words, then single bytes
+// mask is applied to every 8 bytes read (bytes stay at the same position modulo 8 throughout)
+static unsigned long long hashBytes (byte *bytes, unsigned long long byteCount, unsigned long long mask, unsigned long long seed) {
+    unsigned long long hash;
+    unsigned long long i = 0;
+    unsigned long long lane;
+    if (byteCount >= 32) {
+        unsigned long long accumulators[4] = {seed + HASH_PRIME_1 + HASH_PRIME_2, seed + HASH_PRIME_2, seed, seed - HASH_PRIME_1};
+        while (i + 32 <= byteCount) {
+            int j = 0;
+            while (j < 4) {
+                memcpy (&lane, bytes + i + 8*j, 8);
+                accumulators[j] = hashRound (accumulators[j], lane & mask);
+                j ++;
+            }
+            i += 32;
+        }
+        hash = ((accumulators[0] << 1) | (accumulators[0] >> 63)) + ((accumulators[1] << 7) | (accumulators[1] >> 57));
+        hash += ((accumulators[2] << 12) | (accumulators[2] >> 52)) + ((accumulators[3] << 18) | (accumulators[3] >> 46));
+        int j = 0;
+        while (j < 4) {
+            hash = (hash ^ hashRound (0, accumulators[j])) * HASH_PRIME_1 + HASH_PRIME_4;
+            j ++;
+        }
+    } else {
+        hash = seed + HASH_PRIME_5;
+    }
+    hash += byteCount;
+    while (i + 8 <= byteCount) {
+        memcpy (&lane, bytes + i, 8);
+        hash ^= hashRound (0, lane & mask);
+        hash = ((hash << 27) | (hash >> 37)) * HASH_PRIME_1 + HASH_PRIME_4;
+        i += 8;
+    }
+    while (i < byteCount) {
+        byte maskedByte = bytes[i] & (byte) (mask >> (8 * (i % 8)));
+        hash ^= maskedByte * HASH_PRIME_5;
+        hash = ((hash << 11) | (hash >> 53)) * HASH_PRIME_1;
+        i ++;
+    }
+    return avalanche (hash);
+}
+
+static unsigned long long hashRound (unsigned long long accumulator, unsigned long long lane) {
+    accumulator += lane * HASH_PRIME_2;
+    accumulator = (accumulator << 31) | (accumulator >> 33);
+    return accumulator * HASH_PRIME_1;
+}
+
+static unsigned long long avalanche (unsigned long long hash) {
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// every row is hashed with its index as seed, the (mixed) row hashes are summed
+// so rows may be hashed in any order and by any number of threads
+static unsigned long long hashPixelRows (bmpPtr sample, LONG firstRow, LONG rowCount) {
+    unsigned long long mask = ALL_BYTES_HASH_MASK;
+    if (sample->pixelFormat == RGB_24) {
+        mask = RGB_24_HASH_MASK;
+    }
+    unsigned long long rowBytes = (unsigned long long) sample->xRes * sizeof (pixel);
+    unsigned long long rowHashSum = 0;
+    row cRow = firstRow;
+    while (cRow < firstRow + rowCount) {
+        byte *pixels = (byte *) rowPixels (sample, cRow);
+        rowHashSum += avalanche (hashBytes (pixels, rowBytes, mask, cRow));
+        cRow ++;
+    }
+    return rowHashSum;
+}
+
+static unsigned long long finishHash (unsigned long long rowHashSum, LONG xRes, LONG yRes, unsigned long long formatTag) {
+    unsigned long long hash = rowHashSum ^ ((unsigned long long) xRes * HASH_PRIME_1);
+    hash ^= (unsigned long long) yRes * HASH_PRIME_2;
+    hash ^= (formatTag + 1) * HASH_PRIME_3;
+    return avalanche (hash);
+}
+
+static void *hashWorker (void *job) {
+    hashJob *band = (hashJob *) job;
+    band->rowHashSum = hashPixelRows (band->sample, band->firstRow, band->rowCount);
+    return NULL;
+}
+
+channelPtr gaussianBlurChannel (channelPtr source, double sigma, int threadCount) {
+    assert (source != NULL);
+    assert (source->channelArray != NULL);
+    assert (sigma > 0);
+    assert (threadCount > 0);
+    LONG xRes = source->xRes;
+    LONG yRes = source->yRes;
+    if (threadCount > yRes) {
+        threadCount = yRes;
+    }
+    if (threadCount > xRes) {
+        threadCount = xRes;
+    }
+    channelPtr target = createChannel (xRes, yRes);
+    blurJob work;
+    work.source = source;
+    work.target = target;
+    work.boxMode = (sigma >= BOX_BLUR_MIN_SIGMA);
+    work.weights = NULL;
+    work.radius = 0;
+    work.buffers[0] = (unsigned short *) malloc (source->resolution * sizeof (unsigned short));
+    work.buffers[1] = NULL;
+    assert (work.buffers[0] != NULL);
+    if (work.boxMode) {
+        evaluateBoxRadii (sigma, work.boxRadii);
+        work.buffers[1] = (unsigned short *) malloc (source->resolution * sizeof (unsigned short));
+        assert (work.buffers[1] != NULL);
+    } else {
+        work.weights = createGaussianKernel (sigma, &work.radius);
+    }
+    pthread_barrier_t barrier;
+    int retCode = pthread_barrier_init (&barrier, NULL, threadCount);
+    assert (retCode == 0);
+    work.barrier = &barrier;
+
+    pthread_t *threads = (pthread_t *) malloc (threadCount * sizeof (pthread_t));
+    blurJob *jobs = (blurJob *) malloc (threadCount * sizeof (blurJob));
+    assert (threads != NULL && jobs != NULL);
+    int t = 0;
+    while (t < threadCount) {
+        jobs[t] = work;
+        jobs[t].firstRow = (LONG) ((unsigned long long) yRes * t / threadCount);
+        jobs[t].rowCount = (LONG) ((unsigned long long) yRes * (t + 1) / threadCount) - jobs[t].firstRow;
+        jobs[t].firstColumn = (LONG) ((unsigned long long) xRes * t / threadCount);
+        jobs[t].columnCount = (LONG) ((unsigned long long) xRes * (t + 1) / threadCount) - jobs[t].firstColumn;
+        // the calling thread takes the first share
+        if (t > 0) {
+            retCode = pthread_create (threads + t, NULL, blurWorker, jobs + t);
+            assert (retCode == 0);
+        }
+        t ++;
+    }
+    blurWorker (jobs);
+    t = 1;
+    while (t < threadCount) {
+        pthread_join (threads[t], NULL);
+        t ++;
+    }
+    pthread_barrier_destroy (&barrier);
+    free (threads);
+    free (jobs);
+    free (work.weights);
+    free (work.buffers[0]);
+    free (work.buffers[1]);
+    return target;
+}
+
+bmpPtr gaussianBlurBmp (bmpPtr sample, double sigma, int threadCount) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    // same headers, pixel format and alpha storage, every channel is replaced below
+    bmpPtr target = materializeBmp (sample);
+    channelType types[4] = {RED, GREEN, BLUE, ALPHA};
+    int typeCount = 3;
+    if (sample->pixelFormat == ARGB_32) {
+        typeCount = 4;
+    }
+    int i = 0;
+    while (i < typeCount) {
+        channelPtr plane = getChannelRows (sample, types[i], 0, sample->yRes);
+        channelPtr blurred = gaussianBlurChannel (plane, sigma, threadCount);
+        setChannel (types[i], target, blurred);
+        destroyChannel (plane);
+        destroyChannel (blurred);
+        i ++;
+    }
+    return target;
+}
+
+// weights in Q14 that sum to exactly 1 << BLUR_WEIGHT_BITS, radius is ceil (3 sigma)
+static int *createGaussianKernel (double sigma, int *radius) {
+    *radius = (int) ceil (3 * sigma);
+    int tapCount = 2 * *radius + 1;
+    double *exact = (double *) malloc (tapCount * sizeof (double));
+    int *weights = (int *) malloc (tapCount * sizeof (int));
+    assert (exact != NULL && weights != NULL);
+    double sum = 0;
+    int i = 0;
+    while (i < tapCount) {
+        double distance = i - *radius;
+        exact[i] = exp (-(distance * distance) / (2 * sigma * sigma));
+        sum += exact[i];
+        i ++;
+    }
+    int weightSum = 0;
+    i = 0;
+    while (i < tapCount) {
+        weights[i] = (int) floor (exact[i] / sum * (1 << BLUR_WEIGHT_BITS) + 0.5);
+        weightSum += weights[i];
+        i ++;
+    }
+    // rounding error goes to the center tap so that flat areas stay exactly flat
+    weights[*radius] += (1 << BLUR_WEIGHT_BITS) - weightSum;
+    free (exact);
+    return weights;
+}
+
+// box widths whose 3 successive passes match the variance of the gaussian (W. Kovesi)
+static void evaluateBoxRadii (double sigma, int *boxRadii) {
+    double idealWidth = sqrt (12 * sigma * sigma / BOX_BLUR_PASS_COUNT + 1);
+    int lowerWidth = (int) floor (idealWidth);
+    if (lowerWidth % 2 == 0) {
+        lowerWidth --;
+    }
+    int upperWidth = lowerWidth + 2;
+    double idealCount = (12 * sigma * sigma - BOX_BLUR_PASS_COUNT * lowerWidth * lowerWidth - 4 * BOX_BLUR_PASS_COUNT * lowerWidth - 3 * BOX_BLUR_PASS_COUNT) / (-4.0 * lowerWidth - 4);
+    int lowerCount = (int) floor (idealCount + 0.5);
+    int i = 0;
+    while (i < BOX_BLUR_PASS_COUNT) {
+        if (i < lowerCount) {
+            boxRadii[i] = (lowerWidth - 1) / 2;
+        } else {
+            boxRadii[i] = (upperWidth - 1) / 2;
+        }
+        i ++;
+    }
+    return;
+}
+
+// columns per strip so that the rows of the kernel window of one strip stay in L2, multiple of 16
+static LONG evaluateStripWidth (int radius) {
+    LONG stripWidth = BLUR_STRIP_BYTES / ((2 * radius + 2) * sizeof (unsigned short));
+    stripWidth -= stripWidth % 16;
+    if (stripWidth < 16) {
+        stripWidth = 16;
+    }
+    return stripWidth;
+}
+
+// every phase reads what the previous phase wrote in other shares, hence the barriers
+static void *blurWorker (void *job) {
+    blurJob *work = (blurJob *) job;
+    if (!work->boxMode) {
+        gaussianRows (work);
+        pthread_barrier_wait (work->barrier);
+        gaussianColumns (work);
+    } else {
+        LONG xRes = work->source->xRes;
+        LONG yRes = work->source->yRes;
+        unsigned long long i = (unsigned long long) work->firstRow * xRes;
+        unsigned long long end = i + (unsigned long long) work->rowCount * xRes;
+        while (i < end) {
+            work->buffers[0][i] = work->source->channelArray[i] << BLUR_FRACTION_BITS;
+            i ++;
+        }
+        int pass = 0;
+        while (pass < BOX_BLUR_PASS_COUNT) {
+            boxRows (work->buffers[1], work->buffers[0], xRes, work->firstRow, work->rowCount, work->boxRadii[pass]);
+            pthread_barrier_wait (work->barrier);
+            boxColumns (work->buffers[0], work->buffers[1], xRes, yRes, work->firstColumn, work->columnCount, work->boxRadii[pass]);
+            pthread_barrier_wait (work->barrier);
+            pass ++;
+        }
+        i = (unsigned long long) work->firstRow * xRes;
+        while (i < end) {
+            work->target->channelArray[i] = (work->buffers[0][i] + (1 << (BLUR_FRACTION_BITS - 1))) >> BLUR_FRACTION_BITS;
+            i ++;
+        }
+    }
+    return NULL;
+}
+
+// horizontal pass: byte rows to Q8 rows, taps outermost so that the inner loop runs over a whole row (vectorizes)
+// the kernel is symmetric, so mirrored taps are added before being weighted
+static void gaussianRows (blurJob *work) {
+    LONG xRes = work->source->xRes;
+    int radius = work->radius;
+    byte *padded = (byte *) malloc (xRes + 2 * radius);
+    unsigned int *sums = (unsigned int *) malloc (xRes * sizeof (unsigned int));
+    assert (padded != NULL && sums != NULL);
+    row cRow = work->firstRow;
+    while (cRow < work->firstRow + work->rowCount) {
+        byte *source = work->source->channelArray + (unsigned long long) cRow * xRes;
+        // edges are replicated
+        memset (padded, source[0], radius);
+        memcpy (padded + radius, source, xRes);
+        memset (padded + radius + xRes, source[xRes - 1], radius);
+        unsigned int centerWeight = work->weights[radius];
+        column cColumn = 0;
+        while (cColumn < xRes) {
+            sums[cColumn] = centerWeight * padded[radius + cColumn];
+            cColumn ++;
+        }
+        int tap = 1;
+        while (tap <= radius) {
+            unsigned int weight = work->weights[radius + tap];
+            byte *left = padded + radius - tap;
+            byte *right = padded + radius + tap;
+            cColumn = 0;
+            while (cColumn < xRes) {
+                sums[cColumn] += weight * (left[cColumn] + right[cColumn]);
+                cColumn ++;
+            }
+            tap ++;
+        }
+        unsigned short *target = work->buffers[0] + (unsigned long long) cRow * xRes;
+        cColumn = 0;
+        while (cColumn < xRes) {
+            target[cColumn] = (sums[cColumn] + (1 << (BLUR_WEIGHT_BITS - BLUR_FRACTION_BITS - 1))) >> (BLUR_WEIGHT_BITS - BLUR_FRACTION_BITS);
+            cColumn ++;
+        }
+        cRow ++;
+    }
+    free (padded);
+    free (sums);
+    return;
+}
+
+// vertical pass: Q8 rows to byte rows, one strip of columns at a time so that the 2 radius + 1 rows read stay in L2
+static void gaussianColumns (blurJob *work) {
+    LONG xRes = work->source->xRes;
+    LONG yRes = work->source->yRes;
+    int radius = work->radius;
+    LONG stripWidth = evaluateStripWidth (radius);
+    unsigned int *sums = (unsigned int *) malloc (stripWidth * sizeof (unsigned int));
+    assert (sums != NULL);
+    column stripStart = work->firstColumn;
+    while (stripStart < work->firstColumn + work->columnCount) {
+        LONG width = work->firstColumn + work->columnCount - stripStart;
+        if (width > stripWidth) {
+            width = stripWidth;
+        }
+        row cRow = 0;
+        while (cRow < yRes) {
+            unsigned int centerWeight = work->weights[radius];
+            unsigned short *center = work->buffers[0] + (unsigned long long) cRow * xRes + stripStart;
+            column cColumn = 0;
+            while (cColumn < width) {
+                sums[cColumn] = centerWeight * center[cColumn];
+                cColumn ++;
+            }
+            int tap = 1;
+            while (tap <= radius) {
+                unsigned int weight = work->weights[radius + tap];
+                unsigned short *above = work->buffers[0] + (unsigned long long) clampIndex (cRow - tap, yRes) * xRes + stripStart;
+                unsigned short *below = work->buffers[0] + (unsigned long long) clampIndex (cRow + tap, yRes) * xRes + stripStart;
+                cColumn = 0;
+                while (cColumn < width) {
+                    sums[cColumn] += weight * ((unsigned int) above[cColumn] + below[cColumn]);
+                    cColumn ++;
+                }
+                tap ++;
+            }
+            byte *target = work->target->channelArray + (unsigned long long) cRow * xRes + stripStart;
+            cColumn = 0;
+            while (cColumn < width) {
+                target[cColumn] = (sums[cColumn] + (1 << (BLUR_WEIGHT_BITS + BLUR_FRACTION_BITS - 1))) >> (BLUR_WEIGHT_BITS + BLUR_FRACTION_BITS);
+                cColumn ++;
+            }
+            cRow ++;
+        }
+        stripStart += width;
+    }
+    free (sums);
+    return;
+}
+
+// running sum over each row, edges replicated
+static void boxRows (unsigned short *target, unsigned short *source, LONG xRes, LONG firstRow, LONG rowCount, int radius) {
+    unsigned long long width = 2 * radius + 1;
+    // (sum + width / 2) * reciprocal >> 32 rounds sum / width without a division per pixel
+    unsigned long long reciprocal = ((1ULL << 32) + width - 1) / width;
+    row cRow = firstRow;
+    while (cRow < firstRow + rowCount) {
+        unsigned short *sourceRow = source + (unsigned long long) cRow * xRes;
+        unsigned short *targetRow = target + (unsigned long long) cRow * xRes;
+        unsigned long long sum = 0;
+        LONG i = -radius;
+        while (i <= radius) {
+            sum += sourceRow[clampIndex (i, xRes)];
+            i ++;
+        }
+        column cColumn = 0;
+        while (cColumn < xRes) {
+            targetRow[cColumn] = ((sum + width / 2) * reciprocal) >> 32;
+            sum += sourceRow[clampIndex (cColumn + radius + 1, xRes)];
+            sum -= sourceRow[clampIndex (cColumn - radius, xRes)];
+            cColumn ++;
+        }
+        cRow ++;
+    }
+    return;
+}
+
+// running sums down each column, a strip of columns at a time, the inner loops run across the strip (vectorize)
+static void boxColumns (unsigned short *target, unsigned short *source, LONG xRes, LONG yRes, LONG firstColumn, LONG columnCount, int radius) {
+    unsigned long long width = 2 * radius + 1;
+    unsigned long long reciprocal = ((1ULL << 32) + width - 1) / width;
+    LONG stripWidth = evaluateStripWidth (0);
+    unsigned int *sums = (unsigned int *) malloc (stripWidth * sizeof (unsigned int));
+    assert (sums != NULL);
+    // a window sum of Q8 values must fit in 32 bits
+    assert (width * (255 << BLUR_FRACTION_BITS) <= 0xFFFFFFFFULL);
+    column stripStart = firstColumn;
+    while (stripStart < firstColumn + columnCount) {
+        LONG stripColumns = firstColumn + columnCount - stripStart;
+        if (stripColumns > stripWidth) {
+            stripColumns = stripWidth;
+        }
+        memset (sums, 0, stripColumns * sizeof (unsigned int));
+        LONG i = -radius;
+        while (i <= radius) {
+            unsigned short *sourceRow = source + (unsigned long long) clampIndex (i, yRes) * xRes + stripStart;
+            column cColumn = 0;
+            while (cColumn < stripColumns) {
+                sums[cColumn] += sourceRow[cColumn];
+                cColumn ++;
+            }
+            i ++;
+        }
+        row cRow = 0;
+        while (cRow < yRes) {
+            unsigned short *targetRow = target + (unsigned long long) cRow * xRes + stripStart;
+            unsigned short *entering = source + (unsigned long long) clampIndex (cRow + radius + 1, yRes) * xRes + stripStart;
+            unsigned short *leaving = source + (unsigned long long) clampIndex (cRow - radius, yRes) * xRes + stripStart;
+            column cColumn = 0;
+            while (cColumn < stripColumns) {
+                targetRow[cColumn] = ((sums[cColumn] + width / 2) * reciprocal) >> 32;
+                sums[cColumn] += entering[cColumn] - leaving[cColumn];
+                cColumn ++;
+            }
+            cRow ++;
+        }
+        stripStart += stripColumns;
+    }
+    free (sums);
+    return;
+}
+
+static LONG clampIndex (LONG index, LONG count) {
+    if (index < 0) {
+        index = 0;
+    } else if (index >= count) {
+        index = count - 1;
+    }
+    return index;
+}
+
+kernelPtr createKernel (LONG size, double *weights, double bias) {
+    assert (size >= MIN_KERNEL_SIZE && size <= MAX_KERNEL_SIZE && size % 2 == 1);
+    assert (weights != NULL);
+    kernelPtr target = (kernelPtr) malloc (sizeof (kernel));
+    assert (target != NULL);
+    LONG tapCount = size * size;
+    target->size = size;
+    target->bias = bias;
+    target->weights = (double *) malloc (tapCount * sizeof (double));
+    target->fixedWeights = (short *) malloc (tapCount * sizeof (short));
+    assert (target->weights != NULL && target->fixedWeights != NULL);
+    memcpy (target->weights, weights, tapCount * sizeof (double));
+
+    // as many fraction bits as the largest weight allows
+    double maxWeight = 0;
+    double weightSum = 0;
+    LONG i = 0;
+    while (i < tapCount) {
+        if (fabs (weights[i]) > maxWeight) {
+            maxWeight = fabs (weights[i]);
+        }
+        weightSum += weights[i];
+        i ++;
+    }
+    assert (maxWeight > 0);
+    target->fractionBits = MAX_KERNEL_FRACTION_BITS;
+    while (target->fractionBits > 1 && maxWeight * (1 << target->fractionBits) > MAX_FIXED_WEIGHT) {
+        target->fractionBits --;
+    }
+    assert (maxWeight * (1 << target->fractionBits) <= MAX_FIXED_WEIGHT);
+    double scale = 1 << target->fractionBits;
+    long fixedSum = 0;
+    i = 0;
+    while (i < tapCount) {
+        target->fixedWeights[i] = (short) floor (weights[i] * scale + 0.5);
+        fixedSum += target->fixedWeights[i];
+        i ++;
+    }
+    // rounding error goes to the center tap so that flat areas keep their value (eg: blur or sharpen)
+    long center = tapCount / 2;
+    long adjusted = target->fixedWeights[center] + ((long) floor (weightSum * scale + 0.5) - fixedSum);
+    if (adjusted >= -MAX_FIXED_WEIGHT && adjusted <= MAX_FIXED_WEIGHT) {
+        target->fixedWeights[center] = (short) adjusted;
+    }
+    // sums are held in 32 bits
+    double largestSum = fabs (bias) * scale + scale;
+    i = 0;
+    while (i < tapCount) {
+        largestSum += abs (target->fixedWeights[i]) * (double) MAX_RGB_VALUE;
+        i ++;
+    }
+    assert (largestSum < 2147483647.0);
+    return target;
+}
+
+void destroyKernel (kernelPtr kernel) {
+    assert (kernel != NULL);
+    free (kernel->weights);
+    free (kernel->fixedWeights);
+    free (kernel);
+    return;
+}
+
+channelPtr convolveChannel (channelPtr source, kernelPtr kernel, borderMode border, int threadCount) {
+    assert (source != NULL && kernel != NULL);
+    assert (source->channelArray != NULL);
+    verifyBorderMode (border);
+    assert (threadCount > 0);
+    channelPtr target = createChannel (source->xRes, source->yRes);
+    LONG tileCount = ((source->yRes + CONVOLUTION_TILE_ROWS - 1) / CONVOLUTION_TILE_ROWS) * ((source->xRes + CONVOLUTION_TILE_COLUMNS - 1) / CONVOLUTION_TILE_COLUMNS);
+    if (threadCount > tileCount) {
+        threadCount = tileCount;
+    }
+    pthread_t *threads = (pthread_t *) malloc (threadCount * sizeof (pthread_t));
+    convolutionJob *jobs = (convolutionJob *) malloc (threadCount * sizeof (convolutionJob));
+    assert (threads != NULL && jobs != NULL);
+    int t = 0;
+    while (t < threadCount) {
+        jobs[t].source = source;
+        jobs[t].target = target;
+        jobs[t].kernel = kernel;
+        jobs[t].border = border;
+        jobs[t].threadIndex = t;
+        jobs[t].threadCount = threadCount;
+        // the calling thread takes the first share
+        if (t > 0) {
+            int retCode = pthread_create (threads + t, NULL, convolutionWorker, jobs + t);
+            assert (retCode == 0);
+        }
+        t ++;
+    }
+    convolutionWorker (jobs);
+    t = 1;
+    while (t < threadCount) {
+        pthread_join (threads[t], NULL);
+        t ++;
+    }
+    free (threads);
+    free (jobs);
+    return target;
+}
+
+bmpPtr convolveBmp (bmpPtr sample, kernelPtr kernel, borderMode border, int threadCount) {
+    assert (sample != NULL && kernel != NULL);
+    assert (sample->pixelArray != NULL);
+    // same headers, pixel format and alpha, the color channels are replaced below
+    bmpPtr target = materializeBmp (sample);
+    channelType types[3] = {RED, GREEN, BLUE};
+    int i = 0;
+    while (i < 3) {
+        channelPtr plane = getChannelRows (sample, types[i], 0, sample->yRes);
+        channelPtr convolved = convolveChannel (plane, kernel, border, threadCount);
+        setChannel (types[i], target, convolved);
+        destroyChannel (plane);
+        destroyChannel (convolved);
+        i ++;
+    }
+    if (target->premultiplied) {
+        clampColorsToAlpha (target->pixelArray, (unsigned long long) target->xRes * target->yRes);
+    }
+    return target;
+}
+
+static void verifyBorderMode (borderMode border) {
+    assert (border == BORDER_CLAMP || border == BORDER_REFLECT || border == BORDER_ZERO);
+    return;
+}
+
+// index of the pixel read for position index of a row/column of count pixels, -1 for a zero pixel
+static LONG borderIndex (LONG index, LONG count, borderMode border) {
+    if (index >= 0 && index < count) {
+        return index;
+    }
+    if (border == BORDER_ZERO) {
+        index = -1;
+    } else if (border == BORDER_CLAMP || count == 1) {
+        index = clampIndex (index, count);
+    } else {
+        // mirrored as often as needed for kernels larger than the image
+        LONG period = 2 * (count - 1);
+        index = index % period;
+        if (index < 0) {
+            index += period;
+        }
+        if (index >= count) {
+            index = period - index;
+        }
+    }
+    return index;
+}
+
+static void *convolutionWorker (void *job) {
+    convolutionJob *work = (convolutionJob *) job;
+    LONG size = work->kernel->size;
+    byte *padded = (byte *) malloc ((CONVOLUTION_TILE_ROWS + size - 1) * (CONVOLUTION_TILE_COLUMNS + size - 1));
+    int *sums = (int *) malloc (CONVOLUTION_TILE_COLUMNS * sizeof (int));
+    assert (padded != NULL && sums != NULL);
+    LONG tilesAcross = (work->source->xRes + CONVOLUTION_TILE_COLUMNS - 1) / CONVOLUTION_TILE_COLUMNS;
+    LONG tileCount = tilesAcross * ((work->source->yRes + CONVOLUTION_TILE_ROWS - 1) / CONVOLUTION_TILE_ROWS);
+    LONG tile = work->threadIndex;
+    while (tile < tileCount) {
+        convolveTile (work, padded, sums, (tile / tilesAcross) * CONVOLUTION_TILE_ROWS, (tile % tilesAcross) * CONVOLUTION_TILE_COLUMNS);
+        tile += work->threadCount;
+    }
+    free (padded);
+    free (sums);
+    return NULL;
+}
+
+static void convolveTile (convolutionJob *work, byte *padded, int *sums, LONG firstRow, LONG firstColumn) {
+    kernelPtr kernel = work->kernel;
+    LONG rowCount = work->source->yRes - firstRow;
+    if (rowCount > CONVOLUTION_TILE_ROWS) {
+        rowCount = CONVOLUTION_TILE_ROWS;
+    }
+    LONG columnCount = work->source->xRes - firstColumn;
+    if (columnCount > CONVOLUTION_TILE_COLUMNS) {
+        columnCount = CONVOLUTION_TILE_COLUMNS;
+    }
+    int radius = kernel->size / 2;
+    LONG paddedWidth = columnCount + 2 * radius;
+    fillPaddedTile (padded, work->source, firstRow, firstColumn, rowCount, columnCount, radius, work->border);
+    // bias and rounding are folded into the starting value of every sum
+    int start = (int) floor (kernel->bias * (1 << kernel->fractionBits) + 0.5) + (1 << (kernel->fractionBits - 1));
+    row tRow = 0;
+    while (tRow < rowCount) {
+        column cColumn = 0;
+        while (cColumn < columnCount) {
+            sums[cColumn] = start;
+            cColumn ++;
+        }
+        // the common sizes get their own copy with the kernel loops unrolled
+        byte *window = padded + (unsigned long long) tRow * paddedWidth;
+        if (kernel->size == 3) {
+            accumulateKernel (sums, window, paddedWidth, kernel->fixedWeights, 3, columnCount);
+        } else if (kernel->size == 5) {
+            accumulateKernel (sums, window, paddedWidth, kernel->fixedWeights, 5, columnCount);
+        } else if (kernel->size == 7) {
+            accumulateKernel (sums, window, paddedWidth, kernel->fixedWeights, 7, columnCount);
+        } else {
+            accumulateKernel (sums, window, paddedWidth, kernel->fixedWeights, kernel->size, columnCount);
+        }
+        byte *target = work->target->channelArray + (unsigned long long) (firstRow + tRow) * work->source->xRes + firstColumn;
+        cColumn = 0;
+        while (cColumn < columnCount) {
+            target[cColumn] = clampToByte (sums[cColumn] >> kernel->fractionBits);
+            cColumn ++;
+        }
+        tRow ++;
+    }
+    return;
+}
+
+// copies the tile and its halo (radius pixels on every side), resolving the border mode once per pixel
+// so that the kernel loops need no bounds checks
+static void fillPaddedTile (byte *padded, channelPtr source, LONG firstRow, LONG firstColumn, LONG rowCount, LONG columnCount, int radius, borderMode border) {
+    LONG paddedWidth = columnCount + 2 * radius;
+    // columns [inside, insideEnd) of the padded row are inside the image
+    LONG inside = 0;
+    if (firstColumn - radius < 0) {
+        inside = radius - firstColumn;
+    }
+    LONG insideEnd = paddedWidth;
+    if (firstColumn - radius + paddedWidth > source->xRes) {
+        insideEnd = source->xRes - firstColumn + radius;
+    }
+    LONG pRow = 0;
+    while (pRow < rowCount + 2 * radius) {
+        byte *target = padded + (unsigned long long) pRow * paddedWidth;
+        LONG sourceRow = borderIndex (firstRow - radius + pRow, source->yRes, border);
+        if (sourceRow < 0) {
+            memset (target, 0, paddedWidth);
+        } else {
+            byte *sourcePixels = source->channelArray + (unsigned long long) sourceRow * source->xRes;
+            memcpy (target + inside, sourcePixels + firstColumn - radius + inside, insideEnd - inside);
+            LONG pColumn = 0;
+            while (pColumn < paddedWidth) {
+                if (pColumn == inside) {
+                    pColumn = insideEnd;
+                    continue;
+                }
+                LONG sourceColumn = borderIndex (firstColumn - radius + pColumn, source->xRes, border);
+                if (sourceColumn < 0) {
+                    target[pColumn] = 0;
+                } else {
+                    target[pColumn] = sourcePixels[sourceColumn];
+                }
+                pColumn ++;
+            }
+        }
+        pRow ++;
+    }
+    return;
+}
+
+// sums[x] += weights . window around x, taps outermost so that the inner loop runs across the row (vectorizes)
+// inlined with a constant size for the common kernels, the tap loops are then unrolled
+static inline __attribute__ ((always_inline)) void accumulateKernel (int *sums, byte *window, LONG paddedWidth, short *weights, LONG size, LONG width) {
+    LONG kRow = 0;
+    while (kRow < size) {
+        byte *sourceRow = window + kRow * paddedWidth;
+        LONG kColumn = 0;
+        while (kColumn < size) {
+            int weight = weights[kRow * size + kColumn];
+            if (weight != 0) {
+                byte *taps = sourceRow + kColumn;
+                column cColumn = 0;
+                while (cColumn < width) {
+                    sums[cColumn] += weight * taps[cColumn];
+                    cColumn ++;
+                }
+            }
+            kColumn ++;
+        }
+        kRow ++;
+    }
+    return;
+}
+
+bmpPtr resizeBmp (bmpPtr sample, LONG xRes, LONG yRes, resampleFilter filter, int threadCount) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (xRes > 0 && yRes > 0);
+    verifyResampleFilter (filter);
+    assert (threadCount > 0);
+    ensureAllRowsResident (sample);
+    bmpPtr target = createBmpLike (sample, sample->DIBVersion, sample->pixelFormat, xRes, yRes);
+
+    resizeJob work;
+    work.source = sample->pixelArray;
+    // straight ARGB_32 is resampled premultiplied and divided back, premultiplied bitmaps stay so
+    int premultiply = (sample->pixelFormat == ARGB_32 && !sample->premultiplied);
+    if (premultiply || !hasPackedRows (sample)) {
+        work.source = packPixels (sample);
+        if (premultiply) {
+            premultiplyPixels (work.source, work.source, (unsigned long long) sample->xRes * sample->yRes);
+        }
+    }
+    LONG sourceXRes = sample->xRes;
+    LONG sourceYRes = sample->yRes;
+    LONG xFactor = evaluateReduceFactor (filter, sourceXRes, xRes);
+    LONG yFactor = evaluateReduceFactor (filter, sourceYRes, yRes);
+    if (xFactor > 1 || yFactor > 1) {
+        pixelArray reduced = boxReducePixels (work.source, sourceXRes, sourceYRes, xFactor, yFactor);
+        if (work.source != sample->pixelArray) {
+            free (work.source);
+        }
+        work.source = reduced;
+        sourceXRes = (sourceXRes + xFactor - 1) / xFactor;
+        sourceYRes = (sourceYRes + yFactor - 1) / yFactor;
+    }
+    if (threadCount > yRes) {
+        threadCount = yRes;
+    }
+    if (threadCount > sourceYRes) {
+        threadCount = sourceYRes;
+    }
+    work.sourceXRes = sourceXRes;
+    work.intermediate = (pixelArray) malloc ((unsigned long long) xRes * sourceYRes * sizeof (pixel));
+    assert (work.intermediate != NULL);
+    work.target = target->pixelArray;
+    work.xRes = xRes;
+    work.horizontal = createResampleWeights (filter, sourceXRes, xRes);
+    work.vertical = createResampleWeights (filter, sourceYRes, yRes);
+    pthread_barrier_t barrier;
+    int retCode = pthread_barrier_init (&barrier, NULL, threadCount);
+    assert (retCode == 0);
+    work.barrier = &barrier;
+
+    pthread_t *threads = (pthread_t *) malloc (threadCount * sizeof (pthread_t));
+    resizeJob *jobs = (resizeJob *) malloc (threadCount * sizeof (resizeJob));
+    assert (threads != NULL && jobs != NULL);
+    int t = 0;
+    while (t < threadCount) {
+        jobs[t] = work;
+        jobs[t].firstSourceRow = (LONG) ((unsigned long long) sourceYRes * t / threadCount);
+        jobs[t].sourceRowCount = (LONG) ((unsigned long long) sourceYRes * (t + 1) / threadCount) - jobs[t].firstSourceRow;
+        jobs[t].firstRow = (LONG) ((unsigned long long) yRes * t / threadCount);
+        jobs[t].rowCount = (LONG) ((unsigned long long) yRes * (t + 1) / threadCount) - jobs[t].firstRow;
+        // the calling thread takes the first share
+        if (t > 0) {
+            retCode = pthread_create (threads + t, NULL, resizeWorker, jobs + t);
+            assert (retCode == 0);
+        }
+        t ++;
+    }
+    resizeWorker (jobs);
+    t = 1;
+    while (t < threadCount) {
+        pthread_join (threads[t], NULL);
+        t ++;
+    }
+    pthread_barrier_destroy (&barrier);
+    free (threads);
+    free (jobs);
+    destroyResampleWeights (work.horizontal);
+    destroyResampleWeights (work.vertical);
+    free (work.intermediate);
+    if (work.source != sample->pixelArray) {
+        free (work.source);
+    }
+    if (premultiply) {
+        unsigned int reciprocals[256];
+        fillUnpremultiplyReciprocals (reciprocals);
+        unpremultiplyPixels (target->pixelArray, (unsigned long long) xRes * yRes, reciprocals);
+    } else if (sample->premultiplied) {
+        // the negative lobes of bicubic and lanczos may overshoot alpha
+        clampColorsToAlpha (target->pixelArray, (unsigned long long) xRes * yRes);
+    } else {
+        convertPixels (target->pixelArray, target->pixelArray, (unsigned long long) xRes * yRes, RGB_24, 0);
+    }
+    return target;
+}
+
+// new bitmap with the print resolution, row order (and premultiplied ARGB_32) of sample, the specified layout and
+// an uninitialized pixelArray
+static bmpPtr createBmpLike (bmpPtr sample, DIBHeaderVersion version, pixelFormat pixelFormat, LONG xRes, LONG yRes) {
+    bmpPtr target = createBmp (version);
+    target->xRes = xRes;
+    target->yRes = yRes;
+    target->printResX = sample->printResX;
+    target->printResY = sample->printResY;
+    target->rowOrder = sample->rowOrder;
+    target->premultiplied = (sample->premultiplied && pixelFormat == ARGB_32);
+    setConversionDefaults (target, version, pixelFormat);
+    unsigned long long netRes = (unsigned long long) xRes * yRes;
+    target->pixelArray = (pixelArray) malloc (netRes * sizeof (pixel));
+    assert (target->pixelArray != NULL);
+    return target;
+}
+
+static void verifyResampleFilter (resampleFilter filter) {
+    assert (filter == RESAMPLE_BILINEAR || filter == RESAMPLE_BICUBIC || filter == RESAMPLE_LANCZOS);
+    return;
+}
+
+static double evaluateResampleFilter (resampleFilter filter, double x) {
+    x = fabs (x);
+    double value = 0;
+    if (filter == RESAMPLE_BILINEAR) {
+        if (x < 1) {
+            value = 1 - x;
+        }
+    } else if (filter == RESAMPLE_BICUBIC) {
+        double a = -0.5;
+        if (x < 1) {
+            value = ((a + 2) * x - (a + 3)) * x * x + 1;
+        } else if (x < 2) {
+            value = (((x - 5) * x + 8) * x - 4) * a;
+        }
+    } else if (filter == RESAMPLE_LANCZOS) {
+        if (x == 0) {
+            value = 1;
+        } else if (x < 3) {
+            value = 3 * sin (M_PI * x) * sin (M_PI * x / 3) / (M_PI * M_PI * x * x);
+        }
+    } else {
+        assert (PIXEL_FORMAT_DEFAULTS_NOT_SPECIFIED);
+    }
+    return value;
+}
+
+static double resampleFilterSupport (resampleFilter filter) {
+    double support = 3;
+    if (filter == RESAMPLE_BILINEAR) {
+        support = 1;
+    } else if (filter == RESAMPLE_BICUBIC) {
+        support = 2;
+    }
+    return support;
+}
+
+// taps of every target position, the filter is stretched by the scale factor when downscaling
+// taps outside of the source are dropped and the remaining weights renormalized
+static resampleWeights *createResampleWeights (resampleFilter filter, LONG sourceSize, LONG targetSize) {
+    resampleWeights *weights = (resampleWeights *) malloc (sizeof (resampleWeights));
+    assert (weights != NULL);
+    double scale = (double) sourceSize / targetSize;
+    double filterScale = scale;
+    if (filterScale < 1) {
+        filterScale = 1;
+    }
+    double support = resampleFilterSupport (filter) * filterScale;
+    weights->maxCount = (LONG) ceil (support) * 2 + 1;
+    weights->starts = (LONG *) malloc (targetSize * sizeof (LONG));
+    weights->counts = (LONG *) malloc (targetSize * sizeof (LONG));
+    weights->weights = (int *) malloc ((unsigned long long) targetSize * weights->maxCount * sizeof (int));
+    double *exact = (double *) malloc (weights->maxCount * sizeof (double));
+    assert (weights->starts != NULL && weights->counts != NULL && weights->weights != NULL && exact != NULL);
+    LONG i = 0;
+    while (i < targetSize) {
+        double center = (i + 0.5) * scale;
+        LONG start = (LONG) floor (center - support + 0.5);
+        if (start < 0) {
+            start = 0;
+        }
+        LONG end = (LONG) floor (center + support + 0.5);
+        if (end > sourceSize) {
+            end = sourceSize;
+        }
+        LONG count = end - start;
+        assert (count > 0 && count <= weights->maxCount);
+        double total = 0;
+        LONG k = 0;
+        while (k < count) {
+            exact[k] = evaluateResampleFilter (filter, (start + k - center + 0.5) / filterScale);
+            total += exact[k];
+            k ++;
+        }
+        int *fixed = weights->weights + (unsigned long long) i * weights->maxCount;
+        // the running sum of the weights is rounded rather than every weight, so that the rounding error is carried
+        // forward to the next tap and the weights sum exactly to 1 (flat areas stay exactly flat)
+        double cumulative = 0;
+        int previous = 0;
+        k = 0;
+        while (k < count) {
+            cumulative += exact[k];
+            int next = 1 << RESAMPLE_WEIGHT_BITS;
+            if (k < count - 1) {
+                next = (int) floor (cumulative / total * (1 << RESAMPLE_WEIGHT_BITS) + 0.5);
+            }
+            fixed[k] = next - previous;
+            previous = next;
+            k ++;
+        }
+        weights->starts[i] = start;
+        weights->counts[i] = count;
+        i ++;
+    }
+    free (exact);
+    return weights;
+}
+
+static void destroyResampleWeights (resampleWeights *weights) {
+    free (weights->starts);
+    free (weights->counts);
+    free (weights->weights);
+    free (weights);
+    return;
+}
+
+// integer factor the source is box reduced by so that a resampling pass keeps at most RESAMPLE_MAX_TAPS taps
+static LONG evaluateReduceFactor (resampleFilter filter, LONG sourceSize, LONG targetSize) {
+    double tapCount = 2 * resampleFilterSupport (filter) * sourceSize / targetSize;
+    LONG factor = 1;
+    if (tapCount > RESAMPLE_MAX_TAPS) {
+        factor = (LONG) ceil (tapCount / RESAMPLE_MAX_TAPS);
+    }
+    return factor;
+}
+
+// every pixel of the returned (packed) pixelArray is the rounded average of a xFactor x yFactor box of source
+// pixels, the boxes of the last column and row are cut by the edges of the source
+static pixelArray boxReducePixels (pixelArray source, LONG xRes, LONG yRes, LONG xFactor, LONG yFactor) {
+    LONG targetXRes = (xRes + xFactor - 1) / xFactor;
+    LONG targetYRes = (yRes + yFactor - 1) / yFactor;
+    pixelArray target = (pixelArray) malloc ((unsigned long long) targetXRes * targetYRes * sizeof (pixel));
+    unsigned long long *sums = (unsigned long long *) malloc ((unsigned long long) targetXRes * 4 * sizeof (unsigned long long));
+    assert (target != NULL && sums != NULL);
+    row tRow = 0;
+    while (tRow < targetYRes) {
+        row firstRow = tRow * yFactor;
+        row lastRow = firstRow + yFactor;
+        if (lastRow > yRes) {
+            lastRow = yRes;
+        }
+        memset (sums, 0, (unsigned long long) targetXRes * 4 * sizeof (unsigned long long));
+        row cRow = firstRow;
+        while (cRow < lastRow) {
+            byte *pixels = (byte *) (source + (unsigned long long) cRow * xRes);
+            column cColumn = 0;
+            while (cColumn < xRes) {
+                unsigned long long *boxSums = sums + 4 * (cColumn / xFactor);
+                column lastColumn = cColumn + xFactor;
+                if (lastColumn > xRes) {
+                    lastColumn = xRes;
+                }
+                while (cColumn < lastColumn) {
+                    boxSums[0] += pixels[4 * cColumn];
+                    boxSums[1] += pixels[4 * cColumn + 1];
+                    boxSums[2] += pixels[4 * cColumn + 2];
+                    boxSums[3] += pixels[4 * cColumn + 3];
+                    cColumn ++;
+                }
+            }
+            cRow ++;
+        }
+        byte *targetPixels = (byte *) (target + (unsigned long long) tRow * targetXRes);
+        column tColumn = 0;
+        while (tColumn < targetXRes) {
+            LONG columnCount = xRes - tColumn * xFactor;
+            if (columnCount > xFactor) {
+                columnCount = xFactor;
+            }
+            unsigned long long count = (unsigned long long) columnCount * (lastRow - firstRow);
+            int c = 0;
+            while (c < 4) {
+                targetPixels[4 * tColumn + c] = (byte) ((sums[4 * tColumn + c] + count / 2) / count);
+                c ++;
+            }
+            tColumn ++;
+        }
+        tRow ++;
+    }
+    free (sums);
+    return target;
+}
+
+static void *resizeWorker (void *job) {
+    resizeJob *work = (resizeJob *) job;
+    resampleRows (work);
+    // the second pass reads rows of the intermediate image written by other threads
+    pthread_barrier_wait (work->barrier);
+    resampleColumns (work);
+    return NULL;
+}
+
+// first pass: every source row of the band is resampled to xRes pixels (all 4 bytes of a pixel at once)
+static void resampleRows (resizeJob *work) {
+    resampleWeights *weights = work->horizontal;
+    row cRow = work->firstSourceRow;
+    while (cRow < work->firstSourceRow + work->sourceRowCount) {
+        byte *source = (byte *) (work->source + (unsigned long long) cRow * work->sourceXRes);
+        byte *target = (byte *) (work->intermediate + (unsigned long long) cRow * work->xRes);
+        column cColumn = 0;
+        while (cColumn < work->xRes) {
+            int *taps = weights->weights + (unsigned long long) cColumn * weights->maxCount;
+            byte *pixels = source + 4 * weights->starts[cColumn];
+            int sums[4] = {1 << (RESAMPLE_WEIGHT_BITS - 1), 1 << (RESAMPLE_WEIGHT_BITS - 1), 1 << (RESAMPLE_WEIGHT_BITS - 1), 1 << (RESAMPLE_WEIGHT_BITS - 1)};
+            LONG k = 0;
+            while (k < weights->counts[cColumn]) {
+                int c = 0;
+                while (c < 4) {
+                    sums[c] += taps[k] * pixels[4 * k + c];
+                    c ++;
+                }
+                k ++;
+            }
+            int c = 0;
+            while (c < 4) {
+                target[4 * cColumn + c] = clampToByte (sums[c] >> RESAMPLE_WEIGHT_BITS);
+                c ++;
+            }
+            cColumn ++;
+        }
+        cRow ++;
+    }
+    return;
+}
+
+// second pass: every target row of the band is a weighted sum of intermediate rows, the inner loop runs
+// over the bytes of a whole row (vectorizes)
+static void resampleColumns (resizeJob *work) {
+    resampleWeights *weights = work->vertical;
+    LONG byteCount = 4 * work->xRes;
+    int *sums = (int *) malloc (byteCount * sizeof (int));
+    assert (sums != NULL);
+    row cRow = work->firstRow;
+    while (cRow < work->firstRow + work->rowCount) {
+        int *taps = weights->weights + (unsigned long long) cRow * weights->maxCount;
+        LONG i = 0;
+        while (i < byteCount) {
+            sums[i] = 1 << (RESAMPLE_WEIGHT_BITS - 1);
+            i ++;
+        }
+        LONG k = 0;
+        while (k < weights->counts[cRow]) {
+            int weight = taps[k];
+            byte *source = (byte *) (work->intermediate + (unsigned long long) (weights->starts[cRow] + k) * work->xRes);
+            i = 0;
+            while (i < byteCount) {
+                sums[i] += weight * source[i];
+                i ++;
+            }
+            k ++;
+        }
+        byte *target = (byte *) (work->target + (unsigned long long) cRow * work->xRes);
+        i = 0;
+        while (i < byteCount) {
+            target[i] = clampToByte (sums[i] >> RESAMPLE_WEIGHT_BITS);
+            i ++;
+        }
+        cRow ++;
+    }
+    free (sums);
+    return;
+}
+
+// color * alpha / 255, rounded
+static void premultiplyPixels (pixelArray target, pixelArray source, unsigned long long pixelCount) {
+    unsigned long long i = 0;
+    while (i < pixelCount) {
+        unsigned int alpha = source[i].alpha;
+        unsigned int red = source[i].red * alpha + 128;
+        unsigned int green = source[i].green * alpha + 128;
+        unsigned int blue = source[i].blue * alpha + 128;
+        target[i].red = (red + (red >> 8)) >> 8;
+        target[i].green = (green + (green >> 8)) >> 8;
+        target[i].blue = (blue + (blue >> 8)) >> 8;
+        target[i].alpha = alpha;
+        i ++;
+    }
+    return;
+}
+
+// color * 255 / alpha through a table of 16 bit reciprocals (fillUnpremultiplyReciprocals), fully transparent
+// pixels become black
+static void unpremultiplyPixels (pixelArray pixels, unsigned long long pixelCount, unsigned int *reciprocals) {
+    unsigned long long i = 0;
+    while (i < pixelCount) {
+        unsigned int reciprocal = reciprocals[pixels[i].alpha];
+        pixels[i].red = clampToByte ((pixels[i].red * reciprocal + (1 << 15)) >> 16);
+        pixels[i].green = clampToByte ((pixels[i].green * reciprocal + (1 << 15)) >> 16);
+        pixels[i].blue = clampToByte ((pixels[i].blue * reciprocal + (1 << 15)) >> 16);
+        i ++;
+    }
+    return;
+}
+
+// built once per call of the kernels rather than per row
+static void fillUnpremultiplyReciprocals (unsigned int *reciprocals) {
+    reciprocals[0] = 0;
+    int alpha = 1;
+    while (alpha < 256) {
+        reciprocals[alpha] = ((255 << 16) + alpha / 2) / alpha;
+        alpha ++;
+    }
+    return;
+}
+
+// keeps premultiplied colors within their alpha (written branch free so that it vectorizes)
+static void clampColorsToAlpha (pixelArray pixels, unsigned long long pixelCount) {
+    unsigned long long i = 0;
+    while (i < pixelCount) {
+        byte alpha = pixels[i].alpha;
+        pixels[i].red = (pixels[i].red < alpha) ? pixels[i].red : alpha;
+        pixels[i].green = (pixels[i].green < alpha) ? pixels[i].green : alpha;
+        pixels[i].blue = (pixels[i].blue < alpha) ? pixels[i].blue : alpha;
+        i ++;
+    }
+    return;
+}
+
+static byte clampToByte (int value) {
+    if (value < MIN_RGB_VALUE) {
+        value = MIN_RGB_VALUE;
+    } else if (value > MAX_RGB_VALUE) {
+        value = MAX_RGB_VALUE;
+    }
+    return (byte) value;
+}
+
+bmpPtr downsampleBmp (bmpPtr sample) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    bmpPtr target = createHalfBmp (sample);
+    row cRow = 0;
+    while (cRow < target->yRes) {
+        LONG rowCount = (2 * cRow + 1 < sample->yRes) ? 2 : 1;
+        ensureRowsResident (sample, 2 * cRow, rowCount);
+        downsampleRow (target, sample, cRow);
+        cRow ++;
+    }
+    return target;
+}
+
+int getPyramidLevelCount (LONG xRes, LONG yRes) {
+    assert (xRes > 0 && yRes > 0);
+    int levelCount = 0;
+    while (xRes > 1 || yRes > 1) {
+        xRes = (xRes + 1) / 2;
+        yRes = (yRes + 1) / 2;
+        levelCount ++;
+    }
+    return levelCount;
+}
+
+bmpPtr *buildPyramid (bmpPtr sample, int *levelCount) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (levelCount != NULL);
+    *levelCount = getPyramidLevelCount (sample->xRes, sample->yRes);
+    bmpPtr *levels = (bmpPtr *) malloc ((*levelCount + 1) * sizeof (bmpPtr));
+    assert (levels != NULL);
+    bmpPtr parent = sample;
+    int level = 0;
+    while (level < *levelCount) {
+        levels[level] = createHalfBmp (parent);
+        parent = levels[level];
+        level ++;
+    }
+    if (*levelCount > 0) {
+        row cRow = 0;
+        while (cRow < levels[0]->yRes) {
+            LONG rowCount = (2 * cRow + 1 < sample->yRes) ? 2 : 1;
+            ensureRowsResident (sample, 2 * cRow, rowCount);
+            downsampleRow (levels[0], sample, cRow);
+            // the rows just written are still in cache for the levels below
+            cascadePyramidRow (levels, *levelCount, 0, cRow);
+            cRow ++;
+        }
+    }
+    return levels;
+}
+
+void destroyPyramid (bmpPtr *levels, int levelCount) {
+    assert (levels != NULL);
+    int level = 0;
+    while (level < levelCount) {
+        destroyBmp (levels[level]);
+        level ++;
+    }
+    free (levels);
+    return;
+}
+
+static bmpPtr createHalfBmp (bmpPtr sample) {
+    return createBmpLike (sample, sample->DIBVersion, sample->pixelFormat, (sample->xRes + 1) / 2, (sample->yRes + 1) / 2);
+}
+
+// averages source rows 2 * targetRow and 2 * targetRow + 1 (or the last row twice) into targetRow
+// the plain average runs over the bytes of whole pixel pairs (vectorizes), straight ARGB_32 pixels whose 4 alphas
+// differ are then recomputed weighted by alpha (premultiplied colors are already weighted)
+static void downsampleRow (bmpPtr target, bmpPtr source, row targetRow) {
+    row upperRow = 2 * targetRow;
+    row lowerRow = upperRow;
+    if (upperRow + 1 < source->yRes) {
+        lowerRow = upperRow + 1;
+    }
+    byte *upper = (byte *) rowPixels (source, upperRow);
+    byte *lower = (byte *) rowPixels (source, lowerRow);
+    byte *out = (byte *) (target->pixelArray + (unsigned long long) targetRow * target->xRes);
+    LONG pairBytes = 4 * (source->xRes / 2);
+    LONG i = 0;
+    while (i < pairBytes) {
+        LONG k = 2 * i;
+        out[i] = (upper[k] + upper[k + 4] + lower[k] + lower[k + 4] + 2) >> 2;
+        out[i + 1] = (upper[k + 1] + upper[k + 5] + lower[k + 1] + lower[k + 5] + 2) >> 2;
+        out[i + 2] = (upper[k + 2] + upper[k + 6] + lower[k + 2] + lower[k + 6] + 2) >> 2;
+        out[i + 3] = (upper[k + 3] + upper[k + 7] + lower[k + 3] + lower[k + 7] + 2) >> 2;
+        i += 4;
+    }
+    if (source->xRes % 2 != 0) {
+        LONG k = 4 * (source->xRes - 1);
+        int c = 0;
+        while (c < 4) {
+            out[pairBytes + c] = (2 * upper[k + c] + 2 * lower[k + c] + 2) >> 2;
+            c ++;
+        }
+    }
+    if (source->pixelFormat == ARGB_32 && !source->premultiplied) {
+        column cColumn = 0;
+        while (cColumn < target->xRes) {
+            column left = 2 * cColumn;
+            column right = left;
+            if (left + 1 < source->xRes) {
+                right = left + 1;
+            }
+            pixelArray block[4] = {(pixelArray) upper + left, (pixelArray) upper + right, (pixelArray) lower + left, (pixelArray) lower + right};
+            byte alpha = block[0]->alpha;
+            if (block[1]->alpha != alpha || block[2]->alpha != alpha || block[3]->alpha != alpha) {
+                unsigned int alphaSum = 0;
+                unsigned int red = 0;
+                unsigned int green = 0;
+                unsigned int blue = 0;
+                int b = 0;
+                while (b < 4) {
+                    alphaSum += block[b]->alpha;
+                    red += block[b]->red * block[b]->alpha;
+                    green += block[b]->green * block[b]->alpha;
+                    blue += block[b]->blue * block[b]->alpha;
+                    b ++;
+                }
+                // alphas differ so alphaSum > 0
+                pixelArray outPixel = (pixelArray) out + cColumn;
+                outPixel->red = (red + alphaSum / 2) / alphaSum;
+                outPixel->green = (green + alphaSum / 2) / alphaSum;
+                outPixel->blue = (blue + alphaSum / 2) / alphaSum;
+            }
+            cColumn ++;
+        }
+    }
+    return;
+}
+
+// after row cRow of levels[level] is written, extends the levels below for as long as a pair of rows is complete
+static void cascadePyramidRow (bmpPtr *levels, int levelCount, int level, row cRow) {
+    while (level + 1 < levelCount && (cRow % 2 == 1 || cRow == levels[level]->yRes - 1)) {
+        downsampleRow (levels[level + 1], levels[level], cRow / 2);
+        cRow /= 2;
+        level ++;
+    }
+    return;
+}
+
+bmpPtr orientBmp (bmpPtr sample, orientation orientation) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    verifyOrientation (orientation);
+    ensureAllRowsResident (sample);
+    bmpPtr target;
+    if (swapsAxes (orientation)) {
+        target = createBmpLike (sample, sample->DIBVersion, sample->pixelFormat, sample->yRes, sample->xRes);
+        target->printResX = sample->printResY;
+        target->printResY = sample->printResX;
+    } else {
+        target = createBmpLike (sample, sample->DIBVersion, sample->pixelFormat, sample->xRes, sample->yRes);
+    }
+    if (hasPackedRows (sample)) {
+        orientPixels (target->pixelArray, sample->pixelArray, sample->xRes, sample->yRes, orientation);
+    } else {
+        pixelArray packed = packPixels (sample);
+        orientPixels (target->pixelArray, packed, sample->xRes, sample->yRes, orientation);
+        free (packed);
+    }
+    return target;
+}
+
+channelPtr orientChannel (channelPtr source, orientation orientation) {
+    assert (source != NULL);
+    verifyOrientation (orientation);
+    channelPtr target;
+    if (swapsAxes (orientation)) {
+        target = createChannel (source->yRes, source->xRes);
+    } else {
+        target = createChannel (source->xRes, source->yRes);
+    }
+    orientBytes (target->channelArray, source->channelArray, source->xRes, source->yRes, orientation);
+    return target;
+}
+
+void flipBmpVertically (bmpPtr sample) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    ensureAllRowsResident (sample);
+    unsigned long long rowBytes = (unsigned long long) sample->xRes * sizeof (pixel);
+    pixelArray buffer = (pixelArray) malloc (rowBytes);
+    assert (buffer != NULL);
+    row top = 0;
+    row bottom = sample->yRes - 1;
+    while (top < bottom) {
+        pixelArray upper = rowPixels (sample, top);
+        pixelArray lower = rowPixels (sample, bottom);
+        memcpy (buffer, upper, rowBytes);
+        memcpy (upper, lower, rowBytes);
+        memcpy (lower, buffer, rowBytes);
+        top ++;
+        bottom --;
+    }
+    free (buffer);
+    markAllPixelsDirty (sample);
+    return;
+}
+
+static void verifyOrientation (orientation orientation) {
+    assert (orientation >= ROTATE_90 && orientation <= TRANSPOSE);
+    return;
+}
+
+static int swapsAxes (orientation orientation) {
+    return orientation == ROTATE_90 || orientation == ROTATE_270 || orientation == TRANSPOSE;
+}
+
+// target (row, column) is source [base + row * rowStep + column * columnStep] (xRes x yRes source)
+static void evaluateOrientationSteps (orientation orientation, LONG xRes, LONG yRes, long long *base, long long *rowStep, long long *columnStep) {
+    if (orientation == ROTATE_90) {
+        *base = (long long) (yRes - 1) * xRes;
+        *rowStep = 1;
+        *columnStep = -xRes;
+    } else if (orientation == ROTATE_180) {
+        *base = (long long) yRes * xRes - 1;
+        *rowStep = -xRes;
+        *columnStep = -1;
+    } else if (orientation == ROTATE_270) {
+        *base = xRes - 1;
+        *rowStep = -1;
+        *columnStep = xRes;
+    } else if (orientation == FLIP_HORIZONTAL) {
+        *base = xRes - 1;
+        *rowStep = xRes;
+        *columnStep = -1;
+    } else if (orientation == FLIP_VERTICAL) {
+        *base = (long long) (yRes - 1) * xRes;
+        *rowStep = -xRes;
+        *columnStep = 1;
+    } else {
+        *base = 0;
+        *rowStep = 1;
+        *columnStep = xRes;
+    }
+    return;
+}
+
+// rows that stay rows are copied or reversed as a whole, otherwise the target is filled tile by tile: the
+// ORIENT_TILE_SIZE source rows read by a tile stay in cache while its target rows are written sequentially
+static void orientPixels (pixelArray target, pixelArray source, LONG xRes, LONG yRes, orientation orientation) {
+    long long base;
+    long long rowStep;
+    long long columnStep;
+    evaluateOrientationSteps (orientation, xRes, yRes, &base, &rowStep, &columnStep);
+    LONG targetXRes = xRes;
+    LONG targetYRes = yRes;
+    if (swapsAxes (orientation)) {
+        targetXRes = yRes;
+        targetYRes = xRes;
+    }
+    if (columnStep == 1 || columnStep == -1) {
+        row cRow = 0;
+        while (cRow < targetYRes) {
+            pixelArray sourceRow = source + base + cRow * rowStep;
+            pixelArray targetRow = target + (unsigned long long) cRow * targetXRes;
+            if (columnStep == 1) {
+                memcpy (targetRow, sourceRow, targetXRes * sizeof (pixel));
+            } else {
+                column cColumn = 0;
+                while (cColumn < targetXRes) {
+                    targetRow[cColumn] = sourceRow[-cColumn];
+                    cColumn ++;
+                }
+            }
+            cRow ++;
+        }
+    } else {
+        row tileRow = 0;
+        while (tileRow < targetYRes) {
+            row lastRow = tileRow + ORIENT_TILE_SIZE;
+            if (lastRow > targetYRes) {
+                lastRow = targetYRes;
+            }
+            column tileColumn = 0;
+            while (tileColumn < targetXRes) {
+                column lastColumn = tileColumn + ORIENT_TILE_SIZE;
+                if (lastColumn > targetXRes) {
+                    lastColumn = targetXRes;
+                }
+                row cRow = tileRow;
+                while (cRow < lastRow) {
+                    pixelArray targetRow = target + (unsigned long long) cRow * targetXRes;
+                    pixelArray sourceRow = source + base + cRow * rowStep;
+                    column cColumn = tileColumn;
+                    while (cColumn < lastColumn) {
+                        targetRow[cColumn] = sourceRow[cColumn * columnStep];
+                        cColumn ++;
+                    }
+                    cRow ++;
+                }
+                tileColumn = lastColumn;
+            }
+            tileRow = lastRow;
+        }
+    }
+    return;
+}
+
+// orientPixels for 8 bit planes
+static void orientBytes (channelArray target, channelArray source, LONG xRes, LONG yRes, orientation orientation) {
+    long long base;
+    long long rowStep;
+    long long columnStep;
+    evaluateOrientationSteps (orientation, xRes, yRes, &base, &rowStep, &columnStep);
+    LONG targetXRes = xRes;
+    LONG targetYRes = yRes;
+    if (swapsAxes (orientation)) {
+        targetXRes = yRes;
+        targetYRes = xRes;
+    }
+    if (columnStep == 1 || columnStep == -1) {
+        row cRow = 0;
+        while (cRow < targetYRes) {
+            channelArray sourceRow = source + base + cRow * rowStep;
+            channelArray targetRow = target + (unsigned long long) cRow * targetXRes;
+            if (columnStep == 1) {
+                memcpy (targetRow, sourceRow, targetXRes);
+            } else {
+                column cColumn = 0;
+                while (cColumn < targetXRes) {
+                    targetRow[cColumn] = sourceRow[-cColumn];
+                    cColumn ++;
+                }
+            }
+            cRow ++;
+        }
+    } else {
+        row tileRow = 0;
+        while (tileRow < targetYRes) {
+            row lastRow = tileRow + ORIENT_TILE_SIZE;
+            if (lastRow > targetYRes) {
+                lastRow = targetYRes;
+            }
+            column tileColumn = 0;
+            while (tileColumn < targetXRes) {
+                column lastColumn = tileColumn + ORIENT_TILE_SIZE;
+                if (lastColumn > targetXRes) {
+                    lastColumn = targetXRes;
+                }
+                row cRow = tileRow;
+                while (cRow < lastRow) {
+                    channelArray targetRow = target + (unsigned long long) cRow * targetXRes;
+                    channelArray sourceRow = source + base + cRow * rowStep;
+                    column cColumn = tileColumn;
+                    while (cColumn < lastColumn) {
+                        targetRow[cColumn] = sourceRow[cColumn * columnStep];
+                        cColumn ++;
+                    }
+                    cRow ++;
+                }
+                tileColumn = lastColumn;
+            }
+            tileRow = lastRow;
+        }
+    }
+    return;
+}
+
+// order in which the rows of the pixelArray are encoded into the file
+static rowOrder evaluateEncodeOrder (bmpPtr sample) {
+    rowOrder order = sample->rowOrder;
+    if (sample->flipOnSave) {
+        order = (order == TOP_DOWN) ? BOTTOM_UP : TOP_DOWN;
+    }
+    return order;
+}
+
+void compositeBmp (bmpPtr target, bmpPtr source, LONG x, LONG y, blendMode mode, int threadCount) {
+    assert (target != NULL && source != NULL);
+    assert (target->pixelArray != NULL && source->pixelArray != NULL);
+    verifyBlendMode (mode);
+    assert (threadCount > 0);
+    compositeJob work;
+    work.target = target;
+    work.source = source;
+    work.mode = mode;
+    // clip the source rectangle to the target
+    work.targetX = x;
+    work.sourceX = 0;
+    if (x < 0) {
+        work.targetX = 0;
+        work.sourceX = -x;
+    }
+    work.targetY = y;
+    work.sourceY = 0;
+    if (y < 0) {
+        work.targetY = 0;
+        work.sourceY = -y;
+    }
+    LONG width = source->xRes - work.sourceX;
+    if (width > target->xRes - work.targetX) {
+        width = target->xRes - work.targetX;
+    }
+    LONG height = source->yRes - work.sourceY;
+    if (height > target->yRes - work.targetY) {
+        height = target->yRes - work.targetY;
+    }
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    work.width = width;
+    ensureRowsResident (target, work.targetY, height);
+    ensureRowsResident (source, work.sourceY, height);
+
+    compositeJob *jobs = (compositeJob *) malloc (threadCount * sizeof (compositeJob));
+    assert (jobs != NULL);
+    jobs[0] = work;
+    runRowBands (compositeWorker, jobs, sizeof (compositeJob), 0, height, 1, threadCount);
+    free (jobs);
+    markRowsWritten (target, work.targetY, height);
+    return;
+}
+
+static void verifyBlendMode (blendMode mode) {
+    assert (mode >= BLEND_SOURCE_OVER && mode <= BLEND_ADD);
+    return;
+}
+
+static void *compositeWorker (void *job) {
+    compositeJob *band = (compositeJob *) job;
+    int sourceOpaque = band->source->pixelFormat != ARGB_32;
+    int targetOpaque = band->target->pixelFormat != ARGB_32;
+    // blending happens in the alpha storage of the target, a translucent source stored the other way is
+    // converted a row at a time (as is an RGB_24 source over a premultiplied target, to give it its alpha)
+    int premultiplied = band->target->premultiplied;
+    pixelArray converted = NULL;
+    unsigned int reciprocals[256];
+    if (band->source->premultiplied != premultiplied || (sourceOpaque && premultiplied)) {
+        converted = (pixelArray) malloc ((unsigned long long) band->width * sizeof (pixel));
+        assert (converted != NULL);
+        fillUnpremultiplyReciprocals (reciprocals);
+    }
+    LONG i = 0;
+    while (i < band->rows.rowCount) {
+        pixelArray target = rowPixels (band->target, band->targetY + band->rows.firstRow + i) + band->targetX;
+        pixelArray source = rowPixels (band->source, band->sourceY + band->rows.firstRow + i) + band->sourceX;
+        if (converted != NULL) {
+            if (sourceOpaque) {
+                convertPixels (converted, source, band->width, ARGB_32, MAX_RGB_VALUE);
+            } else if (premultiplied) {
+                premultiplyPixels (converted, source, band->width);
+            } else {
+                memcpy (converted, source, (unsigned long long) band->width * sizeof (pixel));
+                unpremultiplyPixels (converted, band->width, reciprocals);
+            }
+            source = converted;
+        }
+        compositeRow (target, source, band->width, band->mode, sourceOpaque, targetOpaque, premultiplied);
+        i ++;
+    }
+    free (converted);
+    return NULL;
+}
+
+// splits a row in runs: transparent source pixels are skipped, pixels opaque on both sides need no division
+// (straight and premultiplied colors are the same there)
+static void compositeRow (pixelArray target, pixelArray source, LONG width, blendMode mode, int sourceOpaque, int targetOpaque, int premultiplied) {
+    LONG i = 0;
+    while (i < width) {
+        LONG end = i;
+        if (!sourceOpaque && source[i].alpha == 0) {
+            while (end < width && source[end].alpha == 0) {
+                end ++;
+            }
+        } else if ((sourceOpaque || source[i].alpha == MAX_RGB_VALUE) && (targetOpaque || target[i].alpha == MAX_RGB_VALUE)) {
+            while (end < width && (sourceOpaque || source[end].alpha == MAX_RGB_VALUE) && (targetOpaque || target[end].alpha == MAX_RGB_VALUE)) {
+                end ++;
+            }
+            blendOpaqueRun (target + i, source + i, end - i, mode);
+        } else {
+            end ++;
+            while (end < width && (sourceOpaque || source[end].alpha != 0) &&
+                   !((sourceOpaque || source[end].alpha == MAX_RGB_VALUE) && (targetOpaque || target[end].alpha == MAX_RGB_VALUE))) {
+                end ++;
+            }
+            if (premultiplied) {
+                blendPremultipliedRun (target + i, source + i, end - i, mode);
+            } else {
+                blendRun (target + i, source + i, end - i, mode, sourceOpaque, targetOpaque);
+            }
+        }
+        i = end;
+    }
+    return;
+}
+
+// both sides opaque: the result is the blend term itself, alpha is left as it is
+static void blendOpaqueRun (pixelArray target, pixelArray source, LONG width, blendMode mode) {
+    LONG i = 0;
+    if (mode == BLEND_SOURCE_OVER) {
+        while (i < width) {
+            target[i].red = source[i].red;
+            target[i].green = source[i].green;
+            target[i].blue = source[i].blue;
+            i ++;
+        }
+    } else {
+        while (i < width) {
+            target[i].red = divide255 (blendTerm (source[i].red, target[i].red, mode));
+            target[i].green = divide255 (blendTerm (source[i].green, target[i].green, mode));
+            target[i].blue = divide255 (blendTerm (source[i].blue, target[i].blue, mode));
+            i ++;
+        }
+    }
+    return;
+}
+
+// general case, with Sa, Da the alphas and B the blend term (all scaled by 255):
+// color = (255 * (Sa * (255 - Da) * Sc + (255 - Sa) * Da * Dc) + Sa * Da * B) / (255 * (255 * Sa + Da * (255 - Sa)))
+// alpha = (255 * Sa + Da * (255 - Sa)) / 255, both rounded (the numerator is at most 255^4, it fits in 32 bits)
+// over an opaque target this reduces to ((255 - Sa) * 255 * Dc + Sa * B) / 255^2, a division by a constant
+// BLEND_ADD sums the premultiplied colors instead
+static void blendRun (pixelArray target, pixelArray source, LONG width, blendMode mode, int sourceOpaque, int targetOpaque) {
+    LONG i = 0;
+    while (i < width) {
+        unsigned int sourceAlpha = sourceOpaque ? MAX_RGB_VALUE : source[i].alpha;
+        unsigned int targetAlpha = targetOpaque ? MAX_RGB_VALUE : target[i].alpha;
+        byte sourceColors[3] = {source[i].red, source[i].green, source[i].blue};
+        byte targetColors[3] = {target[i].red, target[i].green, target[i].blue};
+        byte results[3];
+        unsigned int alphaSum;
+        if (mode == BLEND_ADD) {
+            alphaSum = sourceAlpha + targetAlpha;
+            if (alphaSum > MAX_RGB_VALUE) {
+                alphaSum = MAX_RGB_VALUE;
+            }
+            int c = 0;
+            while (c < 3) {
+                unsigned int premultiplied = sourceColors[c] * sourceAlpha + targetColors[c] * targetAlpha;
+                if (premultiplied > MAX_RGB_VALUE * MAX_RGB_VALUE) {
+                    premultiplied = MAX_RGB_VALUE * MAX_RGB_VALUE;
+                }
+                // alphaSum > 0, transparent source pixels never get here
+                unsigned int color = (premultiplied + alphaSum / 2) / alphaSum;
+                if (color > MAX_RGB_VALUE) {
+                    color = MAX_RGB_VALUE;
+                }
+                results[c] = color;
+                c ++;
+            }
+        } else if (targetAlpha == MAX_RGB_VALUE) {
+            alphaSum = MAX_RGB_VALUE;
+            int c = 0;
+            while (c < 3) {
+                unsigned int numerator = (MAX_RGB_VALUE - sourceAlpha) * MAX_RGB_VALUE * targetColors[c];
+                numerator += sourceAlpha * blendTerm (sourceColors[c], targetColors[c], mode);
+                results[c] = (numerator + MAX_RGB_VALUE * MAX_RGB_VALUE / 2) / (MAX_RGB_VALUE * MAX_RGB_VALUE);
+                c ++;
+            }
+        } else {
+            unsigned int sourceOnly = sourceAlpha * (MAX_RGB_VALUE - targetAlpha);
+            unsigned int targetOnly = (MAX_RGB_VALUE - sourceAlpha) * targetAlpha;
+            unsigned int both = sourceAlpha * targetAlpha;
+            unsigned int coverage = MAX_RGB_VALUE * sourceAlpha + targetOnly;
+            alphaSum = divide255 (coverage);
+            unsigned int denominator = MAX_RGB_VALUE * coverage;
+            int c = 0;
+            while (c < 3) {
+                unsigned int numerator = MAX_RGB_VALUE * (sourceOnly * sourceColors[c] + targetOnly * targetColors[c]);
+                numerator += both * blendTerm (sourceColors[c], targetColors[c], mode);
+                // coverage > 0, the source pixel is not transparent
+                results[c] = (numerator + denominator / 2) / denominator;
+                c ++;
+            }
+        }
+        target[i].red = results[0];
+        target[i].green = results[1];
+        target[i].blue = results[2];
+        if (!targetOpaque) {
+            target[i].alpha = alphaSum;
+        }
+        i ++;
+    }
+    return;
+}
+
+// blend of two straight colors scaled by 255 (0 .. 255 * 255)
+static unsigned int blendTerm (unsigned int sourceColor, unsigned int targetColor, blendMode mode) {
+    unsigned int term;
+    if (mode == BLEND_MULTIPLY) {
+        term = sourceColor * targetColor;
+    } else if (mode == BLEND_SCREEN) {
+        term = (sourceColor + targetColor) * MAX_RGB_VALUE - sourceColor * targetColor;
+    } else if (mode == BLEND_OVERLAY) {
+        if (2 * targetColor <= MAX_RGB_VALUE) {
+            term = 2 * sourceColor * targetColor;
+        } else {
+            term = MAX_RGB_VALUE * MAX_RGB_VALUE - 2 * (MAX_RGB_VALUE - sourceColor) * (MAX_RGB_VALUE - targetColor);
+        }
+    } else if (mode == BLEND_ADD) {
+        term = (sourceColor + targetColor) * MAX_RGB_VALUE;
+        if (term > MAX_RGB_VALUE * MAX_RGB_VALUE) {
+            term = MAX_RGB_VALUE * MAX_RGB_VALUE;
+        }
+    } else {
+        term = sourceColor * MAX_RGB_VALUE;
+    }
+    return term;
+}
+
+// premultiplied target (always ARGB_32), with Sp, Dp the premultiplied colors the general case becomes
+// color = (Sp * (255 - Da) + Dp * (255 - Sa) + P) / 255 with P = Sa * Da * B / 255, which with Sa, Da in place of
+// Sp, Dp is also the alpha: the 4 bytes of a pixel go through the same branch free expression (no division by alpha)
+// each mode gets its own copy of the loop so that the mode is folded in and the loop vectorizes
+static void blendPremultipliedRun (pixelArray target, pixelArray source, LONG width, blendMode mode) {
+    if (mode == BLEND_SOURCE_OVER) {
+        blendPremultipliedPixels (target, source, width, BLEND_SOURCE_OVER);
+    } else if (mode == BLEND_MULTIPLY) {
+        blendPremultipliedPixels (target, source, width, BLEND_MULTIPLY);
+    } else if (mode == BLEND_SCREEN) {
+        blendPremultipliedPixels (target, source, width, BLEND_SCREEN);
+    } else if (mode == BLEND_OVERLAY) {
+        blendPremultipliedPixels (target, source, width, BLEND_OVERLAY);
+    } else {
+        blendPremultipliedPixels (target, source, width, BLEND_ADD);
+    }
+    return;
+}
+
+static inline __attribute__ ((always_inline)) void blendPremultipliedPixels (pixelArray target, pixelArray source, LONG width, blendMode mode) {
+    LONG i = 0;
+    while (i < width) {
+        int sourceAlpha = source[i].alpha;
+        int targetAlpha = target[i].alpha;
+        target[i].red = blendPremultiplied (source[i].red, target[i].red, sourceAlpha, targetAlpha, mode);
+        target[i].green = blendPremultiplied (source[i].green, target[i].green, sourceAlpha, targetAlpha, mode);
+        target[i].blue = blendPremultiplied (source[i].blue, target[i].blue, sourceAlpha, targetAlpha, mode);
+        target[i].alpha = blendPremultiplied (sourceAlpha, targetAlpha, sourceAlpha, targetAlpha, mode);
+        i ++;
+    }
+    return;
+}
+
+// one premultiplied value, BLEND_ADD sums the values (clamped)
+static inline byte blendPremultiplied (int sourceColor, int targetColor, int sourceAlpha, int targetAlpha, blendMode mode) {
+    int term;
+    if (mode == BLEND_MULTIPLY) {
+        term = sourceColor * targetColor;
+    } else if (mode == BLEND_SCREEN) {
+        term = sourceColor * targetAlpha + targetColor * sourceAlpha - sourceColor * targetColor;
+    } else if (mode == BLEND_OVERLAY) {
+        int dark = 2 * sourceColor * targetColor;
+        int light = sourceAlpha * targetAlpha - 2 * (targetAlpha - targetColor) * (sourceAlpha - sourceColor);
+        term = (2 * targetColor <= targetAlpha) ? dark : light;
+    } else {
+        term = sourceColor * targetAlpha;
+    }
+    int value = sourceColor * (MAX_RGB_VALUE - targetAlpha) + targetColor * (MAX_RGB_VALUE - sourceAlpha) + term;
+    if (mode == BLEND_ADD) {
+        value = (sourceColor + targetColor) * MAX_RGB_VALUE;
+    }
+    // only colors above their alpha can leave [0, 255 * 255]
+    value = (value < 0) ? 0 : value;
+    value = (value > MAX_RGB_VALUE * MAX_RGB_VALUE) ? MAX_RGB_VALUE * MAX_RGB_VALUE : value;
+    return divide255 (value);
+}
+
+// value / 255 rounded to nearest, exact for value <= 255 * 255
+static unsigned int divide255 (unsigned int value) {
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}
+
+// records rows written by a kernel for saveBitMapInPlace (and for the owner of a view)
+static void markRowsWritten (bmpPtr sample, row firstRow, LONG rowCount) {
+    row cRow = firstRow;
+    while (cRow < firstRow + rowCount) {
+        if (!sample->pixelsUnsynced) {
+            markRowDirty (sample, cRow);
+        }
+        if (sample->viewOwner != NULL) {
+            sample->viewChangedRows[cRow] = 1;
+        }
+        cRow ++;
+    }
+    return;
+}
+
+int getColorModelChannelCount (colorModel model) {
+    verifyColorModel (model);
+    int planeCount = 3;
+    if (model == COLOR_MODEL_LUMA) {
+        planeCount = 1;
+    }
+    return planeCount;
+}
+
+void getColorModelChannels (bmpPtr sample, colorModel model, channelPtr *planes, int threadCount) {
+    assert (sample != NULL && planes != NULL);
+    assert (sample->pixelArray != NULL);
+    verifyColorModel (model);
+    assert (threadCount > 0);
+    ensureAllRowsResident (sample);
+    planes[0] = createChannel (sample->xRes, sample->yRes);
+    if (model == COLOR_MODEL_YCBCR_420) {
+        planes[1] = createChannel ((sample->xRes + 1) / 2, (sample->yRes + 1) / 2);
+        planes[2] = createChannel ((sample->xRes + 1) / 2, (sample->yRes + 1) / 2);
+    } else if (model != COLOR_MODEL_LUMA) {
+        planes[1] = createChannel (sample->xRes, sample->yRes);
+        planes[2] = createChannel (sample->xRes, sample->yRes);
+    }
+    runColorModelJobs (sample, model, planes, 1, threadCount);
+    return;
+}
+
+void setColorModelChannels (bmpPtr sample, colorModel model, channelPtr *planes, int threadCount) {
+    assert (sample != NULL && planes != NULL);
+    assert (sample->pixelArray != NULL);
+    verifyColorModel (model);
+    verifyColorModelChannels (sample, model, planes);
+    assert (threadCount > 0);
+    // alpha is kept, so every row has to be decoded first
+    ensureAllRowsResident (sample);
+    runColorModelJobs (sample, model, planes, 0, threadCount);
+    markRowsWritten (sample, 0, sample->yRes);
+    return;
+}
+
+static void verifyColorModel (colorModel model) {
+    assert (model == COLOR_MODEL_LUMA || model == COLOR_MODEL_YCBCR_444 || model == COLOR_MODEL_YCBCR_420 || model == COLOR_MODEL_HSV);
+    return;
+}
+
+static void verifyColorModelChannels (bmpPtr sample, colorModel model, channelPtr *planes) {
+    int planeCount = getColorModelChannelCount (model);
+    int p = 0;
+    while (p < planeCount) {
+        assert (planes[p] != NULL);
+        LONG xRes = sample->xRes;
+        LONG yRes = sample->yRes;
+        if (p > 0 && model == COLOR_MODEL_YCBCR_420) {
+            xRes = (xRes + 1) / 2;
+            yRes = (yRes + 1) / 2;
+        }
+        assert (planes[p]->xRes == xRes && planes[p]->yRes == yRes);
+        p ++;
+    }
+    return;
+}
+
+// bands of whole row pairs for 4:2:0
+static void runColorModelJobs (bmpPtr sample, colorModel model, channelPtr *planes, int toPlanes, int threadCount) {
+    LONG unitRows = 1;
+    if (model == COLOR_MODEL_YCBCR_420) {
+        unitRows = 2;
+    }
+    unsigned int hueReciprocals[256];
+    unsigned int saturationReciprocals[256];
+    hueReciprocals[0] = 0;
+    saturationReciprocals[0] = 0;
+    int i = 1;
+    while (i < 256) {
+        // 256 hue steps per turn, 6 * delta per turn
+        hueReciprocals[i] = ((256 << 16) + 3 * i) / (6 * i);
+        saturationReciprocals[i] = ((MAX_RGB_VALUE << 16) + i / 2) / i;
+        i ++;
+    }
+
+    colorModelJob *jobs = (colorModelJob *) malloc (threadCount * sizeof (colorModelJob));
+    assert (jobs != NULL);
+    jobs[0].sample = sample;
+    jobs[0].model = model;
+    jobs[0].planes = planes;
+    jobs[0].toPlanes = toPlanes;
+    jobs[0].hueReciprocals = hueReciprocals;
+    jobs[0].saturationReciprocals = saturationReciprocals;
+    runRowBands (colorModelWorker, jobs, sizeof (colorModelJob), 0, sample->yRes, unitRows, threadCount);
+    free (jobs);
+    return;
+}
+
+// every kernel reads (or writes) the interleaved pixels and the planes in the same pass, no R/G/B channel is built
+static void *colorModelWorker (void *job) {
+    colorModelJob *band = (colorModelJob *) job;
+    bmpPtr sample = band->sample;
+    channelPtr *planes = band->planes;
+    LONG xRes = sample->xRes;
+    byte *upsampled = NULL;
+    if (band->model == COLOR_MODEL_YCBCR_420 && !band->toPlanes) {
+        upsampled = (byte *) malloc (2 * (unsigned long long) xRes);
+        assert (upsampled != NULL);
+    }
+    row cRow = band->rows.firstRow;
+    while (cRow < band->rows.firstRow + band->rows.rowCount) {
+        pixelArray pixels = rowPixels (sample, cRow);
+        unsigned long long index = (unsigned long long) cRow * xRes;
+        byte *first = planes[0]->channelArray + index;
+        if (band->model == COLOR_MODEL_LUMA) {
+            if (band->toPlanes) {
+                lumaRow (first, pixels, xRes);
+            } else {
+                grayRow (pixels, first, xRes);
+            }
+        } else if (band->model == COLOR_MODEL_YCBCR_444) {
+            if (band->toPlanes) {
+                yCbCrRow (first, planes[1]->channelArray + index, planes[2]->channelArray + index, pixels, xRes);
+            } else {
+                rgbFromYCbCrRow (pixels, first, planes[1]->channelArray + index, planes[2]->channelArray + index, xRes);
+            }
+        } else if (band->model == COLOR_MODEL_YCBCR_420) {
+            unsigned long long chromaIndex = (unsigned long long) (cRow / 2) * planes[1]->xRes;
+            byte *blueChroma = planes[1]->channelArray + chromaIndex;
+            byte *redChroma = planes[2]->channelArray + chromaIndex;
+            if (band->toPlanes) {
+                // one row of chroma per pair of rows, the last row of an odd height is paired with itself
+                pixelArray lower = pixels;
+                lumaRow (first, pixels, xRes);
+                if (cRow + 1 < sample->yRes) {
+                    lower = rowPixels (sample, cRow + 1);
+                    lumaRow (first + xRes, lower, xRes);
+                }
+                chroma420Row (blueChroma, redChroma, pixels, lower, xRes);
+                cRow ++;
+            } else {
+                upsampleChromaRow (upsampled, blueChroma, xRes);
+                upsampleChromaRow (upsampled + xRes, redChroma, xRes);
+                rgbFromYCbCrRow (pixels, first, upsampled, upsampled + xRes, xRes);
+            }
+        } else {
+            if (band->toPlanes) {
+                hsvRow (first, planes[1]->channelArray + index, planes[2]->channelArray + index, pixels, xRes,
+                        band->hueReciprocals, band->saturationReciprocals);
+            } else {
+                rgbFromHsvRow (pixels, first, planes[1]->channelArray + index, planes[2]->channelArray + index, xRes);
+            }
+        }
+        cRow ++;
+    }
+    free (upsampled);
+    return NULL;
+}
+
+static void lumaRow (byte *luma, pixelArray pixels, LONG pixelCount) {
+    LONG i = 0;
+    while (i < pixelCount) {
+        int sum = LUMA_RED_WEIGHT * pixels[i].red + LUMA_GREEN_WEIGHT * pixels[i].green + LUMA_BLUE_WEIGHT * pixels[i].blue;
+        luma[i] = (sum + (1 << (COLOR_WEIGHT_BITS - 1))) >> COLOR_WEIGHT_BITS;
+        i ++;
+    }
+    return;
+}
+
+static void yCbCrRow (byte *luma, byte *blueChroma, byte *redChroma, pixelArray pixels, LONG pixelCount) {
+    int offset = (CHROMA_OFFSET << COLOR_WEIGHT_BITS) + (1 << (COLOR_WEIGHT_BITS - 1));
+    LONG i = 0;
+    while (i < pixelCount) {
+        int red = pixels[i].red;
+        int green = pixels[i].green;
+        int blue = pixels[i].blue;
+        int sum = LUMA_RED_WEIGHT * red + LUMA_GREEN_WEIGHT * green + LUMA_BLUE_WEIGHT * blue;
+        luma[i] = (sum + (1 << (COLOR_WEIGHT_BITS - 1))) >> COLOR_WEIGHT_BITS;
+        // 128 + 127.5 rounds up to 256
+        int blueSum = (BLUE_CHROMA_RED_WEIGHT * red + BLUE_CHROMA_GREEN_WEIGHT * green + BLUE_CHROMA_BLUE_WEIGHT * blue + offset) >> COLOR_WEIGHT_BITS;
+        int redSum = (RED_CHROMA_RED_WEIGHT * red + RED_CHROMA_GREEN_WEIGHT * green + RED_CHROMA_BLUE_WEIGHT * blue + offset) >> COLOR_WEIGHT_BITS;
+        blueChroma[i] = (blueSum > MAX_RGB_VALUE) ? MAX_RGB_VALUE : blueSum;
+        redChroma[i] = (redSum > MAX_RGB_VALUE) ? MAX_RGB_VALUE : redSum;
+        i ++;
+    }
+    return;
+}
+
+// chroma of the average of every 2x2 block (chroma is linear, so this is the average of the 4 chromas)
+// the last column of an odd width is paired with itself
+static void chroma420Row (byte *blueChroma, byte *redChroma, pixelArray upper, pixelArray lower, LONG xRes) {
+    LONG pairCount = xRes / 2;
+    LONG i = 0;
+    while (i < pairCount) {
+        LONG left = 2 * i;
+        int red = upper[left].red + upper[left + 1].red + lower[left].red + lower[left + 1].red;
+        int green = upper[left].green + upper[left + 1].green + lower[left].green + lower[left + 1].green;
+        int blue = upper[left].blue + upper[left + 1].blue + lower[left].blue + lower[left + 1].blue;
+        blockChroma (blueChroma + i, redChroma + i, red, green, blue);
+        i ++;
+    }
+    if (xRes % 2 != 0) {
+        LONG last = xRes - 1;
+        blockChroma (blueChroma + pairCount, redChroma + pairCount, 2 * (upper[last].red + lower[last].red),
+                     2 * (upper[last].green + lower[last].green), 2 * (upper[last].blue + lower[last].blue));
+    }
+    return;
+}
+
+// Cb and Cr of the sums of the 4 pixels of a block
+static inline void blockChroma (byte *blueChroma, byte *redChroma, int red, int green, int blue) {
+    int offset = (CHROMA_OFFSET << (COLOR_WEIGHT_BITS + 2)) + (1 << (COLOR_WEIGHT_BITS + 1));
+    int blueSum = (BLUE_CHROMA_RED_WEIGHT * red + BLUE_CHROMA_GREEN_WEIGHT * green + BLUE_CHROMA_BLUE_WEIGHT * blue + offset) >> (COLOR_WEIGHT_BITS + 2);
+    int redSum = (RED_CHROMA_RED_WEIGHT * red + RED_CHROMA_GREEN_WEIGHT * green + RED_CHROMA_BLUE_WEIGHT * blue + offset) >> (COLOR_WEIGHT_BITS + 2);
+    *blueChroma = (blueSum > MAX_RGB_VALUE) ? MAX_RGB_VALUE : blueSum;
+    *redChroma = (redSum > MAX_RGB_VALUE) ? MAX_RGB_VALUE : redSum;
+    return;
+}
+
+// value is the largest component, saturation 255 * delta / max and hue turns once around the 256 values
+// (0 red, 85 green, 171 blue), the divisions go through the reciprocal tables
+static void hsvRow (byte *hue, byte *saturation, byte *value, pixelArray pixels, LONG pixelCount, unsigned int *hueReciprocals, unsigned int *saturationReciprocals) {
+    LONG i = 0;
+    while (i < pixelCount) {
+        int red = pixels[i].red;
+        int green = pixels[i].green;
+        int blue = pixels[i].blue;
+        int max = (red > green) ? red : green;
+        max = (blue > max) ? blue : max;
+        int min = (red < green) ? red : green;
+        min = (blue < min) ? blue : min;
+        int delta = max - min;
+        // position on the turn in units of delta / 6 of a turn
+        int position;
+        if (max == red) {
+            position = green - blue;
+            if (position < 0) {
+                position += 6 * delta;
+            }
+        } else if (max == green) {
+            position = blue - red + 2 * delta;
+        } else {
+            position = red - green + 4 * delta;
+        }
+        hue[i] = ((position * hueReciprocals[delta] + (1 << 15)) >> 16) & MAX_RGB_VALUE;
+        saturation[i] = (delta * saturationReciprocals[max] + (1 << 15)) >> 16;
+        value[i] = max;
+        i ++;
+    }
+    return;
+}
+
+static void grayRow (pixelArray pixels, byte *luma, LONG pixelCount) {
+    LONG i = 0;
+    while (i < pixelCount) {
+        pixels[i].red = luma[i];
+        pixels[i].green = luma[i];
+        pixels[i].blue = luma[i];
+        i ++;
+    }
+    return;
+}
+
+static void rgbFromYCbCrRow (pixelArray pixels, byte *luma, byte *blueChroma, byte *redChroma, LONG pixelCount) {
+    int rounding = 1 << (COLOR_WEIGHT_BITS - 1);
+    LONG i = 0;
+    while (i < pixelCount) {
+        int base = (luma[i] << COLOR_WEIGHT_BITS) + rounding;
+        int blue = blueChroma[i] - CHROMA_OFFSET;
+        int red = redChroma[i] - CHROMA_OFFSET;
+        int redSum = (base + RED_FROM_RED_CHROMA * red) >> COLOR_WEIGHT_BITS;
+        int greenSum = (base - GREEN_FROM_BLUE_CHROMA * blue - GREEN_FROM_RED_CHROMA * red) >> COLOR_WEIGHT_BITS;
+        int blueSum = (base + BLUE_FROM_BLUE_CHROMA * blue) >> COLOR_WEIGHT_BITS;
+        pixels[i].red = (redSum < 0) ? 0 : ((redSum > MAX_RGB_VALUE) ? MAX_RGB_VALUE : redSum);
+        pixels[i].green = (greenSum < 0) ? 0 : ((greenSum > MAX_RGB_VALUE) ? MAX_RGB_VALUE : greenSum);
+        pixels[i].blue = (blueSum < 0) ? 0 : ((blueSum > MAX_RGB_VALUE) ? MAX_RGB_VALUE : blueSum);
+        i ++;
+    }
+    return;
+}
+
+// every chroma value covers 2 pixels of the row (nearest neighbour)
+static void upsampleChromaRow (byte *target, byte *source, LONG xRes) {
+    LONG pairCount = xRes / 2;
+    LONG i = 0;
+    while (i < pairCount) {
+        target[2 * i] = source[i];
+        target[2 * i + 1] = source[i];
+        i ++;
+    }
+    if (xRes % 2 != 0) {
+        target[xRes - 1] = source[pairCount];
+    }
+    return;
+}
+
+// per component the hue goes through 6 sectors of 256 / 6: max for 2 sectors, falling to max * (1 - s) over one,
+// staying there for 2 and rising back over one. Written with min / max only so that the loop vectorizes
+static void rgbFromHsvRow (pixelArray pixels, byte *hue, byte *saturation, byte *value, LONG pixelCount) {
+    LONG i = 0;
+    while (i < pixelCount) {
+        // position on the turn in 1 / 256 of a sector
+        int position = hue[i] * 6;
+        pixels[i].red = hsvComponent (position, 5, value[i], saturation[i]);
+        pixels[i].green = hsvComponent (position, 3, value[i], saturation[i]);
+        pixels[i].blue = hsvComponent (position, 1, value[i], saturation[i]);
+        i ++;
+    }
+    return;
+}
+
+// max * (1 - s * ramp), ramp from 0 to 1 (256) at sectorOffset sectors of the position
+static inline byte hsvComponent (int position, int sectorOffset, int max, int chroma) {
+    int turn = 6 * 256;
+    int k = position + 256 * sectorOffset;
+    k = (k >= turn) ? k - turn : k;
+    int ramp = (k < 4 * 256 - k) ? k : 4 * 256 - k;
+    ramp = (ramp < 256) ? ramp : 256;
+    ramp = (ramp > 0) ? ramp : 0;
+    return divide255 ((max * (MAX_RGB_VALUE * 256 - chroma * ramp) + 128) >> 8);
+}
+
+void applyLUT (bmpPtr sample, byte *redTable, byte *greenTable, byte *blueTable, byte *alphaTable, int threadCount) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (alphaTable == NULL || sample->pixelFormat == ARGB_32);
+    assert (threadCount > 0);
+    if (sample->yRes == 0) {
+        return;
+    }
+    // missing tables are the identity, every pixel then goes through the same 4 lookups
+    byte tables[4 * 256];
+    byte *sources[4] = {redTable, greenTable, blueTable, alphaTable};
+    int c = 0;
+    while (c < 4) {
+        int i = 0;
+        while (i < 256) {
+            tables[c * 256 + i] = (sources[c] == NULL) ? i : sources[c][i];
+            i ++;
+        }
+        c ++;
+    }
+    unsigned int reciprocals[256];
+    fillUnpremultiplyReciprocals (reciprocals);
+    ensureAllRowsResident (sample);
+    lutJob work;
+    work.sample = sample;
+    work.channel = NULL;
+    work.tables = tables;
+    work.reciprocals = reciprocals;
+    runLUTJobs (work, sample->yRes, threadCount);
+    markRowsWritten (sample, 0, sample->yRes);
+    return;
+}
+
+void applyChannelLUT (channelPtr channel, byte *table, int threadCount) {
+    assert (channel != NULL && table != NULL);
+    assert (channel->channelArray != NULL);
+    assert (threadCount > 0);
+    if (channel->yRes == 0) {
+        return;
+    }
+    lutJob work;
+    work.sample = NULL;
+    work.channel = channel;
+    work.tables = table;
+    work.reciprocals = NULL;
+    runLUTJobs (work, channel->yRes, threadCount);
+    return;
+}
+
+void composeLUT (byte *target, byte *first, byte *second) {
+    assert (target != NULL && first != NULL && second != NULL);
+    byte composed[256];
+    int i = 0;
+    while (i < 256) {
+        composed[i] = second[first[i]];
+        i ++;
+    }
+    memcpy (target, composed, sizeof (composed));
+    return;
+}
+
+static void runLUTJobs (lutJob work, LONG rowCount, int threadCount) {
+    lutJob *jobs = (lutJob *) malloc (threadCount * sizeof (lutJob));
+    assert (jobs != NULL);
+    jobs[0] = work;
+    runRowBands (lutWorker, jobs, sizeof (lutJob), 0, rowCount, 1, threadCount);
+    free (jobs);
+    return;
+}
+
+static void *lutWorker (void *job) {
+    lutJob *band = (lutJob *) job;
+    if (band->sample == NULL) {
+        // the rows of a channel are contiguous
+        channelPtr channel = band->channel;
+        mapBytes (channel->channelArray + (unsigned long long) band->rows.firstRow * channel->xRes,
+                  (unsigned long long) band->rows.rowCount * channel->xRes, band->tables);
+        return NULL;
+    }
+    bmpPtr sample = band->sample;
+    row cRow = band->rows.firstRow;
+    while (cRow < band->rows.firstRow + band->rows.rowCount) {
+        pixelArray pixels = rowPixels (sample, cRow);
+        if (sample->premultiplied) {
+            unpremultiplyPixels (pixels, sample->xRes, band->reciprocals);
+            mapPixels (pixels, sample->xRes, band->tables);
+            premultiplyPixels (pixels, pixels, sample->xRes);
+        } else {
+            mapPixels (pixels, sample->xRes, band->tables);
+        }
+        cRow ++;
+    }
+    return NULL;
+}
+
+// 4 independent lookups per pixel, the pixel is read and written whole
+static void mapPixels (pixelArray pixels, LONG pixelCount, byte *tables) {
+    byte *greenTable = tables + 256;
+    byte *blueTable = tables + 2 * 256;
+    byte *alphaTable = tables + 3 * 256;
+    LONG i = 0;
+    while (i < pixelCount) {
+        pixel value = pixels[i];
+        value.red = tables[value.red];
+        value.green = greenTable[value.green];
+        value.blue = blueTable[value.blue];
+        value.alpha = alphaTable[value.alpha];
+        pixels[i] = value;
+        i ++;
+    }
+    return;
+}
+
+static void mapBytes (byte *bytes, unsigned long long byteCount, byte *table) {
+    unsigned long long i = 0;
+    while (i < byteCount) {
+        bytes[i] = table[bytes[i]];
+        i ++;
+    }
+    return;
+}
+
+void computeHistogram (bmpPtr sample, bmpHistogram *histogram, int threadCount) {
+    assert (sample != NULL && histogram != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (threadCount > 0);
+    memset (histogram, 0, sizeof (bmpHistogram));
+    if (sample->yRes > 0) {
+        ensureAllRowsResident (sample);
+        addHistogramRows (histogram, sample, 0, sample->yRes, threadCount);
+    }
+    return;
+}
+
+void accumulateHistogram (bmpHistogram *histogram, bmpPtr sample, LONG firstRow, LONG rowCount) {
+    assert (sample != NULL && histogram != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (firstRow >= 0 && rowCount >= 0 && firstRow + rowCount <= sample->yRes);
+    if (rowCount > 0) {
+        ensureRowsResident (sample, firstRow, rowCount);
+        addHistogramRows (histogram, sample, firstRow, rowCount, 1);
+    }
+    return;
+}
+
+void computeChannelHistogram (channelPtr channel, unsigned long long *counts, int threadCount) {
+    assert (channel != NULL && counts != NULL);
+    assert (channel->channelArray != NULL);
+    assert (threadCount > 0);
+    memset (counts, 0, 256 * sizeof (unsigned long long));
+    if (channel->yRes > 0) {
+        histogramJob work;
+        work.sample = NULL;
+        work.channel = channel;
+        runHistogramJobs (&work, 0, channel->yRes, threadCount, counts, 256);
+    }
+    return;
+}
+
+static void addHistogramRows (bmpHistogram *histogram, bmpPtr sample, LONG firstRow, LONG rowCount, int threadCount) {
+    histogramJob work;
+    work.sample = sample;
+    work.channel = NULL;
+    unsigned long long totals[HISTOGRAM_PIXEL_BINS];
+    memset (totals, 0, sizeof (totals));
+    runHistogramJobs (&work, firstRow, rowCount, threadCount, totals, HISTOGRAM_PIXEL_BINS);
+    int i = 0;
+    while (i < 256) {
+        histogram->red[i] += totals[i];
+        histogram->green[i] += totals[256 + i];
+        histogram->blue[i] += totals[2 * 256 + i];
+        histogram->alpha[i] += totals[3 * 256 + i];
+        histogram->luma[i] += totals[4 * 256 + i];
+        i ++;
+    }
+    return;
+}
+
+// the counts of every band are added to totals
+static void runHistogramJobs (histogramJob *work, LONG firstRow, LONG rowCount, int threadCount, unsigned long long *totals, int binCount) {
+    histogramJob *jobs = (histogramJob *) malloc (threadCount * sizeof (histogramJob));
+    assert (jobs != NULL);
+    jobs[0] = *work;
+    int bandCount = runRowBands (histogramWorker, jobs, sizeof (histogramJob), firstRow, rowCount, 1, threadCount);
+    int t = 0;
+    while (t < bandCount) {
+        int i = 0;
+        while (i < binCount) {
+            totals[i] += jobs[t].counts[i];
+            i ++;
+        }
+        t ++;
+    }
+    free (jobs);
+    return;
+}
+
+static void *histogramWorker (void *job) {
+    histogramJob *band = (histogramJob *) job;
+    int binCount = (band->sample == NULL) ? 256 : HISTOGRAM_PIXEL_BINS;
+    unsigned int *sets = (unsigned int *) calloc (HISTOGRAM_SET_COUNT * binCount, sizeof (unsigned int));
+    assert (sets != NULL);
+    memset (band->counts, 0, binCount * sizeof (unsigned long long));
+    if (band->sample == NULL) {
+        // the rows of a channel are contiguous
+        channelPtr channel = band->channel;
+        byte *bytes = channel->channelArray + (unsigned long long) band->rows.firstRow * channel->xRes;
+        unsigned long long byteCount = (unsigned long long) band->rows.rowCount * channel->xRes;
+        while (byteCount > 0) {
+            unsigned long long chunk = (byteCount < HISTOGRAM_FOLD_PIXELS) ? byteCount : HISTOGRAM_FOLD_PIXELS;
+            countBytes (sets, bytes, chunk);
+            foldHistogramSets (band->counts, sets, binCount);
+            bytes += chunk;
+            byteCount -= chunk;
+        }
+    } else {
+        bmpPtr sample = band->sample;
+        unsigned long long counted = 0;
+        row cRow = band->rows.firstRow;
+        while (cRow < band->rows.firstRow + band->rows.rowCount) {
+            if (counted + sample->xRes > HISTOGRAM_FOLD_PIXELS) {
+                foldHistogramSets (band->counts, sets, binCount);
+                counted = 0;
+            }
+            countPixels (sets, rowPixels (sample, cRow), sample->xRes);
+            counted += sample->xRes;
+            cRow ++;
+        }
+        foldHistogramSets (band->counts, sets, binCount);
+        if (!hasAlphaChannel (sample)) {
+            unsigned long long *alpha = band->counts + 3 * 256;
+            memset (alpha, 0, 256 * sizeof (unsigned long long));
+            alpha[MAX_RGB_VALUE] = (unsigned long long) band->rows.rowCount * sample->xRes;
+        }
+    }
+    free (sets);
+    return NULL;
+}
+
+// pixel i is counted in set i % HISTOGRAM_SET_COUNT (one pixel per set and iteration), luma is rounded as in lumaRow
+static void countPixels (unsigned int *sets, pixelArray pixels, LONG pixelCount) {
+    LONG i = 0;
+    while (i + HISTOGRAM_SET_COUNT <= pixelCount) {
+        int set = 0;
+        while (set < HISTOGRAM_SET_COUNT) {
+            countPixel (sets + set * HISTOGRAM_PIXEL_BINS, pixels[i + set]);
+            set ++;
+        }
+        i += HISTOGRAM_SET_COUNT;
+    }
+    while (i < pixelCount) {
+        countPixel (sets, pixels[i]);
+        i ++;
+    }
+    return;
+}
+
+static inline void countPixel (unsigned int *set, pixel value) {
+    int luma = LUMA_RED_WEIGHT * value.red + LUMA_GREEN_WEIGHT * value.green + LUMA_BLUE_WEIGHT * value.blue;
+    set[value.red] ++;
+    set[256 + value.green] ++;
+    set[2 * 256 + value.blue] ++;
+    set[3 * 256 + value.alpha] ++;
+    set[4 * 256 + ((luma + (1 << (COLOR_WEIGHT_BITS - 1))) >> COLOR_WEIGHT_BITS)] ++;
+    return;
+}
+
+static void countBytes (unsigned int *sets, byte *bytes, unsigned long long byteCount) {
+    unsigned long long i = 0;
+    while (i + HISTOGRAM_SET_COUNT <= byteCount) {
+        int set = 0;
+        while (set < HISTOGRAM_SET_COUNT) {
+            sets[set * 256 + bytes[i + set]] ++;
+            set ++;
+        }
+        i += HISTOGRAM_SET_COUNT;
+    }
+    while (i < byteCount) {
+        sets[bytes[i]] ++;
+        i ++;
+    }
+    return;
+}
+
+// adds the sets to counts and clears them
+static void foldHistogramSets (unsigned long long *counts, unsigned int *sets, int binCount) {
+    int set = 0;
+    while (set < HISTOGRAM_SET_COUNT) {
+        int i = 0;
+        while (i < binCount) {
+            counts[i] += sets[set * binCount + i];
+            sets[set * binCount + i] = 0;
+            i ++;
+        }
+        set ++;
+    }
+    return;
+}
+
+void computeBmpStats (bmpPtr sample, bmpStats *stats, int threadCount) {
+    assert (sample != NULL && stats != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (threadCount > 0);
+    memset (stats, 0, sizeof (bmpStats));
+    if (sample->yRes > 0) {
+        ensureAllRowsResident (sample);
+        addStatsRows (stats, sample, 0, sample->yRes, threadCount);
+    }
+    return;
+}
+
+void accumulateBmpStats (bmpStats *stats, bmpPtr sample, LONG firstRow, LONG rowCount) {
+    assert (sample != NULL && stats != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (firstRow >= 0 && rowCount >= 0 && firstRow + rowCount <= sample->yRes);
+    if (rowCount > 0) {
+        ensureRowsResident (sample, firstRow, rowCount);
+        addStatsRows (stats, sample, firstRow, rowCount, 1);
+    }
+    return;
+}
+
+void computeChannelStats (channelPtr channel, channelStats *stats, int threadCount) {
+    assert (channel != NULL && stats != NULL);
+    assert (channel->channelArray != NULL);
+    assert (threadCount > 0);
+    memset (stats, 0, sizeof (channelStats));
+    if (channel->yRes > 0) {
+        statsJob work;
+        work.sample = NULL;
+        work.channel = channel;
+        runStatsJobs (&work, 0, channel->yRes, threadCount, stats, 1);
+    }
+    return;
+}
+
+static void addStatsRows (bmpStats *stats, bmpPtr sample, LONG firstRow, LONG rowCount, int threadCount) {
+    statsJob work;
+    work.sample = sample;
+    work.channel = NULL;
+    channelStats totals[4];
+    memset (totals, 0, sizeof (totals));
+    runStatsJobs (&work, firstRow, rowCount, threadCount, totals, 4);
+    mergeChannelStats (&stats->red, totals);
+    mergeChannelStats (&stats->green, totals + 1);
+    mergeChannelStats (&stats->blue, totals + 2);
+    mergeChannelStats (&stats->alpha, totals + 3);
+    return;
+}
+
+// the statistics of the bands are merged into totals in band order
+static void runStatsJobs (statsJob *work, LONG firstRow, LONG rowCount, int threadCount, channelStats *totals, int channelCount) {
+    statsJob *jobs = (statsJob *) malloc (threadCount * sizeof (statsJob));
+    assert (jobs != NULL);
+    jobs[0] = *work;
+    int bandCount = runRowBands (statsWorker, jobs, sizeof (statsJob), firstRow, rowCount, 1, threadCount);
+    int t = 0;
+    while (t < bandCount) {
+        int c = 0;
+        while (c < channelCount) {
+            mergeChannelStats (totals + c, jobs[t].stats + c);
+            c ++;
+        }
+        t ++;
+    }
+    free (jobs);
+    return;
+}
+
+static void *statsWorker (void *job) {
+    statsJob *band = (statsJob *) job;
+    memset (band->stats, 0, sizeof (band->stats));
+    if (band->sample == NULL) {
+        // the rows of a channel are contiguous
+        channelPtr channel = band->channel;
+        statsBytes (band->stats, 1, channel->channelArray + (unsigned long long) band->rows.firstRow * channel->xRes,
+                    (unsigned long long) band->rows.rowCount * channel->xRes);
+    } else {
+        bmpPtr sample = band->sample;
+        if (hasPackedRows (sample)) {
+            statsBytes (band->stats, 4, (byte *) rowPixels (sample, band->rows.firstRow),
+                        (unsigned long long) band->rows.rowCount * sample->xRes * sizeof (pixel));
+        } else {
+            row cRow = band->rows.firstRow;
+            while (cRow < band->rows.firstRow + band->rows.rowCount) {
+                statsBytes (band->stats, 4, (byte *) rowPixels (sample, cRow), (unsigned long long) sample->xRes * sizeof (pixel));
+                cRow ++;
+            }
+        }
+        if (!hasAlphaChannel (sample)) {
+            channelStats *alpha = band->stats + 3;
+            alpha->min = MAX_RGB_VALUE;
+            alpha->max = MAX_RGB_VALUE;
+            alpha->sum = alpha->count * MAX_RGB_VALUE;
+            alpha->sumOfSquares = alpha->count * MAX_RGB_VALUE * MAX_RGB_VALUE;
+            alpha->blackCount = 0;
+            alpha->whiteCount = alpha->count;
+        }
+    }
+    return NULL;
+}
+
+// merges the statistics of bytes into stats, byte i belongs to channel i % channelCount (1 or 4)
+// the lanes are updated 16 bytes at a time with no dependency between lanes, so the loop vectorizes. Sums and
+// clipped counts go through narrow lanes for blocks of STATS_BLOCK_STEPS steps: more values per vector and
+// few enough accumulators to stay in registers
+static void statsBytes (channelStats *stats, int channelCount, byte *bytes, unsigned long long byteCount) {
+    statsLanes lanes;
+    while (byteCount > 0) {
+        unsigned long long chunk = (byteCount < STATS_CHUNK_BYTES) ? byteCount : STATS_CHUNK_BYTES;
+        unsigned long long wholeSteps = chunk - chunk % STATS_LANE_COUNT;
+        clearStatsLanes (&lanes);
+        unsigned long long i = 0;
+        while (i < wholeSteps) {
+            unsigned long long blockEnd = i + STATS_BLOCK_STEPS * STATS_LANE_COUNT;
+            if (blockEnd > wholeSteps) {
+                blockEnd = wholeSteps;
+            }
+            unsigned short blockSums[STATS_LANE_COUNT] = {0};
+            byte blockBlacks[STATS_LANE_COUNT] = {0};
+            byte blockWhites[STATS_LANE_COUNT] = {0};
+            while (i < blockEnd) {
+                int lane = 0;
+                while (lane < STATS_LANE_COUNT) {
+                    unsigned short value = bytes[i + lane];
+                    blockSums[lane] += value;
+                    lanes.squares[lane] += (unsigned int) value * value;
+                    blockBlacks[lane] += (value == 0);
+                    blockWhites[lane] += (value == MAX_RGB_VALUE);
+                    lanes.mins[lane] = (value < lanes.mins[lane]) ? value : lanes.mins[lane];
+                    lanes.maxs[lane] = (value > lanes.maxs[lane]) ? value : lanes.maxs[lane];
+                    lane ++;
+                }
+                i += STATS_LANE_COUNT;
+            }
+            int lane = 0;
+            while (lane < STATS_LANE_COUNT) {
+                lanes.sums[lane] += blockSums[lane];
+                lanes.blacks[lane] += blockBlacks[lane];
+                lanes.whites[lane] += blockWhites[lane];
+                lane ++;
+            }
+        }
+        // the rest (less than 16 bytes, whole pixels) in the first lanes
+        int lane = 0;
+        while (i < chunk) {
+            unsigned int value = bytes[i];
+            lanes.sums[lane] += value;
+            lanes.squares[lane] += value * value;
+            lanes.blacks[lane] += (value == 0);
+            lanes.whites[lane] += (value == MAX_RGB_VALUE);
+            lanes.mins[lane] = (value < lanes.mins[lane]) ? value : lanes.mins[lane];
+            lanes.maxs[lane] = (value > lanes.maxs[lane]) ? value : lanes.maxs[lane];
+            i ++;
+            lane ++;
+        }
+        // lane l holds values of channel l % channelCount
+        lane = 0;
+        while (lane < STATS_LANE_COUNT) {
+            channelStats laneStats;
+            laneStats.count = chunk / STATS_LANE_COUNT + (lane < (int) (chunk % STATS_LANE_COUNT));
+            laneStats.min = lanes.mins[lane];
+            laneStats.max = lanes.maxs[lane];
+            laneStats.sum = lanes.sums[lane];
+            laneStats.sumOfSquares = lanes.squares[lane];
+            laneStats.blackCount = lanes.blacks[lane];
+            laneStats.whiteCount = lanes.whites[lane];
+            mergeChannelStats (stats + lane % channelCount, &laneStats);
+            lane ++;
+        }
+        bytes += chunk;
+        byteCount -= chunk;
+    }
+    return;
+}
+
+static void clearStatsLanes (statsLanes *lanes) {
+    memset (lanes, 0, sizeof (statsLanes));
+    memset (lanes->mins, MAX_RGB_VALUE, sizeof (lanes->mins));
+    return;
+}
+
+// empty statistics (count 0) take the min and max of the other side
+static void mergeChannelStats (channelStats *target, channelStats *source) {
+    if (source->count == 0) {
+        return;
+    }
+    if (target->count == 0) {
+        target->min = source->min;
+        target->max = source->max;
+    } else {
+        target->min = (source->min < target->min) ? source->min : target->min;
+        target->max = (source->max > target->max) ? source->max : target->max;
+    }
+    target->count += source->count;
+    target->sum += source->sum;
+    target->sumOfSquares += source->sumOfSquares;
+    target->blackCount += source->blackCount;
+    target->whiteCount += source->whiteCount;
+    return;
+}
+
+void equalizeChannel (channelPtr channel, int threadCount) {
+    assert (channel != NULL);
+    assert (channel->channelArray != NULL);
+    assert (threadCount > 0);
+    unsigned long long counts[256];
+    computeChannelHistogram (channel, counts, threadCount);
+    byte table[256];
+    fillEqualizationTable (table, counts, channel->resolution);
+    applyChannelLUT (channel, table, threadCount);
+    return;
+}
+
+void equalizeBmp (bmpPtr sample, equalizeMode mode, int threadCount) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (!sample->premultiplied);
+    verifyEqualizeMode (mode);
+    assert (threadCount > 0);
+    if (mode == EQUALIZE_CHANNELS) {
+        bmpHistogram *histogram = (bmpHistogram *) malloc (sizeof (bmpHistogram));
+        assert (histogram != NULL);
+        computeHistogram (sample, histogram, threadCount);
+        unsigned long long total = (unsigned long long) sample->xRes * sample->yRes;
+        byte tables[3][256];
+        fillEqualizationTable (tables[0], histogram->red, total);
+        fillEqualizationTable (tables[1], histogram->green, total);
+        fillEqualizationTable (tables[2], histogram->blue, total);
+        free (histogram);
+        applyLUT (sample, tables[0], tables[1], tables[2], NULL, threadCount);
+    } else {
+        channelPtr planes[3];
+        getColorModelChannels (sample, COLOR_MODEL_YCBCR_444, planes, threadCount);
+        equalizeChannel (planes[0], threadCount);
+        setColorModelChannels (sample, COLOR_MODEL_YCBCR_444, planes, threadCount);
+        int p = 0;
+        while (p < 3) {
+            destroyChannel (planes[p]);
+            p ++;
+        }
+    }
+    return;
+}
+
+void equalizeChannelAdaptive (channelPtr channel, LONG tileRows, LONG tileColumns, double clipLimit, int threadCount) {
+    assert (channel != NULL);
+    assert (channel->channelArray != NULL);
+    assert (tileRows > 0 && tileColumns > 0);
+    assert (clipLimit > 0);
+    assert (threadCount > 0);
+    LONG xRes = channel->xRes;
+    LONG yRes = channel->yRes;
+    if (yRes == 0 || xRes == 0) {
+        return;
+    }
+    // every tile holds at least one pixel
+    if (tileRows > yRes) {
+        tileRows = yRes;
+    }
+    if (tileColumns > xRes) {
+        tileColumns = xRes;
+    }
+    if (threadCount > yRes) {
+        threadCount = yRes;
+    }
+    claheJob work;
+    work.channel = channel;
+    work.tileRows = tileRows;
+    work.tileColumns = tileColumns;
+    work.clipLimit = clipLimit;
+    work.tables = (byte *) malloc ((unsigned long long) tileRows * tileColumns * 256);
+    work.rowTiles = (LONG *) malloc (yRes * sizeof (LONG));
+    work.rowWeights = (int *) malloc (yRes * sizeof (int));
+    work.columnTiles = (LONG *) malloc (xRes * sizeof (LONG));
+    work.columnWeights = (int *) malloc (xRes * sizeof (int));
+    assert (work.tables != NULL && work.rowTiles != NULL && work.rowWeights != NULL);
+    assert (work.columnTiles != NULL && work.columnWeights != NULL);
+    evaluateTileWeights (work.rowTiles, work.rowWeights, yRes, tileRows);
+    evaluateTileWeights (work.columnTiles, work.columnWeights, xRes, tileColumns);
+    work.threadCount = threadCount;
+    pthread_barrier_t barrier;
+    int retCode = pthread_barrier_init (&barrier, NULL, threadCount);
+    assert (retCode == 0);
+    work.barrier = &barrier;
+
+    pthread_t *threads = (pthread_t *) malloc (threadCount * sizeof (pthread_t));
+    claheJob *jobs = (claheJob *) malloc (threadCount * sizeof (claheJob));
+    assert (threads != NULL && jobs != NULL);
+    int t = 0;
+    while (t < threadCount) {
+        jobs[t] = work;
+        jobs[t].threadIndex = t;
+        jobs[t].firstRow = (LONG) ((unsigned long long) yRes * t / threadCount);
+        jobs[t].rowCount = (LONG) ((unsigned long long) yRes * (t + 1) / threadCount) - jobs[t].firstRow;
+        // the calling thread takes the first share
+        if (t > 0) {
+            retCode = pthread_create (threads + t, NULL, claheWorker, jobs + t);
+            assert (retCode == 0);
+        }
+        t ++;
+    }
+    claheWorker (jobs);
+    t = 1;
+    while (t < threadCount) {
+        pthread_join (threads[t], NULL);
+        t ++;
+    }
+    pthread_barrier_destroy (&barrier);
+    free (threads);
+    free (jobs);
+    free (work.tables);
+    free (work.rowTiles);
+    free (work.rowWeights);
+    free (work.columnTiles);
+    free (work.columnWeights);
+    return;
+}
+
+void equalizeBmpAdaptive (bmpPtr sample, equalizeMode mode, LONG tileRows, LONG tileColumns, double clipLimit, int threadCount) {
+    assert (sample != NULL);
+    assert (sample->pixelArray != NULL);
+    assert (!sample->premultiplied);
+    verifyEqualizeMode (mode);
+    assert (threadCount > 0);
+    if (mode == EQUALIZE_CHANNELS) {
+        channelType types[3] = {RED, GREEN, BLUE};
+        int c = 0;
+        while (c < 3) {
+            channelPtr plane = getChannelRows (sample, types[c], 0, sample->yRes);
+            equalizeChannelAdaptive (plane, tileRows, tileColumns, clipLimit, threadCount);
+            setChannel (types[c], sample, plane);
+            destroyChannel (plane);
+            c ++;
+        }
+    } else {
+        channelPtr planes[3];
+        getColorModelChannels (sample, COLOR_MODEL_YCBCR_444, planes, threadCount);
+        equalizeChannelAdaptive (planes[0], tileRows, tileColumns, clipLimit, threadCount);
+        setColorModelChannels (sample, COLOR_MODEL_YCBCR_444, planes, threadCount);
+        int p = 0;
+        while (p < 3) {
+            destroyChannel (planes[p]);
+            p ++;
+        }
+    }
+    return;
+}
+
+static void verifyEqualizeMode (equalizeMode mode) {
+    assert (mode == EQUALIZE_LUMA || mode == EQUALIZE_CHANNELS);
+    return;
+}
+
+// (cdf - cdf of the smallest value) * 255 / (total - cdf of the smallest value), rounded
+// the smallest value present becomes 0 and the largest 255, a single valued image is left as it is
+static void fillEqualizationTable (byte *table, unsigned long long *counts, unsigned long long total) {
+    int i = 0;
+    while (i < 256 && counts[i] == 0) {
+        i ++;
+    }
+    unsigned long long smallest = (i < 256) ? counts[i] : 0;
+    unsigned long long range = total - smallest;
+    unsigned long long cumulative = 0;
+    i = 0;
+    while (i < 256) {
+        cumulative += counts[i];
+        if (range == 0) {
+            table[i] = i;
+        } else if (cumulative < smallest) {
+            table[i] = 0;
+        } else {
+            table[i] = ((cumulative - smallest) * MAX_RGB_VALUE + range / 2) / range;
+        }
+        i ++;
+    }
+    return;
+}
+
+// bins above clipLimit times the average bin are cut, the excess is spread evenly over every bin (what does not
+// divide evenly goes one count each to bins spaced over the histogram), the table is the cumulative
+// histogram * 255 / total, rounded
+static void fillClippedTable (byte *table, unsigned long long *counts, unsigned long long total, double clipLimit) {
+    unsigned long long clip = (unsigned long long) (clipLimit * total / 256);
+    if (clip < 1) {
+        clip = 1;
+    }
+    unsigned long long excess = 0;
+    int i = 0;
+    while (i < 256) {
+        if (counts[i] > clip) {
+            excess += counts[i] - clip;
+            counts[i] = clip;
+        }
+        i ++;
+    }
+    unsigned long long share = excess / 256;
+    unsigned long long residual = excess % 256;
+    i = 0;
+    while (i < 256) {
+        counts[i] += share;
+        i ++;
+    }
+    if (residual > 0) {
+        int step = 256 / residual;
+        i = 0;
+        while (i < 256 && residual > 0) {
+            counts[i] ++;
+            residual --;
+            i += step;
+        }
+    }
+    unsigned long long cumulative = 0;
+    i = 0;
+    while (i < 256) {
+        cumulative += counts[i];
+        table[i] = (cumulative * MAX_RGB_VALUE + total / 2) / total;
+        i ++;
+    }
+    return;
+}
+
+// tile t covers [count * t / tileCount, count * (t + 1) / tileCount), positions before the first center and after
+// the last one take a single tile (weight 0)
+static void evaluateTileWeights (LONG *tiles, int *weights, LONG count, LONG tileCount) {
+    LONG tile = 0;
+    LONG position = 0;
+    while (position < count) {
+        // centers of tile and of the next one, doubled so that they stay whole
+        while (tile + 1 < tileCount) {
+            LONG nextCenter = (LONG) ((unsigned long long) count * (tile + 1) / tileCount + (unsigned long long) count * (tile + 2) / tileCount) - 1;
+            if (2 * position < nextCenter) {
+                break;
+            }
+            tile ++;
+        }
+        LONG center = (LONG) ((unsigned long long) count * tile / tileCount + (unsigned long long) count * (tile + 1) / tileCount) - 1;
+        tiles[position] = tile;
+        weights[position] = 0;
+        if (tile + 1 < tileCount && 2 * position > center) {
+            LONG nextCenter = (LONG) ((unsigned long long) count * (tile + 1) / tileCount + (unsigned long long) count * (tile + 2) / tileCount) - 1;
+            weights[position] = (int) (((2 * position - center) * (1LL << CLAHE_WEIGHT_BITS) + (nextCenter - center) / 2) / (nextCenter - center));
+        }
+        position ++;
+    }
+    return;
+}
+
+// every table is read by the rows of 4 tiles, hence the barrier between both phases
+static void *claheWorker (void *job) {
+    claheJob *work = (claheJob *) job;
+    unsigned int *sets = (unsigned int *) malloc (HISTOGRAM_SET_COUNT * 256 * sizeof (unsigned int));
+    assert (sets != NULL);
+    LONG tileCount = work->tileRows * work->tileColumns;
+    LONG tile = work->threadIndex;
+    while (tile < tileCount) {
+        claheTile (work, sets, tile);
+        tile += work->threadCount;
+    }
+    free (sets);
+    pthread_barrier_wait (work->barrier);
+    unsigned short *blended = NULL;
+    if (work->tileColumns * 256 <= work->channel->xRes) {
+        blended = (unsigned short *) malloc (work->tileColumns * 256 * sizeof (unsigned short));
+        assert (blended != NULL);
+    }
+    row cRow = work->firstRow;
+    while (cRow < work->firstRow + work->rowCount) {
+        claheRow (work, blended, cRow);
+        cRow ++;
+    }
+    free (blended);
+    return NULL;
+}
+
+static void claheTile (claheJob *work, unsigned int *sets, LONG tile) {
+    channelPtr channel = work->channel;
+    LONG tileRow = tile / work->tileColumns;
+    LONG tileColumn = tile % work->tileColumns;
+    LONG firstRow = (LONG) ((unsigned long long) channel->yRes * tileRow / work->tileRows);
+    LONG lastRow = (LONG) ((unsigned long long) channel->yRes * (tileRow + 1) / work->tileRows);
+    LONG firstColumn = (LONG) ((unsigned long long) channel->xRes * tileColumn / work->tileColumns);
+    LONG width = (LONG) ((unsigned long long) channel->xRes * (tileColumn + 1) / work->tileColumns) - firstColumn;
+    unsigned long long counts[256];
+    memset (counts, 0, sizeof (counts));
+    memset (sets, 0, HISTOGRAM_SET_COUNT * 256 * sizeof (unsigned int));
+    unsigned long long counted = 0;
+    row cRow = firstRow;
+    while (cRow < lastRow) {
+        if (counted + width > HISTOGRAM_FOLD_PIXELS) {
+            foldHistogramSets (counts, sets, 256);
+            counted = 0;
+        }
+        countBytes (sets, channel->channelArray + (unsigned long long) cRow * channel->xRes + firstColumn, width);
+        counted += width;
+        cRow ++;
+    }
+    foldHistogramSets (counts, sets, 256);
+    fillClippedTable (work->tables + (unsigned long long) tile * 256, counts, (unsigned long long) (lastRow - firstRow) * width, work->clipLimit);
+    return;
+}
+
+// bilinear blend of the values given by the tables of the 4 tiles around every pixel. When the tiles are wide enough
+// the tables of both tile rows are first blended vertically for the whole row (a vectorized pass over
+// tileColumns * 256 entries), leaving 2 lookups per pixel instead of 4 (the sums are the same)
+static void claheRow (claheJob *work, unsigned short *blended, row cRow) {
+    channelPtr channel = work->channel;
+    LONG tileRow = work->rowTiles[cRow];
+    LONG nextTileRow = (tileRow + 1 < work->tileRows) ? tileRow + 1 : tileRow;
+    int lowerWeight = work->rowWeights[cRow];
+    int upperWeight = (1 << CLAHE_WEIGHT_BITS) - lowerWeight;
+    byte *upperTables = work->tables + (unsigned long long) tileRow * work->tileColumns * 256;
+    byte *lowerTables = work->tables + (unsigned long long) nextTileRow * work->tileColumns * 256;
+    byte *values = channel->channelArray + (unsigned long long) cRow * channel->xRes;
+    LONG lastTile = work->tileColumns - 1;
+    int rounding = 1 << (2 * CLAHE_WEIGHT_BITS - 1);
+    if (blended != NULL) {
+        LONG entry = 0;
+        while (entry < work->tileColumns * 256) {
+            blended[entry] = upperTables[entry] * upperWeight + lowerTables[entry] * lowerWeight;
+            entry ++;
+        }
+    }
+    LONG i = 0;
+    while (i < channel->xRes) {
+        int value = values[i];
+        LONG left = work->columnTiles[i] * 256 + value;
+        LONG right = (work->columnTiles[i] < lastTile) ? left + 256 : left;
+        int rightWeight = work->columnWeights[i];
+        int leftWeight = (1 << CLAHE_WEIGHT_BITS) - rightWeight;
+        int sum;
+        if (blended != NULL) {
+            sum = blended[left] * leftWeight + blended[right] * rightWeight;
+        } else {
+            int upper = upperTables[left] * leftWeight + upperTables[right] * rightWeight;
+            int lower = lowerTables[left] * leftWeight + lowerTables[right] * rightWeight;
+            sum = upper * upperWeight + lower * lowerWeight;
+        }
+        values[i] = (sum + rounding) >> (2 * CLAHE_WEIGHT_BITS);
+        i ++;
+    }
+    return;
+}
+
+int bmpsIdentical (bmpPtr first, bmpPtr second, int threadCount) {
+    assert (first != NULL && second != NULL);
+    assert (first->pixelArray != NULL && second->pixelArray != NULL);
+    assert (threadCount > 0);
+    if (first->xRes != second->xRes || first->yRes != second->yRes) {
+        return 0;
+    }
+    if (first->pixelFormat != second->pixelFormat || first->premultiplied != second->premultiplied) {
+        return 0;
+    }
+    ensureAllRowsResident (first);
+    ensureAllRowsResident (second);
+    comparisonJob work;
+    prepareBmpComparison (&work, first, second);
+    work.ignoreAlpha = !hasAlphaChannel (first);
+    return !findDifference (&work, first->yRes, threadCount);
+}
+
+int channelsIdentical (channelPtr first, channelPtr second, int threadCount) {
+    assert (first != NULL && second != NULL);
+    assert (first->channelArray != NULL && second->channelArray != NULL);
+    assert (threadCount > 0);
+    if (first->xRes != second->xRes || first->yRes != second->yRes) {
+        return 0;
+    }
+    comparisonJob work;
+    prepareChannelComparison (&work, first, second);
+    return !findDifference (&work, first->yRes, threadCount);
+}
+
+void measureBmpDifference (bmpPtr first, bmpPtr second, bmpDifference *difference, int threadCount) {
+    verifyComparableBmps (first, second);
+    assert (difference != NULL);
+    assert (threadCount > 0);
+    comparisonJob work;
+    prepareBmpComparison (&work, first, second);
+    if (first->yRes > 0) {
+        ensureAllRowsResident (first);
+        ensureAllRowsResident (second);
+        runComparisonJobs (&work, first->yRes, threadCount, differenceWorker);
+    }
+    if (!hasAlphaChannel (first)) {
+        unsigned long long count = work.differences[3].count;
+        memset (work.differences + 3, 0, sizeof (channelDifference));
+        work.differences[3].count = count;
+    }
+    difference->red = work.differences[0];
+    difference->green = work.differences[1];
+    difference->blue = work.differences[2];
+    difference->alpha = work.differences[3];
+    finishDifference (&difference->red);
+    finishDifference (&difference->green);
+    finishDifference (&difference->blue);
+    finishDifference (&difference->alpha);
+    return;
+}
+
+void measureChannelDifference (channelPtr first, channelPtr second, channelDifference *difference, int threadCount) {
+    assert (first != NULL && second != NULL && difference != NULL);
+    assert (first->channelArray != NULL && second->channelArray != NULL);
+    assert (first->xRes == second->xRes && first->yRes == second->yRes);
+    assert (threadCount > 0);
+    comparisonJob work;
+    prepareChannelComparison (&work, first, second);
+    if (first->yRes > 0) {
+        runComparisonJobs (&work, first->yRes, threadCount, differenceWorker);
+    }
+    *difference = work.differences[0];
+    finishDifference (difference);
+    return;
+}
+
+double computeChannelSSIM (channelPtr first, channelPtr second, LONG windowSize, int threadCount) {
+    assert (first != NULL && second != NULL);
+    assert (first->channelArray != NULL && second->channelArray != NULL);
+    assert (first->xRes == second->xRes && first->yRes == second->yRes);
+    assert (windowSize > 0 && windowSize <= SSIM_MAX_WINDOW);
+    assert (windowSize <= first->xRes && windowSize <= first->yRes);
+    assert (threadCount > 0);
+    comparisonJob work;
+    prepareChannelComparison (&work, first, second);
+    double ssim;
+    windowSSIM (&work, first->xRes, first->yRes, windowSize, threadCount, &ssim);
+    return ssim;
+}
+
+void computeBmpSSIM (bmpPtr first, bmpPtr second, LONG windowSize, bmpSSIM *ssim, int threadCount) {
+    verifyComparableBmps (first, second);
+    assert (ssim != NULL);
+    assert (windowSize > 0 && windowSize <= SSIM_MAX_WINDOW);
+    assert (windowSize <= first->xRes && windowSize <= first->yRes);
+    assert (threadCount > 0);
+    ensureAllRowsResident (first);
+    ensureAllRowsResident (second);
+    comparisonJob work;
+    prepareBmpComparison (&work, first, second);
+    double means[4];
+    windowSSIM (&work, first->xRes, first->yRes, windowSize, threadCount, means);
+    ssim->red = means[0];
+    ssim->green = means[1];
+    ssim->blue = means[2];
+    ssim->alpha = hasAlphaChannel (first) ? means[3] : 1;
+    return;
+}
+
+static void prepareBmpComparison (comparisonJob *work, bmpPtr first, bmpPtr second) {
+    memset (work, 0, sizeof (comparisonJob));
+    work->firstSample = first;
+    work->secondSample = second;
+    work->rowBytes = first->xRes * sizeof (pixel);
+    work->channelCount = 4;
+    return;
+}
+
+static void prepareChannelComparison (comparisonJob *work, channelPtr first, channelPtr second) {
+    memset (work, 0, sizeof (comparisonJob));
+    work->firstChannel = first;
+    work->secondChannel = second;
+    work->rowBytes = first->xRes;
+    work->channelCount = 1;
+    return;
+}
+
+static void verifyComparableBmps (bmpPtr first, bmpPtr second) {
+    assert (first != NULL && second != NULL);
+    assert (first->pixelArray != NULL && second->pixelArray != NULL);
+    assert (first->xRes == second->xRes && first->yRes == second->yRes);
+    assert (first->pixelFormat == second->pixelFormat);
+    assert (first->premultiplied == second->premultiplied);
+    return;
+}
+
+// the differences of the bands are merged into work in band order (so the first location of the largest difference
+// is kept)
+static void runComparisonJobs (comparisonJob *work, LONG rowCount, int threadCount, void *(*worker) (void *)) {
+    comparisonJob *jobs = (comparisonJob *) malloc (threadCount * sizeof (comparisonJob));
+    assert (jobs != NULL);
+    jobs[0] = *work;
+    memset (jobs[0].differences, 0, sizeof (jobs[0].differences));
+    int bandCount = runRowBands (worker, jobs, sizeof (comparisonJob), 0, rowCount, 1, threadCount);
+    int t = 0;
+    while (t < bandCount) {
+        int c = 0;
+        while (c < work->channelCount) {
+            mergeDifference (work->differences + c, jobs[t].differences + c);
+            c ++;
+        }
+        t ++;
+    }
+    free (jobs);
+    return;
+}
+
+// first byte of a row of the bitmap (of the channel when sample is NULL)
+static byte *comparedRow (bmpPtr sample, channelPtr channel, row cRow) {
+    if (sample == NULL) {
+        return channel->channelArray + (unsigned long long) cRow * channel->xRes;
+    }
+    return (byte *) rowPixels (sample, cRow);
+}
+
+// returns 1 as soon as any band holds a difference
+static int findDifference (comparisonJob *work, LONG rowCount, int threadCount) {
+    if (rowCount == 0 || work->rowBytes == 0) {
+        return 0;
+    }
+    pthread_mutex_t lock;
+    int retCode = pthread_mutex_init (&lock, NULL);
+    assert (retCode == 0);
+    int differs = 0;
+    work->lock = &lock;
+    work->differs = &differs;
+    runComparisonJobs (work, rowCount, threadCount, identicalWorker);
+    pthread_mutex_destroy (&lock);
+    return differs;
+}
+
+static void *identicalWorker (void *job) {
+    comparisonJob *band = (comparisonJob *) job;
+    int packed = (band->firstSample == NULL);
+    if (!packed) {
+        packed = hasPackedRows (band->firstSample) && hasPackedRows (band->secondSample);
+    }
+    byte *first = comparedRow (band->firstSample, band->firstChannel, band->rows.firstRow);
+    byte *second = comparedRow (band->secondSample, band->secondChannel, band->rows.firstRow);
+    if (packed) {
+        identicalBytes (band, first, second, (unsigned long long) band->rows.rowCount * band->rowBytes);
+    } else {
+        row cRow = band->rows.firstRow;
+        while (cRow < band->rows.firstRow + band->rows.rowCount && identicalBytes (band, first, second, band->rowBytes)) {
+            cRow ++;
+            first = comparedRow (band->firstSample, band->firstChannel, cRow);
+            second = comparedRow (band->secondSample, band->secondChannel, cRow);
+        }
+    }
+    return NULL;
+}
+
+// compares the bytes a block at a time, 0 as soon as they differ or another thread found a difference
+static int identicalBytes (comparisonJob *band, byte *first, byte *second, unsigned long long byteCount) {
+    while (byteCount > 0) {
+        unsigned long long block = (byteCount < IDENTICAL_BLOCK_BYTES) ? byteCount : IDENTICAL_BLOCK_BYTES;
+        pthread_mutex_lock (band->lock);
+        int found = *band->differs;
+        pthread_mutex_unlock (band->lock);
+        if (found) {
+            return 0;
+        }
+        if (!sameBytes (first, second, block, band->ignoreAlpha)) {
+            pthread_mutex_lock (band->lock);
+            *band->differs = 1;
+            pthread_mutex_unlock (band->lock);
+            return 0;
+        }
+        first += block;
+        second += block;
+        byteCount -= block;
+    }
+    return 1;
+}
+
+// byteCount is a whole number of pixels when ignoreAlpha is set
+static int sameBytes (byte *first, byte *second, unsigned long long byteCount, int ignoreAlpha) {
+    if (memcmp (first, second, byteCount) == 0) {
+        return 1;
+    }
+    if (!ignoreAlpha) {
+        return 0;
+    }
+    // the alpha bytes of RGB_24 pixels are normally cleared (see convertBmp), only blocks that differ get here
+    unsigned long long i = 0;
+    while (i < byteCount) {
+        // alpha is the last byte of a pixel
+        if (i % sizeof (pixel) != sizeof (pixel) - 1 && first[i] != second[i]) {
+            return 0;
+        }
+        i ++;
+    }
+    return 1;
+}
+
+static void *differenceWorker (void *job) {
+    comparisonJob *band = (comparisonJob *) job;
+    int channelCount = band->channelCount;
+    row cRow = band->rows.firstRow;
+    while (cRow < band->rows.firstRow + band->rows.rowCount) {
+        byte *first = comparedRow (band->firstSample, band->firstChannel, cRow);
+        byte *second = comparedRow (band->secondSample, band->secondChannel, cRow);
+        byte maxs[4];
+        differenceBytes (band->differences, maxs, channelCount, first, second, band->rowBytes);
+        int c = 0;
+        while (c < channelCount) {
+            channelDifference *difference = band->differences + c;
+            if (maxs[c] > difference->maxDifference) {
+                // the largest difference grows at most 255 times, its first location is looked up again
+                LONG column = 0;
+                while (abs (first[column * channelCount + c] - second[column * channelCount + c]) != maxs[c]) {
+                    column ++;
+                }
+                difference->maxDifference = maxs[c];
+                difference->maxRow = cRow;
+                difference->maxColumn = column;
+            }
+            c ++;
+        }
+        cRow ++;
+    }
+    return NULL;
+}
+
+// adds the squared differences of the bytes to differences, byte i belongs to channel i % channelCount (1 or 4)
+// whose largest difference goes to maxs. 16 independent lanes as in statsBytes, so the loop vectorizes
+static void differenceBytes (channelDifference *differences, byte *maxs, int channelCount, byte *first, byte *second, unsigned long long byteCount) {
+    memset (maxs, 0, channelCount);
+    int c = 0;
+    while (c < channelCount) {
+        differences[c].count += byteCount / channelCount;
+        c ++;
+    }
+    while (byteCount > 0) {
+        unsigned long long chunk = (byteCount < STATS_CHUNK_BYTES) ? byteCount : STATS_CHUNK_BYTES;
+        unsigned int squares[STATS_LANE_COUNT] = {0};
+        byte laneMaxs[STATS_LANE_COUNT] = {0};
+        unsigned long long i = 0;
+        while (i + STATS_LANE_COUNT <= chunk) {
+            int lane = 0;
+            while (lane < STATS_LANE_COUNT) {
+                byte a = first[i + lane];
+                byte b = second[i + lane];
+                byte difference = (a > b) ? a - b : b - a;
+                squares[lane] += (unsigned int) difference * difference;
+                laneMaxs[lane] = (difference > laneMaxs[lane]) ? difference : laneMaxs[lane];
+                lane ++;
+            }
+            i += STATS_LANE_COUNT;
+        }
+        // the rest (less than 16 bytes, whole pixels) in the first lanes
+        int lane = 0;
+        while (i < chunk) {
+            byte difference = (first[i] > second[i]) ? first[i] - second[i] : second[i] - first[i];
+            squares[lane] += (unsigned int) difference * difference;
+            laneMaxs[lane] = (difference > laneMaxs[lane]) ? difference : laneMaxs[lane];
+            i ++;
+            lane ++;
+        }
+        lane = 0;
+        while (lane < STATS_LANE_COUNT) {
+            differences[lane % channelCount].sumOfSquares += squares[lane];
+            maxs[lane % channelCount] = (laneMaxs[lane] > maxs[lane % channelCount]) ? laneMaxs[lane] : maxs[lane % channelCount];
+            lane ++;
+        }
+        first += chunk;
+        second += chunk;
+        byteCount -= chunk;
+    }
+    return;
+}
+
+// a later band only replaces the largest difference if it is larger
+static void mergeDifference (channelDifference *target, channelDifference *source) {
+    target->count += source->count;
+    target->sumOfSquares += source->sumOfSquares;
+    if (source->maxDifference > target->maxDifference) {
+        target->maxDifference = source->maxDifference;
+        target->maxRow = source->maxRow;
+        target->maxColumn = source->maxColumn;
+    }
+    return;
+}
+
+static void finishDifference (channelDifference *difference) {
+    difference->mse = 0;
+    if (difference->count > 0) {
+        difference->mse = (double) difference->sumOfSquares / difference->count;
+    }
+    difference->psnr = INFINITY;
+    if (difference->sumOfSquares > 0) {
+        difference->psnr = 10 * log10 (MAX_RGB_VALUE * MAX_RGB_VALUE / difference->mse);
+    }
+    return;
+}
+
+// the SSIM of every window row is summed by the threads, the rows are then summed in order (so the result does not
+// depend on how the rows were split)
+static void windowSSIM (comparisonJob *work, LONG xRes, LONG yRes, LONG windowSize, int threadCount, double *means) {
+    LONG windowRows = yRes - windowSize + 1;
+    LONG windowColumns = xRes - windowSize + 1;
+    int channelCount = work->channelCount;
+    work->windowSize = windowSize;
+    work->rowTotals = (double *) malloc ((unsigned long long) windowRows * channelCount * sizeof (double));
+    assert (work->rowTotals != NULL);
+    runComparisonJobs (work, windowRows, threadCount, ssimWorker);
+    int c = 0;
+    while (c < channelCount) {
+        double total = 0;
+        LONG windowRow = 0;
+        while (windowRow < windowRows) {
+            total += work->rowTotals[(unsigned long long) windowRow * channelCount + c];
+            windowRow ++;
+        }
+        means[c] = total / ((double) windowRows * windowColumns);
+        c ++;
+    }
+    free (work->rowTotals);
+    return;
+}
+
+// keeps the sums over windowSize rows of every column (byte) of both images, of their squares and of their products,
+// moving them down a row at a time
+static void *ssimWorker (void *job) {
+    comparisonJob *band = (comparisonJob *) job;
+    LONG rowBytes = band->rowBytes;
+    LONG windowSize = band->windowSize;
+    // firstSums, secondSums, firstSquares, secondSquares and products of every column, one after the other
+    unsigned int *sums = (unsigned int *) calloc (5 * (unsigned long long) rowBytes, sizeof (unsigned int));
+    assert (sums != NULL);
+    row cRow = band->rows.firstRow;
+    while (cRow < band->rows.firstRow + windowSize) {
+        addColumnSums (sums, rowBytes, comparedRow (band->firstSample, band->firstChannel, cRow),
+                       comparedRow (band->secondSample, band->secondChannel, cRow));
+        cRow ++;
+    }
+    unsigned int *windows = (unsigned int *) malloc (5 * (unsigned long long) rowBytes * sizeof (unsigned int));
+    double *values = (double *) malloc (rowBytes * sizeof (double));
+    assert (windows != NULL && values != NULL);
+    row windowRow = band->rows.firstRow;
+    while (windowRow < band->rows.firstRow + band->rows.rowCount) {
+        sumRowSSIM (sums, windows, values, rowBytes, band->channelCount, windowSize,
+                    band->rowTotals + (unsigned long long) windowRow * band->channelCount);
+        if (windowRow + 1 < band->rows.firstRow + band->rows.rowCount) {
+            LONG nextRow = windowRow + windowSize;
+            slideColumnSums (sums, rowBytes, comparedRow (band->firstSample, band->firstChannel, nextRow),
+                             comparedRow (band->secondSample, band->secondChannel, nextRow),
+                             comparedRow (band->firstSample, band->firstChannel, windowRow),
+                             comparedRow (band->secondSample, band->secondChannel, windowRow));
+        }
+        windowRow ++;
+    }
+    free (values);
+    free (windows);
+    free (sums);
+    return NULL;
+}
+
+static void addColumnSums (unsigned int *sums, LONG rowBytes, byte *first, byte *second) {
+    unsigned int *secondSums = sums + rowBytes;
+    unsigned int *firstSquares = secondSums + rowBytes;
+    unsigned int *secondSquares = firstSquares + rowBytes;
+    unsigned int *products = secondSquares + rowBytes;
+    LONG i = 0;
+    while (i < rowBytes) {
+        unsigned int a = first[i];
+        unsigned int b = second[i];
+        sums[i] += a;
+        secondSums[i] += b;
+        firstSquares[i] += a * a;
+        secondSquares[i] += b * b;
+        products[i] += a * b;
+        i ++;
+    }
+    return;
+}
+
+// adds the row (first, second) and removes the row (oldFirst, oldSecond), the sums wrap around in between
+static void slideColumnSums (unsigned int *sums, LONG rowBytes, byte *first, byte *second, byte *oldFirst, byte *oldSecond) {
+    unsigned int *secondSums = sums + rowBytes;
+    unsigned int *firstSquares = secondSums + rowBytes;
+    unsigned int *secondSquares = firstSquares + rowBytes;
+    unsigned int *products = secondSquares + rowBytes;
+    LONG i = 0;
+    while (i < rowBytes) {
+        unsigned int a = first[i];
+        unsigned int b = second[i];
+        unsigned int oldA = oldFirst[i];
+        unsigned int oldB = oldSecond[i];
+        sums[i] += a - oldA;
+        secondSums[i] += b - oldB;
+        firstSquares[i] += a * a - oldA * oldA;
+        secondSquares[i] += b * b - oldB * oldB;
+        products[i] += a * b - oldA * oldB;
+        i ++;
+    }
+    return;
+}
+
+// SSIM of the windows of a window row summed per channel into totals: the column sums are added across windowSize
+// columns into windows, the SSIM of every window (and channel) then goes to values, in separate loops that vectorize
+static void sumRowSSIM (unsigned int *sums, unsigned int *windows, double *values, LONG rowBytes, int channelCount, LONG windowSize, double *totals) {
+    LONG windowBytes = rowBytes - (windowSize - 1) * channelCount;
+    int s = 0;
+    while (s < 5) {
+        unsigned int *columns = sums + s * (unsigned long long) rowBytes;
+        unsigned int *window = windows + s * (unsigned long long) rowBytes;
+        int c = 0;
+        while (c < channelCount) {
+            // running sum kept in a register
+            unsigned int sum = 0;
+            LONG i = c;
+            while (i < c + (windowSize - 1) * channelCount) {
+                sum += columns[i];
+                i += channelCount;
+            }
+            i = c;
+            while (i < windowBytes) {
+                sum += columns[i + (windowSize - 1) * channelCount];
+                window[i] = sum;
+                sum -= columns[i];
+                i += channelCount;
+            }
+            c ++;
+        }
+        s ++;
+    }
+    double n = (double) windowSize * windowSize;
+    unsigned int *secondWindows = windows + rowBytes;
+    unsigned int *firstSquares = secondWindows + rowBytes;
+    unsigned int *secondSquares = firstSquares + rowBytes;
+    unsigned int *products = secondSquares + rowBytes;
+    LONG i = 0;
+    while (i < windowBytes) {
+        values[i] = ssimOfSums (n, (int) windows[i], (int) secondWindows[i], (int) firstSquares[i], (int) secondSquares[i], (int) products[i]);
+        i ++;
+    }
+    int c = 0;
+    while (c < channelCount) {
+        totals[c] = 0;
+        i = c;
+        while (i < windowBytes) {
+            totals[c] += values[i];
+            i += channelCount;
+        }
+        c ++;
+    }
+    return;
+}
+
+// SSIM of a window of n values from its sums: the means, variances and covariance all scaled by n^2 (exact in doubles)
+static inline double ssimOfSums (double n, int firstSum, int secondSum, int firstSquares, int secondSquares, int products) {
+    double productOfSums = (double) firstSum * secondSum;
+    double squaresOfSums = (double) firstSum * firstSum + (double) secondSum * secondSum;
+    double c1 = SSIM_C1 * n * n;
+    double c2 = SSIM_C2 * n * n;
+    double numerator = (2 * productOfSums + c1) * (2 * (n * products - productOfSums) + c2);
+    double denominator = (squaresOfSums + c1) * (n * ((double) firstSquares + secondSquares) - squaresOfSums + c2);
+    return numerator / denominator;
+}
+
+static void verifyFormatForDIBVersion (DIBHeaderVersion version, pixelFormat pixelFormat) {
+    verifyDIBVersion (version);
+    verifyPixelFormat (pixelFormat);
+    if (version == BITMAPINFOHEADER) {
+        assert (pixelFormat == RGB_24);
+    } else if (version == BITMAPV4HEADER) {
+        assert (pixelFormat == ARGB_32);
+    } else {
+        assert (DIB_DEFAULTS_NOT_SPECIFIED);
+    }
+    return;
+}
+
+static void setConversionDefaults (bmpPtr sample, DIBHeaderVersion version, pixelFormat pixelFormat) {
+    assert (sample != NULL);
+    verifyFormatForDIBVersion (version, pixelFormat);
+    setPixelFormat (sample, pixelFormat);
+    if (version == BITMAPINFOHEADER) {
+        sample->colorPlaneCount = DEFAULT_IH_COLOR_PLANE_COUNT;
+        sample->compression = DEFAULT_IH_COMPRESSION;
+        sample->paletteColorCOunt = DEFAULT_IH_PALETTE_CLR_COUNT;
+        sample->impColorCOunt = DEFAULT_IH_IMP_COLOR_COUNT;
+        if (sample->printResX <= 0) {
+            sample->printResX = DEFAULT_IH_PRINT_RES_X;
+        }
+        if (sample->printResY <= 0) {
+            sample->printResY = DEFAULT_IH_PRINT_RES_Y;
+        }
+    } else if (version == BITMAPV4HEADER) {
+        sample->colorPlaneCount = DEFAULT_V4IH_COLOR_PLANE_COUNT;
+        sample->compression = DEFAULT_V4IH_COMPRESSION;
+        sample->paletteColorCOunt = DEFAULT_V4IH_PALETTE_CLR_COUNT;
+        sample->impColorCOunt = DEFAULT_V4IH_IMP_COLOR_COUNT;
+        sample->colorSpace = DEFAULT_V4IH_COLOR_SPACE;
+        if (sample->printResX <= 0) {
+            sample->printResX = DEFAULT_V4IH_PRINT_RES_X;
+        }
+        if (sample->printResY <= 0) {
+            sample->printResY = DEFAULT_V4IH_PRINT_RES_Y;
+        }
+    } else {
+        assert (DIB_DEFAULTS_NOT_SPECIFIED);
+    }
+    sample->imageSizeBytes = evaluateRawImageSizeInBytes (sample);
+    return;
+}
+
+// single pass over the pixels, written as a flat loop over whole pixels so that the compiler can vectorize it
+// target and source may be the same array
+static void convertPixels (pixelArray target, pixelArray source, unsigned long long pixelCount, pixelFormat targetFormat, byte alphaFill) {
+    assert (target != NULL && source != NULL);
+    verifyPixelFormat (targetFormat);
+    unsigned long long i = 0;
+    if (targetFormat == ARGB_32) {
+        while (i < pixelCount) {
+            pixel cPixel = source[i];
+            cPixel.alpha = alphaFill;
+            target[i] = cPixel;
+            i ++;
+        }
+    } else if (targetFormat == RGB_24) {
+        // alpha is not stored for RGB_24, clear it so that the pixelArray stays deterministic
+        while (i < pixelCount) {
+            pixel cPixel = source[i];
+            cPixel.alpha = 0;
+            target[i] = cPixel;
+            i ++;
+        }
+    } else {
+        assert (PIXEL_FORMAT_DEFAULTS_NOT_SPECIFIED);
+    }
+    return;
+}
+
+static DWORD ceiling (DWORD a, DWORD b) {
+    assert (b != 0);
+    DWORD answer;
+    if (a % b != 0) {
+        answer = (DWORD) (a/b) + 1;
+    } else {
+        answer = a/b;
+    }
+    return answer;
+}
+
+static void toLittleEndianBytes (DWORD number, byte *bytes, LONG byteCount) {
+    assert (bytes != NULL);
+    assert (byteCount > 0);
+    int i = 0;
+    while (i < byteCount) {
+        bytes[i] = (number >> (8*i)) & 255;
+        i ++;
+    }
+    return;
+}
+
+static void colorSpaceToLittleEndianBytes (colorSpace colorSpace, byte *bytes) {
+    verifyColorSpace (colorSpace);
+    if (colorSpace == LCS_WINDOWS_COLOR_SPACE) {
+        bytes [0] = ' ';
+        bytes [1] = 'n';
+        bytes [2] = 'i';
+        bytes [3] = 'W';
+    } else {
+        assert (COLOR_SPACE_DEFAULTS_NOT_SPECIFIED);
+    }
+    return;
+}
+
+static DWORD toDWORD (byte *bytes, LONG byteCount) {
+    assert (bytes != NULL);
+    assert (byteCount > 0);
+
+    DWORD number = 0;
+    int i = 0;
+    while (i < byteCount) {
+        number += (DWORD) bytes[i] << (8 * i);
+        i ++;
+    }
+    return number;
+}
+
+static void verifyDIBVersion (DIBHeaderVersion version) {
+    assert (version == BITMAPINFOHEADER || version == BITMAPV4HEADER);
+    return;
+}
+
+static void verifyColorSpace (colorSpace colorSpace) {
+    assert (colorSpace == LCS_WINDOWS_COLOR_SPACE);
+    return;
+}
+
+static void verifyPixelFormat (pixelFormat pixelFormat) {
+    assert (pixelFormat == RGB_24 || pixelFormat == ARGB_32);
+    return;
+}
+
+static void verifyRowOrder (rowOrder order) {
+    assert (order == BOTTOM_UP || order == TOP_DOWN);
+    return;
+}
+
+static void verifyColorDepth (WORD colorDepth) {
+    assert (colorDepth == BPP_24 || colorDepth == BPP_32);
+    return;
+}
+
+static void verifyCompression (DWORD compression, DIBHeaderVersion version) {
+    verifyDIBVersion (version);
+    assert (compression == BI_RGB || compression == BI_BITFIELDS);
+    if (version == BITMAPINFOHEADER) {
+        assert (compression == BI_RGB);
+    } else if (version == BITMAPV4HEADER) {
+        assert (compression == BI_BITFIELDS);
+    } else {
+        assert (DIB_DEFAULTS_NOT_SPECIFIED);
+    }
+    return;
+}
+
+static DWORD determineDIBSize (DIBHeaderVersion version) {
+    verifyDIBVersion (version);
+    DWORD dibSize;
+    if (version == BITMAPINFOHEADER) {
+        dibSize = DEFAULT_IH_SIZE;
+    } else if (version == BITMAPV4HEADER) {
+        dibSize = DEFAULT_V4IH_SIZE;
+    } else {
+        assert (DIB_DEFAULTS_NOT_SPECIFIED);        
+    }
+    return dibSize;
+}
+
+static DIBHeaderVersion determineDIBVersion (DWORD dibSize) {
+    assert (dibSize > 0);
+    assert (dibSize == DEFAULT_IH_SIZE || dibSize == DEFAULT_V4IH_SIZE);
+    DIBHeaderVersion version;
+    if (dibSize == DEFAULT_IH_SIZE) {
+        version = BITMAPINFOHEADER;
+    } else if (dibSize == DEFAULT_V4IH_SIZE) {
+        version = BITMAPV4HEADER;
+    }
+    return version; 
+}
+
+DWORD evaluateRawImageSizeInBytes (bmpPtr sample) {
     assert (sample != NULL);
     verifyDIBVersion (sample->DIBVersion);
     assert (sample->xRes > 0 && sample->yRes > 0);
     assert (sample->colorDepth == BPP_24 || sample->colorDepth == BPP_32);
-    int bytesPerPixel = sample->colorDepth / 8;
-
-    DWORD bytesPerRow = sample->xRes * bytesPerPixel;
-    bytesPerRow = ceiling (bytesPerRow, 4) * 4;
-    DWORD totalBytes = bytesPerRow * sample->yRes;
-    return totalBytes;
+    unsigned long long totalBytes = evaluateRowStride (sample->xRes, sample->colorDepth) * sample->yRes;
+    // images whose file size does not fit in the DWORD size field are not supported
+    assert (totalBytes + 14 + determineDIBSize (sample->DIBVersion) <= MAX_BMP_FILE_SIZE);
+    return (DWORD) totalBytes;
 }
 
 DWORD determineFileSizeInBytes (bmpPtr sample) {
-    DWORD totalBytes = evaluateRawImageSizeInBytes (sample);
+    unsigned long long totalBytes = evaluateRawImageSizeInBytes (sample);
     totalBytes += 14 + determineDIBSize (sample->DIBVersion);
-    return totalBytes;
+    assert (totalBytes <= MAX_BMP_FILE_SIZE);
+    return (DWORD) totalBytes;
+}
+
+static unsigned long long evaluateRowStride (LONG xRes, WORD colorDepth) {
+    assert (xRes > 0);
+    verifyColorDepth (colorDepth);
+    unsigned long long bytesPerRow = (unsigned long long) xRes * (colorDepth / 8);
+    // rows are padded to a multiple of 4 bytes
+    unsigned long long stride = (bytesPerRow + 3) / 4 * 4;
+    return stride;
+}
+
+static void ensureRowsResident (bmpPtr sample, LONG firstRow, LONG rowCount) {
+    assert (sample != NULL);
+    if (sample->lazyLock == NULL) {
+        return;
+    }
+    // several threads may read the same lazy bitmap, only one of them decodes a given block
+    pthread_mutex_lock (sample->lazyLock);
+    if (sample->lazyMap == NULL) {
+        pthread_mutex_unlock (sample->lazyLock);
+        return;
+    }
+    assert (firstRow >= 0 && rowCount > 0 && firstRow + rowCount <= sample->yRes);
+    LONG block = firstRow / sample->lazyBlockRows;
+    LONG lastBlock = (firstRow + rowCount - 1) / sample->lazyBlockRows;
+    while (block <= lastBlock) {
+        if (!sample->residentBlocks[block]) {
+            decodeLazyBlock (sample, block);
+        }
+        block ++;
+    }
+    // nothing left to decode, the file is no longer needed
+    if (sample->residentBlockCount == sample->lazyBlockCount) {
+        releaseLazyMapping (sample);
+    }
+    pthread_mutex_unlock (sample->lazyLock);
+    return;
+}
+
+static void ensureAllRowsResident (bmpPtr sample) {
+    assert (sample != NULL);
+    if (sample->lazyLock != NULL) {
+        ensureRowsResident (sample, 0, sample->yRes);
+    }
+    return;
+}
+
+static void decodeLazyBlock (bmpPtr sample, LONG block) {
+    unsigned long long stride = evaluateRowStride (sample->xRes, sample->colorDepth);
+    byte *fileRows = sample->lazyMap + evaluatePixelArrayFileOffset (sample->DIBVersion);
+    row cRow = block * sample->lazyBlockRows;
+    row lastRow = cRow + sample->lazyBlockRows;
+    if (lastRow > sample->yRes) {
+        lastRow = sample->yRes;
+    }
+    while (cRow < lastRow) {
+        row fileRow = cRow;
+        if (sample->rowOrder == BOTTOM_UP) {
+            fileRow = sample->yRes - 1 - cRow;
+        }
+        unsigned long long pixIndex = (unsigned long long) cRow * sample->xRes;
+        decodePixels (sample->pixelArray + pixIndex, fileRows + fileRow * stride, sample->xRes, sample->colorDepth);
+        cRow ++;
+    }
+    sample->residentBlocks[block] = 1;
+    sample->residentBlockCount ++;
+    return;
+}
+
+static void releaseLazyMapping (bmpPtr sample) {
+    if (sample->lazyMap != NULL) {
+        munmap (sample->lazyMap, sample->lazyMapSize);
+    }
+    free (sample->residentBlocks);
+    sample->lazyMap = NULL;
+    sample->lazyMapSize = 0;
+    sample->residentBlocks = NULL;
+    sample->lazyBlockRows = 0;
+    sample->lazyBlockCount = 0;
+    sample->residentBlockCount = 0;
+    return;
 }
 
 static void setDFLTPixelArray (bmpPtr bitmap) {
     verifyPixelFormat (bitmap->pixelFormat);
+    assert (bitmap->viewOwner == NULL && bitmap->viewCount == 0);
+    releaseLazyMapping (bitmap);
     free (bitmap->pixelArray);
+    markAllPixelsDirty (bitmap);
     if (bitmap->pixelFormat == RGB_24) {
         assert (bitmap->DIBVersion == BITMAPINFOHEADER);
         bitmap->pixelArray = (pixelArray) malloc (DEFAULT_IH_XRES_RGB_24 * DEFAULT_IH_YRES_RGB_24 * sizeof (pixel));
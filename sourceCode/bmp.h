@@ -5,6 +5,9 @@
 #define MAX_IMAGE_NAME_LENGTH 256   // use '<' not '<='
 #define MAX_RELATIVE_PATH_LENGTH 4097
 
+// the file size is stored in a DWORD, so no bitmap file may be larger than this
+#define MAX_BMP_FILE_SIZE 0xFFFFFFFFULL
+
 
 // supported DIB header versions
 // BITMAPINFOHEADER
@@ -31,12 +34,65 @@
 // LCS windows color space
 #define LCS_WINDOWS_COLOR_SPACE 0
 
+// supported row orders (sign of the height field on disk)
+// BOTTOM_UP: positive height, first row in the file is the bottom row of the image
+// TOP_DOWN: negative height, first row in the file is the top row of the image
+#define BOTTOM_UP 0
+#define TOP_DOWN 1
+
 // channel types
 #define RED 0
 #define GREEN 1
 #define BLUE 2
 #define ALPHA 3
 
+// border modes of convolveChannel/convolveBmp, how pixels outside of the image are read
+// BORDER_CLAMP: the nearest edge pixel (aa|abc), BORDER_REFLECT: mirrored about the edge pixel (cb|abc), BORDER_ZERO: 0
+#define BORDER_CLAMP 0
+#define BORDER_REFLECT 1
+#define BORDER_ZERO 2
+
+// resampling filters of resizeBmp
+// RESAMPLE_BILINEAR: triangle (support 1), RESAMPLE_BICUBIC: Keys cubic a = -0.5 (support 2), RESAMPLE_LANCZOS: lanczos 3 (support 3)
+#define RESAMPLE_BILINEAR 0
+#define RESAMPLE_BICUBIC 1
+#define RESAMPLE_LANCZOS 2
+
+// orientation changes of orientBmp and orientChannel (rotations are clockwise)
+#define ROTATE_90 0
+#define ROTATE_180 1
+#define ROTATE_270 2
+#define FLIP_HORIZONTAL 3
+#define FLIP_VERTICAL 4
+#define TRANSPOSE 5
+
+// blend modes of compositeBmp (W3C compositing and blending formulas, source over target)
+// BLEND_ADD adds premultiplied colors and alphas, clamped to 255
+#define BLEND_SOURCE_OVER 0
+#define BLEND_MULTIPLY 1
+#define BLEND_SCREEN 2
+#define BLEND_OVERLAY 3
+#define BLEND_ADD 4
+
+// color models of getColorModelChannels and setColorModelChannels (BT.601 full range, as in JPEG)
+// > COLOR_MODEL_LUMA: 1 channel, Y
+// > COLOR_MODEL_YCBCR_444: 3 channels, Y Cb Cr
+// > COLOR_MODEL_YCBCR_420: 3 channels, Y Cb Cr with the chroma channels at half resolution (rounded up)
+// > COLOR_MODEL_HSV: 3 channels, hue (one turn over 0 .. 255, 0 is red), saturation and value
+#define COLOR_MODEL_LUMA 0
+#define COLOR_MODEL_YCBCR_444 1
+#define COLOR_MODEL_YCBCR_420 2
+#define COLOR_MODEL_HSV 3
+
+// what equalizeBmp and equalizeBmpAdaptive equalize
+// > EQUALIZE_LUMA: luma only (in YCbCr 4:4:4, chroma is kept), > EQUALIZE_CHANNELS: red, green and blue on their own
+#define EQUALIZE_LUMA 0
+#define EQUALIZE_CHANNELS 1
+
+// smallest and largest supported convolution kernels (odd sizes only)
+#define MIN_KERNEL_SIZE 3
+#define MAX_KERNEL_SIZE 15
+
 #define MIN_RGB_VALUE 0
 #define MAX_RGB_VALUE 255
 
@@ -51,12 +107,22 @@ typedef int DIBHeaderVersion;
 typedef int pixelFormat;
 typedef DWORD colorSpace;
 typedef int channelType;
+typedef int rowOrder;
+typedef int borderMode;
+typedef int resampleFilter;
+typedef int orientation;
+typedef int blendMode;
+typedef int colorModel;
+typedef int equalizeMode;
 
 typedef char relativePath [MAX_RELATIVE_PATH_LENGTH];
 typedef char fileName [MAX_IMAGE_NAME_LENGTH];
 
 typedef struct bmp *bmpPtr;
 typedef struct channel *channelPtr;
+typedef struct mappedBmp *mappedBmpPtr;
+typedef struct pixelHash *pixelHashPtr;
+typedef struct kernel *kernelPtr;
 
 // creates an instance of ADT 'bmp' (sets the DIBHEaderVersion and DIbSize) and returns a pointer to it
 bmpPtr createBmp (DIBHeaderVersion version);
@@ -80,6 +146,58 @@ bmpPtr parseBitMap (relativePath srcFilePath);
 // saves the specified bitmap image as a '.bmp' file on the hard drive
 void saveBitMap (bmpPtr sampleBitmap, fileName imageFileName, relativePath destination);
 
+// saves the specified bitmap over the '.bmp' file it was parsed from (or last saved to)
+// only the rows changed since then (eg: through setChannel) are rewritten, changed header fields are patched in place
+// falls back to a full write when the pixel layout changed, the pixelArray was (re)allocated or filePath is not
+// the file the bitmap was parsed from or last saved to (paths are compared as given), or filePath does not hold a
+// '.bmp' file (eg: it does not exist yet)
+void saveBitMapInPlace (bmpPtr sampleBitmap, relativePath filePath);
+// returns the number of rows changed since the bitmap was parsed or saved
+LONG getDirtyRowCount (bmpPtr bitMap);
+// marks a bitmap read only (eg: shared by bmpCache), every later change of its pixels or headers
+// (or of those of its views) asserts
+void markBmpReadOnly (bmpPtr bitMap);
+
+// parses a '.bmp' file lazily: only the headers are read up front, the file is mapped and blocks of rows
+// are decoded into the pixelArray the first time they are accessed (eg: through getChannelRows)
+// the decoding is serialized by a lock owned by the bitmap, so several threads may read the same lazy bitmap
+bmpPtr parseBitMapLazy (relativePath srcFilePath);
+// returns the number of rows already decoded (every row unless the bitmap was parsed lazily)
+LONG getResidentRowCount (bmpPtr bitMap);
+
+// parses only the headers of a '.bmp' file, the returned bitmap has no pixelArray
+bmpPtr parseBitMapHeader (relativePath srcFilePath);
+// rewrites in place only the header bytes of a '.bmp' file that differ from the headers of the specified bitmap
+// (eg: print resolution or important color count), the pixelArray of the file is not touched
+// DIB version, resolution, color depth, compression and row order must match the file
+void patchBitMapHeader (bmpPtr header, relativePath filePath);
+// copies a '.bmp' file, replacing its headers with those of the specified bitmap
+// the pixelArray is copied by the kernel (copy_file_range/sendfile), same restrictions as patchBitMapHeader
+void copyBitMapWithHeader (bmpPtr header, relativePath srcFilePath, relativePath dstFilePath);
+
+// "open for edit" mode: maps a '.bmp' file read-write so that its pixels can be edited in place
+// edits land directly in the page cache, only the touched pages are written back
+mappedBmpPtr openBitMapForEdit (relativePath filePath);
+// returns the headers of the mapped file as a bitmap without pixelArray (do not destroy it)
+bmpPtr getMappedHeader (mappedBmpPtr image);
+// returns the size in bytes of one row in the file (pixels + padding)
+unsigned long long getMappedRowStride (mappedBmpPtr image);
+// returns a pointer to the specified row (0 is the top row) inside the mapping
+// pixels are stored as B G R (RGB_24) or B G R A (ARGB_32), the row is padded to a multiple of 4 bytes
+byte *getMappedRow (mappedBmpPtr image, LONG row);
+// synchronously writes the specified rows back to the file
+void flushMappedRows (mappedBmpPtr image, LONG firstRow, LONG rowCount);
+// synchronously writes every modified page back to the file
+void flushMappedBitMap (mappedBmpPtr image);
+// unmaps the file and frees any memory associated with it
+void closeMappedBitMap (mappedBmpPtr image);
+
+// parses a '.bmp' file already held in memory (byteCount bytes starting at source)
+bmpPtr parseBitMapFromMemory (byte *source, unsigned long long byteCount);
+// writes the specified bitmap as a '.bmp' file into memory
+// target must hold at least determineFileSizeInBytes (sampleBitmap) bytes
+void writeBitMapToMemory (bmpPtr sampleBitmap, byte *target);
+
 
 // Acess functions ADT : 'bmp'
 
@@ -105,6 +223,17 @@ LONG getYRes (bmpPtr bitMap);
 // sets the resolution 'height' (pixels) of the bitmap image
 void setYRes (bmpPtr bitMap, LONG yRes);
 
+// returns the order in which rows are stored on disk (in memory row 0 is always the top row)
+rowOrder getRowOrder (bmpPtr bitMap);
+// sets the order in which rows are written by saveBitMap
+// TOP_DOWN rows are written in memory order, which is cheaper for producers that generate rows top to bottom
+void setRowOrder (bmpPtr bitMap, rowOrder order);
+// returns 1 if the bitmap is written flipped vertically
+int getFlipOnSave (bmpPtr bitMap);
+// flip 1: saveBitMap, saveBitMapInPlace and writeBitMapToMemory write the image upside down at no extra cost
+// (rows are written in the opposite order of the one in the header), the pixelArray is left untouched
+void setFlipOnSave (bmpPtr bitMap, int flip);
+
 // allocates memory for pixel array (xRes and yRes must be initialized beforehand)
 void setUpPixelArray (bmpPtr sample);
 
@@ -160,6 +289,229 @@ colorSpace getColorSpace (bmpPtr sample);
 DWORD determineFileSizeInBytes (bmpPtr sample);
 DWORD evaluateRawImageSizeInBytes (bmpPtr sample);
 
+// conversions
+// creates a new bitmap with the pixels of 'src' under the specified DIB header version and pixel format
+// header, compression and color space are set to the defaults of the target version (listed in this interface)
+// supported pairs are BITMAPINFOHEADER/RGB_24 and BITMAPV4HEADER/ARGB_32
+// alphaFill is the alpha value given to every pixel when converting to ARGB_32 (ignored otherwise)
+// the result is straight alpha, premultiplied colors are divided back before alpha is replaced
+bmpPtr convertBmp (bmpPtr src, DIBHeaderVersion targetVersion, pixelFormat targetFormat, byte alphaFill);
+// same as convertBmp but reuses the pixelArray of the specified bitmap instead of allocating a new one
+void convertBmpInPlace (bmpPtr sample, DIBHeaderVersion targetVersion, pixelFormat targetFormat, byte alphaFill);
+
+// premultiplied alpha (ARGB_32 only): colors are held multiplied by alpha (rounded), so that resizeBmp, downsampleBmp,
+// buildPyramid, gaussianBlurBmp and compositeBmp work on them as they are instead of multiplying and dividing per call
+// > files are always straight alpha: saveBitMap (and every other writer) divides the colors back while encoding
+// > copies made by the kernels, materializeBmp and views keep the storage of their source
+// > channels, hashes and setChannel see and take the premultiplied values
+// > the bitmap must have no view, rows are not marked dirty (the file content does not change)
+void premultiplyBmp (bmpPtr sample);
+// divides the colors back (fully transparent pixels become black)
+void unpremultiplyBmp (bmpPtr sample);
+// returns 1 if the colors of the bitmap are premultiplied
+int isPremultiplied (bmpPtr sample);
+
+// creates a view of the xRes x yRes rectangle of parent whose top left pixel is (firstRow, firstColumn)
+// the view shares the pixels of parent (no copy) and has its headers, it can be used wherever a bitmap is expected
+// (channel extraction, setChannel, kernels, saveBitMap ...) except to change its resolution or pixel layout
+// > rows written through the view are marked dirty in the parent (for saveBitMapInPlace) when it is destroyed
+// > views are destroyed with destroyBmp, before their parent
+// > views are created and destroyed by one thread, distinct views can be processed by different threads at once
+bmpPtr createBmpView (bmpPtr parent, LONG firstRow, LONG firstColumn, LONG xRes, LONG yRes);
+// returns 1 if the bitmap is a view of another bitmap
+int isBmpView (bmpPtr bitMap);
+// creates a bitmap owning a copy of the pixels and headers of sample (eg: to keep a view after its parent is gone)
+bmpPtr materializeBmp (bmpPtr sample);
+
+// 64 bit non cryptographic digest of the pixels of a bitmap (eg: to deduplicate frames)
+// depends only on resolution, pixel format and pixel values: not on headers, row order or file padding
+unsigned long long hashBmpPixels (bmpPtr sample);
+// same digest as hashBmpPixels, computed on threadCount threads each hashing a band of rows
+unsigned long long hashBmpPixelsParallel (bmpPtr sample, int threadCount);
+// 64 bit digest of the values of a channel
+unsigned long long hashChannel (channelPtr channel);
+// incremental digest of a bitmap of the specified resolution and format, for rows produced band by band
+// (eg: by a renderer streaming rows into a writer): rows are fed through updatePixelHash in any order, each exactly once
+// finishPixelHash returns the same digest as hashBmpPixels and destroys the hash
+pixelHashPtr createPixelHash (LONG xRes, LONG yRes, pixelFormat pixelFormat);
+void updatePixelHash (pixelHashPtr hash, bmpPtr sample, LONG firstRow, LONG rowCount);
+unsigned long long finishPixelHash (pixelHashPtr hash);
+
+// creates a gaussian blurred copy of a channel, edges are extended by replicating the border pixels
+// separable fixed point passes on threadCount threads, from sigma 6 on 3 box blurs approximate the gaussian
+channelPtr gaussianBlurChannel (channelPtr source, double sigma, int threadCount);
+// creates a gaussian blurred copy of a bitmap (every channel, alpha included, is blurred on its own)
+bmpPtr gaussianBlurBmp (bmpPtr sample, double sigma, int threadCount);
+
+// creates a size x size convolution kernel (odd size between MIN_KERNEL_SIZE and MAX_KERNEL_SIZE)
+// weights are given row major, bias is added to every result (eg: 128 to keep the negative half of a sobel)
+// weights are held in 16 bit fixed point, results are rounded and clamped to [0, 255]
+kernelPtr createKernel (LONG size, double *weights, double bias);
+void destroyKernel (kernelPtr kernel);
+// creates the convolution of a channel by a kernel (correlation: the kernel is not flipped)
+// the image is processed in tiles (plus halo) shared out between threadCount threads
+channelPtr convolveChannel (channelPtr source, kernelPtr kernel, borderMode border, int threadCount);
+// creates a copy of a bitmap whose red, green and blue channels are convolved by the kernel, alpha is kept as is
+// (premultiplied colors are then clamped to their alpha)
+bmpPtr convolveBmp (bmpPtr sample, kernelPtr kernel, borderMode border, int threadCount);
+
+// creates a copy of a bitmap resampled to xRes x yRes (same headers, DIB version and pixel format)
+// two separable passes (rows then columns) with precomputed fixed point weights, the filter is widened when
+// downscaling so that it also antialiases. ARGB_32 is resampled premultiplied so that transparent pixels do not
+// bleed their color (straight bitmaps are premultiplied on the way in and back on the way out). Both passes are split in bands of rows between threadCount threads
+// at extreme downscale ratios the source is first box reduced by an integer factor so that the fixed point weights keep
+// their precision
+bmpPtr resizeBmp (bmpPtr sample, LONG xRes, LONG yRes, resampleFilter filter, int threadCount);
+
+// creates a copy of a bitmap at half its resolution (rounded up), every pixel is the rounded average of a 2x2 block
+// (the last row/column of an odd sized image is averaged with itself). Straight ARGB_32 blocks of unequal alpha are
+// averaged weighted by alpha
+bmpPtr downsampleBmp (bmpPtr sample);
+// returns the number of halvings from xRes x yRes down to 1x1
+int getPyramidLevelCount (LONG xRes, LONG yRes);
+// returns every level below sample down to 1x1 (levels[0] is downsampleBmp (sample)), *levelCount is set to
+// getPyramidLevelCount (). All levels are built in one pass over the rows of sample: every level is extended as soon
+// as two rows of the level above are ready, so a lazily parsed sample is decoded once, block by block
+// the levels are ordinary bitmaps (saveBitMap, writeBitMapToMemory ...), free them with destroyPyramid
+bmpPtr *buildPyramid (bmpPtr sample, int *levelCount);
+void destroyPyramid (bmpPtr *levels, int levelCount);
+
+// creates a rotated, flipped or transposed copy of a bitmap (same headers, the resolutions are swapped by
+// ROTATE_90, ROTATE_270 and TRANSPOSE). Rows are copied (reversed) as a whole, rotations and transposes
+// go through small tiles so that the column reads stay in cache
+bmpPtr orientBmp (bmpPtr sample, orientation orientation);
+// same as orientBmp for a single channel
+channelPtr orientChannel (channelPtr source, orientation orientation);
+// flips a bitmap vertically in place by swapping its rows
+void flipBmpVertically (bmpPtr sample);
+
+// composites source over target in place, the top left pixel of source lands on (row y, column x) of target
+// (parts outside of target are clipped). Blends in the alpha storage of target (a source stored the other way is
+// converted row by row), RGB_24 bitmaps are opaque, results are rounded exactly. Runs of transparent source pixels and of opaque pixels on both sides take fast paths
+// the rows are split in bands between threadCount threads
+void compositeBmp (bmpPtr target, bmpPtr source, LONG x, LONG y, blendMode mode, int threadCount);
+
+// returns the number of channels of a color model (1 or 3)
+int getColorModelChannelCount (colorModel model);
+// creates the channels of the bitmap in the specified color model into planes[0 .. getColorModelChannelCount ())
+// every band of rows (threadCount threads) is converted in one pass over the pixels with 16 bit fixed point weights,
+// no R/G/B channel is built on the way. 4:2:0 chroma is that of the average of every 2x2 block
+// (premultiplied colors are converted as they are held)
+void getColorModelChannels (bmpPtr sample, colorModel model, channelPtr *planes, int threadCount);
+// writes channels of a color model back into the colors of the bitmap (alpha is kept), the inverse of
+// getColorModelChannels: COLOR_MODEL_LUMA gives a gray image, 4:2:0 chroma covers its 2x2 block
+void setColorModelChannels (bmpPtr sample, colorModel model, channelPtr *planes, int threadCount);
+
+// tone curves (levels, gamma, inversion, thresholds ...) as 256 entry tables: every value v becomes table[v]
+// maps the channels of a bitmap in place, a NULL table leaves its channel as it is (alphaTable must be NULL for RGB_24)
+// premultiplied colors are divided back, mapped and multiplied again by the (mapped) alpha
+// the rows are split in bands between threadCount threads
+void applyLUT (bmpPtr sample, byte *redTable, byte *greenTable, byte *blueTable, byte *alphaTable, int threadCount);
+// maps the values of a channel in place through a 256 entry table
+void applyChannelLUT (channelPtr channel, byte *table, int threadCount);
+// fills target with the table of first followed by second (second[first[v]]), so that chained curves are applied
+// in a single pass. target may be first or second
+void composeLUT (byte *target, byte *first, byte *second);
+
+// counts of every value of the red, green, blue, alpha and luma (BT.601, as COLOR_MODEL_LUMA) of the pixels of a bitmap
+typedef struct bmpHistogram {
+    unsigned long long red[256];
+    unsigned long long green[256];
+    unsigned long long blue[256];
+    unsigned long long alpha[256];
+    unsigned long long luma[256];
+} bmpHistogram;
+// fills the histograms of every channel in one pass over the pixels: the rows are split in bands between
+// threadCount threads, each counting into 4 interleaved sets of counters (so that runs of equal values do not
+// increment the same counter back to back), the counts of every thread are summed at the end
+// RGB_24 pixels are counted opaque (alpha 255), premultiplied colors are counted as they are held
+void computeHistogram (bmpPtr sample, bmpHistogram *histogram, int threadCount);
+// adds the counts of rowCount rows starting at firstRow to the histogram, only those rows are decoded from a lazily
+// parsed bitmap (eg: to go through a large file block by block, or to count rows as they are produced)
+void accumulateHistogram (bmpHistogram *histogram, bmpPtr sample, LONG firstRow, LONG rowCount);
+// fills counts[0 .. 255] with the counts of every value of a channel
+void computeChannelHistogram (channelPtr channel, unsigned long long *counts, int threadCount);
+
+// statistics of the values of a channel, the mean is sum / count and the variance sumOfSquares / count - mean * mean
+// (all zero, the empty statistics, when count is 0)
+typedef struct channelStats {
+    unsigned long long count;
+    byte min;
+    byte max;
+    unsigned long long sum;
+    unsigned long long sumOfSquares;
+    // values clipped at 0 and at 255
+    unsigned long long blackCount;
+    unsigned long long whiteCount;
+} channelStats;
+typedef struct bmpStats {
+    channelStats red;
+    channelStats green;
+    channelStats blue;
+    channelStats alpha;
+} bmpStats;
+// statistics of every channel of a bitmap in one pass over the pixels, the rows are split in bands between threadCount
+// threads whose statistics are merged in band order. RGB_24 pixels are opaque, premultiplied colors are taken as held
+void computeBmpStats (bmpPtr sample, bmpStats *stats, int threadCount);
+// merges the statistics of rowCount rows starting at firstRow into stats (zeroed beforehand, eg: by memset), only those
+// rows are decoded from a lazily parsed bitmap
+void accumulateBmpStats (bmpStats *stats, bmpPtr sample, LONG firstRow, LONG rowCount);
+void computeChannelStats (channelPtr channel, channelStats *stats, int threadCount);
+
+// histogram equalization in place: every value is mapped through the normalized cumulative histogram
+// (computeChannelHistogram / computeHistogram, then applyChannelLUT / applyLUT)
+void equalizeChannel (channelPtr channel, int threadCount);
+// alpha is kept, the bitmap must not be premultiplied (unpremultiplyBmp first)
+void equalizeBmp (bmpPtr sample, equalizeMode mode, int threadCount);
+// contrast limited adaptive histogram equalization (CLAHE) in place: the channel is cut in tileRows x tileColumns tiles,
+// the histogram of every tile is clipped at clipLimit times its average bin (the excess is spread over every bin)
+// and turned into a table, every pixel is mapped through the tables of the 4 nearest tile centers, weighted bilinearly
+// the tables are built on threadCount threads (tiles interleaved between threads), then bands of rows are mapped
+void equalizeChannelAdaptive (channelPtr channel, LONG tileRows, LONG tileColumns, double clipLimit, int threadCount);
+// CLAHE of a bitmap, same restrictions as equalizeBmp
+void equalizeBmpAdaptive (bmpPtr sample, equalizeMode mode, LONG tileRows, LONG tileColumns, double clipLimit, int threadCount);
+
+// differences between two images of the same size, compared value by value
+typedef struct channelDifference {
+    unsigned long long count;
+    // squared differences summed over the count values, the mean squared error is sumOfSquares / count
+    unsigned long long sumOfSquares;
+    double mse;
+    // 10 log10 (255^2 / mse) in dB, INFINITY when no value differs
+    double psnr;
+    // largest absolute difference and its first (top to bottom, left to right) location, 0 0 when no value differs
+    byte maxDifference;
+    LONG maxRow;
+    LONG maxColumn;
+} channelDifference;
+typedef struct bmpDifference {
+    channelDifference red;
+    channelDifference green;
+    channelDifference blue;
+    channelDifference alpha;
+} bmpDifference;
+// mean structural similarity of every channel
+typedef struct bmpSSIM {
+    double red;
+    double green;
+    double blue;
+    double alpha;
+} bmpSSIM;
+// whether two bitmaps hold the same pixels (0 if their resolutions, pixel formats or premultiplied states differ),
+// the alpha byte of RGB_24 pixels is ignored. The rows are split in bands compared a block of memory at a time
+// (memcmp) by threadCount threads, every thread stops at the first difference found by any of them
+int bmpsIdentical (bmpPtr first, bmpPtr second, int threadCount);
+int channelsIdentical (channelPtr first, channelPtr second, int threadCount);
+// MSE, PSNR and largest absolute difference of every channel of two bitmaps of the same resolution, pixel format
+// and premultiplied state (the alpha of RGB_24 bitmaps never differs), in one pass on threadCount threads
+void measureBmpDifference (bmpPtr first, bmpPtr second, bmpDifference *difference, int threadCount);
+void measureChannelDifference (channelPtr first, channelPtr second, channelDifference *difference, int threadCount);
+// SSIM (Wang et al.) averaged over every windowSize x windowSize window (1 to 128, at most the resolution) at every
+// position, with a uniform window. The result does not depend on threadCount, 1 when both images are the same
+double computeChannelSSIM (channelPtr first, channelPtr second, LONG windowSize, int threadCount);
+// SSIM of every channel of two bitmaps, same restrictions as measureBmpDifference (the alpha of RGB_24 bitmaps is 1)
+void computeBmpSSIM (bmpPtr first, bmpPtr second, LONG windowSize, bmpSSIM *ssim, int threadCount);
+
 // Access functions ADT : 'channel'
 // takes an 'initialized bmp ADT instance reference' as input, creates and initializes the RED channel and returns a pointer to it.
 channelPtr getRedChannel (bmpPtr bitMap);
@@ -170,6 +522,13 @@ channelPtr getBlueChannel (bmpPtr bitMap);
 // takes an 'initialized bmp ADT instance reference' as input, creates and initializes the ALPHA channel and returns a pointer to it.
 // provided the there exists alpha channel in the pixel format 
 channelPtr getAlphaChannel (bmpPtr bitMap);
+// creates a channel of the specified type holding only rowCount rows starting at firstRow (0 is the top row)
+// for lazily parsed bitmaps only those rows are decoded
+channelPtr getChannelRows (bmpPtr bitMap, channelType channelType, LONG firstRow, LONG rowCount);
+// creates an xRes x yRes channel holding the luma (BT.601) of the bitmap, every value is the average of a box of pixels
+// single pass over the pixelArray without building full size channels (eg: for perceptual hashing)
+// for lazily parsed bitmaps the rows are decoded band by band as the thumbnail reaches them
+channelPtr getLumaThumbnail (bmpPtr bitMap, LONG xRes, LONG yRes);
 
 
 // to access dimensions of channel
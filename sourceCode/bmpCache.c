@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "bmp.h"
+#include "bmpCache.h"
+
+#define INITIAL_BUCKET_COUNT 64
+// every pixel format is held as a 4 byte pixel in memory
+#define CACHED_BYTES_PER_PIXEL 4
+
+typedef struct cacheEntry {
+    // key
+    char *path;
+    dev_t device;
+    ino_t inode;
+    struct timespec modificationTime;
+    off_t fileSize;
+
+    bmpPtr bitMap;
+    unsigned long long byteCount;
+    // handles given out and not yet released
+    int refCount;
+    // 0 once the entry has been evicted (or replaced), it is then freed by the last release
+    int cached;
+    struct cacheEntry *nextInBucket;
+    // recency list, mostRecent first
+    struct cacheEntry *newer;
+    struct cacheEntry *older;
+} cacheEntry;
+
+typedef struct bmpCache {
+    pthread_mutex_t lock;
+    unsigned long long byteBudget;
+    unsigned long long byteCount;
+    unsigned long long entryCount;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    cacheEntry **buckets;
+    unsigned long long bucketCount;
+    cacheEntry *mostRecent;
+    cacheEntry *leastRecent;
+} bmpCache;
+
+static unsigned long long hashPath (char *path);
+static cacheEntry *findEntry (bmpCachePtr cache, char *path);
+static int matchesFile (cacheEntry *entry, struct stat *fileStatus);
+static void insertEntry (bmpCachePtr cache, cacheEntry *entry);
+static void detachEntry (bmpCachePtr cache, cacheEntry *entry);
+static void evictToBudget (bmpCachePtr cache);
+static void growBuckets (bmpCachePtr cache);
+static void linkMostRecent (bmpCachePtr cache, cacheEntry *entry);
+static void unlinkRecency (bmpCachePtr cache, cacheEntry *entry);
+static void destroyEntry (cacheEntry *entry);
+static bmpPtr parseFileWithStatus (relativePath srcFilePath, struct stat *fileStatus);
+
+bmpCachePtr createBmpCache (unsigned long long byteBudget) {
+    bmpCachePtr cache = (bmpCachePtr) malloc (sizeof (bmpCache));
+    assert (cache != NULL);
+    int retCode = pthread_mutex_init (&cache->lock, NULL);
+    assert (retCode == 0);
+    cache->byteBudget = byteBudget;
+    cache->byteCount = 0;
+    cache->entryCount = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+    cache->bucketCount = INITIAL_BUCKET_COUNT;
+    cache->buckets = (cacheEntry **) calloc (cache->bucketCount, sizeof (cacheEntry *));
+    assert (cache->buckets != NULL);
+    cache->mostRecent = NULL;
+    cache->leastRecent = NULL;
+    return cache;
+}
+
+void destroyBmpCache (bmpCachePtr cache) {
+    assert (cache != NULL);
+    cacheEntry *entry = cache->mostRecent;
+    while (entry != NULL) {
+        cacheEntry *older = entry->older;
+        assert (entry->refCount == 0);
+        destroyEntry (entry);
+        entry = older;
+    }
+    free (cache->buckets);
+    pthread_mutex_destroy (&cache->lock);
+    free (cache);
+    return;
+}
+
+cachedBmpPtr acquireCachedBitMap (bmpCachePtr cache, relativePath srcFilePath) {
+    assert (cache != NULL);
+    assert (srcFilePath != NULL);
+    struct stat fileStatus;
+    int retCode = stat (srcFilePath, &fileStatus);
+    assert (retCode == 0);
+
+    pthread_mutex_lock (&cache->lock);
+    cacheEntry *entry = findEntry (cache, srcFilePath);
+    if (entry != NULL && matchesFile (entry, &fileStatus)) {
+        entry->refCount ++;
+        unlinkRecency (cache, entry);
+        linkMostRecent (cache, entry);
+        cache->hits ++;
+        pthread_mutex_unlock (&cache->lock);
+        return entry;
+    }
+    cache->misses ++;
+    pthread_mutex_unlock (&cache->lock);
+
+    // parsed without holding the lock so that misses on different files do not serialize
+    // the key is that of the file actually parsed, which may have been replaced since the lookup
+    bmpPtr bitMap = parseFileWithStatus (srcFilePath, &fileStatus);
+    markBmpReadOnly (bitMap);
+
+    pthread_mutex_lock (&cache->lock);
+    entry = findEntry (cache, srcFilePath);
+    if (entry != NULL && matchesFile (entry, &fileStatus)) {
+        // another thread parsed the same file meanwhile, share its copy
+        entry->refCount ++;
+        unlinkRecency (cache, entry);
+        linkMostRecent (cache, entry);
+        pthread_mutex_unlock (&cache->lock);
+        destroyBmp (bitMap);
+        return entry;
+    }
+    if (entry != NULL) {
+        // the file changed on disk
+        detachEntry (cache, entry);
+    }
+    entry = (cacheEntry *) malloc (sizeof (cacheEntry));
+    assert (entry != NULL);
+    entry->path = strdup (srcFilePath);
+    assert (entry->path != NULL);
+    entry->device = fileStatus.st_dev;
+    entry->inode = fileStatus.st_ino;
+    entry->modificationTime = fileStatus.st_mtim;
+    entry->fileSize = fileStatus.st_size;
+    entry->bitMap = bitMap;
+    entry->byteCount = (unsigned long long) getXRes (bitMap) * getYRes (bitMap) * CACHED_BYTES_PER_PIXEL;
+    entry->refCount = 1;
+    insertEntry (cache, entry);
+    // may evict the new entry itself when it is larger than the budget, the handle stays valid until released
+    evictToBudget (cache);
+    pthread_mutex_unlock (&cache->lock);
+    return entry;
+}
+
+bmpPtr getCachedBitMap (cachedBmpPtr handle) {
+    assert (handle != NULL);
+    // bitMap is set once when the entry is built (read only), refCount is only read under the cache lock
+    return handle->bitMap;
+}
+
+void releaseCachedBitMap (bmpCachePtr cache, cachedBmpPtr handle) {
+    assert (cache != NULL);
+    assert (handle != NULL);
+    pthread_mutex_lock (&cache->lock);
+    assert (handle->refCount > 0);
+    handle->refCount --;
+    int unreferenced = (handle->refCount == 0 && !handle->cached);
+    pthread_mutex_unlock (&cache->lock);
+    if (unreferenced) {
+        destroyEntry (handle);
+    }
+    return;
+}
+
+bmpCacheStats getBmpCacheStats (bmpCachePtr cache) {
+    assert (cache != NULL);
+    bmpCacheStats stats;
+    pthread_mutex_lock (&cache->lock);
+    stats.hits = cache->hits;
+    stats.misses = cache->misses;
+    stats.evictions = cache->evictions;
+    stats.byteCount = cache->byteCount;
+    stats.entryCount = cache->entryCount;
+    pthread_mutex_unlock (&cache->lock);
+    return stats;
+}
+
+// parses the file from the descriptor its status is taken from
+static bmpPtr parseFileWithStatus (relativePath srcFilePath, struct stat *fileStatus) {
+    int file = open (srcFilePath, O_RDONLY);
+    assert (file >= 0);
+    int retCode = fstat (file, fileStatus);
+    assert (retCode == 0);
+    assert (fileStatus->st_size > 0);
+    unsigned long long byteCount = (unsigned long long) fileStatus->st_size;
+    byte *bytes = (byte *) malloc (byteCount);
+    assert (bytes != NULL);
+    unsigned long long readCount = 0;
+    while (readCount < byteCount) {
+        ssize_t chunk = read (file, bytes + readCount, byteCount - readCount);
+        assert (chunk > 0);
+        readCount += (unsigned long long) chunk;
+    }
+    close (file);
+    bmpPtr bitMap = parseBitMapFromMemory (bytes, byteCount);
+    free (bytes);
+    return bitMap;
+}
+
+// djb2
+static unsigned long long hashPath (char *path) {
+    unsigned long long hash = 5381;
+    while (*path != '\0') {
+        hash = hash * 33 + (byte) *path;
+        path ++;
+    }
+    return hash;
+}
+
+static cacheEntry *findEntry (bmpCachePtr cache, char *path) {
+    cacheEntry *entry = cache->buckets[hashPath (path) & (cache->bucketCount - 1)];
+    while (entry != NULL && strcmp (entry->path, path) != 0) {
+        entry = entry->nextInBucket;
+    }
+    return entry;
+}
+
+static int matchesFile (cacheEntry *entry, struct stat *fileStatus) {
+    int matches = entry->device == fileStatus->st_dev && entry->inode == fileStatus->st_ino;
+    matches = matches && entry->fileSize == fileStatus->st_size;
+    matches = matches && entry->modificationTime.tv_sec == fileStatus->st_mtim.tv_sec;
+    matches = matches && entry->modificationTime.tv_nsec == fileStatus->st_mtim.tv_nsec;
+    return matches;
+}
+
+static void insertEntry (bmpCachePtr cache, cacheEntry *entry) {
+    if (cache->entryCount >= cache->bucketCount) {
+        growBuckets (cache);
+    }
+    unsigned long long bucket = hashPath (entry->path) & (cache->bucketCount - 1);
+    entry->nextInBucket = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    linkMostRecent (cache, entry);
+    entry->cached = 1;
+    cache->byteCount += entry->byteCount;
+    cache->entryCount ++;
+    return;
+}
+
+// removes the entry from the cache, it is freed now or by the release of its last handle
+static void detachEntry (bmpCachePtr cache, cacheEntry *entry) {
+    cacheEntry **link = &cache->buckets[hashPath (entry->path) & (cache->bucketCount - 1)];
+    while (*link != entry) {
+        link = &(*link)->nextInBucket;
+    }
+    *link = entry->nextInBucket;
+    unlinkRecency (cache, entry);
+    entry->cached = 0;
+    cache->byteCount -= entry->byteCount;
+    cache->entryCount --;
+    if (entry->refCount == 0) {
+        destroyEntry (entry);
+    }
+    return;
+}
+
+static void evictToBudget (bmpCachePtr cache) {
+    while (cache->byteCount > cache->byteBudget && cache->leastRecent != NULL) {
+        detachEntry (cache, cache->leastRecent);
+        cache->evictions ++;
+    }
+    return;
+}
+
+static void growBuckets (bmpCachePtr cache) {
+    unsigned long long bucketCount = cache->bucketCount * 2;
+    cacheEntry **buckets = (cacheEntry **) calloc (bucketCount, sizeof (cacheEntry *));
+    assert (buckets != NULL);
+    unsigned long long i = 0;
+    while (i < cache->bucketCount) {
+        cacheEntry *entry = cache->buckets[i];
+        while (entry != NULL) {
+            cacheEntry *next = entry->nextInBucket;
+            unsigned long long bucket = hashPath (entry->path) & (bucketCount - 1);
+            entry->nextInBucket = buckets[bucket];
+            buckets[bucket] = entry;
+            entry = next;
+        }
+        i ++;
+    }
+    free (cache->buckets);
+    cache->buckets = buckets;
+    cache->bucketCount = bucketCount;
+    return;
+}
+
+static void linkMostRecent (bmpCachePtr cache, cacheEntry *entry) {
+    entry->newer = NULL;
+    entry->older = cache->mostRecent;
+    if (cache->mostRecent != NULL) {
+        cache->mostRecent->newer = entry;
+    } else {
+        cache->leastRecent = entry;
+    }
+    cache->mostRecent = entry;
+    return;
+}
+
+static void unlinkRecency (bmpCachePtr cache, cacheEntry *entry) {
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->mostRecent = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->leastRecent = entry->newer;
+    }
+    entry->newer = NULL;
+    entry->older = NULL;
+    return;
+}
+
+static void destroyEntry (cacheEntry *entry) {
+    destroyBmp (entry->bitMap);
+    free (entry->path);
+    free (entry);
+    return;
+}
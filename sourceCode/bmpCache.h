@@ -0,0 +1,37 @@
+//  bmpCache.h
+//
+// in-process cache of parsed bitmaps (include "bmp.h" before this interface)
+//
+// > entries are keyed by path + device + inode + modification time + size of the file, a file that
+//   changed on disk is parsed again
+// > the cache holds at most byteBudget bytes of decoded pixels, least recently used entries are evicted first
+// > hits share one parsed bitmap between every caller: handles are read only, the bitmap must not be
+//   modified (copy it with convertBmp first, any change asserts) and stays valid until the handle is released
+// > every function is safe to call from many threads at once
+
+typedef struct bmpCache *bmpCachePtr;
+typedef struct cacheEntry *cachedBmpPtr;
+
+typedef struct bmpCacheStats {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    // decoded pixel bytes and number of bitmaps currently held by the cache
+    unsigned long long byteCount;
+    unsigned long long entryCount;
+} bmpCacheStats;
+
+// creates an empty cache holding at most byteBudget bytes of decoded pixels
+bmpCachePtr createBmpCache (unsigned long long byteBudget);
+// frees the cache and every bitmap in it, every handle must have been released
+void destroyBmpCache (bmpCachePtr cache);
+
+// returns a handle to the parsed '.bmp' file, parsing it (parseBitMap) only if it is not cached
+cachedBmpPtr acquireCachedBitMap (bmpCachePtr cache, relativePath srcFilePath);
+// returns the shared, read only bitmap of a handle (marked with markBmpReadOnly, eg: setChannel on it asserts)
+bmpPtr getCachedBitMap (cachedBmpPtr handle);
+// releases a handle returned by acquireCachedBitMap
+void releaseCachedBitMap (bmpCachePtr cache, cachedBmpPtr handle);
+
+// returns a snapshot of the hit/miss/eviction counters and of the cache occupancy
+bmpCacheStats getBmpCacheStats (bmpCachePtr cache);
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "bmp.h"
+#include "bmpPHash.h"
+
+#define HASH_BIT_COUNT 64
+#define HASH_SIDE 8
+#define DCT_SIDE 32
+
+// work handed to each hashing thread, either samples or srcFilePaths is set
+typedef struct hashingJob {
+    bmpPtr *samples;
+    relativePath *srcFilePaths;
+    DWORD count;
+    perceptualHashType hashType;
+    unsigned long long *hashes;
+    int threadIndex;
+    int threadCount;
+} hashingJob;
+
+static void verifyPerceptualHashType (perceptualHashType hashType);
+static unsigned long long averageHash (channelPtr luma);
+static unsigned long long differenceHash (channelPtr luma);
+static unsigned long long dctHash (channelPtr luma);
+static void initializeCosineTable ();
+static int compareDoubles (const void *a, const void *b);
+static void runHashingJobs (hashingJob *work, int threadCount);
+static void *hashingWorker (void *job);
+
+// cos ((2x + 1) u pi / 64) for the 8 lowest frequencies u, shared by every thread
+static double cosineTable[HASH_SIDE][DCT_SIDE];
+static pthread_once_t cosineTableOnce = PTHREAD_ONCE_INIT;
+
+unsigned long long computePerceptualHash (bmpPtr sample, perceptualHashType hashType) {
+    assert (sample != NULL);
+    verifyPerceptualHashType (hashType);
+    channelPtr luma = getLumaThumbnail (sample, getPerceptualHashXRes (hashType), getPerceptualHashYRes (hashType));
+    unsigned long long hash = computePerceptualHashFromLuma (luma, hashType);
+    destroyChannel (luma);
+    return hash;
+}
+
+unsigned long long computePerceptualHashFromLuma (channelPtr luma, perceptualHashType hashType) {
+    assert (luma != NULL);
+    verifyPerceptualHashType (hashType);
+    assert (getChXRes (luma) == getPerceptualHashXRes (hashType));
+    assert (getChYRes (luma) == getPerceptualHashYRes (hashType));
+    unsigned long long hash = 0;
+    if (hashType == AVERAGE_HASH) {
+        hash = averageHash (luma);
+    } else if (hashType == DIFFERENCE_HASH) {
+        hash = differenceHash (luma);
+    } else {
+        hash = dctHash (luma);
+    }
+    return hash;
+}
+
+LONG getPerceptualHashXRes (perceptualHashType hashType) {
+    verifyPerceptualHashType (hashType);
+    LONG xRes = HASH_SIDE;
+    if (hashType == DIFFERENCE_HASH) {
+        xRes = HASH_SIDE + 1;
+    } else if (hashType == DCT_HASH) {
+        xRes = DCT_SIDE;
+    }
+    return xRes;
+}
+
+LONG getPerceptualHashYRes (perceptualHashType hashType) {
+    verifyPerceptualHashType (hashType);
+    LONG yRes = HASH_SIDE;
+    if (hashType == DCT_HASH) {
+        yRes = DCT_SIDE;
+    }
+    return yRes;
+}
+
+void computePerceptualHashes (bmpPtr *samples, DWORD sampleCount, perceptualHashType hashType, unsigned long long *hashes, int threadCount) {
+    assert (samples != NULL && hashes != NULL);
+    verifyPerceptualHashType (hashType);
+    hashingJob work;
+    work.samples = samples;
+    work.srcFilePaths = NULL;
+    work.count = sampleCount;
+    work.hashType = hashType;
+    work.hashes = hashes;
+    runHashingJobs (&work, threadCount);
+    return;
+}
+
+void computePerceptualHashesOfFiles (relativePath *srcFilePaths, DWORD fileCount, perceptualHashType hashType, unsigned long long *hashes, int threadCount) {
+    assert (srcFilePaths != NULL && hashes != NULL);
+    verifyPerceptualHashType (hashType);
+    hashingJob work;
+    work.samples = NULL;
+    work.srcFilePaths = srcFilePaths;
+    work.count = fileCount;
+    work.hashType = hashType;
+    work.hashes = hashes;
+    runHashingJobs (&work, threadCount);
+    return;
+}
+
+int hammingDistance (unsigned long long hashA, unsigned long long hashB) {
+    return __builtin_popcountll (hashA ^ hashB);
+}
+
+static void verifyPerceptualHashType (perceptualHashType hashType) {
+    assert (hashType == AVERAGE_HASH || hashType == DIFFERENCE_HASH || hashType == DCT_HASH);
+    return;
+}
+
+static unsigned long long averageHash (channelPtr luma) {
+    unsigned int sum = 0;
+    LONG row = 0;
+    while (row < HASH_SIDE) {
+        LONG column = 0;
+        while (column < HASH_SIDE) {
+            sum += getPixel (row, column, luma);
+            column ++;
+        }
+        row ++;
+    }
+    unsigned long long hash = 0;
+    row = 0;
+    while (row < HASH_SIDE) {
+        LONG column = 0;
+        while (column < HASH_SIDE) {
+            // compared against the mean without dividing: value > sum / 64
+            hash = (hash << 1) | (getPixel (row, column, luma) * HASH_BIT_COUNT > sum);
+            column ++;
+        }
+        row ++;
+    }
+    return hash;
+}
+
+static unsigned long long differenceHash (channelPtr luma) {
+    unsigned long long hash = 0;
+    LONG row = 0;
+    while (row < HASH_SIDE) {
+        LONG column = 0;
+        while (column < HASH_SIDE) {
+            hash = (hash << 1) | (getPixel (row, column + 1, luma) > getPixel (row, column, luma));
+            column ++;
+        }
+        row ++;
+    }
+    return hash;
+}
+
+// only the 8x8 lowest frequencies of the 2D DCT-II are needed: rows are transformed to 8 coefficients
+// each, then the 8 columns of the result
+static unsigned long long dctHash (channelPtr luma) {
+    pthread_once (&cosineTableOnce, initializeCosineTable);
+    double rowCoefficients[DCT_SIDE][HASH_SIDE];
+    LONG row = 0;
+    while (row < DCT_SIDE) {
+        int u = 0;
+        while (u < HASH_SIDE) {
+            double sum = 0;
+            LONG column = 0;
+            while (column < DCT_SIDE) {
+                sum += getPixel (row, column, luma) * cosineTable[u][column];
+                column ++;
+            }
+            rowCoefficients[row][u] = sum;
+            u ++;
+        }
+        row ++;
+    }
+    double coefficients[HASH_BIT_COUNT];
+    int v = 0;
+    while (v < HASH_SIDE) {
+        int u = 0;
+        while (u < HASH_SIDE) {
+            double sum = 0;
+            row = 0;
+            while (row < DCT_SIDE) {
+                sum += rowCoefficients[row][u] * cosineTable[v][row];
+                row ++;
+            }
+            coefficients[v * HASH_SIDE + u] = sum;
+            u ++;
+        }
+        v ++;
+    }
+    // the DC coefficient only carries the mean brightness, it is left out of the median
+    double sorted[HASH_BIT_COUNT - 1];
+    memcpy (sorted, coefficients + 1, sizeof (sorted));
+    qsort (sorted, HASH_BIT_COUNT - 1, sizeof (double), compareDoubles);
+    double median = sorted[(HASH_BIT_COUNT - 1) / 2];
+    unsigned long long hash = 0;
+    int i = 0;
+    while (i < HASH_BIT_COUNT) {
+        hash = (hash << 1) | (coefficients[i] > median);
+        i ++;
+    }
+    return hash;
+}
+
+static void initializeCosineTable () {
+    int u = 0;
+    while (u < HASH_SIDE) {
+        int x = 0;
+        while (x < DCT_SIDE) {
+            cosineTable[u][x] = cos ((2 * x + 1) * u * M_PI / (2 * DCT_SIDE));
+            x ++;
+        }
+        u ++;
+    }
+    return;
+}
+
+static int compareDoubles (const void *a, const void *b) {
+    double first = *(const double *) a;
+    double second = *(const double *) b;
+    return (first > second) - (first < second);
+}
+
+static void runHashingJobs (hashingJob *work, int threadCount) {
+    assert (threadCount > 0);
+    if (work->count == 0) {
+        return;
+    }
+    if ((DWORD) threadCount > work->count) {
+        threadCount = (int) work->count;
+    }
+    pthread_t *threads = (pthread_t *) malloc (threadCount * sizeof (pthread_t));
+    hashingJob *jobs = (hashingJob *) malloc (threadCount * sizeof (hashingJob));
+    assert (threads != NULL && jobs != NULL);
+    int t = 0;
+    while (t < threadCount) {
+        jobs[t] = *work;
+        jobs[t].threadIndex = t;
+        jobs[t].threadCount = threadCount;
+        // the calling thread takes the first share
+        if (t > 0) {
+            int retCode = pthread_create (threads + t, NULL, hashingWorker, jobs + t);
+            assert (retCode == 0);
+        }
+        t ++;
+    }
+    hashingWorker (jobs);
+    t = 1;
+    while (t < threadCount) {
+        pthread_join (threads[t], NULL);
+        t ++;
+    }
+    free (threads);
+    free (jobs);
+    return;
+}
+
+static void *hashingWorker (void *job) {
+    hashingJob *work = (hashingJob *) job;
+    // interleaved between threads so that runs of large images are shared out
+    DWORD i = work->threadIndex;
+    while (i < work->count) {
+        if (work->samples != NULL) {
+            work->hashes[i] = computePerceptualHash (work->samples[i], work->hashType);
+        } else {
+            // the file is mapped and its rows decoded block by block while the thumbnail is built
+            bmpPtr sample = parseBitMapLazy (work->srcFilePaths[i]);
+            work->hashes[i] = computePerceptualHash (sample, work->hashType);
+            destroyBmp (sample);
+        }
+        i += work->threadCount;
+    }
+    return NULL;
+}
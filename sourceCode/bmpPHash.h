@@ -0,0 +1,34 @@
+//  bmpPHash.h
+//
+// perceptual hashes for near duplicate detection (include "bmp.h" before this interface)
+//
+// every hash is 64 bits computed from a small luma thumbnail (getLumaThumbnail), so that images
+// that look alike (rescaled, recompressed, slightly brightened...) get hashes a few bits apart
+//  > AVERAGE_HASH (aHash): 8x8 thumbnail, bit set when the pixel is brighter than the mean
+//  > DIFFERENCE_HASH (dHash): 9x8 thumbnail, bit set when a pixel is brighter than its left neighbour
+//  > DCT_HASH (pHash): 32x32 thumbnail, bit set when a low frequency DCT coefficient is above the median
+// bit 63 - i holds the i'th value in row major order
+
+#define AVERAGE_HASH 0
+#define DIFFERENCE_HASH 1
+#define DCT_HASH 2
+
+typedef int perceptualHashType;
+
+// computes the perceptual hash of the specified type of a bitmap
+unsigned long long computePerceptualHash (bmpPtr sample, perceptualHashType hashType);
+// computes the perceptual hash of the specified type from a luma thumbnail of the expected size
+// (8x8 for AVERAGE_HASH, 9x8 for DIFFERENCE_HASH, 32x32 for DCT_HASH), eg: built while streaming rows
+unsigned long long computePerceptualHashFromLuma (channelPtr luma, perceptualHashType hashType);
+// returns the resolution of the luma thumbnail used by the specified hash type
+LONG getPerceptualHashXRes (perceptualHashType hashType);
+LONG getPerceptualHashYRes (perceptualHashType hashType);
+
+// hashes[i] receives the hash of samples[i], the bitmaps are shared out between threadCount threads
+void computePerceptualHashes (bmpPtr *samples, DWORD sampleCount, perceptualHashType hashType, unsigned long long *hashes, int threadCount);
+// same as computePerceptualHashes for '.bmp' files, every file is parsed lazily (parseBitMapLazy), hashed and destroyed
+// on a worker thread, its rows are decoded from the mapped file as the luma thumbnail reaches them
+void computePerceptualHashesOfFiles (relativePath *srcFilePaths, DWORD fileCount, perceptualHashType hashType, unsigned long long *hashes, int threadCount);
+
+// number of bits that differ between two hashes (0 for identical images, 64 at most)
+int hammingDistance (unsigned long long hashA, unsigned long long hashB);
@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bmp.h"
+#include "bmpPack.h"
+
+#define INITIAL_PACK_CAPACITY 64
+#define PACK_COPY_BLOCK_SIZE (1 << 20)
+// bitmap file header and the dimensions of the DIB header, read by addFileToPack
+#define PEEKED_HEADER_SIZE 26
+
+typedef struct packEntry {
+    char *name;
+    unsigned long long offset;
+    DWORD byteCount;
+    LONG xRes;
+    LONG yRes;
+} packEntry;
+
+typedef struct packWriter {
+    FILE *packFile;
+    unsigned long long fileOffset;
+    DWORD entryCount;
+    DWORD capacity;
+    packEntry *entries;
+    // open addressed set of the names added so far: ordinal + 1 of their entry, 0 for an empty slot
+    DWORD *nameSlots;
+    DWORD slotCount;
+} packWriter;
+
+typedef struct pack {
+    byte *map;
+    unsigned long long mapSize;
+    DWORD entryCount;
+    packEntry *entries;
+    // entries sorted by name for lookups
+    packEntry **byName;
+} pack;
+
+// work handed to each extraction thread
+typedef struct extractionJob {
+    packPtr pack;
+    DWORD *ordinals;
+    DWORD entryCount;
+    bmpPtr *targets;
+    int threadIndex;
+    int threadCount;
+} extractionJob;
+
+static void appendEntry (packWriterPtr writer, char *name, DWORD byteCount, LONG xRes, LONG yRes);
+static void verifyNewEntryName (packWriterPtr writer, char *name);
+static DWORD *findNameSlot (packWriterPtr writer, char *name);
+static void growNameSlots (packWriterPtr writer);
+static unsigned long long hashName (char *name);
+static void writeLittleEndian (FILE *target, unsigned long long number, int byteCount);
+static unsigned long long readLittleEndian (byte *bytes, int byteCount);
+static int compareEntryNames (const void *a, const void *b);
+static void *extractionWorker (void *job);
+
+packWriterPtr createPackWriter (relativePath packPath) {
+    assert (packPath != NULL);
+    packWriterPtr writer = (packWriterPtr) malloc (sizeof (packWriter));
+    assert (writer != NULL);
+    writer->packFile = fopen (packPath, "wb");
+    assert (writer->packFile != NULL);
+    writer->fileOffset = 0;
+    writer->entryCount = 0;
+    writer->capacity = INITIAL_PACK_CAPACITY;
+    writer->entries = (packEntry *) malloc (writer->capacity * sizeof (packEntry));
+    assert (writer->entries != NULL);
+    writer->slotCount = 2 * INITIAL_PACK_CAPACITY;
+    writer->nameSlots = (DWORD *) calloc (writer->slotCount, sizeof (DWORD));
+    assert (writer->nameSlots != NULL);
+    return writer;
+}
+
+void addBmpToPack (packWriterPtr writer, char *name, bmpPtr sample) {
+    assert (writer != NULL);
+    assert (sample != NULL);
+    verifyNewEntryName (writer, name);
+    DWORD byteCount = determineFileSizeInBytes (sample);
+    byte *blob = (byte *) malloc (byteCount);
+    assert (blob != NULL);
+    writeBitMapToMemory (sample, blob);
+    size_t written = fwrite (blob, 1, byteCount, writer->packFile);
+    assert (written == byteCount);
+    free (blob);
+    appendEntry (writer, name, byteCount, getXRes (sample), getYRes (sample));
+    return;
+}
+
+void addFileToPack (packWriterPtr writer, char *name, relativePath srcFilePath) {
+    assert (writer != NULL);
+    verifyNewEntryName (writer, name);
+    FILE *source = fopen (srcFilePath, "rb");
+    assert (source != NULL);
+
+    byte header[PEEKED_HEADER_SIZE];
+    size_t read = fread (header, 1, PEEKED_HEADER_SIZE, source);
+    assert (read == PEEKED_HEADER_SIZE);
+    assert (header[0] == 'B' && header[1] == 'M');
+    DWORD byteCount = (DWORD) readLittleEndian (header + 2, 4);
+    // the entry spans byteCount bytes of the pack, all of which must come from the file
+    struct stat fileStatus;
+    int retCode = fstat (fileno (source), &fileStatus);
+    assert (retCode == 0);
+    assert (byteCount >= PEEKED_HEADER_SIZE && byteCount <= (unsigned long long) fileStatus.st_size);
+    LONG xRes = (LONG) readLittleEndian (header + 18, 4);
+    LONG yRes = (LONG) readLittleEndian (header + 22, 4);
+    assert (xRes > 0 && yRes != INT_MIN);
+    if (yRes < 0) {
+        yRes = -yRes;
+    }
+
+    size_t written = fwrite (header, 1, PEEKED_HEADER_SIZE, writer->packFile);
+    assert (written == PEEKED_HEADER_SIZE);
+    byte *block = (byte *) malloc (PACK_COPY_BLOCK_SIZE);
+    assert (block != NULL);
+    unsigned long long copied = PEEKED_HEADER_SIZE;
+    while (copied < byteCount) {
+        unsigned long long chunk = byteCount - copied;
+        if (chunk > PACK_COPY_BLOCK_SIZE) {
+            chunk = PACK_COPY_BLOCK_SIZE;
+        }
+        read = fread (block, 1, chunk, source);
+        assert (read == chunk);
+        written = fwrite (block, 1, chunk, writer->packFile);
+        assert (written == chunk);
+        copied += chunk;
+    }
+    free (block);
+    fclose (source);
+    appendEntry (writer, name, byteCount, xRes, yRes);
+    return;
+}
+
+int packWriterHasEntry (packWriterPtr writer, char *name) {
+    assert (writer != NULL);
+    assert (name != NULL);
+    int found = (*findNameSlot (writer, name) != 0);
+    return found;
+}
+
+void closePackWriter (packWriterPtr writer) {
+    assert (writer != NULL);
+    unsigned long long indexOffset = writer->fileOffset;
+    DWORD i = 0;
+    while (i < writer->entryCount) {
+        packEntry *entry = writer->entries + i;
+        WORD nameLength = strlen (entry->name);
+        writeLittleEndian (writer->packFile, nameLength, 2);
+        size_t written = fwrite (entry->name, 1, nameLength, writer->packFile);
+        assert (written == nameLength);
+        writeLittleEndian (writer->packFile, entry->offset, 8);
+        writeLittleEndian (writer->packFile, entry->byteCount, 4);
+        writeLittleEndian (writer->packFile, (DWORD) entry->xRes, 4);
+        writeLittleEndian (writer->packFile, (DWORD) entry->yRes, 4);
+        free (entry->name);
+        i ++;
+    }
+    writeLittleEndian (writer->packFile, indexOffset, 8);
+    writeLittleEndian (writer->packFile, writer->entryCount, 4);
+    writeLittleEndian (writer->packFile, PACK_MAGIC, 4);
+    int retCode = fclose (writer->packFile);
+    assert (retCode == 0);
+    free (writer->entries);
+    free (writer->nameSlots);
+    free (writer);
+    return;
+}
+
+packPtr openPack (relativePath packPath) {
+    assert (packPath != NULL);
+    int fd = open (packPath, O_RDONLY);
+    assert (fd >= 0);
+    struct stat info;
+    int retCode = fstat (fd, &info);
+    assert (retCode == 0);
+    assert (info.st_size >= PACK_FOOTER_SIZE);
+
+    packPtr target = (packPtr) malloc (sizeof (pack));
+    assert (target != NULL);
+    target->mapSize = info.st_size;
+    target->map = (byte *) mmap (NULL, target->mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    assert (target->map != MAP_FAILED);
+    // the mapping stays valid after the descriptor is closed
+    close (fd);
+
+    byte *footer = target->map + target->mapSize - PACK_FOOTER_SIZE;
+    unsigned long long indexOffset = readLittleEndian (footer, 8);
+    target->entryCount = (DWORD) readLittleEndian (footer + 8, 4);
+    assert ((DWORD) readLittleEndian (footer + 12, 4) == PACK_MAGIC);
+    assert (indexOffset <= target->mapSize - PACK_FOOTER_SIZE);
+
+    target->entries = (packEntry *) malloc ((target->entryCount + 1) * sizeof (packEntry));
+    target->byName = (packEntry **) malloc ((target->entryCount + 1) * sizeof (packEntry *));
+    assert (target->entries != NULL && target->byName != NULL);
+
+    byte *cursor = target->map + indexOffset;
+    byte *indexEnd = footer;
+    DWORD i = 0;
+    while (i < target->entryCount) {
+        assert (cursor + 2 <= indexEnd);
+        WORD nameLength = (WORD) readLittleEndian (cursor, 2);
+        assert (nameLength < MAX_PACK_ENTRY_NAME_LENGTH);
+        cursor += 2;
+        assert (cursor + nameLength + 20 <= indexEnd);
+        packEntry *entry = target->entries + i;
+        entry->name = (char *) malloc (nameLength + 1);
+        assert (entry->name != NULL);
+        memcpy (entry->name, cursor, nameLength);
+        entry->name[nameLength] = '\0';
+        cursor += nameLength;
+        entry->offset = readLittleEndian (cursor, 8);
+        entry->byteCount = (DWORD) readLittleEndian (cursor + 8, 4);
+        entry->xRes = (LONG) readLittleEndian (cursor + 12, 4);
+        entry->yRes = (LONG) readLittleEndian (cursor + 16, 4);
+        cursor += 20;
+        // checked without adding, a corrupt offset could wrap the sum
+        assert (entry->offset <= indexOffset && entry->byteCount <= indexOffset - entry->offset);
+        target->byName[i] = entry;
+        i ++;
+    }
+    qsort (target->byName, target->entryCount, sizeof (packEntry *), compareEntryNames);
+    // a name given twice could only ever be found once
+    i = 1;
+    while (i < target->entryCount) {
+        assert (compareEntryNames (target->byName + i - 1, target->byName + i) != 0);
+        i ++;
+    }
+    return target;
+}
+
+void closePack (packPtr pack) {
+    assert (pack != NULL);
+    DWORD i = 0;
+    while (i < pack->entryCount) {
+        free (pack->entries[i].name);
+        i ++;
+    }
+    munmap (pack->map, pack->mapSize);
+    free (pack->entries);
+    free (pack->byName);
+    free (pack);
+    return;
+}
+
+DWORD getPackEntryCount (packPtr pack) {
+    assert (pack != NULL);
+    DWORD entryCount = pack->entryCount;
+    return entryCount;
+}
+
+LONG findPackEntry (packPtr pack, char *name) {
+    assert (pack != NULL);
+    assert (name != NULL);
+    packEntry key;
+    key.name = name;
+    packEntry *keyPtr = &key;
+    packEntry **found = (packEntry **) bsearch (&keyPtr, pack->byName, pack->entryCount, sizeof (packEntry *), compareEntryNames);
+    LONG ordinal = PACK_ENTRY_NOT_FOUND;
+    if (found != NULL) {
+        ordinal = (LONG) (*found - pack->entries);
+    }
+    return ordinal;
+}
+
+packEntryView getPackEntryView (packPtr pack, DWORD ordinal) {
+    assert (pack != NULL);
+    assert (ordinal < pack->entryCount);
+    packEntry *entry = pack->entries + ordinal;
+    packEntryView view;
+    view.name = entry->name;
+    view.data = pack->map + entry->offset;
+    view.byteCount = entry->byteCount;
+    view.xRes = entry->xRes;
+    view.yRes = entry->yRes;
+    return view;
+}
+
+bmpPtr extractPackEntry (packPtr pack, DWORD ordinal) {
+    packEntryView view = getPackEntryView (pack, ordinal);
+    bmpPtr sample = parseBitMapFromMemory (view.data, view.byteCount);
+    return sample;
+}
+
+bmpPtr extractPackEntryByName (packPtr pack, char *name) {
+    LONG ordinal = findPackEntry (pack, name);
+    assert (ordinal != PACK_ENTRY_NOT_FOUND);
+    bmpPtr sample = extractPackEntry (pack, ordinal);
+    return sample;
+}
+
+void extractPackEntries (packPtr pack, DWORD *ordinals, DWORD entryCount, bmpPtr *targets, int threadCount) {
+    assert (pack != NULL);
+    assert (ordinals != NULL && targets != NULL);
+    assert (threadCount > 0);
+    if ((DWORD) threadCount > entryCount) {
+        threadCount = (int) entryCount;
+    }
+    if (threadCount <= 1) {
+        DWORD i = 0;
+        while (i < entryCount) {
+            targets[i] = extractPackEntry (pack, ordinals[i]);
+            i ++;
+        }
+        return;
+    }
+
+    pthread_t *threads = (pthread_t *) malloc (threadCount * sizeof (pthread_t));
+    extractionJob *jobs = (extractionJob *) malloc (threadCount * sizeof (extractionJob));
+    assert (threads != NULL && jobs != NULL);
+    int t = 0;
+    while (t < threadCount) {
+        jobs[t].pack = pack;
+        jobs[t].ordinals = ordinals;
+        jobs[t].entryCount = entryCount;
+        jobs[t].targets = targets;
+        jobs[t].threadIndex = t;
+        jobs[t].threadCount = threadCount;
+        int retCode = pthread_create (threads + t, NULL, extractionWorker, jobs + t);
+        assert (retCode == 0);
+        t ++;
+    }
+    t = 0;
+    while (t < threadCount) {
+        pthread_join (threads[t], NULL);
+        t ++;
+    }
+    free (threads);
+    free (jobs);
+    return;
+}
+
+static void *extractionWorker (void *job) {
+    extractionJob *work = (extractionJob *) job;
+    // entries are interleaved between threads so that runs of large entries are shared out
+    DWORD i = work->threadIndex;
+    while (i < work->entryCount) {
+        work->targets[i] = extractPackEntry (work->pack, work->ordinals[i]);
+        i += work->threadCount;
+    }
+    return NULL;
+}
+
+static void appendEntry (packWriterPtr writer, char *name, DWORD byteCount, LONG xRes, LONG yRes) {
+    assert (name != NULL);
+    int nameLength = strlen (name);
+    assert (nameLength > 0 && nameLength < MAX_PACK_ENTRY_NAME_LENGTH);
+    if (writer->entryCount == writer->capacity) {
+        writer->capacity *= 2;
+        writer->entries = (packEntry *) realloc (writer->entries, writer->capacity * sizeof (packEntry));
+        assert (writer->entries != NULL);
+    }
+    packEntry *entry = writer->entries + writer->entryCount;
+    entry->name = strdup (name);
+    assert (entry->name != NULL);
+    entry->offset = writer->fileOffset;
+    entry->byteCount = byteCount;
+    entry->xRes = xRes;
+    entry->yRes = yRes;
+    writer->entryCount ++;
+    writer->fileOffset += byteCount;
+    *findNameSlot (writer, entry->name) = writer->entryCount;
+    if (writer->entryCount * 2 > writer->slotCount) {
+        growNameSlots (writer);
+    }
+    return;
+}
+
+// names are unique within a pack, findPackEntry could never reach the second bitmap of a name
+static void verifyNewEntryName (packWriterPtr writer, char *name) {
+    assert (name != NULL);
+    assert (!packWriterHasEntry (writer, name));
+    return;
+}
+
+// the slot holding name, or the empty slot where it would go (linear probing, at most half the slots are used)
+static DWORD *findNameSlot (packWriterPtr writer, char *name) {
+    DWORD mask = writer->slotCount - 1;
+    DWORD slot = hashName (name) & mask;
+    while (writer->nameSlots[slot] != 0 && strcmp (writer->entries[writer->nameSlots[slot] - 1].name, name) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return writer->nameSlots + slot;
+}
+
+static void growNameSlots (packWriterPtr writer) {
+    free (writer->nameSlots);
+    writer->slotCount *= 2;
+    writer->nameSlots = (DWORD *) calloc (writer->slotCount, sizeof (DWORD));
+    assert (writer->nameSlots != NULL);
+    DWORD i = 0;
+    while (i < writer->entryCount) {
+        *findNameSlot (writer, writer->entries[i].name) = i + 1;
+        i ++;
+    }
+    return;
+}
+
+// djb2
+static unsigned long long hashName (char *name) {
+    unsigned long long hash = 5381;
+    while (*name != '\0') {
+        hash = hash * 33 + (byte) *name;
+        name ++;
+    }
+    return hash;
+}
+
+static void writeLittleEndian (FILE *target, unsigned long long number, int byteCount) {
+    assert (target != NULL);
+    assert (byteCount > 0 && byteCount <= 8);
+    byte bytes[8];
+    int i = 0;
+    while (i < byteCount) {
+        bytes[i] = (number >> (8*i)) & 255;
+        i ++;
+    }
+    size_t written = fwrite (bytes, 1, byteCount, target);
+    assert (written == (size_t) byteCount);
+    return;
+}
+
+static unsigned long long readLittleEndian (byte *bytes, int byteCount) {
+    assert (bytes != NULL);
+    assert (byteCount > 0 && byteCount <= 8);
+    unsigned long long number = 0;
+    int i = 0;
+    while (i < byteCount) {
+        number |= (unsigned long long) bytes[i] << (8 * i);
+        i ++;
+    }
+    return number;
+}
+
+static int compareEntryNames (const void *a, const void *b) {
+    packEntry *first = *(packEntry **) a;
+    packEntry *second = *(packEntry **) b;
+    int order = strcmp (first->name, second->name);
+    return order;
+}
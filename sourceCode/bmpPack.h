@@ -0,0 +1,59 @@
+//  bmpPack.h
+//
+// pack container for many small bitmaps (include "bmp.h" before this interface)
+//
+// layout of a pack file:
+//  > standard '.bmp' files stored back to back, starting at offset 0
+//  > index: one record per bitmap
+//      WORD nameLength, name (nameLength bytes, no terminator), 8 bytes offset, DWORD size, LONG xRes, LONG yRes
+//  > footer (PACK_FOOTER_SIZE bytes): 8 bytes index offset, DWORD entry count, DWORD PACK_MAGIC
+// all numbers are little endian
+
+#define PACK_MAGIC 0x4B415042   // "BPAK"
+#define PACK_FOOTER_SIZE 16
+#define MAX_PACK_ENTRY_NAME_LENGTH MAX_IMAGE_NAME_LENGTH   // use '<' not '<='
+
+#define PACK_ENTRY_NOT_FOUND -1
+
+typedef struct packWriter *packWriterPtr;
+typedef struct pack *packPtr;
+
+// zero-copy view of one bitmap inside an open pack
+// data points into the mapping of the pack and is valid until closePack
+typedef struct packEntryView {
+    char *name;
+    byte *data;
+    DWORD byteCount;
+    LONG xRes;
+    LONG yRes;
+} packEntryView;
+
+// creates (or truncates) a pack file and returns a writer for it
+packWriterPtr createPackWriter (relativePath packPath);
+// appends the specified bitmap to the pack under the specified name (names are unique within a pack)
+void addBmpToPack (packWriterPtr writer, char *name, bmpPtr sample);
+// appends an existing '.bmp' file to the pack as is, under the specified name
+void addFileToPack (packWriterPtr writer, char *name, relativePath srcFilePath);
+// returns 1 if a bitmap was already added under the specified name (adding another one under it fails)
+int packWriterHasEntry (packWriterPtr writer, char *name);
+// writes the index and footer, closes the pack file and destroys the writer
+void closePackWriter (packWriterPtr writer);
+
+// maps a pack file read only and loads its index
+packPtr openPack (relativePath packPath);
+// unmaps the pack and frees any memory associated with it (views become invalid)
+void closePack (packPtr pack);
+
+// returns the number of bitmaps in the pack
+DWORD getPackEntryCount (packPtr pack);
+// returns the ordinal of the bitmap with the specified name or PACK_ENTRY_NOT_FOUND
+LONG findPackEntry (packPtr pack, char *name);
+// returns a zero-copy view of the bitmap with the specified ordinal
+packEntryView getPackEntryView (packPtr pack, DWORD ordinal);
+
+// parses the bitmap with the specified ordinal into a new instance of ADT 'bmp'
+bmpPtr extractPackEntry (packPtr pack, DWORD ordinal);
+// parses the bitmap with the specified name into a new instance of ADT 'bmp'
+bmpPtr extractPackEntryByName (packPtr pack, char *name);
+// parses entryCount bitmaps (given by ordinal) on threadCount threads, targets[i] receives ordinals[i]
+void extractPackEntries (packPtr pack, DWORD *ordinals, DWORD entryCount, bmpPtr *targets, int threadCount);
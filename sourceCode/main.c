@@ -4,10 +4,16 @@
 
 #include "bmp.h"
 #include "testBmp.h"
+#include "testBmpPack.h"
+#include "testBmpCache.h"
+#include "testBmpPHash.h"
 
 
 int main (int argc, char *argv[]) {
     /*testBmp ();*/
+    /*testBmpPack ();*/
+    /*testBmpCache ();*/
+    /*testBmpPHash ();*/
     printf ("Hello World\n");
     printf ("\t>Please note that all the unit testers have been disabled by /* */ style comments\n");
     bmpPtr sampleBitmap = createBmp (BITMAPINFOHEADER);
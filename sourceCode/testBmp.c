@@ -1,10 +1,21 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "testBmp.h"
 #include "bmp.h"
 
+// a thread reading a band of rows of a lazily parsed bitmap
+typedef struct lazyReader {
+    bmpPtr image;
+    LONG firstRow;
+    LONG rowCount;
+    channelPtr rows;
+} lazyReader;
+
 static void testCreateBitMap ();
 static void testAccessFunctions ();
 static void testCompareChannels ();
@@ -14,6 +25,45 @@ static void testMiscOps ();
 static void testWriteAndParse ();
 static void testDeterMineFileSizeInBytes ();
 static void testEvaluateRawImageSizeInBytes ();
+static void testConvertBmp ();
+static void testRowOrder ();
+static void testLargeImageSizes ();
+static void testPatchBitMapHeader ();
+static void testOpenBitMapForEdit ();
+static void testSaveBitMapInPlace ();
+static void testParseBitMapLazy ();
+static void *lazyReaderWorker (void *args);
+static void testHashBmpPixels ();
+static void testGetLumaThumbnail ();
+static void testGaussianBlur ();
+static channelPtr referenceGaussianBlur (channelPtr source, double sigma);
+static int maxChannelDifference (channelPtr a, channelPtr b, LONG border);
+static void testConvolution ();
+static channelPtr referenceConvolution (channelPtr source, LONG size, double *weights, double bias, borderMode border);
+static LONG referenceBorderIndex (LONG index, LONG count, borderMode border);
+static void testResizeBmp ();
+static void fillChannel (bmpPtr image, channelType type, byte value);
+static void testDownsampleBmp ();
+static void testOrientBmp ();
+static void testBmpView ();
+static void compareViewChannel (channelPtr parent, channelPtr view, LONG firstRow, LONG firstColumn);
+static void testCompositeBmp ();
+static double referenceBlend (double sourceColor, double sourceAlpha, double targetColor, double targetAlpha, blendMode mode);
+static void fillScrambled (bmpPtr image, int seed);
+static void testPremultipliedBmp ();
+static void testColorModels ();
+static void testLUT ();
+static void testHistogram ();
+static void testEqualization ();
+static unsigned long long cumulativeCount (unsigned long long *counts, byte value);
+static channelPtr copyTestChannel (channelPtr source, LONG firstRow, LONG firstColumn, LONG xRes, LONG yRes);
+static void testStats ();
+static void referenceStats (channelPtr channel, channelStats *stats);
+static void testCompareBmp ();
+static void referenceDifference (channelPtr first, channelPtr second, channelDifference *difference);
+static double referenceWindowSSIM (channelPtr first, channelPtr second, LONG windowSize);
+static void referenceOrientation (orientation orientation, LONG xRes, LONG yRes, LONG row, LONG column, LONG *sourceRow, LONG *sourceColumn);
+static bmpPtr createTestImage (DIBHeaderVersion version, LONG xRes, LONG yRes);
 
 static void compareChannels (channelPtr before, channelPtr after);
 void testBmp () {
@@ -25,6 +75,29 @@ void testBmp () {
     testInitializeBmpDFLT ();
     testWriteAndParse ();
     testMiscOps ();
+    testConvertBmp ();
+    testRowOrder ();
+    testLargeImageSizes ();
+    testPatchBitMapHeader ();
+    testOpenBitMapForEdit ();
+    testSaveBitMapInPlace ();
+    testParseBitMapLazy ();
+    testHashBmpPixels ();
+    testGetLumaThumbnail ();
+    testGaussianBlur ();
+    testConvolution ();
+    testResizeBmp ();
+    testDownsampleBmp ();
+    testOrientBmp ();
+    testBmpView ();
+    testCompositeBmp ();
+    testPremultipliedBmp ();
+    testColorModels ();
+    testLUT ();
+    testHistogram ();
+    testEqualization ();
+    testStats ();
+    testCompareBmp ();
     printf (">Woohoo!! All passed\n> MIC DROP!!!\n");
     return;
 }
@@ -773,4 +846,2571 @@ static void testCompareChannels () {
 
 
     return;
+}
+
+static void testConvertBmp () {
+    printf ("\t>testing convertBmp ()\n");
+    bmpPtr bitMap = createBmp (BITMAPINFOHEADER);
+    initializeBmpDFLT (bitMap, RGB_24);
+    channelPtr redBefore = getRedChannel (bitMap);
+    channelPtr greenBefore = getGreenChannel (bitMap);
+    channelPtr blueBefore = getBlueChannel (bitMap);
+
+    bmpPtr converted = convertBmp (bitMap, BITMAPV4HEADER, ARGB_32, 200);
+    assert (getDIBHeaderVersion (converted) == BITMAPV4HEADER);
+    assert (getDIBHeaderSize (converted) == DEFAULT_V4IH_SIZE);
+    assert (getPixelFormat (converted) == ARGB_32);
+    assert (getColorDepth (converted) == BPP_32);
+    assert (getCompression (converted) == DEFAULT_V4IH_COMPRESSION);
+    assert (getColorSpace (converted) == DEFAULT_V4IH_COLOR_SPACE);
+    assert (getXRes (converted) == DEFAULT_IH_XRES_RGB_24);
+    assert (getYRes (converted) == DEFAULT_IH_YRES_RGB_24);
+    assert (getImageSize (converted) == evaluateRawImageSizeInBytes (converted));
+
+    channelPtr red = getRedChannel (converted);
+    channelPtr green = getGreenChannel (converted);
+    channelPtr blue = getBlueChannel (converted);
+    channelPtr alpha = getAlphaChannel (converted);
+    compareChannels (red, redBefore);
+    compareChannels (green, greenBefore);
+    compareChannels (blue, blueBefore);
+    assert (getPixel (0, 0, alpha) == 200);
+    assert (getPixel (1, 1, alpha) == 200);
+    destroyChannel (red);
+    destroyChannel (green);
+    destroyChannel (blue);
+    destroyChannel (alpha);
+
+    // and back again, in place
+    convertBmpInPlace (converted, BITMAPINFOHEADER, RGB_24, 0);
+    assert (getDIBHeaderVersion (converted) == BITMAPINFOHEADER);
+    assert (getPixelFormat (converted) == RGB_24);
+    assert (getCompression (converted) == DEFAULT_IH_COMPRESSION);
+    assert (getImageSize (converted) == DEFAULT_IH_IMAGE_SIZE_RGB_24);
+    red = getRedChannel (converted);
+    compareChannels (red, redBefore);
+    destroyChannel (red);
+
+    saveBitMap (converted, "converted", ".");
+    bmpPtr image = parseBitMap ("./converted");
+    green = getGreenChannel (image);
+    compareChannels (green, greenBefore);
+    destroyChannel (green);
+    destroyBmp (image);
+    int retCode = remove ("./converted");
+    assert (retCode == 0);
+
+    destroyChannel (redBefore);
+    destroyChannel (greenBefore);
+    destroyChannel (blueBefore);
+    destroyBmp (converted);
+    destroyBmp (bitMap);
+    return;
+}
+
+static void testRowOrder () {
+    printf ("\t>testing setRowOrder () with parseBitMap () and saveBitMap ()\n");
+    bmpPtr bitMap = createBmp (BITMAPINFOHEADER);
+    initializeBmpDFLT (bitMap, RGB_24);
+    assert (getRowOrder (bitMap) == BOTTOM_UP);
+    bmpPtr sample = createBmp (BITMAPV4HEADER);
+    initializeBmpDFLT (sample, ARGB_32);
+
+    bmpPtr images[2] = {bitMap, sample};
+    int i = 0;
+    while (i < 2) {
+        bmpPtr image = images[i];
+        channelPtr redBefore = getRedChannel (image);
+        channelPtr blueBefore = getBlueChannel (image);
+        rowOrder order = BOTTOM_UP;
+        while (order <= TOP_DOWN) {
+            setRowOrder (image, order);
+            saveBitMap (image, "rowOrder", ".");
+
+            // height field is at offset 22, negative for top-down
+            FILE *file = fopen ("./rowOrder", "rb");
+            assert (file != NULL);
+            fseek (file, 22, SEEK_SET);
+            byte bytes[4];
+            size_t read = fread (bytes, 1, 4, file);
+            assert (read == 4);
+            fclose (file);
+            LONG height = (LONG) (bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((DWORD) bytes[3] << 24));
+            if (order == TOP_DOWN) {
+                assert (height == -getYRes (image));
+            } else {
+                assert (height == getYRes (image));
+            }
+
+            bmpPtr parsed = parseBitMap ("./rowOrder");
+            assert (getRowOrder (parsed) == order);
+            assert (getYRes (parsed) == getYRes (image));
+            channelPtr redAfter = getRedChannel (parsed);
+            channelPtr blueAfter = getBlueChannel (parsed);
+            compareChannels (redAfter, redBefore);
+            compareChannels (blueAfter, blueBefore);
+            destroyChannel (redAfter);
+            destroyChannel (blueAfter);
+            destroyBmp (parsed);
+            int retCode = remove ("./rowOrder");
+            assert (retCode == 0);
+            order ++;
+        }
+        destroyChannel (redBefore);
+        destroyChannel (blueBefore);
+        i ++;
+    }
+    destroyBmp (bitMap);
+    destroyBmp (sample);
+    return;
+}
+
+// size arithmetic only, nothing is allocated (see benchBmp.c for the full sized run)
+static void testLargeImageSizes () {
+    printf ("\t>testing size arithmetic for large images\n");
+    bmpPtr sample = createBmp (BITMAPV4HEADER);
+    setPixelFormat (sample, ARGB_32);
+    setXRes (sample, 30000);
+    setYRes (sample, 30000);
+    DWORD imageSize = evaluateRawImageSizeInBytes (sample);
+    assert (imageSize == 3600000000U);
+    DWORD fileSize = determineFileSizeInBytes (sample);
+    assert (fileSize == 3600000122U);
+    destroyBmp (sample);
+
+    sample = createBmp (BITMAPINFOHEADER);
+    setPixelFormat (sample, RGB_24);
+    setXRes (sample, 30001);
+    setYRes (sample, 30000);
+    // 90003 bytes per row padded to 90004
+    imageSize = evaluateRawImageSizeInBytes (sample);
+    assert (imageSize == 2700120000U);
+    fileSize = determineFileSizeInBytes (sample);
+    assert (fileSize == 2700120054U);
+    destroyBmp (sample);
+    return;
+}
+
+static void testPatchBitMapHeader () {
+    printf ("\t>testing parseBitMapHeader (), patchBitMapHeader () and copyBitMapWithHeader ()\n");
+    bmpPtr bitMap = createBmp (BITMAPV4HEADER);
+    initializeBmpDFLT (bitMap, ARGB_32);
+    channelPtr alphaBefore = getAlphaChannel (bitMap);
+    saveBitMap (bitMap, "patch", ".");
+    destroyBmp (bitMap);
+
+    bmpPtr header = parseBitMapHeader ("./patch");
+    assert (getXRes (header) == DEFAULT_V4IH_XRES_ARGB_32);
+    assert (getPrintResX (header) == DEFAULT_V4IH_PRINT_RES_X);
+    setPrintResX (header, 3780);
+    setPrintResY (header, 3781);
+    setImpColorCount (header, 7);
+    patchBitMapHeader (header, "./patch");
+
+    bmpPtr image = parseBitMap ("./patch");
+    assert (getPrintResX (image) == 3780);
+    assert (getPrintResY (image) == 3781);
+    assert (getImpColorCount (image) == 7);
+    channelPtr alphaAfter = getAlphaChannel (image);
+    compareChannels (alphaAfter, alphaBefore);
+    destroyChannel (alphaAfter);
+    destroyBmp (image);
+
+    setPrintResY (header, 1000);
+    copyBitMapWithHeader (header, "./patch", "./patchCopy");
+    image = parseBitMap ("./patchCopy");
+    assert (getPrintResX (image) == 3780);
+    assert (getPrintResY (image) == 1000);
+    alphaAfter = getAlphaChannel (image);
+    compareChannels (alphaAfter, alphaBefore);
+    destroyChannel (alphaAfter);
+    destroyBmp (image);
+
+    destroyChannel (alphaBefore);
+    destroyBmp (header);
+    int retCode = remove ("./patch");
+    assert (retCode == 0);
+    retCode = remove ("./patchCopy");
+    assert (retCode == 0);
+    return;
+}
+
+static void testOpenBitMapForEdit () {
+    printf ("\t>testing openBitMapForEdit ()\n");
+    bmpPtr bitMap = createBmp (BITMAPINFOHEADER);
+    initializeBmpDFLT (bitMap, RGB_24);
+    saveBitMap (bitMap, "mapped", ".");
+    destroyBmp (bitMap);
+
+    mappedBmpPtr mapped = openBitMapForEdit ("./mapped");
+    assert (getXRes (getMappedHeader (mapped)) == DEFAULT_IH_XRES_RGB_24);
+    // 2 pixels of 3 bytes padded to 8
+    assert (getMappedRowStride (mapped) == 8);
+    // (0,0) is blue, stored as B G R
+    byte *topRow = getMappedRow (mapped, 0);
+    assert (topRow[0] == 255 && topRow[1] == 0 && topRow[2] == 0);
+    // paint (0,1) and (1,0) grey
+    topRow[3] = 100;
+    topRow[4] = 100;
+    topRow[5] = 100;
+    byte *bottomRow = getMappedRow (mapped, 1);
+    bottomRow[0] = 50;
+    bottomRow[1] = 50;
+    bottomRow[2] = 50;
+    flushMappedRows (mapped, 0, 1);
+    flushMappedBitMap (mapped);
+    closeMappedBitMap (mapped);
+
+    bmpPtr image = parseBitMap ("./mapped");
+    channelPtr red = getRedChannel (image);
+    channelPtr blue = getBlueChannel (image);
+    assert (getPixel (0, 0, blue) == 255);
+    assert (getPixel (0, 1, red) == 100);
+    assert (getPixel (1, 0, red) == 50);
+    assert (getPixel (1, 1, red) == 255);
+    destroyChannel (red);
+    destroyChannel (blue);
+    destroyBmp (image);
+    int retCode = remove ("./mapped");
+    assert (retCode == 0);
+    return;
+}
+
+static void testSaveBitMapInPlace () {
+    printf ("\t>testing saveBitMapInPlace ()\n");
+    DIBHeaderVersion version = BITMAPINFOHEADER;
+    while (version <= BITMAPV4HEADER) {
+        bmpPtr bitMap = createTestImage (version, 5, 6);
+        assert (getDirtyRowCount (bitMap) == 6);
+        saveBitMap (bitMap, "inPlace", ".");
+        assert (getDirtyRowCount (bitMap) == 0);
+        destroyBmp (bitMap);
+
+        bmpPtr image = parseBitMap ("./inPlace");
+        assert (getDirtyRowCount (image) == 0);
+        channelPtr green = getGreenChannel (image);
+        // unchanged values do not dirty any row
+        setChannel (GREEN, image, green);
+        assert (getDirtyRowCount (image) == 0);
+        setPixel (1, 2, green, 42);
+        setPixel (2, 0, green, 43);
+        setPixel (5, 4, green, 44);
+        setChannel (GREEN, image, green);
+        assert (getDirtyRowCount (image) == 3);
+        setPrintResX (image, 1234);
+        saveBitMapInPlace (image, "./inPlace");
+        assert (getDirtyRowCount (image) == 0);
+        destroyBmp (image);
+
+        image = parseBitMap ("./inPlace");
+        assert (getPrintResX (image) == 1234);
+        channelPtr greenAfter = getGreenChannel (image);
+        compareChannels (greenAfter, green);
+        destroyChannel (greenAfter);
+
+        // a new layout falls back to a full write
+        setRowOrder (image, TOP_DOWN);
+        saveBitMapInPlace (image, "./inPlace");
+        destroyBmp (image);
+        image = parseBitMap ("./inPlace");
+        assert (getRowOrder (image) == TOP_DOWN);
+        greenAfter = getGreenChannel (image);
+        compareChannels (greenAfter, green);
+        destroyChannel (greenAfter);
+
+        // saving over another file of the same layout writes every row, not just the dirty ones
+        bmpPtr other = createTestImage (version, 5, 6);
+        setRowOrder (other, TOP_DOWN);
+        fillScrambled (other, 3);
+        saveBitMap (other, "inPlaceOther", ".");
+        destroyBmp (other);
+        setPixel (3, 3, green, 45);
+        setChannel (GREEN, image, green);
+        assert (getDirtyRowCount (image) == 1);
+        saveBitMapInPlace (image, "./inPlaceOther");
+        other = parseBitMap ("./inPlaceOther");
+        assert (hashBmpPixels (other) == hashBmpPixels (image));
+        destroyBmp (other);
+        // which is then the file the dirty rows refer to
+        setPixel (0, 1, green, 46);
+        setChannel (GREEN, image, green);
+        saveBitMapInPlace (image, "./inPlaceOther");
+        other = parseBitMap ("./inPlaceOther");
+        assert (hashBmpPixels (other) == hashBmpPixels (image));
+        destroyBmp (other);
+        int retCode = remove ("./inPlaceOther");
+        assert (retCode == 0);
+
+        // a path that does not exist yet is written in full
+        bmpPtr fresh = createTestImage (version, 4, 2);
+        saveBitMapInPlace (fresh, "./inPlaceNew");
+        assert (getDirtyRowCount (fresh) == 0);
+        other = parseBitMap ("./inPlaceNew");
+        assert (hashBmpPixels (other) == hashBmpPixels (fresh));
+        destroyBmp (other);
+        // and so is a file that is no longer a '.bmp' file
+        FILE *garbage = fopen ("./inPlaceNew", "wb");
+        assert (garbage != NULL);
+        fputs ("not a bitmap", garbage);
+        fclose (garbage);
+        fillScrambled (fresh, 5);
+        saveBitMapInPlace (fresh, "./inPlaceNew");
+        other = parseBitMap ("./inPlaceNew");
+        assert (hashBmpPixels (other) == hashBmpPixels (fresh));
+        destroyBmp (other);
+        destroyBmp (fresh);
+        retCode = remove ("./inPlaceNew");
+        assert (retCode == 0);
+
+        destroyChannel (green);
+        destroyBmp (image);
+        retCode = remove ("./inPlace");
+        assert (retCode == 0);
+        version ++;
+    }
+    return;
+}
+
+static void testParseBitMapLazy () {
+    printf ("\t>testing parseBitMapLazy ()\n");
+    DIBHeaderVersion version = BITMAPINFOHEADER;
+    while (version <= BITMAPV4HEADER) {
+        rowOrder order = BOTTOM_UP;
+        while (order <= TOP_DOWN) {
+            // large enough to span several blocks of decoded rows
+            bmpPtr bitMap = createTestImage (version, 1001, 300);
+            setRowOrder (bitMap, order);
+            saveBitMap (bitMap, "lazy", ".");
+            channelPtr blue = getBlueChannel (bitMap);
+            destroyBmp (bitMap);
+
+            bmpPtr image = parseBitMapLazy ("./lazy");
+            assert (getResidentRowCount (image) == 0);
+            channelPtr blueRows = getChannelRows (image, BLUE, 150, 3);
+            LONG residentRows = getResidentRowCount (image);
+            assert (residentRows >= 3 && residentRows < 300);
+            assert (getChXRes (blueRows) == 1001 && getChYRes (blueRows) == 3);
+            LONG cRow = 0;
+            while (cRow < 3) {
+                LONG column = 0;
+                while (column < 1001) {
+                    assert (getPixel (cRow, column, blueRows) == getPixel (150 + cRow, column, blue));
+                    column ++;
+                }
+                cRow ++;
+            }
+            destroyChannel (blueRows);
+            // extracting a whole channel decodes every row
+            channelPtr blueAfter = getBlueChannel (image);
+            assert (getResidentRowCount (image) == 300);
+            compareChannels (blueAfter, blue);
+            destroyChannel (blueAfter);
+            destroyBmp (image);
+
+            // readers on several threads share the decoding of overlapping bands
+            image = parseBitMapLazy ("./lazy");
+            lazyReader readers[4];
+            pthread_t threads[4];
+            int t = 0;
+            while (t < 4) {
+                readers[t].image = image;
+                readers[t].firstRow = t * 60;
+                readers[t].rowCount = 120;
+                int retCode = pthread_create (&threads[t], NULL, lazyReaderWorker, &readers[t]);
+                assert (retCode == 0);
+                t ++;
+            }
+            t = 0;
+            while (t < 4) {
+                pthread_join (threads[t], NULL);
+                LONG cRow = 0;
+                while (cRow < readers[t].rowCount) {
+                    LONG column = 0;
+                    while (column < 1001) {
+                        assert (getPixel (cRow, column, readers[t].rows) == getPixel (readers[t].firstRow + cRow, column, blue));
+                        column ++;
+                    }
+                    cRow ++;
+                }
+                destroyChannel (readers[t].rows);
+                t ++;
+            }
+            destroyChannel (blue);
+            destroyBmp (image);
+
+            // saving over the mapped file decodes everything first
+            image = parseBitMapLazy ("./lazy");
+            bmpPtr eager = parseBitMap ("./lazy");
+            saveBitMap (image, "lazy", ".");
+            destroyBmp (image);
+            image = parseBitMap ("./lazy");
+            channelPtr green = getGreenChannel (image);
+            channelPtr greenEager = getGreenChannel (eager);
+            compareChannels (green, greenEager);
+            destroyChannel (green);
+            destroyChannel (greenEager);
+            destroyBmp (eager);
+            destroyBmp (image);
+            int retCode = remove ("./lazy");
+            assert (retCode == 0);
+            order ++;
+        }
+        version ++;
+    }
+    return;
+}
+
+static void *lazyReaderWorker (void *args) {
+    lazyReader *reader = (lazyReader *) args;
+    reader->rows = getChannelRows (reader->image, BLUE, reader->firstRow, reader->rowCount);
+    return NULL;
+}
+
+static void testHashBmpPixels () {
+    printf ("\t>testing hashBmpPixels (), hashChannel () and the incremental pixel hash\n");
+    DIBHeaderVersion version = BITMAPINFOHEADER;
+    while (version <= BITMAPV4HEADER) {
+        bmpPtr image = createTestImage (version, 37, 23);
+        unsigned long long digest = hashBmpPixels (image);
+        assert (hashBmpPixelsParallel (image, 1) == digest);
+        assert (hashBmpPixelsParallel (image, 3) == digest);
+        assert (hashBmpPixelsParallel (image, 64) == digest);
+
+        // bands fed out of order
+        pixelHashPtr hash = createPixelHash (37, 23, getPixelFormat (image));
+        updatePixelHash (hash, image, 20, 3);
+        updatePixelHash (hash, image, 0, 7);
+        updatePixelHash (hash, image, 7, 13);
+        assert (finishPixelHash (hash) == digest);
+
+        // headers and row order do not take part
+        setPrintResX (image, 1000);
+        setRowOrder (image, TOP_DOWN);
+        saveBitMap (image, "hashed", ".");
+        bmpPtr parsed = parseBitMap ("./hashed");
+        assert (hashBmpPixels (parsed) == digest);
+        destroyBmp (parsed);
+        int retCode = remove ("./hashed");
+        assert (retCode == 0);
+
+        channelPtr green = getGreenChannel (image);
+        unsigned long long channelDigest = hashChannel (green);
+        assert (channelDigest != digest);
+        setPixel (11, 30, green, getPixel (11, 30, green) ^ 1);
+        assert (hashChannel (green) != channelDigest);
+        setChannel (GREEN, image, green);
+        assert (hashBmpPixels (image) != digest);
+        destroyChannel (green);
+        destroyBmp (image);
+        version ++;
+    }
+    // swapping two rows changes the digest
+    bmpPtr image = createTestImage (BITMAPV4HEADER, 8, 2);
+    unsigned long long digest = hashBmpPixels (image);
+    channelType types[4] = {RED, GREEN, BLUE, ALPHA};
+    int i = 0;
+    while (i < 4) {
+        channelPtr plane = getChannelRows (image, types[i], 0, 2);
+        channelPtr swapped = createChannel (8, 2);
+        LONG column = 0;
+        while (column < 8) {
+            setPixel (0, column, swapped, getPixel (1, column, plane));
+            setPixel (1, column, swapped, getPixel (0, column, plane));
+            column ++;
+        }
+        setChannel (types[i], image, swapped);
+        destroyChannel (plane);
+        destroyChannel (swapped);
+        i ++;
+    }
+    assert (hashBmpPixels (image) != digest);
+    destroyBmp (image);
+    return;
+}
+
+static void testGetLumaThumbnail () {
+    printf ("\t>testing getLumaThumbnail ()\n");
+    // left half white, right half pure red
+    bmpPtr image = createTestImage (BITMAPV4HEADER, 10, 6);
+    channelPtr planes[3] = {createChannel (10, 6), createChannel (10, 6), createChannel (10, 6)};
+    LONG row = 0;
+    while (row < 6) {
+        LONG column = 0;
+        while (column < 10) {
+            setPixel (row, column, planes[0], 255);
+            setPixel (row, column, planes[1], column < 5 ? 255 : 0);
+            setPixel (row, column, planes[2], column < 5 ? 255 : 0);
+            column ++;
+        }
+        row ++;
+    }
+    setChannel (RED, image, planes[0]);
+    setChannel (GREEN, image, planes[1]);
+    setChannel (BLUE, image, planes[2]);
+    channelPtr luma = getLumaThumbnail (image, 2, 3);
+    assert (getChXRes (luma) == 2 && getChYRes (luma) == 3);
+    row = 0;
+    while (row < 3) {
+        assert (getPixel (row, 0, luma) == 255);
+        assert (getPixel (row, 1, luma) == 77);
+        row ++;
+    }
+    destroyChannel (luma);
+    // box straddling both halves, and a thumbnail larger than the image
+    luma = getLumaThumbnail (image, 1, 1);
+    assert (getPixel (0, 0, luma) == 166);
+    destroyChannel (luma);
+    luma = getLumaThumbnail (image, 20, 12);
+    assert (getPixel (11, 9, luma) == 255 && getPixel (0, 10, luma) == 77);
+    destroyChannel (luma);
+    int i = 0;
+    while (i < 3) {
+        destroyChannel (planes[i]);
+        i ++;
+    }
+    destroyBmp (image);
+
+    // a lazy bitmap gives the same thumbnail, every band of rows is decoded on the way
+    image = createTestImage (BITMAPINFOHEADER, 1001, 300);
+    saveBitMap (image, "lazyLuma", ".");
+    channelPtr eagerLuma = getLumaThumbnail (image, 7, 9);
+    destroyBmp (image);
+    image = parseBitMapLazy ("./lazyLuma");
+    luma = getLumaThumbnail (image, 7, 9);
+    assert (getResidentRowCount (image) == 300);
+    compareChannels (luma, eagerLuma);
+    destroyChannel (luma);
+    destroyChannel (eagerLuma);
+    destroyBmp (image);
+    int retCode = remove ("./lazyLuma");
+    assert (retCode == 0);
+    return;
+}
+
+static void testGaussianBlur () {
+    printf ("\t>testing gaussianBlurChannel () and gaussianBlurBmp ()\n");
+    bmpPtr image = createTestImage (BITMAPV4HEADER, 71, 53);
+    channelPtr red = getRedChannel (image);
+    double sigmas[4] = {0.7, 2.5, 6.0, 11.0};
+    int i = 0;
+    while (i < 4) {
+        channelPtr blurred = gaussianBlurChannel (red, sigmas[i], 1);
+        channelPtr reference = referenceGaussianBlur (red, sigmas[i]);
+        // fixed point passes are within 1 of the exact blur
+        // the box approximation is within a few levels away from the edges (its passes replicate blurred edges)
+        if (sigmas[i] < 6.0) {
+            assert (maxChannelDifference (blurred, reference, 0) <= 1);
+        } else {
+            assert (maxChannelDifference (blurred, reference, 2 * sigmas[i]) <= 4);
+        }
+        // the split between threads does not change the result
+        channelPtr threaded = gaussianBlurChannel (red, sigmas[i], 5);
+        assert (maxChannelDifference (blurred, threaded, 0) == 0);
+        destroyChannel (threaded);
+        destroyChannel (reference);
+        destroyChannel (blurred);
+        i ++;
+    }
+
+    // flat areas stay flat
+    channelPtr flat = createChannel (40, 30);
+    LONG row = 0;
+    while (row < 30) {
+        LONG column = 0;
+        while (column < 40) {
+            setPixel (row, column, flat, 201);
+            column ++;
+        }
+        row ++;
+    }
+    i = 0;
+    while (i < 4) {
+        channelPtr blurred = gaussianBlurChannel (flat, sigmas[i], 2);
+        assert (maxChannelDifference (blurred, flat, 0) == 0);
+        destroyChannel (blurred);
+        i ++;
+    }
+    destroyChannel (flat);
+
+    bmpPtr blurredImage = gaussianBlurBmp (image, 2.5, 3);
+    assert (getXRes (blurredImage) == 71 && getYRes (blurredImage) == 53);
+    assert (getPixelFormat (blurredImage) == ARGB_32);
+    channelPtr expected = gaussianBlurChannel (red, 2.5, 1);
+    channelPtr actual = getRedChannel (blurredImage);
+    compareChannels (expected, actual);
+    destroyChannel (expected);
+    destroyChannel (actual);
+    channelPtr alpha = getAlphaChannel (image);
+    expected = gaussianBlurChannel (alpha, 2.5, 1);
+    actual = getAlphaChannel (blurredImage);
+    compareChannels (expected, actual);
+    destroyChannel (expected);
+    destroyChannel (actual);
+    destroyChannel (alpha);
+    destroyBmp (blurredImage);
+    destroyChannel (red);
+    destroyBmp (image);
+    return;
+}
+
+static void testConvolution () {
+    printf ("\t>testing convolveChannel () and convolveBmp ()\n");
+    double sharpen[9] = {0, -1, 0, -1, 5, -1, 0, -1, 0};
+    double sobel[9] = {-1, 0, 1, -2, 0, 2, -1, 0, 1};
+    double smooth[25];
+    double emboss[49];
+    double box[225];
+    int i = 0;
+    while (i < 25) {
+        smooth[i] = (1 + (i % 5) * (4 - i % 5) + (i / 5) * (4 - i / 5)) / 65.0;
+        i ++;
+    }
+    i = 0;
+    while (i < 49) {
+        emboss[i] = ((i * 37) % 11 - 5) / 16.0;
+        i ++;
+    }
+    i = 0;
+    while (i < 225) {
+        box[i] = 1 / 225.0;
+        i ++;
+    }
+    LONG sizes[5] = {3, 3, 5, 7, 15};
+    double *weights[5] = {sharpen, sobel, smooth, emboss, box};
+    double biases[5] = {0, 128, 0, 128, 0};
+
+    // larger than one tile in both directions, not a multiple of the tile size
+    bmpPtr image = createTestImage (BITMAPV4HEADER, 300, 150);
+    channelPtr red = getRedChannel (image);
+    bmpPtr tiny = createTestImage (BITMAPINFOHEADER, 3, 2);
+    channelPtr tinyRed = getRedChannel (tiny);
+    int k = 0;
+    while (k < 5) {
+        kernelPtr kernel = createKernel (sizes[k], weights[k], biases[k]);
+        borderMode border = BORDER_CLAMP;
+        while (border <= BORDER_ZERO) {
+            channelPtr convolved = convolveChannel (red, kernel, border, 1);
+            channelPtr reference = referenceConvolution (red, sizes[k], weights[k], biases[k], border);
+            assert (maxChannelDifference (convolved, reference, 0) <= 1);
+            channelPtr threaded = convolveChannel (red, kernel, border, 4);
+            assert (maxChannelDifference (convolved, threaded, 0) == 0);
+            destroyChannel (threaded);
+            destroyChannel (reference);
+            destroyChannel (convolved);
+
+            // kernel larger than the image
+            convolved = convolveChannel (tinyRed, kernel, border, 2);
+            reference = referenceConvolution (tinyRed, sizes[k], weights[k], biases[k], border);
+            assert (maxChannelDifference (convolved, reference, 0) <= 1);
+            destroyChannel (reference);
+            destroyChannel (convolved);
+            border ++;
+        }
+        destroyKernel (kernel);
+        k ++;
+    }
+
+    kernelPtr kernel = createKernel (3, sharpen, 0);
+    bmpPtr sharpened = convolveBmp (image, kernel, BORDER_REFLECT, 2);
+    channelPtr expected = convolveChannel (red, kernel, BORDER_REFLECT, 1);
+    channelPtr actual = getRedChannel (sharpened);
+    compareChannels (expected, actual);
+    destroyChannel (expected);
+    destroyChannel (actual);
+    expected = getAlphaChannel (image);
+    actual = getAlphaChannel (sharpened);
+    compareChannels (expected, actual);
+    destroyChannel (expected);
+    destroyChannel (actual);
+    destroyBmp (sharpened);
+    destroyKernel (kernel);
+
+    destroyChannel (tinyRed);
+    destroyBmp (tiny);
+    destroyChannel (red);
+    destroyBmp (image);
+    return;
+}
+
+// straightforward double precision correlation
+static channelPtr referenceConvolution (channelPtr source, LONG size, double *weights, double bias, borderMode border) {
+    LONG xRes = getChXRes (source);
+    LONG yRes = getChYRes (source);
+    LONG radius = size / 2;
+    channelPtr target = createChannel (xRes, yRes);
+    LONG row = 0;
+    while (row < yRes) {
+        LONG column = 0;
+        while (column < xRes) {
+            double sum = bias;
+            LONG kRow = 0;
+            while (kRow < size) {
+                LONG kColumn = 0;
+                while (kColumn < size) {
+                    LONG sourceRow = referenceBorderIndex (row + kRow - radius, yRes, border);
+                    LONG sourceColumn = referenceBorderIndex (column + kColumn - radius, xRes, border);
+                    if (sourceRow >= 0 && sourceColumn >= 0) {
+                        sum += weights[kRow * size + kColumn] * getPixel (sourceRow, sourceColumn, source);
+                    }
+                    kColumn ++;
+                }
+                kRow ++;
+            }
+            sum = floor (sum + 0.5);
+            if (sum < 0) {
+                sum = 0;
+            } else if (sum > 255) {
+                sum = 255;
+            }
+            setPixel (row, column, target, (byte) sum);
+            column ++;
+        }
+        row ++;
+    }
+    return target;
+}
+
+// reflection done one bounce at a time
+static LONG referenceBorderIndex (LONG index, LONG count, borderMode border) {
+    if (border == BORDER_ZERO && (index < 0 || index >= count)) {
+        return -1;
+    }
+    while (index < 0 || index >= count) {
+        if (border == BORDER_CLAMP || count == 1) {
+            index = index < 0 ? 0 : count - 1;
+        } else if (index < 0) {
+            index = -index;
+        } else {
+            index = 2 * (count - 1) - index;
+        }
+    }
+    return index;
+}
+
+// straightforward double precision 2D gaussian, edges replicated
+static channelPtr referenceGaussianBlur (channelPtr source, double sigma) {
+    LONG xRes = getChXRes (source);
+    LONG yRes = getChYRes (source);
+    int radius = (int) ceil (3 * sigma);
+    channelPtr target = createChannel (xRes, yRes);
+    LONG row = 0;
+    while (row < yRes) {
+        LONG column = 0;
+        while (column < xRes) {
+            double sum = 0;
+            double weightSum = 0;
+            int dy = -radius;
+            while (dy <= radius) {
+                int dx = -radius;
+                while (dx <= radius) {
+                    LONG sourceRow = row + dy < 0 ? 0 : (row + dy >= yRes ? yRes - 1 : row + dy);
+                    LONG sourceColumn = column + dx < 0 ? 0 : (column + dx >= xRes ? xRes - 1 : column + dx);
+                    double weight = exp (-(dx * dx + dy * dy) / (2 * sigma * sigma));
+                    sum += weight * getPixel (sourceRow, sourceColumn, source);
+                    weightSum += weight;
+                    dx ++;
+                }
+                dy ++;
+            }
+            setPixel (row, column, target, (byte) floor (sum / weightSum + 0.5));
+            column ++;
+        }
+        row ++;
+    }
+    return target;
+}
+
+// largest difference between two channels, ignoring a border of the specified width
+static int maxChannelDifference (channelPtr a, channelPtr b, LONG border) {
+    assert (getChXRes (a) == getChXRes (b) && getChYRes (a) == getChYRes (b));
+    int maxDifference = 0;
+    LONG row = border;
+    while (row < getChYRes (a) - border) {
+        LONG column = border;
+        while (column < getChXRes (a) - border) {
+            int difference = abs (getPixel (row, column, a) - getPixel (row, column, b));
+            if (difference > maxDifference) {
+                maxDifference = difference;
+            }
+            column ++;
+        }
+        row ++;
+    }
+    return maxDifference;
+}
+
+static void testResizeBmp () {
+    printf ("\t>testing resizeBmp ()\n");
+    resampleFilter filters[3] = {RESAMPLE_BILINEAR, RESAMPLE_BICUBIC, RESAMPLE_LANCZOS};
+    channelType types[4] = {RED, GREEN, BLUE, ALPHA};
+    bmpPtr rgb = createTestImage (BITMAPINFOHEADER, 37, 29);
+    bmpPtr argb = createTestImage (BITMAPV4HEADER, 37, 29);
+    fillChannel (argb, ALPHA, 255);
+    bmpPtr flat = createTestImage (BITMAPV4HEADER, 37, 29);
+    fillChannel (flat, RED, 13);
+    fillChannel (flat, GREEN, 250);
+    fillChannel (flat, BLUE, 0);
+    fillChannel (flat, ALPHA, 255);
+    LONG sizes[4][2] = {{37, 29}, {100, 7}, {5, 64}, {1, 1}};
+    int f = 0;
+    while (f < 3) {
+        // same size is an exact copy
+        bmpPtr resized = resizeBmp (rgb, 37, 29, filters[f], 1);
+        assert (getPixelFormat (resized) == RGB_24);
+        assert (hashBmpPixels (resized) == hashBmpPixels (rgb));
+        destroyBmp (resized);
+        resized = resizeBmp (argb, 37, 29, filters[f], 1);
+        assert (hashBmpPixels (resized) == hashBmpPixels (argb));
+        destroyBmp (resized);
+
+        int s = 0;
+        while (s < 4) {
+            // flat colors stay exactly flat, up or down
+            resized = resizeBmp (flat, sizes[s][0], sizes[s][1], filters[f], 1);
+            assert (getXRes (resized) == sizes[s][0] && getYRes (resized) == sizes[s][1]);
+            byte values[4] = {13, 250, 0, 255};
+            int t = 0;
+            while (t < 4) {
+                channelPtr plane = getChannelRows (resized, types[t], 0, sizes[s][1]);
+                LONG i = 0;
+                while (i < sizes[s][0] * sizes[s][1]) {
+                    assert (getPixel (i / sizes[s][0], i % sizes[s][0], plane) == values[t]);
+                    i ++;
+                }
+                destroyChannel (plane);
+                t ++;
+            }
+            destroyBmp (resized);
+
+            // the split between threads does not change the result
+            resized = resizeBmp (argb, sizes[s][0], sizes[s][1], filters[f], 1);
+            bmpPtr threaded = resizeBmp (argb, sizes[s][0], sizes[s][1], filters[f], 3);
+            assert (hashBmpPixels (resized) == hashBmpPixels (threaded));
+            destroyBmp (threaded);
+            destroyBmp (resized);
+            s ++;
+        }
+        f ++;
+    }
+
+    // halving a ramp with the (widened) triangle filter averages 4 neighbours with weights 1 3 3 1
+    bmpPtr ramp = createTestImage (BITMAPINFOHEADER, 64, 4);
+    channelPtr plane = createChannel (64, 4);
+    LONG i = 0;
+    while (i < 64 * 4) {
+        setPixel (i / 64, i % 64, plane, 2 * (i % 64));
+        i ++;
+    }
+    setChannel (RED, ramp, plane);
+    destroyChannel (plane);
+    bmpPtr halved = resizeBmp (ramp, 32, 2, RESAMPLE_BILINEAR, 2);
+    plane = getRedChannel (halved);
+    i = 1;
+    while (i < 31) {
+        assert (getPixel (1, i, plane) == 4 * i + 1);
+        i ++;
+    }
+    destroyChannel (plane);
+    destroyBmp (halved);
+    destroyBmp (ramp);
+
+    // transparent pixels do not bleed their color into opaque neighbours
+    bmpPtr halves = createTestImage (BITMAPV4HEADER, 16, 16);
+    fillChannel (halves, GREEN, 0);
+    fillChannel (halves, BLUE, 0);
+    channelPtr red = createChannel (16, 16);
+    channelPtr alpha = createChannel (16, 16);
+    i = 0;
+    while (i < 16 * 16) {
+        setPixel (i / 16, i % 16, red, (i % 16 < 8) ? 255 : 0);
+        setPixel (i / 16, i % 16, alpha, (i % 16 < 8) ? 0 : 255);
+        i ++;
+    }
+    setChannel (RED, halves, red);
+    setChannel (ALPHA, halves, alpha);
+    destroyChannel (alpha);
+    destroyChannel (red);
+    f = 0;
+    while (f < 3) {
+        bmpPtr resized = resizeBmp (halves, 5, 5, filters[f], 1);
+        red = getRedChannel (resized);
+        alpha = getAlphaChannel (resized);
+        i = 0;
+        while (i < 25) {
+            if (getPixel (i / 5, i % 5, alpha) > 0) {
+                assert (getPixel (i / 5, i % 5, red) == 0);
+            }
+            i ++;
+        }
+        if (filters[f] == RESAMPLE_BILINEAR) {
+            assert (getPixel (2, 0, alpha) == 0 && getPixel (2, 4, alpha) == 255);
+        }
+        destroyChannel (alpha);
+        destroyChannel (red);
+        destroyBmp (resized);
+        f ++;
+    }
+    destroyBmp (halves);
+
+    // at extreme ratios alternating columns still average to their mean (about 127.5)
+    bmpPtr stripes = createTestImage (BITMAPINFOHEADER, 30000, 1);
+    plane = createChannel (30000, 1);
+    i = 0;
+    while (i < 30000) {
+        setPixel (0, i, plane, (i % 2) * 255);
+        i ++;
+    }
+    setChannel (RED, stripes, plane);
+    destroyChannel (plane);
+    LONG widths[2] = {1, 8};
+    f = 0;
+    while (f < 3) {
+        int w = 0;
+        while (w < 2) {
+            bmpPtr resized = resizeBmp (stripes, widths[w], 1, filters[f], 1);
+            plane = getRedChannel (resized);
+            i = 0;
+            while (i < widths[w]) {
+                assert (abs (2 * getPixel (0, i, plane) - 255) <= 4);
+                i ++;
+            }
+            destroyChannel (plane);
+            destroyBmp (resized);
+            w ++;
+        }
+        f ++;
+    }
+    destroyBmp (stripes);
+
+    destroyBmp (flat);
+    destroyBmp (argb);
+    destroyBmp (rgb);
+    return;
+}
+
+static void testDownsampleBmp () {
+    printf ("\t>testing downsampleBmp () and buildPyramid ()\n");
+    channelType types[4] = {RED, GREEN, BLUE, ALPHA};
+    DIBHeaderVersion version = BITMAPINFOHEADER;
+    while (version <= BITMAPV4HEADER) {
+        // odd in both directions
+        bmpPtr image = createTestImage (version, 37, 29);
+        if (version == BITMAPV4HEADER) {
+            fillChannel (image, ALPHA, 200);
+        }
+        bmpPtr half = downsampleBmp (image);
+        assert (getXRes (half) == 19 && getYRes (half) == 15);
+        assert (getPixelFormat (half) == getPixelFormat (image));
+        int typeCount = (version == BITMAPV4HEADER) ? 4 : 3;
+        int t = 0;
+        while (t < typeCount) {
+            channelPtr before = getChannelRows (image, types[t], 0, 29);
+            channelPtr after = getChannelRows (half, types[t], 0, 15);
+            LONG row = 0;
+            while (row < 15) {
+                LONG column = 0;
+                while (column < 19) {
+                    LONG lower = (2 * row + 1 < 29) ? 2 * row + 1 : 2 * row;
+                    LONG right = (2 * column + 1 < 37) ? 2 * column + 1 : 2 * column;
+                    int sum = getPixel (2 * row, 2 * column, before) + getPixel (2 * row, right, before);
+                    sum += getPixel (lower, 2 * column, before) + getPixel (lower, right, before);
+                    assert (getPixel (row, column, after) == (sum + 2) / 4);
+                    column ++;
+                }
+                row ++;
+            }
+            destroyChannel (after);
+            destroyChannel (before);
+            t ++;
+        }
+        destroyBmp (half);
+
+        // every level is the downsample of the one above, the last is 1x1
+        int levelCount = 0;
+        bmpPtr *levels = buildPyramid (image, &levelCount);
+        assert (levelCount == 6 && levelCount == getPyramidLevelCount (37, 29));
+        bmpPtr parent = image;
+        int level = 0;
+        while (level < levelCount) {
+            half = downsampleBmp (parent);
+            assert (hashBmpPixels (half) == hashBmpPixels (levels[level]));
+            destroyBmp (half);
+            parent = levels[level];
+            level ++;
+        }
+        assert (getXRes (levels[5]) == 1 && getYRes (levels[5]) == 1);
+
+        // streamed from a lazily parsed file
+        setRowOrder (image, BOTTOM_UP);
+        saveBitMap (image, "pyramid", ".");
+        bmpPtr lazy = parseBitMapLazy ("./pyramid");
+        int lazyLevelCount = 0;
+        bmpPtr *lazyLevels = buildPyramid (lazy, &lazyLevelCount);
+        assert (lazyLevelCount == levelCount);
+        assert (getResidentRowCount (lazy) == 29);
+        level = 0;
+        while (level < levelCount) {
+            assert (hashBmpPixels (lazyLevels[level]) == hashBmpPixels (levels[level]));
+            level ++;
+        }
+        destroyPyramid (lazyLevels, lazyLevelCount);
+        destroyBmp (lazy);
+        int retCode = remove ("./pyramid");
+        assert (retCode == 0);
+        destroyPyramid (levels, levelCount);
+        destroyBmp (image);
+        version ++;
+    }
+
+    // a transparent pixel does not darken its block
+    bmpPtr image = createTestImage (BITMAPV4HEADER, 2, 2);
+    fillChannel (image, RED, 240);
+    fillChannel (image, ALPHA, 255);
+    channelPtr plane = getAlphaChannel (image);
+    setPixel (0, 0, plane, 0);
+    setChannel (ALPHA, image, plane);
+    destroyChannel (plane);
+    plane = getRedChannel (image);
+    setPixel (0, 0, plane, 0);
+    setChannel (RED, image, plane);
+    destroyChannel (plane);
+    bmpPtr half = downsampleBmp (image);
+    plane = getRedChannel (half);
+    assert (getPixel (0, 0, plane) == 240);
+    destroyChannel (plane);
+    plane = getAlphaChannel (half);
+    assert (getPixel (0, 0, plane) == 191);
+    destroyChannel (plane);
+
+    // nothing below 1x1
+    int levelCount = 0;
+    bmpPtr *levels = buildPyramid (half, &levelCount);
+    assert (levelCount == 0);
+    destroyPyramid (levels, levelCount);
+    destroyBmp (half);
+    destroyBmp (image);
+    return;
+}
+
+static void testOrientBmp () {
+    printf ("\t>testing orientBmp (), orientChannel (), flipBmpVertically () and setFlipOnSave ()\n");
+    // several tiles in both directions, not a multiple of the tile size
+    bmpPtr image = createTestImage (BITMAPV4HEADER, 75, 41);
+    channelType types[4] = {RED, GREEN, BLUE, ALPHA};
+    orientation orientation = ROTATE_90;
+    while (orientation <= TRANSPOSE) {
+        bmpPtr oriented = orientBmp (image, orientation);
+        LONG xRes = 75;
+        LONG yRes = 41;
+        if (orientation == ROTATE_90 || orientation == ROTATE_270 || orientation == TRANSPOSE) {
+            xRes = 41;
+            yRes = 75;
+        }
+        assert (getXRes (oriented) == xRes && getYRes (oriented) == yRes);
+        int t = 0;
+        while (t < 4) {
+            channelPtr before = getChannelRows (image, types[t], 0, 41);
+            channelPtr after = getChannelRows (oriented, types[t], 0, yRes);
+            channelPtr orientedPlane = orientChannel (before, orientation);
+            compareChannels (after, orientedPlane);
+            LONG row = 0;
+            while (row < yRes) {
+                LONG column = 0;
+                while (column < xRes) {
+                    LONG sourceRow;
+                    LONG sourceColumn;
+                    referenceOrientation (orientation, 75, 41, row, column, &sourceRow, &sourceColumn);
+                    assert (getPixel (row, column, after) == getPixel (sourceRow, sourceColumn, before));
+                    column ++;
+                }
+                row ++;
+            }
+            destroyChannel (orientedPlane);
+            destroyChannel (after);
+            destroyChannel (before);
+            t ++;
+        }
+        destroyBmp (oriented);
+        orientation ++;
+    }
+
+    // four quarter turns and two transposes are the identity
+    bmpPtr turned = orientBmp (image, ROTATE_90);
+    int i = 0;
+    while (i < 3) {
+        bmpPtr next = orientBmp (turned, ROTATE_90);
+        destroyBmp (turned);
+        turned = next;
+        i ++;
+    }
+    assert (hashBmpPixels (turned) == hashBmpPixels (image));
+    destroyBmp (turned);
+
+    // in place flip and the flip applied while saving
+    bmpPtr flipped = orientBmp (image, FLIP_VERTICAL);
+    unsigned long long flippedHash = hashBmpPixels (flipped);
+    destroyBmp (flipped);
+    rowOrder order = BOTTOM_UP;
+    while (order <= TOP_DOWN) {
+        setRowOrder (image, order);
+        setFlipOnSave (image, 1);
+        assert (getFlipOnSave (image) == 1);
+        saveBitMap (image, "flipped", ".");
+        bmpPtr parsed = parseBitMap ("./flipped");
+        assert (getRowOrder (parsed) == order);
+        assert (hashBmpPixels (parsed) == flippedHash);
+        destroyBmp (parsed);
+        // turning the flip off rewrites every row
+        setFlipOnSave (image, 0);
+        assert (getDirtyRowCount (image) == 41);
+        saveBitMapInPlace (image, "./flipped");
+        parsed = parseBitMap ("./flipped");
+        assert (hashBmpPixels (parsed) == hashBmpPixels (image));
+        destroyBmp (parsed);
+        int retCode = remove ("./flipped");
+        assert (retCode == 0);
+        order ++;
+    }
+    flipBmpVertically (image);
+    assert (hashBmpPixels (image) == flippedHash);
+    destroyBmp (image);
+    return;
+}
+
+static void testBmpView () {
+    printf ("\t>testing createBmpView () and materializeBmp ()\n");
+    DIBHeaderVersion version = BITMAPINFOHEADER;
+    while (version <= BITMAPV4HEADER) {
+        bmpPtr image = createTestImage (version, 75, 41);
+        bmpPtr view = createBmpView (image, 5, 7, 30, 20);
+        assert (isBmpView (view) && !isBmpView (image));
+        assert (getXRes (view) == 30 && getYRes (view) == 20);
+        assert (getPixelFormat (view) == getPixelFormat (image));
+        channelPtr parentGreen = getGreenChannel (image);
+        channelPtr viewGreen = getGreenChannel (view);
+        compareViewChannel (parentGreen, viewGreen, 5, 7);
+        destroyChannel (viewGreen);
+        viewGreen = getChannelRows (view, GREEN, 3, 10);
+        compareViewChannel (parentGreen, viewGreen, 8, 7);
+        destroyChannel (viewGreen);
+
+        // a view of a view
+        bmpPtr inner = createBmpView (view, 2, 3, 10, 4);
+        viewGreen = getGreenChannel (inner);
+        compareViewChannel (parentGreen, viewGreen, 7, 10);
+        destroyChannel (viewGreen);
+        destroyBmp (inner);
+
+        // every kernel sees the same pixels as in a materialized copy
+        bmpPtr copy = materializeBmp (view);
+        assert (!isBmpView (copy));
+        assert (hashBmpPixels (view) == hashBmpPixels (copy));
+        bmpPtr fromView = resizeBmp (view, 13, 17, RESAMPLE_BICUBIC, 2);
+        bmpPtr fromCopy = resizeBmp (copy, 13, 17, RESAMPLE_BICUBIC, 2);
+        assert (hashBmpPixels (fromView) == hashBmpPixels (fromCopy));
+        destroyBmp (fromView);
+        destroyBmp (fromCopy);
+        fromView = orientBmp (view, ROTATE_270);
+        fromCopy = orientBmp (copy, ROTATE_270);
+        assert (hashBmpPixels (fromView) == hashBmpPixels (fromCopy));
+        destroyBmp (fromView);
+        destroyBmp (fromCopy);
+        fromView = downsampleBmp (view);
+        fromCopy = downsampleBmp (copy);
+        assert (hashBmpPixels (fromView) == hashBmpPixels (fromCopy));
+        destroyBmp (fromView);
+        destroyBmp (fromCopy);
+        fromView = gaussianBlurBmp (view, 1.5, 2);
+        fromCopy = gaussianBlurBmp (copy, 1.5, 2);
+        assert (hashBmpPixels (fromView) == hashBmpPixels (fromCopy));
+        destroyBmp (fromView);
+        destroyBmp (fromCopy);
+        fromView = convertBmp (view, BITMAPV4HEADER, ARGB_32, 90);
+        fromCopy = convertBmp (copy, BITMAPV4HEADER, ARGB_32, 90);
+        assert (hashBmpPixels (fromView) == hashBmpPixels (fromCopy));
+        destroyBmp (fromView);
+        destroyBmp (fromCopy);
+
+        // saved views are ordinary files
+        rowOrder order = BOTTOM_UP;
+        while (order <= TOP_DOWN) {
+            setRowOrder (view, order);
+            saveBitMap (view, "view", ".");
+            bmpPtr parsed = parseBitMap ("./view");
+            assert (getXRes (parsed) == 30 && getYRes (parsed) == 20);
+            assert (hashBmpPixels (parsed) == hashBmpPixels (copy));
+            destroyBmp (parsed);
+            order ++;
+        }
+        int retCode = remove ("./view");
+        assert (retCode == 0);
+        destroyBmp (copy);
+
+        // writes go to the parent, only inside the rectangle
+        channelPtr flat = createChannel (30, 20);
+        LONG i = 0;
+        while (i < 30 * 20) {
+            setPixel (i / 30, i % 30, flat, 3);
+            i ++;
+        }
+        setChannel (GREEN, view, flat);
+        destroyChannel (flat);
+        channelPtr after = getGreenChannel (image);
+        LONG row = 0;
+        while (row < 41) {
+            LONG column = 0;
+            while (column < 75) {
+                if (row >= 5 && row < 25 && column >= 7 && column < 37) {
+                    assert (getPixel (row, column, after) == 3);
+                } else {
+                    assert (getPixel (row, column, after) == getPixel (row, column, parentGreen));
+                }
+                column ++;
+            }
+            row ++;
+        }
+        destroyChannel (after);
+        destroyChannel (parentGreen);
+        destroyBmp (view);
+        destroyBmp (image);
+        version ++;
+    }
+
+    // rows written through a view are saved in place through the parent
+    bmpPtr image = createTestImage (BITMAPV4HEADER, 1001, 300);
+    saveBitMap (image, "viewParent", ".");
+    destroyBmp (image);
+    image = parseBitMap ("./viewParent");
+    bmpPtr view = createBmpView (image, 10, 0, 1001, 8);
+    flipBmpVertically (view);
+    assert (getDirtyRowCount (image) == 0);
+    destroyBmp (view);
+    assert (getDirtyRowCount (image) == 8);
+    saveBitMapInPlace (image, "./viewParent");
+    bmpPtr parsed = parseBitMap ("./viewParent");
+    assert (hashBmpPixels (parsed) == hashBmpPixels (image));
+    destroyBmp (parsed);
+    destroyBmp (image);
+
+    // only the rows covered by a view of a lazily parsed bitmap are decoded
+    image = parseBitMapLazy ("./viewParent");
+    view = createBmpView (image, 150, 5, 10, 2);
+    assert (getResidentRowCount (image) >= 2 && getResidentRowCount (image) < 300);
+    channelPtr blue = getBlueChannel (view);
+    destroyChannel (blue);
+    destroyBmp (view);
+    destroyBmp (image);
+    int retCode = remove ("./viewParent");
+    assert (retCode == 0);
+    return;
+}
+
+static void compareViewChannel (channelPtr parent, channelPtr view, LONG firstRow, LONG firstColumn) {
+    LONG row = 0;
+    while (row < getChYRes (view)) {
+        LONG column = 0;
+        while (column < getChXRes (view)) {
+            assert (getPixel (row, column, view) == getPixel (firstRow + row, firstColumn + column, parent));
+            column ++;
+        }
+        row ++;
+    }
+    return;
+}
+
+static void testCompositeBmp () {
+    printf ("\t>testing compositeBmp ()\n");
+    bmpPtr overlay = createTestImage (BITMAPV4HEADER, 25, 20);
+    fillScrambled (overlay, 1);
+    DIBHeaderVersion version = BITMAPINFOHEADER;
+    while (version <= BITMAPV4HEADER) {
+        bmpPtr base = createTestImage (version, 40, 30);
+        fillScrambled (base, 2);
+        channelType types[4] = {RED, GREEN, BLUE, ALPHA};
+        channelPtr overlayPlanes[4];
+        channelPtr basePlanes[4];
+        int t = 0;
+        while (t < 4) {
+            overlayPlanes[t] = getChannelRows (overlay, types[t], 0, 20);
+            basePlanes[t] = NULL;
+            if (t < 3 || version == BITMAPV4HEADER) {
+                basePlanes[t] = getChannelRows (base, types[t], 0, 30);
+            }
+            t ++;
+        }
+        blendMode mode = BLEND_SOURCE_OVER;
+        while (mode <= BLEND_ADD) {
+            // clipped on the left and at the bottom
+            bmpPtr composited = materializeBmp (base);
+            compositeBmp (composited, overlay, -5, 17, mode, 1);
+            bmpPtr threaded = materializeBmp (base);
+            compositeBmp (threaded, overlay, -5, 17, mode, 3);
+            assert (hashBmpPixels (threaded) == hashBmpPixels (composited));
+            destroyBmp (threaded);
+
+            channelPtr results[4];
+            t = 0;
+            while (t < 4) {
+                results[t] = NULL;
+                if (basePlanes[t] != NULL) {
+                    results[t] = getChannelRows (composited, types[t], 0, 30);
+                }
+                t ++;
+            }
+            LONG row = 0;
+            while (row < 30) {
+                LONG column = 0;
+                while (column < 40) {
+                    LONG sourceRow = row - 17;
+                    LONG sourceColumn = column + 5;
+                    if (sourceRow < 0 || sourceColumn >= 25) {
+                        t = 0;
+                        while (t < 4 && basePlanes[t] != NULL) {
+                            assert (getPixel (row, column, results[t]) == getPixel (row, column, basePlanes[t]));
+                            t ++;
+                        }
+                    } else {
+                        double sourceAlpha = getPixel (sourceRow, sourceColumn, overlayPlanes[3]) / 255.0;
+                        double targetAlpha = 1;
+                        if (version == BITMAPV4HEADER) {
+                            targetAlpha = getPixel (row, column, basePlanes[3]) / 255.0;
+                        }
+                        double alpha = sourceAlpha + targetAlpha * (1 - sourceAlpha);
+                        if (mode == BLEND_ADD) {
+                            alpha = fmin (1, sourceAlpha + targetAlpha);
+                        }
+                        if (version == BITMAPV4HEADER) {
+                            assert (abs (getPixel (row, column, results[3]) - (int) floor (alpha * 255 + 0.5)) <= 1);
+                        }
+                        t = 0;
+                        while (t < 3 && alpha > 0) {
+                            double sourceColor = getPixel (sourceRow, sourceColumn, overlayPlanes[t]) / 255.0;
+                            double targetColor = getPixel (row, column, basePlanes[t]) / 255.0;
+                            double color = referenceBlend (sourceColor, sourceAlpha, targetColor, targetAlpha, mode) / alpha;
+                            if (sourceAlpha == 0) {
+                                color = targetColor;
+                            }
+                            assert (abs (getPixel (row, column, results[t]) - (int) floor (fmin (color, 1) * 255 + 0.5)) <= 1);
+                            t ++;
+                        }
+                    }
+                    column ++;
+                }
+                row ++;
+            }
+            t = 0;
+            while (t < 4) {
+                if (results[t] != NULL) {
+                    destroyChannel (results[t]);
+                }
+                t ++;
+            }
+            destroyBmp (composited);
+            mode ++;
+        }
+
+        // outside of the target entirely
+        bmpPtr untouched = materializeBmp (base);
+        compositeBmp (untouched, overlay, 40, 0, BLEND_SCREEN, 2);
+        compositeBmp (untouched, overlay, -25, -20, BLEND_SCREEN, 2);
+        assert (hashBmpPixels (untouched) == hashBmpPixels (base));
+        destroyBmp (untouched);
+        t = 0;
+        while (t < 4) {
+            destroyChannel (overlayPlanes[t]);
+            if (basePlanes[t] != NULL) {
+                destroyChannel (basePlanes[t]);
+            }
+            t ++;
+        }
+        destroyBmp (base);
+        version ++;
+    }
+    destroyBmp (overlay);
+    return;
+}
+
+// premultiplied result color of the W3C formulas (straight colors and alphas in 0 .. 1)
+static double referenceBlend (double sourceColor, double sourceAlpha, double targetColor, double targetAlpha, blendMode mode) {
+    if (mode == BLEND_ADD) {
+        return fmin (1, sourceColor * sourceAlpha + targetColor * targetAlpha);
+    }
+    double blend = sourceColor;
+    if (mode == BLEND_MULTIPLY) {
+        blend = sourceColor * targetColor;
+    } else if (mode == BLEND_SCREEN) {
+        blend = sourceColor + targetColor - sourceColor * targetColor;
+    } else if (mode == BLEND_OVERLAY) {
+        if (targetColor <= 0.5) {
+            blend = 2 * sourceColor * targetColor;
+        } else {
+            blend = 1 - 2 * (1 - sourceColor) * (1 - targetColor);
+        }
+    }
+    double color = sourceAlpha * (1 - targetAlpha) * sourceColor + (1 - sourceAlpha) * targetAlpha * targetColor;
+    return color + sourceAlpha * targetAlpha * blend;
+}
+
+// scrambled colors, alpha is a mix of runs of 0, of 255 and of other values
+static void fillScrambled (bmpPtr image, int seed) {
+    channelType types[4] = {RED, GREEN, BLUE, ALPHA};
+    int typeCount = (getPixelFormat (image) == ARGB_32) ? 4 : 3;
+    int t = 0;
+    while (t < typeCount) {
+        channelPtr plane = createChannel (getXRes (image), getYRes (image));
+        LONG row = 0;
+        while (row < getYRes (image)) {
+            LONG column = 0;
+            while (column < getXRes (image)) {
+                unsigned int value = ((row * 7919 + column * 104729 + seed * 31 + t * 17) * 2654435761u) >> 24;
+                if (types[t] == ALPHA) {
+                    LONG run = (column / 4 + row + seed) % 4;
+                    if (run == 0) {
+                        value = 0;
+                    } else if (run == 1) {
+                        value = 255;
+                    }
+                }
+                setPixel (row, column, plane, value);
+                column ++;
+            }
+            row ++;
+        }
+        setChannel (types[t], image, plane);
+        destroyChannel (plane);
+        t ++;
+    }
+    return;
+}
+
+static void testPremultipliedBmp () {
+    printf ("\t>testing premultiplyBmp () and unpremultiplyBmp ()\n");
+    channelType types[3] = {RED, GREEN, BLUE};
+    bmpPtr straight = createTestImage (BITMAPV4HEADER, 37, 23);
+    fillScrambled (straight, 3);
+    bmpPtr premultiplied = materializeBmp (straight);
+    assert (!isPremultiplied (premultiplied));
+    premultiplyBmp (premultiplied);
+    assert (isPremultiplied (premultiplied));
+    channelPtr alpha = getAlphaChannel (straight);
+    int t = 0;
+    while (t < 3) {
+        channelPtr before = getChannelRows (straight, types[t], 0, 23);
+        channelPtr after = getChannelRows (premultiplied, types[t], 0, 23);
+        LONG row = 0;
+        while (row < 23) {
+            LONG column = 0;
+            while (column < 37) {
+                int product = getPixel (row, column, before) * getPixel (row, column, alpha);
+                assert (getPixel (row, column, after) == (2 * product + 255) / 510);
+                column ++;
+            }
+            row ++;
+        }
+        destroyChannel (before);
+        destroyChannel (after);
+        t ++;
+    }
+    // views and copies keep the storage
+    bmpPtr view = createBmpView (premultiplied, 2, 3, 10, 10);
+    assert (isPremultiplied (view));
+    destroyBmp (view);
+
+    // files are straight alpha: opaque pixels come back exactly, transparent ones black
+    bmpPtr expected = materializeBmp (premultiplied);
+    assert (isPremultiplied (expected));
+    unpremultiplyBmp (expected);
+    assert (!isPremultiplied (expected));
+    saveBitMap (premultiplied, "premultiplied", ".");
+    assert (isPremultiplied (premultiplied));
+    bmpPtr parsed = parseBitMap ("./premultiplied");
+    assert (!isPremultiplied (parsed));
+    assert (hashBmpPixels (parsed) == hashBmpPixels (expected));
+    t = 0;
+    while (t < 3) {
+        channelPtr before = getChannelRows (straight, types[t], 0, 23);
+        channelPtr after = getChannelRows (parsed, types[t], 0, 23);
+        LONG row = 0;
+        while (row < 23) {
+            LONG column = 0;
+            while (column < 37) {
+                if (getPixel (row, column, alpha) == 255) {
+                    assert (getPixel (row, column, after) == getPixel (row, column, before));
+                } else if (getPixel (row, column, alpha) == 0) {
+                    assert (getPixel (row, column, after) == 0);
+                }
+                column ++;
+            }
+            row ++;
+        }
+        destroyChannel (before);
+        destroyChannel (after);
+        t ++;
+    }
+    destroyBmp (parsed);
+    int retCode = remove ("./premultiplied");
+    assert (retCode == 0);
+
+    // conversions give straight copies
+    bmpPtr converted = convertBmp (premultiplied, BITMAPV4HEADER, ARGB_32, 255);
+    bmpPtr reference = convertBmp (expected, BITMAPV4HEADER, ARGB_32, 255);
+    assert (!isPremultiplied (converted));
+    assert (hashBmpPixels (converted) == hashBmpPixels (reference));
+    destroyBmp (converted);
+    destroyBmp (reference);
+    converted = materializeBmp (premultiplied);
+    convertBmpInPlace (converted, BITMAPINFOHEADER, RGB_24, 0);
+    reference = convertBmp (expected, BITMAPINFOHEADER, RGB_24, 0);
+    assert (!isPremultiplied (converted));
+    assert (hashBmpPixels (converted) == hashBmpPixels (reference));
+    destroyBmp (converted);
+    destroyBmp (reference);
+
+    // kernels run on the premultiplied colors and match their straight counterparts premultiplied
+    bmpPtr results[3];
+    bmpPtr references[3];
+    results[0] = resizeBmp (premultiplied, 20, 15, RESAMPLE_BILINEAR, 2);
+    references[0] = resizeBmp (straight, 20, 15, RESAMPLE_BILINEAR, 2);
+    results[1] = downsampleBmp (premultiplied);
+    references[1] = downsampleBmp (straight);
+    bmpPtr overlay = createTestImage (BITMAPV4HEADER, 25, 20);
+    fillScrambled (overlay, 1);
+    results[2] = createTestImage (BITMAPV4HEADER, 40, 30);
+    fillScrambled (results[2], 2);
+    references[2] = materializeBmp (results[2]);
+    premultiplyBmp (results[2]);
+    compositeBmp (results[2], overlay, 20, -3, BLEND_OVERLAY, 1);
+    compositeBmp (references[2], overlay, 20, -3, BLEND_OVERLAY, 1);
+    int tolerances[3] = {1, 2, 2};
+    int i = 0;
+    while (i < 3) {
+        assert (isPremultiplied (results[i]));
+        premultiplyBmp (references[i]);
+        channelType allTypes[4] = {RED, GREEN, BLUE, ALPHA};
+        t = 0;
+        while (t < 4) {
+            channelPtr result = getChannelRows (results[i], allTypes[t], 0, getYRes (results[i]));
+            channelPtr reference = getChannelRows (references[i], allTypes[t], 0, getYRes (results[i]));
+            assert (maxChannelDifference (result, reference, 0) <= tolerances[i]);
+            destroyChannel (result);
+            destroyChannel (reference);
+            t ++;
+        }
+        destroyBmp (results[i]);
+        destroyBmp (references[i]);
+        i ++;
+    }
+    // a premultiplied source is blended as is into a premultiplied target, an RGB_24 source is opaque
+    bmpPtr straightBase = createTestImage (BITMAPV4HEADER, 40, 30);
+    fillScrambled (straightBase, 2);
+    bmpPtr base = materializeBmp (straightBase);
+    premultiplyBmp (base);
+    bmpPtr premultipliedOverlay = materializeBmp (overlay);
+    premultiplyBmp (premultipliedOverlay);
+    bmpPtr rgbOverlay = convertBmp (overlay, BITMAPINFOHEADER, RGB_24, 0);
+    blendMode mode = BLEND_SOURCE_OVER;
+    while (mode <= BLEND_ADD) {
+        bmpPtr sources[2] = {overlay, rgbOverlay};
+        i = 0;
+        while (i < 2) {
+            bmpPtr composited = materializeBmp (base);
+            compositeBmp (composited, sources[i], -4, 12, mode, 1);
+            bmpPtr reference = materializeBmp (straightBase);
+            compositeBmp (reference, sources[i], -4, 12, mode, 1);
+            premultiplyBmp (reference);
+            channelType allTypes[4] = {RED, GREEN, BLUE, ALPHA};
+            t = 0;
+            while (t < 4) {
+                channelPtr result = getChannelRows (composited, allTypes[t], 0, 30);
+                channelPtr expectedPlane = getChannelRows (reference, allTypes[t], 0, 30);
+                assert (maxChannelDifference (result, expectedPlane, 0) <= 2);
+                destroyChannel (result);
+                destroyChannel (expectedPlane);
+                t ++;
+            }
+            if (i == 0) {
+                bmpPtr threaded = materializeBmp (base);
+                compositeBmp (threaded, premultipliedOverlay, -4, 12, mode, 3);
+                assert (hashBmpPixels (threaded) == hashBmpPixels (composited));
+                destroyBmp (threaded);
+                // and divided back over a straight target
+                bmpPtr straightTarget = materializeBmp (straightBase);
+                compositeBmp (straightTarget, premultipliedOverlay, -4, 12, mode, 2);
+                premultiplyBmp (straightTarget);
+                t = 0;
+                while (t < 4) {
+                    channelPtr result = getChannelRows (straightTarget, allTypes[t], 0, 30);
+                    channelPtr expectedPlane = getChannelRows (reference, allTypes[t], 0, 30);
+                    assert (maxChannelDifference (result, expectedPlane, 0) <= 2);
+                    destroyChannel (result);
+                    destroyChannel (expectedPlane);
+                    t ++;
+                }
+                destroyBmp (straightTarget);
+            }
+            destroyBmp (reference);
+            destroyBmp (composited);
+            i ++;
+        }
+        mode ++;
+    }
+    destroyBmp (rgbOverlay);
+    destroyBmp (premultipliedOverlay);
+    destroyBmp (straightBase);
+    destroyBmp (base);
+    destroyBmp (overlay);
+    destroyChannel (alpha);
+    destroyBmp (expected);
+    destroyBmp (premultiplied);
+    destroyBmp (straight);
+    return;
+}
+
+static void testColorModels () {
+    printf ("\t>testing getColorModelChannels () and setColorModelChannels ()\n");
+    bmpPtr image = createTestImage (BITMAPV4HEADER, 37, 23);
+    fillScrambled (image, 4);
+    channelPtr red = getRedChannel (image);
+    channelPtr green = getGreenChannel (image);
+    channelPtr blue = getBlueChannel (image);
+    channelPtr alpha = getAlphaChannel (image);
+    colorModel model = COLOR_MODEL_LUMA;
+    while (model <= COLOR_MODEL_HSV) {
+        int planeCount = getColorModelChannelCount (model);
+        channelPtr planes[3];
+        channelPtr threaded[3];
+        getColorModelChannels (image, model, planes, 1);
+        getColorModelChannels (image, model, threaded, 3);
+        int p = 0;
+        while (p < planeCount) {
+            assert (hashChannel (threaded[p]) == hashChannel (planes[p]));
+            destroyChannel (threaded[p]);
+            p ++;
+        }
+        // against the floating point definitions
+        LONG row = 0;
+        while (row < 23) {
+            LONG column = 0;
+            while (column < 37) {
+                double r = getPixel (row, column, red);
+                double g = getPixel (row, column, green);
+                double b = getPixel (row, column, blue);
+                if (model == COLOR_MODEL_HSV) {
+                    double max = fmax (r, fmax (g, b));
+                    double delta = max - fmin (r, fmin (g, b));
+                    assert (getPixel (row, column, planes[2]) == max);
+                    if (max > 0) {
+                        assert (fabs (getPixel (row, column, planes[1]) - 255 * delta / max) <= 0.5 + 1e-9);
+                    }
+                    if (delta > 0) {
+                        double turn = (max == r) ? (g - b) / delta : ((max == g) ? 2 + (b - r) / delta : 4 + (r - g) / delta);
+                        double hue = fmod (turn * 256 / 6 + 256, 256);
+                        double difference = fabs (getPixel (row, column, planes[0]) - hue);
+                        assert (fmin (difference, 256 - difference) <= 0.5 + 1e-9);
+                    }
+                } else {
+                    double luma = 0.299 * r + 0.587 * g + 0.114 * b;
+                    assert (fabs (getPixel (row, column, planes[0]) - luma) <= 0.51);
+                }
+                if (model == COLOR_MODEL_YCBCR_444) {
+                    double blueChroma = 128 - 0.168736 * r - 0.331264 * g + 0.5 * b;
+                    double redChroma = 128 + 0.5 * r - 0.418688 * g - 0.081312 * b;
+                    assert (fabs (getPixel (row, column, planes[1]) - fmin (blueChroma, 255)) <= 0.51);
+                    assert (fabs (getPixel (row, column, planes[2]) - fmin (redChroma, 255)) <= 0.51);
+                }
+                if (model == COLOR_MODEL_YCBCR_420 && row % 2 == 0 && column % 2 == 0) {
+                    double sums[3] = {0, 0, 0};
+                    int dRow = 0;
+                    while (dRow < 2) {
+                        int dColumn = 0;
+                        while (dColumn < 2) {
+                            LONG blockRow = (row + dRow < 23) ? row + dRow : row;
+                            LONG blockColumn = (column + dColumn < 37) ? column + dColumn : column;
+                            sums[0] += getPixel (blockRow, blockColumn, red) / 4.0;
+                            sums[1] += getPixel (blockRow, blockColumn, green) / 4.0;
+                            sums[2] += getPixel (blockRow, blockColumn, blue) / 4.0;
+                            dColumn ++;
+                        }
+                        dRow ++;
+                    }
+                    double blueChroma = 128 - 0.168736 * sums[0] - 0.331264 * sums[1] + 0.5 * sums[2];
+                    assert (fabs (getPixel (row / 2, column / 2, planes[1]) - fmin (blueChroma, 255)) <= 0.51);
+                }
+                column ++;
+            }
+            row ++;
+        }
+
+        // and back, alpha is kept
+        bmpPtr restored = materializeBmp (image);
+        setColorModelChannels (restored, model, planes, 2);
+        channelPtr restoredAlpha = getAlphaChannel (restored);
+        compareChannels (restoredAlpha, alpha);
+        destroyChannel (restoredAlpha);
+        channelPtr restoredPlanes[3] = {getRedChannel (restored), getGreenChannel (restored), getBlueChannel (restored)};
+        channelPtr originals[3] = {red, green, blue};
+        // hsv quantizes the hue to 256 steps, 4:2:0 (which loses the chroma detail inside every 2x2 block) is
+        // checked below
+        p = 0;
+        while (p < 3) {
+            if (model == COLOR_MODEL_LUMA) {
+                compareChannels (restoredPlanes[p], planes[0]);
+            } else if (model == COLOR_MODEL_YCBCR_444) {
+                assert (maxChannelDifference (restoredPlanes[p], originals[p], 0) <= 1);
+            } else if (model == COLOR_MODEL_HSV) {
+                assert (maxChannelDifference (restoredPlanes[p], originals[p], 0) <= 3);
+            }
+            destroyChannel (restoredPlanes[p]);
+            p ++;
+        }
+        destroyBmp (restored);
+        p = 0;
+        while (p < planeCount) {
+            destroyChannel (planes[p]);
+            p ++;
+        }
+        model ++;
+    }
+
+    // 4:2:0 is exact up to rounding on an image made of uniform 2x2 blocks
+    bmpPtr blocks = createTestImage (BITMAPINFOHEADER, 36, 22);
+    bmpPtr half = createTestImage (BITMAPINFOHEADER, 18, 11);
+    fillScrambled (half, 5);
+    channelType types[3] = {RED, GREEN, BLUE};
+    int t = 0;
+    while (t < 3) {
+        channelPtr source = getChannelRows (half, types[t], 0, 11);
+        channelPtr plane = createChannel (36, 22);
+        LONG row = 0;
+        while (row < 22) {
+            LONG column = 0;
+            while (column < 36) {
+                setPixel (row, column, plane, getPixel (row / 2, column / 2, source));
+                column ++;
+            }
+            row ++;
+        }
+        setChannel (types[t], blocks, plane);
+        destroyChannel (plane);
+        destroyChannel (source);
+        t ++;
+    }
+    channelPtr planes[3];
+    getColorModelChannels (blocks, COLOR_MODEL_YCBCR_420, planes, 2);
+    bmpPtr restored = materializeBmp (blocks);
+    setColorModelChannels (restored, COLOR_MODEL_YCBCR_420, planes, 2);
+    t = 0;
+    while (t < 3) {
+        channelPtr before = getChannelRows (blocks, types[t], 0, 22);
+        channelPtr after = getChannelRows (restored, types[t], 0, 22);
+        assert (maxChannelDifference (before, after, 0) <= 2);
+        destroyChannel (before);
+        destroyChannel (after);
+        destroyChannel (planes[t]);
+        t ++;
+    }
+    destroyBmp (restored);
+    destroyBmp (half);
+    destroyBmp (blocks);
+
+    // views convert their rectangle only
+    bmpPtr view = createBmpView (image, 5, 7, 20, 11);
+    channelPtr parentPlanes[3];
+    channelPtr viewPlanes[3];
+    getColorModelChannels (image, COLOR_MODEL_HSV, parentPlanes, 1);
+    getColorModelChannels (view, COLOR_MODEL_HSV, viewPlanes, 2);
+    t = 0;
+    while (t < 3) {
+        compareViewChannel (parentPlanes[t], viewPlanes[t], 5, 7);
+        destroyChannel (parentPlanes[t]);
+        destroyChannel (viewPlanes[t]);
+        t ++;
+    }
+    destroyBmp (view);
+    destroyChannel (red);
+    destroyChannel (green);
+    destroyChannel (blue);
+    destroyChannel (alpha);
+    destroyBmp (image);
+    return;
+}
+
+static void testLUT () {
+    printf ("\t>testing applyLUT (), applyChannelLUT () and composeLUT ()\n");
+    byte invert[256];
+    byte square[256];
+    byte threshold[256];
+    int v = 0;
+    while (v < 256) {
+        invert[v] = 255 - v;
+        square[v] = (v * v + 127) / 255;
+        threshold[v] = (v < 100) ? 0 : 255;
+        v ++;
+    }
+    byte *tables[4] = {invert, NULL, square, threshold};
+    bmpPtr image = createTestImage (BITMAPV4HEADER, 37, 23);
+    fillScrambled (image, 6);
+    channelType types[4] = {RED, GREEN, BLUE, ALPHA};
+    channelPtr originals[4];
+    int c = 0;
+    while (c < 4) {
+        originals[c] = getChannelRows (image, types[c], 0, 23);
+        c ++;
+    }
+
+    // every channel through its own table, NULL leaves green as it is
+    bmpPtr mapped = materializeBmp (image);
+    applyLUT (mapped, invert, NULL, square, threshold, 3);
+    c = 0;
+    while (c < 4) {
+        channelPtr result = getChannelRows (mapped, types[c], 0, 23);
+        LONG row = 0;
+        while (row < 23) {
+            LONG column = 0;
+            while (column < 37) {
+                byte original = getPixel (row, column, originals[c]);
+                byte expected = (tables[c] == NULL) ? original : tables[c][original];
+                assert (getPixel (row, column, result) == expected);
+                column ++;
+            }
+            row ++;
+        }
+        destroyChannel (result);
+        c ++;
+    }
+
+    // on one thread, on a view (only its rectangle changes) and on a channel
+    bmpPtr single = materializeBmp (image);
+    applyLUT (single, invert, NULL, square, threshold, 1);
+    assert (hashBmpPixels (single) == hashBmpPixels (mapped));
+    bmpPtr partial = materializeBmp (image);
+    bmpPtr view = createBmpView (partial, 5, 7, 20, 11);
+    applyLUT (view, invert, NULL, square, threshold, 2);
+    c = 0;
+    while (c < 4) {
+        channelPtr inView = getChannelRows (view, types[c], 0, 11);
+        channelPtr expected = getChannelRows (mapped, types[c], 0, 23);
+        compareViewChannel (expected, inView, 5, 7);
+        destroyChannel (inView);
+        destroyChannel (expected);
+        c ++;
+    }
+    destroyBmp (view);
+    channelPtr untouched = getChannelRows (partial, RED, 0, 23);
+    assert (getPixel (4, 7, untouched) == getPixel (4, 7, originals[0]));
+    assert (getPixel (5, 6, untouched) == getPixel (5, 6, originals[0]));
+    assert (getPixel (16, 27, untouched) == getPixel (16, 27, originals[0]));
+    destroyChannel (untouched);
+    destroyBmp (partial);
+    channelPtr plane = getChannelRows (image, BLUE, 0, 23);
+    applyChannelLUT (plane, square, 4);
+    channelPtr expected = getChannelRows (mapped, BLUE, 0, 23);
+    compareChannels (plane, expected);
+    destroyChannel (expected);
+
+    // a composed table costs one pass and gives the same result as its tables in turn (target may alias)
+    byte composed[256];
+    composeLUT (composed, invert, square);
+    composeLUT (composed, composed, threshold);
+    channelPtr chained = getChannelRows (image, BLUE, 0, 23);
+    applyChannelLUT (chained, invert, 2);
+    applyChannelLUT (chained, square, 2);
+    applyChannelLUT (chained, threshold, 2);
+    destroyChannel (plane);
+    plane = getChannelRows (image, BLUE, 0, 23);
+    applyChannelLUT (plane, composed, 2);
+    compareChannels (plane, chained);
+    destroyChannel (plane);
+    destroyChannel (chained);
+
+    // RGB_24 leaves its (absent) alpha alone
+    bmpPtr opaque = convertBmp (image, BITMAPINFOHEADER, RGB_24, 0);
+    unsigned long long before = hashBmpPixels (opaque);
+    applyLUT (opaque, invert, NULL, NULL, NULL, 2);
+    applyLUT (opaque, invert, NULL, NULL, NULL, 2);
+    assert (hashBmpPixels (opaque) == before);
+    destroyBmp (opaque);
+
+    // premultiplied bitmaps are mapped straight and multiplied again by the mapped alpha
+    bmpPtr premultiplied = materializeBmp (image);
+    premultiplyBmp (premultiplied);
+    bmpPtr reference = materializeBmp (premultiplied);
+    unpremultiplyBmp (reference);
+    applyLUT (reference, invert, NULL, square, threshold, 1);
+    premultiplyBmp (reference);
+    applyLUT (premultiplied, invert, NULL, square, threshold, 3);
+    assert (isPremultiplied (premultiplied));
+    assert (hashBmpPixels (premultiplied) == hashBmpPixels (reference));
+    destroyBmp (reference);
+    destroyBmp (premultiplied);
+
+    c = 0;
+    while (c < 4) {
+        destroyChannel (originals[c]);
+        c ++;
+    }
+    destroyBmp (single);
+    destroyBmp (mapped);
+    destroyBmp (image);
+    return;
+}
+
+static void testHistogram () {
+    printf ("\t>testing computeHistogram (), accumulateHistogram () and computeChannelHistogram ()\n");
+    bmpHistogram *histogram = (bmpHistogram *) malloc (sizeof (bmpHistogram));
+    bmpHistogram *reference = (bmpHistogram *) malloc (sizeof (bmpHistogram));
+    assert (histogram != NULL && reference != NULL);
+    // odd width so that rows end in the middle of the interleaved sets
+    bmpPtr image = createTestImage (BITMAPV4HEADER, 37, 23);
+    fillScrambled (image, 7);
+    channelType types[4] = {RED, GREEN, BLUE, ALPHA};
+    channelPtr planes[5];
+    int c = 0;
+    while (c < 4) {
+        planes[c] = getChannelRows (image, types[c], 0, 23);
+        c ++;
+    }
+    getColorModelChannels (image, COLOR_MODEL_LUMA, planes + 4, 1);
+    memset (reference, 0, sizeof (bmpHistogram));
+    unsigned long long *referenceCounts[5] = {reference->red, reference->green, reference->blue, reference->alpha, reference->luma};
+    c = 0;
+    while (c < 5) {
+        LONG row = 0;
+        while (row < 23) {
+            LONG column = 0;
+            while (column < 37) {
+                referenceCounts[c][getPixel (row, column, planes[c])] ++;
+                column ++;
+            }
+            row ++;
+        }
+        c ++;
+    }
+    int threadCount = 1;
+    while (threadCount <= 5) {
+        computeHistogram (image, histogram, threadCount);
+        assert (memcmp (histogram, reference, sizeof (bmpHistogram)) == 0);
+        threadCount += 2;
+    }
+    unsigned long long channelCounts[256];
+    c = 0;
+    while (c < 5) {
+        computeChannelHistogram (planes[c], channelCounts, 3);
+        assert (memcmp (channelCounts, referenceCounts[c], sizeof (channelCounts)) == 0);
+        c ++;
+    }
+
+    // a view counts only its rectangle, RGB_24 pixels are opaque
+    bmpPtr view = createBmpView (image, 3, 4, 30, 15);
+    computeHistogram (view, histogram, 2);
+    channelPtr viewRed = getRedChannel (view);
+    computeChannelHistogram (viewRed, channelCounts, 1);
+    assert (memcmp (channelCounts, histogram->red, sizeof (channelCounts)) == 0);
+    destroyChannel (viewRed);
+    destroyBmp (view);
+    bmpPtr opaque = convertBmp (image, BITMAPINFOHEADER, RGB_24, 0);
+    computeHistogram (opaque, histogram, 2);
+    assert (histogram->alpha[255] == 37 * 23 && histogram->alpha[0] == 0);
+    assert (memcmp (histogram->luma, reference->luma, sizeof (reference->luma)) == 0);
+    destroyBmp (opaque);
+
+    // a lazily parsed file counted band by band, the rows are decoded as they are reached
+    saveBitMap (image, "histogram", ".");
+    bmpPtr lazy = parseBitMapLazy ("./histogram");
+    memset (histogram, 0, sizeof (bmpHistogram));
+    LONG firstRow = 0;
+    while (firstRow < 23) {
+        LONG rowCount = (23 - firstRow < 6) ? 23 - firstRow : 6;
+        accumulateHistogram (histogram, lazy, firstRow, rowCount);
+        firstRow += rowCount;
+        assert (getResidentRowCount (lazy) >= firstRow);
+    }
+    assert (memcmp (histogram, reference, sizeof (bmpHistogram)) == 0);
+    destroyBmp (lazy);
+    int retCode = remove ("./histogram");
+    assert (retCode == 0);
+
+    // runs of one value all land in the right bin
+    fillChannel (image, RED, 9);
+    computeHistogram (image, histogram, 4);
+    assert (histogram->red[9] == 37 * 23);
+    c = 0;
+    while (c < 5) {
+        destroyChannel (planes[c]);
+        c ++;
+    }
+    destroyBmp (image);
+    free (histogram);
+    free (reference);
+    return;
+}
+
+static void testEqualization () {
+    printf ("\t>testing equalizeChannel (), equalizeChannelAdaptive (), equalizeBmp () and equalizeBmpAdaptive ()\n");
+    // low contrast, each quadrant in its own range
+    channelPtr source = createChannel (40, 30);
+    LONG row = 0;
+    while (row < 30) {
+        LONG column = 0;
+        while (column < 40) {
+            unsigned int scrambled = ((row * 7919 + column * 104729) * 2654435761u) >> 24;
+            setPixel (row, column, source, 60 + 40 * (row >= 15) + 20 * (column >= 20) + scrambled % 31);
+            column ++;
+        }
+        row ++;
+    }
+    unsigned long long counts[256];
+    computeChannelHistogram (source, counts, 1);
+    int smallest = 0;
+    while (counts[smallest] == 0) {
+        smallest ++;
+    }
+
+    // global: (cdf - cdf of the smallest value) * 255 / (total - cdf of the smallest value), any thread count
+    channelPtr equalized = copyTestChannel (source, 0, 0, 40, 30);
+    channelPtr threaded = copyTestChannel (source, 0, 0, 40, 30);
+    equalizeChannel (equalized, 1);
+    equalizeChannel (threaded, 3);
+    compareChannels (equalized, threaded);
+    destroyChannel (threaded);
+    // CLAHE with a single tile and no clipping maps through cdf * 255 / total
+    channelPtr adaptive = copyTestChannel (source, 0, 0, 40, 30);
+    equalizeChannelAdaptive (adaptive, 1, 1, 256, 2);
+    row = 0;
+    while (row < 30) {
+        LONG column = 0;
+        while (column < 40) {
+            unsigned long long cumulative = cumulativeCount (counts, getPixel (row, column, source));
+            double expected = (cumulative - counts[smallest]) * 255.0 / (1200 - counts[smallest]);
+            assert (fabs (getPixel (row, column, equalized) - expected) <= 0.5 + 1e-9);
+            assert (fabs (getPixel (row, column, adaptive) - cumulative * 255.0 / 1200) <= 0.5 + 1e-9);
+            column ++;
+        }
+        row ++;
+    }
+    destroyChannel (adaptive);
+
+    // 2x2 tiles: the pixels up to the center of the top left tile are mapped by its table only, which is the table
+    // of the quadrant equalized on its own. Clipping flattens the table, any thread count gives the same result
+    channelPtr tiled = copyTestChannel (source, 0, 0, 40, 30);
+    equalizeChannelAdaptive (tiled, 2, 2, 2.5, 1);
+    channelPtr quadrant = copyTestChannel (source, 0, 0, 20, 15);
+    equalizeChannelAdaptive (quadrant, 1, 1, 2.5, 1);
+    row = 0;
+    while (row <= 7) {
+        LONG column = 0;
+        while (column <= 9) {
+            assert (getPixel (row, column, tiled) == getPixel (row, column, quadrant));
+            column ++;
+        }
+        row ++;
+    }
+    channelPtr unclipped = copyTestChannel (source, 0, 0, 20, 15);
+    equalizeChannelAdaptive (unclipped, 1, 1, 256, 1);
+    unsigned long long clippedCounts[256];
+    computeChannelHistogram (quadrant, clippedCounts, 1);
+    computeChannelHistogram (unclipped, counts, 1);
+    int clippedLowest = 0;
+    int lowest = 0;
+    while (clippedCounts[clippedLowest] == 0) {
+        clippedLowest ++;
+    }
+    while (counts[lowest] == 0) {
+        lowest ++;
+    }
+    assert (clippedLowest > lowest);
+    destroyChannel (unclipped);
+    destroyChannel (quadrant);
+    threaded = copyTestChannel (source, 0, 0, 40, 30);
+    equalizeChannelAdaptive (threaded, 2, 2, 2.5, 4);
+    compareChannels (tiled, threaded);
+    destroyChannel (threaded);
+
+    // more tiles than pixels, a constant channel stays constant
+    channelPtr flat = createChannel (3, 2);
+    row = 0;
+    while (row < 2) {
+        setPixel (row, 0, flat, 77);
+        setPixel (row, 1, flat, 77);
+        setPixel (row, 2, flat, 77);
+        row ++;
+    }
+    equalizeChannelAdaptive (flat, 8, 8, 40, 4);
+    computeChannelHistogram (flat, counts, 1);
+    int v = 0;
+    while (counts[v] == 0) {
+        v ++;
+    }
+    assert (counts[v] == 6);
+    equalizeChannel (flat, 1);
+    computeChannelHistogram (flat, counts, 1);
+    assert (counts[v] == 6);
+    destroyChannel (flat);
+
+    // bitmaps: every color channel on its own, or the luma (exact on a gray image), alpha is kept
+    bmpPtr image = createTestImage (BITMAPV4HEADER, 40, 30);
+    fillScrambled (image, 8);
+    channelPtr alpha = getAlphaChannel (image);
+    bmpPtr channels = materializeBmp (image);
+    equalizeBmp (channels, EQUALIZE_CHANNELS, 3);
+    channelType types[3] = {RED, GREEN, BLUE};
+    int c = 0;
+    while (c < 3) {
+        channelPtr plane = getChannelRows (image, types[c], 0, 30);
+        equalizeChannel (plane, 1);
+        channelPtr result = getChannelRows (channels, types[c], 0, 30);
+        compareChannels (result, plane);
+        destroyChannel (result);
+        destroyChannel (plane);
+        c ++;
+    }
+    equalizeBmpAdaptive (channels, EQUALIZE_CHANNELS, 3, 4, 3, 2);
+    channelPtr resultAlpha = getAlphaChannel (channels);
+    compareChannels (resultAlpha, alpha);
+    destroyChannel (resultAlpha);
+    destroyBmp (channels);
+    c = 0;
+    while (c < 3) {
+        setChannel (types[c], image, source);
+        c ++;
+    }
+    bmpPtr gray = materializeBmp (image);
+    equalizeBmp (gray, EQUALIZE_LUMA, 2);
+    channelPtr result = getGreenChannel (gray);
+    compareChannels (result, equalized);
+    destroyChannel (result);
+    destroyBmp (gray);
+    gray = materializeBmp (image);
+    equalizeBmpAdaptive (gray, EQUALIZE_LUMA, 2, 2, 2.5, 3);
+    result = getBlueChannel (gray);
+    compareChannels (result, tiled);
+    destroyChannel (result);
+    resultAlpha = getAlphaChannel (gray);
+    compareChannels (resultAlpha, alpha);
+    destroyChannel (resultAlpha);
+    destroyBmp (gray);
+
+    destroyChannel (alpha);
+    destroyBmp (image);
+    destroyChannel (tiled);
+    destroyChannel (equalized);
+    destroyChannel (source);
+    return;
+}
+
+// number of values of the histogram up to value
+static unsigned long long cumulativeCount (unsigned long long *counts, byte value) {
+    unsigned long long cumulative = 0;
+    int v = 0;
+    while (v <= value) {
+        cumulative += counts[v];
+        v ++;
+    }
+    return cumulative;
+}
+
+// xRes x yRes copy of the channel from (firstRow, firstColumn)
+static channelPtr copyTestChannel (channelPtr source, LONG firstRow, LONG firstColumn, LONG xRes, LONG yRes) {
+    channelPtr copy = createChannel (xRes, yRes);
+    LONG row = 0;
+    while (row < yRes) {
+        LONG column = 0;
+        while (column < xRes) {
+            setPixel (row, column, copy, getPixel (firstRow + row, firstColumn + column, source));
+            column ++;
+        }
+        row ++;
+    }
+    return copy;
+}
+
+static void testStats () {
+    printf ("\t>testing computeBmpStats (), accumulateBmpStats () and computeChannelStats ()\n");
+    // more than one chunk of lane accumulators, rows end in the middle of the 16 byte steps
+    bmpPtr image = createTestImage (BITMAPV4HEADER, 301, 250);
+    fillScrambled (image, 11);
+    // clipped values, long runs of 255 overflow nothing
+    fillChannel (image, GREEN, MAX_RGB_VALUE);
+    channelPtr green = getGreenChannel (image);
+    LONG column = 0;
+    while (column < 301) {
+        setPixel (17, column, green, 0);
+        column ++;
+    }
+    setChannel (GREEN, image, green);
+    destroyChannel (green);
+    channelType types[4] = {RED, GREEN, BLUE, ALPHA};
+    channelPtr planes[4];
+    channelStats reference[4];
+    int c = 0;
+    while (c < 4) {
+        planes[c] = getChannelRows (image, types[c], 0, 250);
+        referenceStats (planes[c], reference + c);
+        c ++;
+    }
+    assert (reference[1].whiteCount == 249 * 301 && reference[1].blackCount == 301);
+    bmpStats stats;
+    int threadCount = 1;
+    while (threadCount <= 5) {
+        computeBmpStats (image, &stats, threadCount);
+        assert (memcmp (&stats.red, reference, sizeof (channelStats)) == 0);
+        assert (memcmp (&stats.green, reference + 1, sizeof (channelStats)) == 0);
+        assert (memcmp (&stats.blue, reference + 2, sizeof (channelStats)) == 0);
+        assert (memcmp (&stats.alpha, reference + 3, sizeof (channelStats)) == 0);
+        threadCount += 2;
+    }
+    channelStats single;
+    c = 0;
+    while (c < 4) {
+        computeChannelStats (planes[c], &single, 3);
+        assert (memcmp (&single, reference + c, sizeof (channelStats)) == 0);
+        c ++;
+    }
+
+    // a view covers only its rectangle, RGB_24 pixels are opaque
+    bmpPtr view = createBmpView (image, 3, 4, 45, 31);
+    channelPtr viewBlue = getBlueChannel (view);
+    referenceStats (viewBlue, &single);
+    computeBmpStats (view, &stats, 2);
+    assert (memcmp (&stats.blue, &single, sizeof (channelStats)) == 0);
+    assert (stats.red.count == 45 * 31);
+    destroyChannel (viewBlue);
+    destroyBmp (view);
+    bmpPtr opaque = convertBmp (image, BITMAPINFOHEADER, RGB_24, 0);
+    computeBmpStats (opaque, &stats, 2);
+    assert (memcmp (&stats.red, reference, sizeof (channelStats)) == 0);
+    assert (stats.alpha.min == MAX_RGB_VALUE && stats.alpha.max == MAX_RGB_VALUE);
+    assert (stats.alpha.whiteCount == 301 * 250 && stats.alpha.blackCount == 0);
+    assert (stats.alpha.sum == 301ULL * 250 * MAX_RGB_VALUE);
+    destroyBmp (opaque);
+
+    // a lazily parsed file merged band by band equals the whole pass, an empty band changes nothing
+    saveBitMap (image, "stats", ".");
+    bmpPtr lazy = parseBitMapLazy ("./stats");
+    bmpStats merged;
+    memset (&merged, 0, sizeof (bmpStats));
+    accumulateBmpStats (&merged, lazy, 0, 0);
+    assert (merged.red.count == 0);
+    LONG firstRow = 0;
+    while (firstRow < 250) {
+        LONG rowCount = (250 - firstRow < 40) ? 250 - firstRow : 40;
+        accumulateBmpStats (&merged, lazy, firstRow, rowCount);
+        firstRow += rowCount;
+        assert (getResidentRowCount (lazy) >= firstRow);
+    }
+    computeBmpStats (image, &stats, 1);
+    assert (memcmp (&merged, &stats, sizeof (bmpStats)) == 0);
+    destroyBmp (lazy);
+    int retCode = remove ("./stats");
+    assert (retCode == 0);
+
+    c = 0;
+    while (c < 4) {
+        destroyChannel (planes[c]);
+        c ++;
+    }
+    destroyBmp (image);
+    return;
+}
+
+static void referenceStats (channelPtr channel, channelStats *stats) {
+    memset (stats, 0, sizeof (channelStats));
+    stats->min = MAX_RGB_VALUE;
+    LONG row = 0;
+    while (row < getChYRes (channel)) {
+        LONG column = 0;
+        while (column < getChXRes (channel)) {
+            unsigned long long value = getPixel (row, column, channel);
+            stats->count ++;
+            stats->min = (value < stats->min) ? value : stats->min;
+            stats->max = (value > stats->max) ? value : stats->max;
+            stats->sum += value;
+            stats->sumOfSquares += value * value;
+            stats->blackCount += (value == 0);
+            stats->whiteCount += (value == MAX_RGB_VALUE);
+            column ++;
+        }
+        row ++;
+    }
+    return;
+}
+
+static void testCompareBmp () {
+    printf ("\t>testing bmpsIdentical (), measureBmpDifference (), computeBmpSSIM () and their channel versions\n");
+    bmpPtr image = createTestImage (BITMAPV4HEADER, 53, 41);
+    fillScrambled (image, 5);
+    // convertBmp replaces alpha
+    bmpPtr copy = convertBmp (image, BITMAPV4HEADER, ARGB_32, 0);
+    channelPtr alpha = getAlphaChannel (image);
+    setChannel (ALPHA, copy, alpha);
+    destroyChannel (alpha);
+    int threadCount = 1;
+    while (threadCount <= 5) {
+        assert (bmpsIdentical (image, copy, threadCount));
+        threadCount += 2;
+    }
+    bmpDifference difference;
+    measureBmpDifference (image, copy, &difference, 3);
+    assert (difference.red.count == 53 * 41 && difference.red.sumOfSquares == 0 && difference.red.mse == 0);
+    assert (isinf (difference.green.psnr) && difference.alpha.maxDifference == 0);
+    assert (difference.blue.maxRow == 0 && difference.blue.maxColumn == 0);
+    bmpSSIM ssim;
+    computeBmpSSIM (image, copy, 8, &ssim, 2);
+    assert (ssim.red == 1 && ssim.green == 1 && ssim.blue == 1 && ssim.alpha == 1);
+
+    // a few changed values, the largest difference twice in the green channel (the first one is reported)
+    channelPtr green = getGreenChannel (copy);
+    setPixel (30, 7, green, getPixel (30, 7, green) ^ 0x80);
+    setPixel (12, 40, green, getPixel (12, 40, green) ^ 0x80);
+    setPixel (12, 44, green, getPixel (12, 44, green) ^ 0x80);
+    setPixel (40, 52, green, getPixel (40, 52, green) ^ 0x01);
+    setChannel (GREEN, copy, green);
+    destroyChannel (green);
+    threadCount = 1;
+    while (threadCount <= 5) {
+        assert (!bmpsIdentical (image, copy, threadCount));
+        threadCount += 2;
+    }
+    channelType types[4] = {RED, GREEN, BLUE, ALPHA};
+    channelPtr firstPlanes[4];
+    channelPtr secondPlanes[4];
+    channelDifference reference[4];
+    double referenceSSIM[4];
+    int c = 0;
+    while (c < 4) {
+        firstPlanes[c] = getChannelRows (image, types[c], 0, 41);
+        secondPlanes[c] = getChannelRows (copy, types[c], 0, 41);
+        referenceDifference (firstPlanes[c], secondPlanes[c], reference + c);
+        referenceSSIM[c] = referenceWindowSSIM (firstPlanes[c], secondPlanes[c], 7);
+        c ++;
+    }
+    assert (reference[1].maxDifference == 128 && reference[1].maxRow == 12 && reference[1].maxColumn == 40);
+    bmpDifference single;
+    measureBmpDifference (image, copy, &single, 1);
+    channelDifference *measured[4] = {&single.red, &single.green, &single.blue, &single.alpha};
+    c = 0;
+    while (c < 4) {
+        assert (measured[c]->count == reference[c].count && measured[c]->sumOfSquares == reference[c].sumOfSquares);
+        assert (measured[c]->maxDifference == reference[c].maxDifference);
+        assert (measured[c]->maxRow == reference[c].maxRow && measured[c]->maxColumn == reference[c].maxColumn);
+        c ++;
+    }
+    assert (single.green.mse == (double) reference[1].sumOfSquares / (53 * 41));
+    assert (fabs (single.green.psnr - 10 * log10 (255.0 * 255 / single.green.mse)) < 1e-12);
+    bmpSSIM singleSSIM;
+    computeBmpSSIM (image, copy, 7, &singleSSIM, 1);
+    double *measuredSSIM[4] = {&singleSSIM.red, &singleSSIM.green, &singleSSIM.blue, &singleSSIM.alpha};
+    c = 0;
+    while (c < 4) {
+        assert (fabs (*measuredSSIM[c] - referenceSSIM[c]) < 1e-12);
+        c ++;
+    }
+    assert (singleSSIM.green < 1 && singleSSIM.red == 1);
+    // the results do not depend on the thread count
+    threadCount = 2;
+    while (threadCount <= 6) {
+        measureBmpDifference (image, copy, &difference, threadCount);
+        assert (memcmp (&difference, &single, sizeof (bmpDifference)) == 0);
+        computeBmpSSIM (image, copy, 7, &ssim, threadCount);
+        assert (memcmp (&ssim, &singleSSIM, sizeof (bmpSSIM)) == 0);
+        threadCount += 2;
+    }
+    channelDifference channelResult;
+    c = 0;
+    while (c < 4) {
+        assert (channelsIdentical (firstPlanes[c], secondPlanes[c], 3) == (c != 1));
+        measureChannelDifference (firstPlanes[c], secondPlanes[c], &channelResult, 4);
+        assert (memcmp (&channelResult, measured[c], sizeof (channelDifference)) == 0);
+        assert (computeChannelSSIM (firstPlanes[c], secondPlanes[c], 7, 3) == *measuredSSIM[c]);
+        c ++;
+    }
+
+    // views compare their rectangles, the alpha byte of RGB_24 pixels never differs
+    bmpPtr firstView = createBmpView (image, 13, 35, 18, 21);
+    bmpPtr secondView = createBmpView (copy, 13, 35, 18, 21);
+    assert (bmpsIdentical (firstView, secondView, 2));
+    measureBmpDifference (firstView, secondView, &difference, 2);
+    assert (difference.green.maxDifference == 0 && difference.green.count == 18 * 21);
+    destroyBmp (firstView);
+    destroyBmp (secondView);
+    firstView = createBmpView (image, 5, 30, 20, 20);
+    secondView = createBmpView (copy, 5, 30, 20, 20);
+    assert (!bmpsIdentical (firstView, secondView, 2));
+    measureBmpDifference (firstView, secondView, &difference, 2);
+    assert (difference.green.maxDifference == 128 && difference.green.maxRow == 7 && difference.green.maxColumn == 10);
+    destroyBmp (firstView);
+    destroyBmp (secondView);
+    bmpPtr opaque = convertBmp (image, BITMAPINFOHEADER, RGB_24, 0);
+    bmpPtr opaqueCopy = convertBmp (image, BITMAPINFOHEADER, RGB_24, 0);
+    assert (bmpsIdentical (opaque, opaqueCopy, 2));
+    assert (!bmpsIdentical (opaque, image, 2));
+    measureBmpDifference (opaque, opaqueCopy, &difference, 2);
+    assert (difference.alpha.sumOfSquares == 0 && isinf (difference.alpha.psnr));
+    destroyBmp (opaqueCopy);
+    destroyBmp (opaque);
+    bmpPtr smaller = createTestImage (BITMAPV4HEADER, 53, 40);
+    assert (!bmpsIdentical (image, smaller, 1));
+    destroyBmp (smaller);
+
+    c = 0;
+    while (c < 4) {
+        destroyChannel (firstPlanes[c]);
+        destroyChannel (secondPlanes[c]);
+        c ++;
+    }
+    destroyBmp (copy);
+    destroyBmp (image);
+    return;
+}
+
+static void referenceDifference (channelPtr first, channelPtr second, channelDifference *difference) {
+    memset (difference, 0, sizeof (channelDifference));
+    LONG row = 0;
+    while (row < getChYRes (first)) {
+        LONG column = 0;
+        while (column < getChXRes (first)) {
+            int delta = abs (getPixel (row, column, first) - getPixel (row, column, second));
+            difference->count ++;
+            difference->sumOfSquares += delta * delta;
+            if (delta > difference->maxDifference) {
+                difference->maxDifference = delta;
+                difference->maxRow = row;
+                difference->maxColumn = column;
+            }
+            column ++;
+        }
+        row ++;
+    }
+    return;
+}
+
+// mean SSIM of every window, the means, variances and covariance taken on their own
+static double referenceWindowSSIM (channelPtr first, channelPtr second, LONG windowSize) {
+    double c1 = (0.01 * 255) * (0.01 * 255);
+    double c2 = (0.03 * 255) * (0.03 * 255);
+    double n = windowSize * windowSize;
+    double total = 0;
+    LONG windowCount = 0;
+    LONG top = 0;
+    while (top + windowSize <= getChYRes (first)) {
+        LONG left = 0;
+        while (left + windowSize <= getChXRes (first)) {
+            double firstMean = 0;
+            double secondMean = 0;
+            LONG row = top;
+            while (row < top + windowSize) {
+                LONG column = left;
+                while (column < left + windowSize) {
+                    firstMean += getPixel (row, column, first) / n;
+                    secondMean += getPixel (row, column, second) / n;
+                    column ++;
+                }
+                row ++;
+            }
+            double firstVariance = 0;
+            double secondVariance = 0;
+            double covariance = 0;
+            row = top;
+            while (row < top + windowSize) {
+                LONG column = left;
+                while (column < left + windowSize) {
+                    double a = getPixel (row, column, first) - firstMean;
+                    double b = getPixel (row, column, second) - secondMean;
+                    firstVariance += a * a / n;
+                    secondVariance += b * b / n;
+                    covariance += a * b / n;
+                    column ++;
+                }
+                row ++;
+            }
+            total += (2 * firstMean * secondMean + c1) * (2 * covariance + c2) /
+                     ((firstMean * firstMean + secondMean * secondMean + c1) * (firstVariance + secondVariance + c2));
+            windowCount ++;
+            left ++;
+        }
+        top ++;
+    }
+    return total / windowCount;
+}
+
+static void referenceOrientation (orientation orientation, LONG xRes, LONG yRes, LONG row, LONG column, LONG *sourceRow, LONG *sourceColumn) {
+    if (orientation == ROTATE_90) {
+        *sourceRow = yRes - 1 - column;
+        *sourceColumn = row;
+    } else if (orientation == ROTATE_180) {
+        *sourceRow = yRes - 1 - row;
+        *sourceColumn = xRes - 1 - column;
+    } else if (orientation == ROTATE_270) {
+        *sourceRow = column;
+        *sourceColumn = xRes - 1 - row;
+    } else if (orientation == FLIP_HORIZONTAL) {
+        *sourceRow = row;
+        *sourceColumn = xRes - 1 - column;
+    } else if (orientation == FLIP_VERTICAL) {
+        *sourceRow = yRes - 1 - row;
+        *sourceColumn = column;
+    } else {
+        *sourceRow = column;
+        *sourceColumn = row;
+    }
+    return;
+}
+
+static void fillChannel (bmpPtr image, channelType type, byte value) {
+    channelPtr plane = createChannel (getXRes (image), getYRes (image));
+    LONG row = 0;
+    while (row < getYRes (image)) {
+        LONG column = 0;
+        while (column < getXRes (image)) {
+            setPixel (row, column, plane, value);
+            column ++;
+        }
+        row ++;
+    }
+    setChannel (type, image, plane);
+    destroyChannel (plane);
+    return;
+}
+
+// creates a bitmap of the specified size with a simple gradient in every channel
+static bmpPtr createTestImage (DIBHeaderVersion version, LONG xRes, LONG yRes) {
+    bmpPtr image = createBmp (version);
+    if (version == BITMAPV4HEADER) {
+        setPixelFormat (image, ARGB_32);
+        setColorSpace (image, DEFAULT_V4IH_COLOR_SPACE);
+    } else {
+        setPixelFormat (image, RGB_24);
+    }
+    setColorPlaneCount (image, 1);
+    setPrintResX (image, DEFAULT_IH_PRINT_RES_X);
+    setPrintResY (image, DEFAULT_IH_PRINT_RES_Y);
+    setPaletteColorCount (image, 0);
+    setImpColorCount (image, 0);
+    setXRes (image, xRes);
+    setYRes (image, yRes);
+    setUpPixelArray (image);
+    setImageSize (image, evaluateRawImageSizeInBytes (image));
+
+    channelType types[4] = {RED, GREEN, BLUE, ALPHA};
+    int typeCount = 3;
+    if (version == BITMAPV4HEADER) {
+        typeCount = 4;
+    }
+    int i = 0;
+    while (i < typeCount) {
+        channelPtr plane = createChannel (xRes, yRes);
+        LONG row = 0;
+        while (row < yRes) {
+            LONG column = 0;
+            while (column < xRes) {
+                setPixel (row, column, plane, (row * 16 + column * 3 + i * 50) & 255);
+                column ++;
+            }
+            row ++;
+        }
+        setChannel (types[i], image, plane);
+        destroyChannel (plane);
+        i ++;
+    }
+    return image;
 }
\ No newline at end of file
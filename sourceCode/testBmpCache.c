@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "bmp.h"
+#include "bmpCache.h"
+#include "testBmpCache.h"
+
+#define TEST_CACHE_FILE_COUNT 4
+#define TEST_CACHE_THREAD_COUNT 8
+#define TEST_CACHE_LOOKUPS_PER_THREAD 500
+
+static void testCacheHitsAndMisses ();
+static void testCacheEviction ();
+static void testConcurrentLookups ();
+static void *lookupWorker (void *cache);
+static void saveTestImage (fileName imageName, LONG xRes, byte red);
+
+void testBmpCache () {
+    printf ("\n>Testing ADT:bmpCache\n");
+    testCacheHitsAndMisses ();
+    testCacheEviction ();
+    testConcurrentLookups ();
+    printf (">All cache tests passed\n");
+    return;
+}
+
+static void testCacheHitsAndMisses () {
+    printf ("\t>testing acquireCachedBitMap () and getBmpCacheStats ()\n");
+    bmpCachePtr cache = createBmpCache (1 << 20);
+    saveTestImage ("cache0.bmp", 3, 10);
+
+    cachedBmpPtr first = acquireCachedBitMap (cache, "./cache0.bmp");
+    cachedBmpPtr second = acquireCachedBitMap (cache, "./cache0.bmp");
+    assert (getCachedBitMap (first) == getCachedBitMap (second));
+    bmpCacheStats stats = getBmpCacheStats (cache);
+    assert (stats.misses == 1 && stats.hits == 1 && stats.evictions == 0);
+    assert (stats.entryCount == 1 && stats.byteCount == 3 * 2 * 4);
+
+    // the shared bitmap is read only, changing it fails
+    fflush (stdout);
+    pid_t child = fork ();
+    assert (child >= 0);
+    if (child == 0) {
+        freopen ("/dev/null", "w", stderr);
+        setPrintResX (getCachedBitMap (first), 1);
+        _exit (0);
+    }
+    int status;
+    pid_t waited = waitpid (child, &status, 0);
+    assert (waited == child);
+    assert (WIFSIGNALED (status) && WTERMSIG (status) == SIGABRT);
+    releaseCachedBitMap (cache, first);
+    releaseCachedBitMap (cache, second);
+
+    // a file changed on disk is parsed again
+    saveTestImage ("cache0.bmp", 5, 20);
+    cachedBmpPtr changed = acquireCachedBitMap (cache, "./cache0.bmp");
+    assert (getXRes (getCachedBitMap (changed)) == 5);
+    stats = getBmpCacheStats (cache);
+    assert (stats.misses == 2 && stats.hits == 1);
+    assert (stats.entryCount == 1 && stats.byteCount == 5 * 2 * 4);
+    releaseCachedBitMap (cache, changed);
+
+    destroyBmpCache (cache);
+    int retCode = remove ("./cache0.bmp");
+    assert (retCode == 0);
+    return;
+}
+
+static void testCacheEviction () {
+    printf ("\t>testing LRU eviction\n");
+    // room for two 4x2 bitmaps
+    bmpCachePtr cache = createBmpCache (2 * 4 * 2 * 4);
+    saveTestImage ("cache0.bmp", 4, 0);
+    saveTestImage ("cache1.bmp", 4, 1);
+    saveTestImage ("cache2.bmp", 4, 2);
+
+    releaseCachedBitMap (cache, acquireCachedBitMap (cache, "./cache0.bmp"));
+    releaseCachedBitMap (cache, acquireCachedBitMap (cache, "./cache1.bmp"));
+    // cache0 becomes the most recently used, cache1 is evicted by cache2
+    releaseCachedBitMap (cache, acquireCachedBitMap (cache, "./cache0.bmp"));
+    releaseCachedBitMap (cache, acquireCachedBitMap (cache, "./cache2.bmp"));
+    bmpCacheStats stats = getBmpCacheStats (cache);
+    assert (stats.hits == 1 && stats.misses == 3 && stats.evictions == 1);
+    assert (stats.entryCount == 2);
+    releaseCachedBitMap (cache, acquireCachedBitMap (cache, "./cache0.bmp"));
+    releaseCachedBitMap (cache, acquireCachedBitMap (cache, "./cache1.bmp"));
+    stats = getBmpCacheStats (cache);
+    assert (stats.hits == 2 && stats.misses == 4 && stats.evictions == 2);
+    destroyBmpCache (cache);
+
+    // a bitmap evicted while in use stays valid until it is released
+    cache = createBmpCache (0);
+    cachedBmpPtr handle = acquireCachedBitMap (cache, "./cache2.bmp");
+    stats = getBmpCacheStats (cache);
+    assert (stats.entryCount == 0 && stats.byteCount == 0 && stats.evictions == 1);
+    channelPtr red = getRedChannel (getCachedBitMap (handle));
+    assert (getPixel (1, 3, red) == 2);
+    destroyChannel (red);
+    releaseCachedBitMap (cache, handle);
+    destroyBmpCache (cache);
+
+    int i = 0;
+    while (i < 3) {
+        char path[32];
+        sprintf (path, "./cache%d.bmp", i);
+        int retCode = remove (path);
+        assert (retCode == 0);
+        i ++;
+    }
+    return;
+}
+
+static void testConcurrentLookups () {
+    printf ("\t>testing concurrent lookups\n");
+    bmpCachePtr cache = createBmpCache (1 << 20);
+    int i = 0;
+    while (i < TEST_CACHE_FILE_COUNT) {
+        char name[32];
+        sprintf (name, "cache%d.bmp", i);
+        saveTestImage (name, i + 1, i);
+        i ++;
+    }
+    pthread_t threads[TEST_CACHE_THREAD_COUNT];
+    i = 0;
+    while (i < TEST_CACHE_THREAD_COUNT) {
+        int retCode = pthread_create (&threads[i], NULL, lookupWorker, cache);
+        assert (retCode == 0);
+        i ++;
+    }
+    i = 0;
+    while (i < TEST_CACHE_THREAD_COUNT) {
+        pthread_join (threads[i], NULL);
+        i ++;
+    }
+    bmpCacheStats stats = getBmpCacheStats (cache);
+    assert (stats.hits + stats.misses == TEST_CACHE_THREAD_COUNT * TEST_CACHE_LOOKUPS_PER_THREAD);
+    assert (stats.misses >= TEST_CACHE_FILE_COUNT);
+    assert (stats.entryCount == TEST_CACHE_FILE_COUNT && stats.evictions == 0);
+    destroyBmpCache (cache);
+    i = 0;
+    while (i < TEST_CACHE_FILE_COUNT) {
+        char path[32];
+        sprintf (path, "./cache%d.bmp", i);
+        int retCode = remove (path);
+        assert (retCode == 0);
+        i ++;
+    }
+    return;
+}
+
+static void *lookupWorker (void *cache) {
+    int i = 0;
+    while (i < TEST_CACHE_LOOKUPS_PER_THREAD) {
+        int file = i % TEST_CACHE_FILE_COUNT;
+        char path[32];
+        sprintf (path, "./cache%d.bmp", file);
+        cachedBmpPtr handle = acquireCachedBitMap ((bmpCachePtr) cache, path);
+        bmpPtr bitMap = getCachedBitMap (handle);
+        assert (getXRes (bitMap) == file + 1);
+        channelPtr red = getRedChannel (bitMap);
+        assert (getPixel (0, 0, red) == file);
+        destroyChannel (red);
+        releaseCachedBitMap ((bmpCachePtr) cache, handle);
+        i ++;
+    }
+    return NULL;
+}
+
+// saves an xRes x 2 ARGB_32 bitmap whose red channel is filled with the specified value
+static void saveTestImage (fileName imageName, LONG xRes, byte red) {
+    bmpPtr image = createBmp (BITMAPV4HEADER);
+    initializeBmpDFLT (image, ARGB_32);
+    setXRes (image, xRes);
+    setUpPixelArray (image);
+    setImageSize (image, evaluateRawImageSizeInBytes (image));
+    channelPtr plane = createChannel (xRes, getYRes (image));
+    LONG row = 0;
+    while (row < getYRes (image)) {
+        LONG column = 0;
+        while (column < xRes) {
+            setPixel (row, column, plane, red);
+            column ++;
+        }
+        row ++;
+    }
+    setChannel (RED, image, plane);
+    setChannel (GREEN, image, plane);
+    setChannel (BLUE, image, plane);
+    setChannel (ALPHA, image, plane);
+    destroyChannel (plane);
+    saveBitMap (image, imageName, ".");
+    destroyBmp (image);
+    return;
+}
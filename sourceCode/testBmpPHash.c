@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bmp.h"
+#include "bmpPHash.h"
+#include "testBmpPHash.h"
+
+#define TEST_PHASH_BATCH_SIZE 12
+
+static void testHammingDistance ();
+static void testNearDuplicates ();
+static void testBatchHashing ();
+static bmpPtr createPattern (LONG xRes, LONG yRes, int brightness, int inverted);
+
+void testBmpPHash () {
+    printf ("\n>Testing perceptual hashes\n");
+    testHammingDistance ();
+    testNearDuplicates ();
+    testBatchHashing ();
+    printf (">All perceptual hash tests passed\n");
+    return;
+}
+
+static void testHammingDistance () {
+    printf ("\t>testing hammingDistance ()\n");
+    assert (hammingDistance (0, 0) == 0);
+    assert (hammingDistance (0, 0xFFFFFFFFFFFFFFFFULL) == 64);
+    assert (hammingDistance (0x8000000000000001ULL, 1) == 1);
+    assert (hammingDistance (0xF0, 0x0F) == 8);
+    return;
+}
+
+static void testNearDuplicates () {
+    printf ("\t>testing computePerceptualHash () on near duplicates\n");
+    bmpPtr original = createPattern (96, 64, 0, 0);
+    bmpPtr brighter = createPattern (96, 64, 12, 0);
+    bmpPtr larger = createPattern (240, 160, 0, 0);
+    bmpPtr inverted = createPattern (96, 64, 0, 1);
+    perceptualHashType hashType = AVERAGE_HASH;
+    while (hashType <= DCT_HASH) {
+        unsigned long long hash = computePerceptualHash (original, hashType);
+        assert (computePerceptualHash (original, hashType) == hash);
+        assert (hammingDistance (hash, computePerceptualHash (brighter, hashType)) <= 6);
+        assert (hammingDistance (hash, computePerceptualHash (larger, hashType)) <= 10);
+        assert (hammingDistance (hash, computePerceptualHash (inverted, hashType)) >= 24);
+
+        // same result from a thumbnail built by the caller
+        channelPtr luma = getLumaThumbnail (original, getPerceptualHashXRes (hashType), getPerceptualHashYRes (hashType));
+        assert (computePerceptualHashFromLuma (luma, hashType) == hash);
+        destroyChannel (luma);
+        hashType ++;
+    }
+    destroyBmp (original);
+    destroyBmp (brighter);
+    destroyBmp (larger);
+    destroyBmp (inverted);
+    return;
+}
+
+static void testBatchHashing () {
+    printf ("\t>testing computePerceptualHashes () and computePerceptualHashesOfFiles ()\n");
+    bmpPtr samples[TEST_PHASH_BATCH_SIZE];
+    relativePath paths[TEST_PHASH_BATCH_SIZE];
+    unsigned long long expected[TEST_PHASH_BATCH_SIZE];
+    unsigned long long hashes[TEST_PHASH_BATCH_SIZE];
+    int i = 0;
+    while (i < TEST_PHASH_BATCH_SIZE) {
+        samples[i] = createPattern (40 + i * 7, 30 + i * 3, i * 5, i % 2);
+        char name[32];
+        sprintf (name, "phash%d.bmp", i);
+        saveBitMap (samples[i], name, ".");
+        sprintf (paths[i], "./phash%d.bmp", i);
+        expected[i] = computePerceptualHash (samples[i], DCT_HASH);
+        i ++;
+    }
+    int threadCount = 1;
+    while (threadCount <= 5) {
+        memset (hashes, 0, sizeof (hashes));
+        computePerceptualHashes (samples, TEST_PHASH_BATCH_SIZE, DCT_HASH, hashes, threadCount);
+        assert (memcmp (hashes, expected, sizeof (hashes)) == 0);
+        memset (hashes, 0, sizeof (hashes));
+        computePerceptualHashesOfFiles (paths, TEST_PHASH_BATCH_SIZE, DCT_HASH, hashes, threadCount);
+        assert (memcmp (hashes, expected, sizeof (hashes)) == 0);
+        threadCount += 4;
+    }
+    i = 0;
+    while (i < TEST_PHASH_BATCH_SIZE) {
+        destroyBmp (samples[i]);
+        int retCode = remove (paths[i]);
+        assert (retCode == 0);
+        i ++;
+    }
+    return;
+}
+
+// resolution independent pattern: a 4x3 checkerboard over a diagonal gradient
+static bmpPtr createPattern (LONG xRes, LONG yRes, int brightness, int inverted) {
+    bmpPtr image = createBmp (BITMAPINFOHEADER);
+    initializeBmpDFLT (image, RGB_24);
+    setXRes (image, xRes);
+    setYRes (image, yRes);
+    setUpPixelArray (image);
+    setImageSize (image, evaluateRawImageSizeInBytes (image));
+    channelPtr plane = createChannel (xRes, yRes);
+    LONG row = 0;
+    while (row < yRes) {
+        LONG column = 0;
+        while (column < xRes) {
+            int value = 20 + column * 60 / xRes + row * 40 / yRes;
+            if ((column * 4 / xRes + row * 3 / yRes) % 2 == 1) {
+                value += 120;
+            }
+            if (inverted) {
+                value = 255 - value;
+            }
+            value += brightness;
+            if (value > 255) {
+                value = 255;
+            }
+            setPixel (row, column, plane, value);
+            column ++;
+        }
+        row ++;
+    }
+    setChannel (RED, image, plane);
+    setChannel (GREEN, image, plane);
+    setChannel (BLUE, image, plane);
+    destroyChannel (plane);
+    return image;
+}
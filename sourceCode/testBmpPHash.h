@@ -0,0 +1,2 @@
+// unit testing for the perceptual hashes : bmpPHash
+void testBmpPHash ();
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "bmp.h"
+#include "bmpPack.h"
+#include "testBmpPack.h"
+
+#define TEST_PACK_PATH "./test.bpak"
+#define TEST_PACK_SPRITE_COUNT 40
+#define TEST_PACK_NAME_COUNT 300
+
+static void testWriteAndOpenPack ();
+static void testExtractPackEntries ();
+static void testDuplicateEntryNames ();
+static void compareBitmaps (bmpPtr before, bmpPtr after);
+static void fillSprite (bmpPtr sprite, int seed);
+
+void testBmpPack () {
+    printf ("\n>Testing ADT:pack\n");
+    testWriteAndOpenPack ();
+    testExtractPackEntries ();
+    testDuplicateEntryNames ();
+    printf (">All pack tests passed\n");
+    return;
+}
+
+static void testWriteAndOpenPack () {
+    printf ("\t>testing createPackWriter (), addBmpToPack (), addFileToPack () and openPack ()\n");
+    bmpPtr rgb = createBmp (BITMAPINFOHEADER);
+    initializeBmpDFLT (rgb, RGB_24);
+    bmpPtr argb = createBmp (BITMAPV4HEADER);
+    initializeBmpDFLT (argb, ARGB_32);
+    saveBitMap (argb, "packSource.bmp", ".");
+
+    packWriterPtr writer = createPackWriter (TEST_PACK_PATH);
+    addBmpToPack (writer, "rgb", rgb);
+    addFileToPack (writer, "argb", "./packSource.bmp");
+    closePackWriter (writer);
+
+    packPtr pack = openPack (TEST_PACK_PATH);
+    assert (getPackEntryCount (pack) == 2);
+    assert (findPackEntry (pack, "rgb") == 0);
+    assert (findPackEntry (pack, "argb") == 1);
+    assert (findPackEntry (pack, "missing") == PACK_ENTRY_NOT_FOUND);
+
+    packEntryView view = getPackEntryView (pack, 1);
+    assert (strcmp (view.name, "argb") == 0);
+    assert (view.xRes == DEFAULT_V4IH_XRES_ARGB_32);
+    assert (view.yRes == DEFAULT_V4IH_YRES_ARGB_32);
+    assert (view.byteCount == determineFileSizeInBytes (argb));
+    assert (view.data[0] == 'B' && view.data[1] == 'M');
+
+    bmpPtr extracted = extractPackEntryByName (pack, "rgb");
+    compareBitmaps (rgb, extracted);
+    destroyBmp (extracted);
+    extracted = extractPackEntry (pack, 1);
+    compareBitmaps (argb, extracted);
+    destroyBmp (extracted);
+
+    closePack (pack);
+
+    // a file whose header claims fewer bytes than the headers themselves is rejected
+    FILE *source = fopen ("./packSource.bmp", "r+b");
+    assert (source != NULL);
+    fseek (source, 2, SEEK_SET);
+    byte shortSize[4] = {10, 0, 0, 0};
+    fwrite (shortSize, 1, 4, source);
+    fclose (source);
+    fflush (stdout);
+    pid_t child = fork ();
+    assert (child >= 0);
+    if (child == 0) {
+        freopen ("/dev/null", "w", stderr);
+        writer = createPackWriter ("./corrupt.bpak");
+        addFileToPack (writer, "short", "./packSource.bmp");
+        _exit (0);
+    }
+    int status;
+    pid_t waited = waitpid (child, &status, 0);
+    assert (waited == child);
+    assert (WIFSIGNALED (status) && WTERMSIG (status) == SIGABRT);
+    remove ("./corrupt.bpak");
+
+    destroyBmp (rgb);
+    destroyBmp (argb);
+    int retCode = remove ("./packSource.bmp");
+    assert (retCode == 0);
+    retCode = remove (TEST_PACK_PATH);
+    assert (retCode == 0);
+    return;
+}
+
+static void testExtractPackEntries () {
+    printf ("\t>testing extractPackEntries ()\n");
+    bmpPtr sprites[TEST_PACK_SPRITE_COUNT];
+    packWriterPtr writer = createPackWriter (TEST_PACK_PATH);
+    int i = 0;
+    while (i < TEST_PACK_SPRITE_COUNT) {
+        sprites[i] = createBmp (BITMAPV4HEADER);
+        initializeBmpDFLT (sprites[i], ARGB_32);
+        fillSprite (sprites[i], i);
+        char name[32];
+        sprintf (name, "sprite%d", i);
+        addBmpToPack (writer, name, sprites[i]);
+        i ++;
+    }
+    closePackWriter (writer);
+
+    packPtr pack = openPack (TEST_PACK_PATH);
+    assert (getPackEntryCount (pack) == TEST_PACK_SPRITE_COUNT);
+    DWORD ordinals[TEST_PACK_SPRITE_COUNT];
+    bmpPtr extracted[TEST_PACK_SPRITE_COUNT];
+    i = 0;
+    while (i < TEST_PACK_SPRITE_COUNT) {
+        // reversed, so that targets[i] must follow ordinals[i] and not the pack order
+        ordinals[i] = TEST_PACK_SPRITE_COUNT - 1 - i;
+        i ++;
+    }
+    extractPackEntries (pack, ordinals, TEST_PACK_SPRITE_COUNT, extracted, 4);
+    i = 0;
+    while (i < TEST_PACK_SPRITE_COUNT) {
+        compareBitmaps (sprites[ordinals[i]], extracted[i]);
+        destroyBmp (extracted[i]);
+        i ++;
+    }
+    closePack (pack);
+    i = 0;
+    while (i < TEST_PACK_SPRITE_COUNT) {
+        destroyBmp (sprites[i]);
+        i ++;
+    }
+    int retCode = remove (TEST_PACK_PATH);
+    assert (retCode == 0);
+    return;
+}
+
+static void testDuplicateEntryNames () {
+    printf ("\t>testing packWriterHasEntry () and duplicate names\n");
+    bmpPtr rgb = createBmp (BITMAPINFOHEADER);
+    initializeBmpDFLT (rgb, RGB_24);
+    packWriterPtr writer = createPackWriter (TEST_PACK_PATH);
+    // enough names to grow the set of names several times
+    int i = 0;
+    while (i < TEST_PACK_NAME_COUNT) {
+        char name[32];
+        sprintf (name, "tile%d", i);
+        assert (!packWriterHasEntry (writer, name));
+        addBmpToPack (writer, name, rgb);
+        assert (packWriterHasEntry (writer, name));
+        i ++;
+    }
+    i = 0;
+    while (i < TEST_PACK_NAME_COUNT) {
+        char name[32];
+        sprintf (name, "tile%d", i);
+        assert (packWriterHasEntry (writer, name));
+        i ++;
+    }
+    assert (!packWriterHasEntry (writer, "tile"));
+
+    // adding a name twice fails before anything is written
+    fflush (stdout);
+    pid_t child = fork ();
+    assert (child >= 0);
+    if (child == 0) {
+        freopen ("/dev/null", "w", stderr);
+        addBmpToPack (writer, "tile7", rgb);
+        _exit (0);
+    }
+    int status;
+    pid_t waited = waitpid (child, &status, 0);
+    assert (waited == child);
+    assert (WIFSIGNALED (status) && WTERMSIG (status) == SIGABRT);
+    closePackWriter (writer);
+
+    packPtr pack = openPack (TEST_PACK_PATH);
+    assert (getPackEntryCount (pack) == TEST_PACK_NAME_COUNT);
+    assert (findPackEntry (pack, "tile7") == 7);
+    closePack (pack);
+    destroyBmp (rgb);
+    int retCode = remove (TEST_PACK_PATH);
+    assert (retCode == 0);
+    return;
+}
+
+static void compareBitmaps (bmpPtr before, bmpPtr after) {
+    assert (getDIBHeaderVersion (before) == getDIBHeaderVersion (after));
+    assert (getXRes (before) == getXRes (after));
+    assert (getYRes (before) == getYRes (after));
+    channelPtr channelsBefore[4] = {getRedChannel (before), getGreenChannel (before), getBlueChannel (before), NULL};
+    channelPtr channelsAfter[4] = {getRedChannel (after), getGreenChannel (after), getBlueChannel (after), NULL};
+    int channelCount = 3;
+    if (getPixelFormat (before) == ARGB_32) {
+        channelsBefore[3] = getAlphaChannel (before);
+        channelsAfter[3] = getAlphaChannel (after);
+        channelCount = 4;
+    }
+    int i = 0;
+    while (i < channelCount) {
+        LONG row = 0;
+        while (row < getYRes (before)) {
+            LONG column = 0;
+            while (column < getXRes (before)) {
+                assert (getPixel (row, column, channelsBefore[i]) == getPixel (row, column, channelsAfter[i]));
+                column ++;
+            }
+            row ++;
+        }
+        destroyChannel (channelsBefore[i]);
+        destroyChannel (channelsAfter[i]);
+        i ++;
+    }
+    return;
+}
+
+static void fillSprite (bmpPtr sprite, int seed) {
+    channelPtr plane = createChannel (getXRes (sprite), getYRes (sprite));
+    LONG row = 0;
+    while (row < getYRes (sprite)) {
+        LONG column = 0;
+        while (column < getXRes (sprite)) {
+            setPixel (row, column, plane, (seed * 31 + row * 7 + column) & 255);
+            column ++;
+        }
+        row ++;
+    }
+    setChannel (RED, sprite, plane);
+    setChannel (ALPHA, sprite, plane);
+    destroyChannel (plane);
+    return;
+}
@@ -0,0 +1,2 @@
+// unit testing for ADT : pack
+void testBmpPack ();